@@ -0,0 +1,100 @@
+//
+// This file is part of the libWetCloth open source project
+//
+// Copyright 2018 Yun (Raymond) Fei, Christopher Batty, Eitan Grinspun, and Changxi Zheng
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "AsyncWriter.h"
+
+#include <algorithm>
+
+const size_t AsyncWriter::default_max_bytes;
+
+AsyncWriter::AsyncWriter( int num_workers, size_t max_bytes )
+    : m_max_bytes(max_bytes)
+    , m_bytes_in_flight(0)
+    , m_jobs_in_flight(0)
+    , m_stopping(false)
+{
+    start(num_workers);
+}
+
+AsyncWriter::~AsyncWriter()
+{
+    flush();
+    stop();
+}
+
+void AsyncWriter::configure( int num_workers, size_t max_bytes )
+{
+    flush();
+    stop();
+
+    m_max_bytes = max_bytes;
+    start(num_workers);
+}
+
+void AsyncWriter::submit( size_t bytes, const std::function<void()>& job )
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_job_done.wait(lock, [&] { return m_jobs_in_flight == 0 || m_bytes_in_flight + bytes <= m_max_bytes; });
+
+    m_bytes_in_flight += bytes;
+    ++m_jobs_in_flight;
+    m_jobs.push_back(Job {bytes, job});
+
+    lock.unlock();
+    m_job_ready.notify_one();
+}
+
+void AsyncWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_job_done.wait(lock, [&] { return m_jobs_in_flight == 0; });
+}
+
+void AsyncWriter::start( int num_workers )
+{
+    m_stopping = false;
+
+    num_workers = std::max(1, num_workers);
+    for (int i = 0; i < num_workers; ++i) {
+        m_workers.emplace_back(&AsyncWriter::work, this);
+    }
+}
+
+void AsyncWriter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_job_ready.notify_all();
+
+    for (std::thread& t : m_workers) t.join();
+    m_workers.clear();
+}
+
+void AsyncWriter::work()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_job_ready.wait(lock, [&] { return m_stopping || !m_jobs.empty(); });
+        if (m_jobs.empty()) return;
+
+        Job job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+
+        lock.unlock();
+        job.func();
+        lock.lock();
+
+        m_bytes_in_flight -= job.bytes;
+        --m_jobs_in_flight;
+        m_job_done.notify_all();
+    }
+}
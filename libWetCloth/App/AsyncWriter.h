@@ -0,0 +1,104 @@
+//
+// This file is part of the libWetCloth open source project
+//
+// Copyright 2018 Yun (Raymond) Fei, Christopher Batty, Eitan Grinspun, and Changxi Zheng
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*!
+ * Writes output files on a fixed pool of worker threads.
+ *
+ * Every job is submitted with an estimate of the memory it holds until it
+ * is done. submit() blocks while the jobs in flight exceed the memory
+ * budget, so a simulation that steps faster than the disk waits instead of
+ * piling up copies of the scene. A single job is always admitted, however
+ * large. flush() waits for everything submitted so far; the destructor
+ * flushes and joins the workers, so no frame is cut short at exit.
+ */
+class AsyncWriter
+{
+public:
+    explicit AsyncWriter( int num_workers = 1, size_t max_bytes = default_max_bytes );
+
+    ~AsyncWriter();
+
+    // waits for the pending jobs, then restarts with the new limits
+    void configure( int num_workers, size_t max_bytes );
+
+    void submit( size_t bytes, const std::function<void()>& job );
+
+    void flush();
+
+    static const size_t default_max_bytes = (size_t) 512 << 20;
+
+private:
+    struct Job
+    {
+        size_t bytes;
+        std::function<void()> func;
+    };
+
+    void start( int num_workers );
+    void stop();
+    void work();
+
+    std::mutex m_mutex;
+    std::condition_variable m_job_ready;
+    std::condition_variable m_job_done;
+    std::deque<Job> m_jobs;
+    std::vector<std::thread> m_workers;
+
+    size_t m_max_bytes;
+    size_t m_bytes_in_flight;
+    int m_jobs_in_flight;
+    bool m_stopping;
+};
+
+/*!
+ * Recycles output packets, so their buffers keep their capacity from frame
+ * to frame instead of being reallocated. Packets are created on demand;
+ * how many exist at once is bounded by the AsyncWriter they are handed to.
+ */
+template<typename T>
+class PacketPool
+{
+public:
+    T* acquire()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_free.empty()) {
+            m_all.emplace_back(new T);
+            return m_all.back().get();
+        }
+
+        T* packet = m_free.back();
+        m_free.pop_back();
+        return packet;
+    }
+
+    void release( T* packet )
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free.push_back(packet);
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector< std::unique_ptr<T> > m_all;
+    std::vector<T*> m_free;
+};
+
+#endif
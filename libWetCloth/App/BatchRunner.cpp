@@ -0,0 +1,179 @@
+//
+// This file is part of the libWetCloth open source project
+//
+// Copyright 2018 Yun (Raymond) Fei, Christopher Batty, Eitan Grinspun, and Changxi Zheng
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "BatchRunner.h"
+
+#include <atomic>
+#include <cmath>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <direct.h>
+#endif
+
+#include "StringUtilities.h"
+#include "ThreadUtils.h"
+#include "TimingUtilities.h"
+
+namespace {
+void makeDirectory( const std::string& dir )
+{
+#ifdef WIN32
+    _mkdir(dir.c_str());
+#else
+    mkdir(dir.c_str(), 0777);
+#endif
+}
+}
+
+BatchRunner::BatchRunner( const std::string& scene_file, const std::string& batch_file, const std::string& output_dir, const Options& options )
+    : m_options(options)
+    , m_output_dir(output_dir)
+{
+    m_options.jobs = std::max(1, m_options.jobs);
+    m_options.threads_per_run = std::max(1, m_options.threads_per_run);
+
+    m_parser.loadXMLFile(scene_file, m_scene_chars, m_scene_doc);
+    loadBatchFile(batch_file);
+}
+
+void BatchRunner::loadBatchFile( const std::string& batch_file )
+{
+    m_parser.loadXMLFile(batch_file, m_batch_chars, m_batch_doc);
+
+    rapidxml::xml_node<>* node = m_batch_doc.first_node("batch");
+    if (node == NULL) {
+        std::cerr << outputmod::startred << "ERROR IN BATCHRUNNER:" << outputmod::endred << " Failed to locate root <batch> node in " << batch_file << ". Exiting." << std::endl;
+        exit(1);
+    }
+
+    std::set<std::string> names;
+    for (rapidxml::xml_node<>* nd = node->first_node("variant"); nd; nd = nd->next_sibling("variant")) {
+        rapidxml::xml_attribute<>* atrbnde = nd->first_attribute("name");
+        if (atrbnde == NULL || !*atrbnde->value()) {
+            std::cerr << outputmod::startred << "ERROR IN BATCHRUNNER:" << outputmod::endred << " Variant " << m_variants.size() << " has no 'name' attribute. Exiting." << std::endl;
+            exit(1);
+        }
+
+        // the name is also the output directory of the variant
+        const std::string name(atrbnde->value());
+        if (!names.insert(name).second) {
+            std::cerr << outputmod::startred << "ERROR IN BATCHRUNNER:" << outputmod::endred << " Variant " << name << " is listed twice. Exiting." << std::endl;
+            exit(1);
+        }
+
+        m_variants.push_back(Variant{name, nd});
+    }
+
+    if (m_variants.empty()) {
+        std::cerr << outputmod::startred << "ERROR IN BATCHRUNNER:" << outputmod::endred << " No <variant> in " << batch_file << ". Exiting." << std::endl;
+        exit(1);
+    }
+}
+
+void BatchRunner::run()
+{
+    std::atomic<int> next_variant(0);
+
+    auto job = [&] {
+        // the arena bounds the threads of the parallel loops of this run
+        tbb::task_arena arena(m_options.threads_per_run);
+
+        for (int i = next_variant++; i < (int) m_variants.size(); i = next_variant++) {
+            arena.execute([&] { runVariant(m_variants[i]); });
+        }
+    };
+
+    const int num_jobs = std::min(m_options.jobs, (int) m_variants.size());
+
+    std::vector<std::thread> jobs;
+    for (int i = 1; i < num_jobs; ++i) jobs.emplace_back(job);
+    job();
+
+    for (std::thread& t : jobs) t.join();
+}
+
+void BatchRunner::runVariant( const Variant& variant )
+{
+    const double start_time = timingutils::seconds();
+
+    std::shared_ptr<ParticleSimulation> sim;
+    scalar dt = 0.0;
+    scalar max_time = 0.0;
+    scalar steps_per_sec_cap = 100.0;
+    renderingutils::Color bgcolor(1.0, 1.0, 1.0);
+    std::string description;
+    std::string scenetag;
+    bool cam_inited = false;
+    Camera cam;
+
+    {
+        std::lock_guard<std::mutex> lock(m_load_mutex);
+        m_parser.loadExecutableSimulation(m_scene_doc, variant.overrides, false, sim, cam, dt, max_time, steps_per_sec_cap, bgcolor, description, scenetag, cam_inited);
+    }
+
+    sim->finalInit();
+    sim->configureOutput(m_options.num_writers, m_options.output_memory);
+
+    const std::string dir = m_output_dir + "/" + variant.name;
+    makeDirectory(dir);
+
+    const int num_steps = (int) ceil(max_time / dt);
+
+    {
+        std::lock_guard<std::mutex> lock(m_log_mutex);
+        std::cout << outputmod::startblue << "[batch: " << variant.name << "]" << outputmod::endblue << " " << num_steps << " steps on " << threadutils::get_num_threads() << " threads" << std::endl << sim->getLiquidInfo() << std::endl;
+    }
+
+    const int report_every = std::max(1, num_steps / 20);
+    for (int step = sim->getCurrentStep(); step < num_steps; ) {
+        sim->stepSystem(dt, false);
+        ++step;
+
+        writeOutput(*sim, dir, step);
+
+        if (!(step % report_every) || step == num_steps) {
+            std::lock_guard<std::mutex> lock(m_log_mutex);
+            std::cout << outputmod::startblue << "[batch: " << variant.name << "]" << outputmod::endblue << " step " << step << " of " << num_steps << std::endl;
+        }
+    }
+
+    sim->flushOutput();
+
+    std::lock_guard<std::mutex> lock(m_log_mutex);
+    std::cout << outputmod::startgreen << "[batch: " << variant.name << "]" << outputmod::endgreen << " done in " << (timingutils::seconds() - start_time) << " s" << std::endl;
+}
+
+void BatchRunner::writeOutput( ParticleSimulation& sim, const std::string& dir, int step )
+{
+    const int save_every = m_options.save_every;
+    if (save_every && !(step % save_every)) {
+        std::stringstream oss_frame;
+        oss_frame << std::setw(5) << std::setfill('0') << (step / save_every);
+
+        if (m_options.binary_frames) {
+            sim.serializeFrame(dir + "/cache" + oss_frame.str() + ".wcf", m_options.frame_options);
+        } else {
+            sim.serializeScene(dir + "/cloth" + oss_frame.str() + ".obj", dir + "/hair" + oss_frame.str() + ".obj", dir + "/fluid" + oss_frame.str() + ".obj",
+                               dir + "/internal" + oss_frame.str() + ".obj", dir + "/external" + oss_frame.str() + ".obj", dir + "/spring" + oss_frame.str() + ".obj");
+        }
+    }
+
+    const int save_checkpoint = m_options.save_checkpoint;
+    if (save_checkpoint && !(step % save_checkpoint)) {
+        std::stringstream oss_checkpoint;
+        oss_checkpoint << dir << "/checkpoint" << std::setw(5) << std::setfill('0') << (step / save_checkpoint) << ".wcc";
+
+        sim.serializeCheckpoint(oss_checkpoint.str());
+    }
+}
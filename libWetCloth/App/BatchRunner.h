@@ -0,0 +1,94 @@
+//
+// This file is part of the libWetCloth open source project
+//
+// Copyright 2018 Yun (Raymond) Fei, Christopher Batty, Eitan Grinspun, and Changxi Zheng
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef BATCH_RUNNER_H
+#define BATCH_RUNNER_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rapidxml.hpp"
+
+#include "FrameCache.h"
+#include "TwoDSceneXMLParser.h"
+
+/*!
+ * Runs the variants of one scene listed in a batch file, without any
+ * interaction, for parameter studies:
+ *
+ *   <batch>
+ *     <variant name="oil">
+ *       <liquidinfo>
+ *         <viscosity value="0.81"/>
+ *         <liquidDensity value="0.92"/>
+ *       </liquidinfo>
+ *       <StrandParameters index="0">
+ *         <youngsModulus value="1.83e7"/>
+ *       </StrandParameters>
+ *     </variant>
+ *     ...
+ *   </batch>
+ *
+ * The values under a variant replace those of the scene (see
+ * TwoDSceneXMLParser::loadExecutableSimulation). The scene file is parsed
+ * once for all variants and the level sets of its meshes are built once.
+ * Up to jobs variants run at the same time, each in a task arena of
+ * threads_per_run threads, and each writes its frames and checkpoints to a
+ * directory of its own name under the output directory.
+ */
+class BatchRunner
+{
+public:
+    struct Options
+    {
+        int jobs;
+        int threads_per_run;
+        int save_every;
+        bool binary_frames;
+        FrameCache::Options frame_options;
+        int save_checkpoint;
+        int num_writers;
+        size_t output_memory;
+    };
+
+    BatchRunner( const std::string& scene_file, const std::string& batch_file, const std::string& output_dir, const Options& options );
+
+    // returns when every variant ran to the duration of the scene
+    void run();
+
+private:
+    struct Variant
+    {
+        std::string name;
+        rapidxml::xml_node<>* overrides;
+    };
+
+    void loadBatchFile( const std::string& batch_file );
+
+    void runVariant( const Variant& variant );
+
+    void writeOutput( ParticleSimulation& sim, const std::string& dir, int step );
+
+    Options m_options;
+    std::string m_output_dir;
+
+    TwoDSceneXMLParser m_parser;
+    std::vector<char> m_scene_chars;
+    rapidxml::xml_document<> m_scene_doc;
+    std::vector<char> m_batch_chars;
+    rapidxml::xml_document<> m_batch_doc;
+    std::vector<Variant> m_variants;
+
+    // the scene document is shared, so the variants are loaded one at a time
+    std::mutex m_load_mutex;
+    std::mutex m_log_mutex;
+};
+
+#endif
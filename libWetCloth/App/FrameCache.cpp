@@ -0,0 +1,339 @@
+//
+// This file is part of the libWetCloth open source project
+//
+// Copyright 2018 Yun (Raymond) Fei, Christopher Batty, Eitan Grinspun, and Changxi Zheng
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "FrameCache.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+const char FrameCache::magic[8] = { 'W', 'C', 'F', 'R', 'A', 'M', 'E', '\0' };
+const uint32_t FrameCache::version;
+
+namespace {
+// group byte k of every element together, so exponents and high bytes of
+// neighboring values end up next to each other
+void shuffle( const std::vector<unsigned char>& in, int elem_size, std::vector<unsigned char>& out )
+{
+    const size_t n = in.size() / elem_size;
+    out.resize(in.size());
+    for (int k = 0; k < elem_size; ++k) {
+        unsigned char* dst = out.data() + k * n;
+        for (size_t i = 0; i < n; ++i) dst[i] = in[i * elem_size + k];
+    }
+}
+
+void unshuffle( const std::vector<unsigned char>& in, int elem_size, std::vector<unsigned char>& out )
+{
+    const size_t n = in.size() / elem_size;
+    out.resize(in.size());
+    for (int k = 0; k < elem_size; ++k) {
+        const unsigned char* src = in.data() + k * n;
+        for (size_t i = 0; i < n; ++i) out[i * elem_size + k] = src[i];
+    }
+}
+
+template<typename T>
+inline void put( std::ostream& os, const T& v )
+{
+    os.write((const char*) &v, sizeof(T));
+}
+
+template<typename T>
+inline bool get( std::istream& is, T& v )
+{
+    return (bool) is.read((char*) &v, sizeof(T));
+}
+}
+
+int FrameCache::typeSize( COLUMN_TYPE type )
+{
+    switch (type) {
+    case CT_FLOAT32:
+        return 4;
+    case CT_FLOAT64:
+        return 8;
+    case CT_INT32:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+bool FrameCache::parseFormat( const std::string& spec, Options& options )
+{
+    options = Options();
+
+    std::stringstream ss(spec);
+    std::string token;
+    bool binary = false;
+
+    while (std::getline(ss, token, ',')) {
+        if (token == "obj") binary = false;
+        else if (token == "bin") binary = true;
+        else if (token == "f32") options.float32 = true;
+        else if (token == "z") options.compress = true;
+        else std::cerr << "[frame cache: unknown format option " << token << " ignored]" << std::endl;
+    }
+
+    return binary;
+}
+
+FrameCacheWriter::FrameCacheWriter( const FrameCache::Options& options )
+    : m_options(options)
+{}
+
+void FrameCacheWriter::addReals( const std::string& name, const double* data, uint64_t count, int components )
+{
+    FrameCache::Column col;
+    col.name = name;
+    col.components = components;
+    col.count = count;
+
+    const uint64_t n = count * components;
+
+    if (m_options.float32) {
+        col.type = FrameCache::CT_FLOAT32;
+        col.bytes.resize(n * sizeof(float));
+        float* dst = (float*) col.bytes.data();
+        for (uint64_t i = 0; i < n; ++i) dst[i] = (float) data[i];
+    } else {
+        col.type = FrameCache::CT_FLOAT64;
+        col.bytes.resize(n * sizeof(double));
+        if (n) std::memcpy(col.bytes.data(), data, n * sizeof(double));
+    }
+
+    m_columns.push_back(std::move(col));
+}
+
+void FrameCacheWriter::addInts( const std::string& name, const int* data, uint64_t count, int components )
+{
+    FrameCache::Column col;
+    col.name = name;
+    col.type = FrameCache::CT_INT32;
+    col.components = components;
+    col.count = count;
+
+    const uint64_t n = count * components;
+    col.bytes.resize(n * sizeof(int32_t));
+    if (n) std::memcpy(col.bytes.data(), data, n * sizeof(int32_t));
+
+    m_columns.push_back(std::move(col));
+}
+
+bool FrameCacheWriter::write( const std::string& filename ) const
+{
+    std::ofstream ofs(filename.c_str(), std::ios::binary);
+    if (!ofs) {
+        std::cerr << "[frame cache: cannot open " << filename << " for writing]" << std::endl;
+        return false;
+    }
+
+    ofs.write(FrameCache::magic, sizeof(FrameCache::magic));
+    put(ofs, FrameCache::version);
+    put(ofs, (uint32_t) m_columns.size());
+
+    std::vector<unsigned char> shuffled;
+    std::vector<unsigned char> deflated;
+
+    for (const FrameCache::Column& col : m_columns)
+    {
+        const std::vector<unsigned char>* stored = &col.bytes;
+        uint8_t encoding = FrameCache::CE_RAW;
+
+#ifdef USE_ZLIB
+        if (m_options.compress && !col.bytes.empty()) {
+            shuffle(col.bytes, FrameCache::typeSize(col.type), shuffled);
+
+            uLongf len = compressBound(shuffled.size());
+            deflated.resize(len);
+            if (compress2(deflated.data(), &len, shuffled.data(), shuffled.size(), Z_BEST_SPEED) == Z_OK && len < col.bytes.size()) {
+                deflated.resize(len);
+                stored = &deflated;
+                encoding = FrameCache::CE_SHUFFLE | FrameCache::CE_DEFLATE;
+            }
+        }
+#endif
+
+        put(ofs, (uint32_t) col.name.size());
+        ofs.write(col.name.data(), col.name.size());
+        put(ofs, (uint8_t) col.type);
+        put(ofs, (uint8_t) col.components);
+        put(ofs, encoding);
+        put(ofs, (uint8_t) 0);
+        put(ofs, col.count);
+        put(ofs, (uint64_t) stored->size());
+        ofs.write((const char*) stored->data(), stored->size());
+    }
+
+    ofs.flush();
+    if (!ofs) {
+        std::cerr << "[frame cache: failed writing " << filename << "]" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool FrameCacheReader::open( const std::string& filename )
+{
+    m_columns.clear();
+
+    std::ifstream ifs(filename.c_str(), std::ios::binary | std::ios::ate);
+    if (!ifs) {
+        std::cerr << "[frame cache: cannot open " << filename << "]" << std::endl;
+        return false;
+    }
+
+    // every length read from the file is checked against the bytes left
+    // before anything is allocated for it
+    const std::streamoff file_size = ifs.tellg();
+    ifs.seekg(0);
+    auto remaining = [&] () -> uint64_t {
+        const std::streamoff pos = ifs.tellg();
+        return (pos < 0 || pos > file_size) ? 0 : (uint64_t) (file_size - pos);
+    };
+
+    char magic[sizeof(FrameCache::magic)];
+    uint32_t version, num_columns;
+    if (!ifs.read(magic, sizeof(magic)) || std::memcmp(magic, FrameCache::magic, sizeof(magic)) != 0 || !get(ifs, version) || version != FrameCache::version || !get(ifs, num_columns)) {
+        std::cerr << "[frame cache: " << filename << " is not a version " << FrameCache::version << " frame]" << std::endl;
+        return false;
+    }
+
+    // name length, type, components, encoding, reserved, count, stored bytes
+    const uint64_t min_column_header = 4 + 4 + 8 + 8;
+    if (num_columns > remaining() / min_column_header) {
+        std::cerr << "[frame cache: " << filename << " is truncated or corrupt]" << std::endl;
+        return false;
+    }
+
+    m_columns.resize(num_columns);
+
+    std::vector<unsigned char> stored;
+    std::vector<unsigned char> shuffled;
+
+    for (FrameCache::Column& col : m_columns)
+    {
+        uint32_t name_len;
+        uint8_t type, components, encoding, reserved;
+        uint64_t stored_size;
+
+        bool ok = get(ifs, name_len) && name_len <= remaining();
+        if (ok) {
+            col.name.resize(name_len);
+            ok = (bool) ifs.read(&col.name[0], name_len);
+        }
+        ok = ok && get(ifs, type) && get(ifs, components) && get(ifs, encoding) && get(ifs, reserved) && get(ifs, col.count) && get(ifs, stored_size);
+        ok = ok && type < FrameCache::CT_COUNT && components >= 1 && components <= 4;
+        ok = ok && !(encoding & ~(FrameCache::CE_SHUFFLE | FrameCache::CE_DEFLATE));
+        ok = ok && stored_size <= remaining();
+
+        // the decoded size must not overflow, and must match what is stored:
+        // raw columns exactly, deflated ones within the 1032:1 bound of deflate
+        uint64_t num_bytes = 0;
+        if (ok) {
+            const uint64_t elem_size = (uint64_t) components * FrameCache::typeSize((FrameCache::COLUMN_TYPE) type);
+            ok = col.count <= std::numeric_limits<uint64_t>::max() / elem_size;
+            if (ok) num_bytes = col.count * elem_size;
+            if (ok && (encoding & FrameCache::CE_DEFLATE)) ok = num_bytes / 1032 <= stored_size;
+            else if (ok) ok = num_bytes == stored_size;
+        }
+
+        if (ok) {
+            stored.resize(stored_size);
+            ok = (bool) ifs.read((char*) stored.data(), stored_size);
+        }
+
+        if (!ok) {
+            std::cerr << "[frame cache: " << filename << " is truncated or corrupt]" << std::endl;
+            m_columns.clear();
+            return false;
+        }
+
+        col.type = (FrameCache::COLUMN_TYPE) type;
+        col.components = components;
+
+        if (encoding & FrameCache::CE_DEFLATE) {
+#ifdef USE_ZLIB
+            shuffled.resize(num_bytes);
+            uLongf len = num_bytes;
+            if (uncompress(shuffled.data(), &len, stored.data(), stored.size()) != Z_OK || len != num_bytes) {
+                std::cerr << "[frame cache: bad compressed column " << col.name << " in " << filename << "]" << std::endl;
+                m_columns.clear();
+                return false;
+            }
+#else
+            std::cerr << "[frame cache: " << filename << " is compressed, rebuild with zlib to read it]" << std::endl;
+            m_columns.clear();
+            return false;
+#endif
+        } else {
+            shuffled.swap(stored);
+        }
+
+        if (encoding & FrameCache::CE_SHUFFLE) unshuffle(shuffled, FrameCache::typeSize(col.type), col.bytes);
+        else col.bytes.swap(shuffled);
+
+        if (col.bytes.size() != num_bytes) {
+            std::cerr << "[frame cache: column " << col.name << " in " << filename << " has the wrong size]" << std::endl;
+            m_columns.clear();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const FrameCache::Column* FrameCacheReader::find( const std::string& name ) const
+{
+    for (const FrameCache::Column& col : m_columns) {
+        if (col.name == name) return &col;
+    }
+    return nullptr;
+}
+
+bool FrameCacheReader::readReals( const std::string& name, std::vector<double>& out, int& components ) const
+{
+    const FrameCache::Column* col = find(name);
+    if (!col || col->type == FrameCache::CT_INT32) return false;
+
+    const uint64_t n = col->count * col->components;
+    out.resize(n);
+    components = col->components;
+
+    if (col->type == FrameCache::CT_FLOAT32) {
+        const float* src = (const float*) col->bytes.data();
+        for (uint64_t i = 0; i < n; ++i) out[i] = src[i];
+    } else if (n) {
+        std::memcpy(out.data(), col->bytes.data(), n * sizeof(double));
+    }
+
+    return true;
+}
+
+bool FrameCacheReader::readInts( const std::string& name, std::vector<int>& out, int& components ) const
+{
+    const FrameCache::Column* col = find(name);
+    if (!col || col->type != FrameCache::CT_INT32) return false;
+
+    const uint64_t n = col->count * col->components;
+    out.resize(n);
+    components = col->components;
+
+    if (n) std::memcpy(out.data(), col->bytes.data(), n * sizeof(int32_t));
+
+    return true;
+}
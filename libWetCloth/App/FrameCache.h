@@ -0,0 +1,119 @@
+//
+// This file is part of the libWetCloth open source project
+//
+// Copyright 2018 Yun (Raymond) Fei, Christopher Batty, Eitan Grinspun, and Changxi Zheng
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef FRAME_CACHE_H
+#define FRAME_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*!
+ * Binary frame cache: one file per output frame, holding named columns
+ * such as "fluid/position" or "cloth/faces". Each column is a block of
+ * count elements with 1-4 components of one type, stored contiguously,
+ * so a reader can pull a single attribute without parsing the rest.
+ *
+ * File layout (host byte order, little-endian on all supported platforms):
+ *   char[8] magic "WCFRAME", uint32 version, uint32 num_columns
+ *   per column:
+ *     uint32 name length, name bytes
+ *     uint8 type, uint8 components, uint8 encoding, uint8 reserved
+ *     uint64 count, uint64 stored bytes, stored bytes
+ *
+ * Real columns are written as float64, or float32 if asked for. With
+ * compression, the bytes of each column are shuffled by significance and
+ * deflated (lossless); that needs zlib (USE_ZLIB), without it columns are
+ * stored raw. This file does not depend on the simulator, so tools can
+ * build it alone to read caches.
+ */
+class FrameCache
+{
+public:
+    enum COLUMN_TYPE
+    {
+        CT_FLOAT32 = 0,
+        CT_FLOAT64,
+        CT_INT32,
+
+        CT_COUNT
+    };
+
+    enum COLUMN_ENCODING
+    {
+        CE_RAW = 0,
+        CE_SHUFFLE = 1,
+        CE_DEFLATE = 2
+    };
+
+    struct Options
+    {
+        bool float32;
+        bool compress;
+
+        Options() : float32(false), compress(false) {}
+    };
+
+    struct Column
+    {
+        std::string name;
+        COLUMN_TYPE type;
+        int components;
+        uint64_t count;
+        std::vector<unsigned char> bytes; // decoded, count * components values
+    };
+
+    static const char magic[8];
+    static const uint32_t version = 1;
+
+    static int typeSize( COLUMN_TYPE type );
+
+    // parse "obj", "bin", "bin,f32", "bin,f32,z", ...; returns false for obj
+    static bool parseFormat( const std::string& spec, Options& options );
+};
+
+class FrameCacheWriter
+{
+public:
+    explicit FrameCacheWriter( const FrameCache::Options& options );
+
+    void addReals( const std::string& name, const double* data, uint64_t count, int components );
+
+    void addInts( const std::string& name, const int* data, uint64_t count, int components );
+
+    bool write( const std::string& filename ) const;
+
+private:
+    FrameCache::Options m_options;
+    std::vector<FrameCache::Column> m_columns;
+};
+
+class FrameCacheReader
+{
+public:
+    bool open( const std::string& filename );
+
+    inline const std::vector<FrameCache::Column>& columns() const
+    {
+        return m_columns;
+    }
+
+    // null if the frame has no such column
+    const FrameCache::Column* find( const std::string& name ) const;
+
+    // converts float32 to double; false if missing or not real
+    bool readReals( const std::string& name, std::vector<double>& out, int& components ) const;
+
+    bool readInts( const std::string& name, std::vector<int>& out, int& components ) const;
+
+private:
+    std::vector<FrameCache::Column> m_columns;
+};
+
+#endif
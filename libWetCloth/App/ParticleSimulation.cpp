@@ -49,10 +49,12 @@ int ParticleSimulation::currentCameraIndex() const
     return m_display_controller->currentCameraIndex();
 }
 
-void ParticleSimulation::stepSystem(const scalar &dt)
+void ParticleSimulation::stepSystem(const scalar &dt, bool print_statistics)
 {
     m_core->stepSystem(dt);
 
+    if (!print_statistics) return;
+
     const std::vector<scalar>& timing_buffer = m_core->getTimingStatistics();
 
     scalar total_time = 0.0;
@@ -197,6 +199,7 @@ void ParticleSimulation::initializeOpenGLRenderer() {
     TwAddVarRW(bar, "Implicit viscosity", TW_TYPE_BOOLCPP, &info.implicit_viscosity, " help='Use implicit viscosity computation' group='features'");
     TwAddVarRW(bar, "Implicit cloth/yarn for liquid drag", TW_TYPE_BOOLCPP, &info.drag_by_future_solid, " help='Use implicitly (turn off to use explicitly integrated cloth/yarn velocity) integrated cloth/yarn velocity to compute liquid drag force' group='features'");
     TwAddVarRW(bar, "Air drag", TW_TYPE_BOOLCPP, &info.drag_by_future_solid, " help='Turn on to apply air drag force to the cloth/yarn' group='features'");
+    TwAddVarRW(bar, "Sort liquid particles", TW_TYPE_BOOLCPP, &info.sort_particles, " help='Reorder liquid particles in bucket order after rebucketizing for better memory locality' group='features'");
     TwAddVarRO(bar, "Init with nonuniform volume fraction", TW_TYPE_BOOLCPP, &info.init_nonuniform_fraction, " help='Must be turned on when initializing the cloth/yarn with nonuniform volume fraction' group='features'");
 #endif
 }
@@ -214,7 +217,7 @@ void ParticleSimulation::updateOpenGLRendererState() {
 }
 
 void ParticleSimulation::computeCameraCenter(renderingutils::Viewport &view) {
-    const VectorXs& x = m_core->getScene()->getX();
+    ConstVectorXsRef x = m_core->getScene()->getX();
 
     // Compute the bounds on all particle positions
     scalar max_x = -std::numeric_limits<scalar>::infinity();
@@ -268,6 +271,31 @@ void ParticleSimulation::readPos( const std::string& fn_pos )
     ifs.close();
 }
 
+void ParticleSimulation::serializeCheckpoint( const std::string& fn_checkpoint )
+{
+    m_scene_serializer.serializeCheckpoint(*m_core, fn_checkpoint);
+}
+
+bool ParticleSimulation::readCheckpoint( const CheckpointReader& checkpoint )
+{
+    return m_core->loadCheckpoint(checkpoint);
+}
+
+void ParticleSimulation::configureOutput( int num_workers, size_t max_bytes )
+{
+    m_scene_serializer.configureOutput(num_workers, max_bytes);
+}
+
+void ParticleSimulation::flushOutput()
+{
+    m_scene_serializer.flush();
+}
+
+void ParticleSimulation::serializeFrame( const std::string& fn_frame, const FrameCache::Options& options )
+{
+    m_scene_serializer.serializeFrame(*m_core->getScene(), fn_frame, options);
+}
+
 void ParticleSimulation::serializePositionOnly( const std::string& fn_pos )
 {
     m_scene_serializer.serializePositionOnly(*m_core->getScene(), fn_pos);
@@ -306,6 +334,11 @@ std::string ParticleSimulation::getSolverName() {
     return m_core->getSceneStepper()->getName();
 }
 
+int ParticleSimulation::getCurrentStep() const
+{
+    return m_core->getCurrentTime();
+}
+
 void ParticleSimulation::keyboard( unsigned char key, int x, int y )
 {
     m_display_controller->keyboard(key, x, y);
@@ -30,7 +30,8 @@ public:
 	/////////////////////////////////////////////////////////////////////////////
 	// Simulation Control Functions
 
-	void stepSystem( const scalar& dt );
+	// the timing statistics go to stdout unless print_statistics is false (runs of a batch)
+	void stepSystem( const scalar& dt, bool print_statistics = true );
 
 	/////////////////////////////////////////////////////////////////////////////
 	// Rendering Functions
@@ -50,14 +51,28 @@ public:
 	                     const std::string& fn_external_boundaries,
 	                     const std::string& fn_spring);
 
+	void serializeFrame( const std::string& fn_frame, const FrameCache::Options& options );
+
 	void serializePositionOnly( const std::string& fn_pos );
 
 	void readPos( const std::string& fn_pos );
+
+	void serializeCheckpoint( const std::string& fn_checkpoint );
+
+	// false, with the scene possibly half overwritten, if the checkpoint does not fit
+	bool readCheckpoint( const CheckpointReader& checkpoint );
+
+	void configureOutput( int num_workers, size_t max_bytes );
+
+	void flushOutput();
 	/////////////////////////////////////////////////////////////////////////////
 	// Status Functions
 
 	std::string getSolverName();
 
+	// frames simulated so far, including those before a restart
+	int getCurrentStep() const;
+
 	void centerCamera(bool b_reshape = true);
 	void keyboard( unsigned char key, int x, int y );
 	void reshape( int w, int h );
@@ -85,16 +85,16 @@ const RenderInfo& TwoDSceneRenderer::getRenderInfo() const
 void TwoDSceneRenderer::renderParticleSimulation( const TwoDScene& scene, const scalar& dt )
 {
 #ifdef RENDER_ENABLED
-    const VectorXs& x = scene.getX();
-    const VectorXs& rest_x = scene.getRestPos();
+    ConstVectorXsRef x = scene.getX();
+    ConstVectorXsRef rest_x = scene.getRestPos();
     const VectorXs& gx = scene.getGaussX();
 
-    const VectorXs& v = scene.getV();
+    ConstVectorXsRef v = scene.getV();
     const VectorXs& gv = scene.getGaussV();
 
-    const VectorXs& vol = scene.getVol();
-    const VectorXs& fvol = scene.getFluidVol();
-    const VectorXs& fv = scene.getFluidV();
+    ConstVectorXsRef vol = scene.getVol();
+    ConstVectorXsRef fvol = scene.getFluidVol();
+    ConstVectorXsRef fv = scene.getFluidV();
 
     const MatrixXi& faces = scene.getFaces();
     const MatrixXs& fe = scene.getGaussFe();
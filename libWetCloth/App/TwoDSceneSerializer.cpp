@@ -29,75 +29,79 @@ void serialize_pos_subprog( SerializePosPacket* packet )
 
     ofs_pos.flush();
     ofs_pos.close();
-
-    delete packet;
 }
 
 void serialize_subprog( SerializePacket* packet )
 {
     std::ofstream ofs_fluid(packet->fn_fluid.c_str());
+    ofs_fluid << std::setprecision(8);
     const int num_fp = packet->m_fluid_vertices.size();
     for (int i = 0; i < num_fp; ++i)
     {
-        ofs_fluid << "v " << std::setprecision(8) << packet->m_fluid_vertices[i](0) << " " << packet->m_fluid_vertices[i](1) << " " << packet->m_fluid_vertices[i](2) << " " << packet->m_fluid_radii[i] << std::endl;
+        ofs_fluid << "v " << packet->m_fluid_vertices[i](0) << " " << packet->m_fluid_vertices[i](1) << " " << packet->m_fluid_vertices[i](2) << " " << packet->m_fluid_radii[i] << '\n';
     }
 
     std::ofstream ofs_hair(packet->fn_hairs.c_str());
+    ofs_hair << std::setprecision(8);
     const int num_hair_vtx = packet->m_hair_vertices.size();
     for (int i = 0; i < num_hair_vtx; ++i)
     {
-        ofs_hair << "v " << std::setprecision(8) << packet->m_hair_vertices[i](0) << " " << packet->m_hair_vertices[i](1) << " " << packet->m_hair_vertices[i](2) << " " << packet->m_hair_radii[i](0) << " " << packet->m_hair_radii[i](1) << " " << packet->m_hair_sat[i] << " " << packet->m_hair_group[i] << " " << packet->m_hair_vertices_rest[i](0) << " " << packet->m_hair_vertices_rest[i](1) << " " << packet->m_hair_vertices_rest[i](2) << std::endl;
+        ofs_hair << "v " << packet->m_hair_vertices[i](0) << " " << packet->m_hair_vertices[i](1) << " " << packet->m_hair_vertices[i](2) << " " << packet->m_hair_radii[i](0) << " " << packet->m_hair_radii[i](1) << " " << packet->m_hair_sat[i] << " " << packet->m_hair_group[i] << " " << packet->m_hair_vertices_rest[i](0) << " " << packet->m_hair_vertices_rest[i](1) << " " << packet->m_hair_vertices_rest[i](2) << '\n';
     }
     for (auto& e : packet->m_hair_indices)
     {
-        ofs_hair << "l " << (e(0) + 1) << " " << (e(1) + 1) << std::endl;
+        ofs_hair << "l " << (e(0) + 1) << " " << (e(1) + 1) << '\n';
     }
 
 
     std::ofstream ofs_cloth(packet->fn_clothes.c_str());
+    ofs_cloth << std::setprecision(8);
     const int num_cloth_vtx = packet->m_dbl_face_cloth_vertices.size();
     for (int i = 0; i < num_cloth_vtx; ++i)
     {
-        ofs_cloth << "v " << std::setprecision(8) << packet->m_dbl_face_cloth_vertices[i](0) << " " << packet->m_dbl_face_cloth_vertices[i](1) << " " << packet->m_dbl_face_cloth_vertices[i](2) << " "
-                  << packet->m_dbl_face_cloth_sat[i] << " " << packet->m_dbl_face_cloth_dir[i] << " " << packet->m_dbl_face_cloth_group[i] << " " << packet->m_dbl_face_cloth_vertices_rest[i](0) << " " << packet->m_dbl_face_cloth_vertices_rest[i](1) << " " << packet->m_dbl_face_cloth_vertices_rest[i](2) << " " << packet->m_dbl_face_cloth_vertices_central[i](0) << " " << packet->m_dbl_face_cloth_vertices_central[i](1) << " " << packet->m_dbl_face_cloth_vertices_central[i](2) << std::endl;
+        ofs_cloth << "v " << packet->m_dbl_face_cloth_vertices[i](0) << " " << packet->m_dbl_face_cloth_vertices[i](1) << " " << packet->m_dbl_face_cloth_vertices[i](2) << " "
+                  << packet->m_dbl_face_cloth_sat[i] << " " << packet->m_dbl_face_cloth_dir[i] << " " << packet->m_dbl_face_cloth_group[i] << " " << packet->m_dbl_face_cloth_vertices_rest[i](0) << " " << packet->m_dbl_face_cloth_vertices_rest[i](1) << " " << packet->m_dbl_face_cloth_vertices_rest[i](2) << " " << packet->m_dbl_face_cloth_vertices_central[i](0) << " " << packet->m_dbl_face_cloth_vertices_central[i](1) << " " << packet->m_dbl_face_cloth_vertices_central[i](2) << '\n';
     }
 
     for (auto& f : packet->m_dbl_face_cloth_indices)
     {
-        ofs_cloth << "f " << (f(0) + 1) << " " << (f(1) + 1) << " " << (f(2) + 1) << std::endl;
+        ofs_cloth << "f " << (f(0) + 1) << " " << (f(1) + 1) << " " << (f(2) + 1) << '\n';
     }
 
 
     std::ofstream ofs_internal(packet->fn_internal_boundaries.c_str());
+    ofs_internal << std::setprecision(8);
     for (auto& v : packet->m_internal_vertices)
     {
-        ofs_internal << "v " << std::setprecision(8) << v(0) << " " << v(1) << " " << v(2) << std::endl;
+        ofs_internal << "v " << v(0) << " " << v(1) << " " << v(2) << '\n';
     }
     for (auto& f : packet->m_internal_indices)
     {
-        ofs_internal << "f " << (f(0) + 1) << " " << (f(1) + 1) << " " << (f(2) + 1) << std::endl;
+        ofs_internal << "f " << (f(0) + 1) << " " << (f(1) + 1) << " " << (f(2) + 1) << '\n';
     }
 
 
     std::ofstream ofs_external(packet->fn_external_boundaries.c_str());
+    ofs_external << std::setprecision(8);
     for (auto& v : packet->m_external_vertices)
     {
-        ofs_external << "v " << std::setprecision(8) << v(0) << " " << v(1) << " " << v(2) << std::endl;
+        ofs_external << "v " << v(0) << " " << v(1) << " " << v(2) << '\n';
     }
     for (auto& f : packet->m_external_indices)
     {
-        ofs_external << "f " << (f(0) + 1) << " " << (f(1) + 1) << " " << (f(2) + 1) << std::endl;
+        ofs_external << "f " << (f(0) + 1) << " " << (f(1) + 1) << " " << (f(2) + 1) << '\n';
     }
 
     std::ofstream ofs_spring(packet->fn_springs.c_str());
+    ofs_spring << std::setprecision(8);
     for (auto& v : packet->m_attach_spring_vertices)
     {
-        ofs_spring << "v " << std::setprecision(8) << v(0) << " " << v(1) << " " << v(2) << std::endl;
+        ofs_spring << "v " << v(0) << " " << v(1) << " " << v(2) << '\n';
     }
     const int num_springs = packet->m_attach_spring_vertices.size() / 2;
     for (int i = 0; i < num_springs; ++i)
     {
-        ofs_spring << "l " << (i * 2) << " " << (i * 2 + 1) << std::endl;
+        ofs_spring << "l " << (i * 2) << " " << (i * 2 + 1) << '\n';
     }
 
     ofs_fluid.flush();
@@ -115,8 +119,75 @@ void serialize_subprog( SerializePacket* packet )
     ofs_spring.close();
 
     std::cout << "[Frame with " << packet->fn_fluid << " written]" << std::endl;
+}
+
+static_assert(sizeof(Vector3s) == 3 * sizeof(scalar) && sizeof(Vector2s) == 2 * sizeof(scalar), "packet vectors are written as flat arrays");
+static_assert(sizeof(Vector3i) == 3 * sizeof(int) && sizeof(Vector2i) == 2 * sizeof(int), "packet indices are written as flat arrays");
+
+// indices are 0-based, unlike in the obj files
+void serialize_frame_subprog( SerializePacket* packet )
+{
+    FrameCacheWriter writer(packet->frame_options);
+
+    writer.addReals("fluid/position", (const scalar*) packet->m_fluid_vertices.data(), packet->m_fluid_vertices.size(), 3);
+    writer.addReals("fluid/radius", packet->m_fluid_radii.data(), packet->m_fluid_radii.size(), 1);
+
+    writer.addReals("hair/position", (const scalar*) packet->m_hair_vertices.data(), packet->m_hair_vertices.size(), 3);
+    writer.addReals("hair/rest_position", (const scalar*) packet->m_hair_vertices_rest.data(), packet->m_hair_vertices_rest.size(), 3);
+    writer.addReals("hair/radius", (const scalar*) packet->m_hair_radii.data(), packet->m_hair_radii.size(), 2);
+    writer.addReals("hair/saturation", packet->m_hair_sat.data(), packet->m_hair_sat.size(), 1);
+    writer.addInts("hair/group", packet->m_hair_group.data(), packet->m_hair_group.size(), 1);
+    writer.addInts("hair/edges", (const int*) packet->m_hair_indices.data(), packet->m_hair_indices.size(), 2);
+
+    writer.addReals("cloth/position", (const scalar*) packet->m_dbl_face_cloth_vertices.data(), packet->m_dbl_face_cloth_vertices.size(), 3);
+    writer.addReals("cloth/rest_position", (const scalar*) packet->m_dbl_face_cloth_vertices_rest.data(), packet->m_dbl_face_cloth_vertices_rest.size(), 3);
+    writer.addReals("cloth/central_position", (const scalar*) packet->m_dbl_face_cloth_vertices_central.data(), packet->m_dbl_face_cloth_vertices_central.size(), 3);
+    writer.addReals("cloth/saturation", packet->m_dbl_face_cloth_sat.data(), packet->m_dbl_face_cloth_sat.size(), 1);
+    writer.addInts("cloth/direction", packet->m_dbl_face_cloth_dir.data(), packet->m_dbl_face_cloth_dir.size(), 1);
+    writer.addInts("cloth/group", packet->m_dbl_face_cloth_group.data(), packet->m_dbl_face_cloth_group.size(), 1);
+    writer.addInts("cloth/faces", (const int*) packet->m_dbl_face_cloth_indices.data(), packet->m_dbl_face_cloth_indices.size(), 3);
+
+    writer.addReals("internal/position", (const scalar*) packet->m_internal_vertices.data(), packet->m_internal_vertices.size(), 3);
+    writer.addInts("internal/faces", (const int*) packet->m_internal_indices.data(), packet->m_internal_indices.size(), 3);
+
+    writer.addReals("external/position", (const scalar*) packet->m_external_vertices.data(), packet->m_external_vertices.size(), 3);
+    writer.addInts("external/faces", (const int*) packet->m_external_indices.data(), packet->m_external_indices.size(), 3);
+
+    // spring i connects vertices 2i and 2i + 1
+    writer.addReals("spring/position", (const scalar*) packet->m_attach_spring_vertices.data(), packet->m_attach_spring_vertices.size(), 3);
+
+    if (writer.write(packet->fn_frame)) std::cout << "[Frame with " << packet->fn_frame << " written]" << std::endl;
+}
+
+template<typename T>
+static size_t vector_bytes( const std::vector<T>& v )
+{
+    return v.capacity() * sizeof(T);
+}
+
+// the memory a packet holds until it is written
+static size_t packet_bytes( const SerializePacket* packet )
+{
+    return sizeof(SerializePacket) +
+           vector_bytes(packet->m_dbl_face_cloth_indices) + vector_bytes(packet->m_dbl_face_cloth_vertices) +
+           vector_bytes(packet->m_dbl_face_cloth_vertices_rest) + vector_bytes(packet->m_dbl_face_cloth_vertices_central) +
+           vector_bytes(packet->m_dbl_face_cloth_sat) + vector_bytes(packet->m_dbl_face_cloth_group) + vector_bytes(packet->m_dbl_face_cloth_dir) +
+           vector_bytes(packet->m_hair_vertices) + vector_bytes(packet->m_hair_vertices_rest) + vector_bytes(packet->m_hair_indices) +
+           vector_bytes(packet->m_hair_radii) + vector_bytes(packet->m_hair_sat) + vector_bytes(packet->m_hair_group) +
+           vector_bytes(packet->m_attach_spring_vertices) +
+           vector_bytes(packet->m_fluid_vertices) + vector_bytes(packet->m_fluid_radii) +
+           vector_bytes(packet->m_external_indices) + vector_bytes(packet->m_external_vertices) +
+           vector_bytes(packet->m_internal_indices) + vector_bytes(packet->m_internal_vertices);
+}
+
+void TwoDSceneSerializer::configureOutput( int num_workers, size_t max_bytes )
+{
+    m_writer.configure(num_workers, max_bytes);
+}
 
-    delete packet;
+void TwoDSceneSerializer::flush()
+{
+    m_writer.flush();
 }
 
 void TwoDSceneSerializer::serializeScene( TwoDScene& scene,
@@ -127,7 +198,7 @@ void TwoDSceneSerializer::serializeScene( TwoDScene& scene,
         const std::string& fn_external_boundaries,
         const std::string& fn_springs)
 {
-    SerializePacket* data = new SerializePacket;
+    SerializePacket* data = m_packets.acquire();
 
     updateDoubleFaceCloth(scene, data);
     updateHairs(scene, data);
@@ -142,24 +213,60 @@ void TwoDSceneSerializer::serializeScene( TwoDScene& scene,
     data->fn_internal_boundaries = fn_internal_boundaries.c_str();
     data->fn_springs = fn_springs.c_str();
 
-    std::thread t(std::bind(serialize_subprog, data));
-    t.detach();
+    m_writer.submit(packet_bytes(data), [this, data] {
+        serialize_subprog(data);
+        m_packets.release(data);
+    });
+}
+
+void TwoDSceneSerializer::serializeFrame( TwoDScene& scene, const std::string& fn_frame, const FrameCache::Options& options )
+{
+    SerializePacket* data = m_packets.acquire();
+
+    updateDoubleFaceCloth(scene, data);
+    updateHairs(scene, data);
+    updateFluid(scene, data);
+    updateMesh(scene, data);
+    updateAttachSprings(scene, data);
+
+    data->fn_frame = fn_frame;
+    data->frame_options = options;
+
+    m_writer.submit(packet_bytes(data), [this, data] {
+        serialize_frame_subprog(data);
+        m_packets.release(data);
+    });
 }
 
 void TwoDSceneSerializer::serializePositionOnly( TwoDScene& scene, const std::string& fn_pos )
 {
-    SerializePosPacket* data = new SerializePosPacket;
+    SerializePosPacket* data = m_pos_packets.acquire();
     data->fn_pos = fn_pos.c_str();
     data->m_pos = scene.getX();
     data->m_d_gauss = scene.getGaussd();
 
-    std::thread t(std::bind(serialize_pos_subprog, data));
-    t.detach();
+    m_writer.submit(sizeof(SerializePosPacket) + (data->m_pos.size() + data->m_d_gauss.size()) * sizeof(scalar), [this, data] {
+        serialize_pos_subprog(data);
+        m_pos_packets.release(data);
+    });
+}
+
+void TwoDSceneSerializer::serializeCheckpoint( const WetClothCore& core, const std::string& fn_checkpoint )
+{
+    SerializeCheckpointPacket* data = m_checkpoint_packets.acquire();
+    data->fn_checkpoint = fn_checkpoint;
+    data->checkpoint.clear();
+    core.saveCheckpoint(data->checkpoint);
+
+    m_writer.submit(sizeof(SerializeCheckpointPacket) + data->checkpoint.bytes(), [this, data] {
+        data->checkpoint.write(data->fn_checkpoint);
+        m_checkpoint_packets.release(data);
+    });
 }
 
 void TwoDSceneSerializer::loadPosOnly( TwoDScene& scene, std::ifstream& inputstream )
 {
-    VectorXs& x = scene.getX();
+    VectorXsRef x = scene.getX();
     int bufsize;
     inputstream.read((char*) &bufsize, sizeof(int));
     inputstream.read((char*) x.data(), bufsize);
@@ -171,13 +278,20 @@ void TwoDSceneSerializer::loadPosOnly( TwoDScene& scene, std::ifstream& inputstr
 
 void TwoDSceneSerializer::updateHairs(const TwoDScene& scene, SerializePacket* data)
 {
-    const VectorXs& x = scene.getX();
-    const VectorXs& rest_x = scene.getRestPos();
-    const VectorXs& r = scene.getRadius();
-    const VectorXs& vol = scene.getVol();
-    const VectorXs& fvol = scene.getFluidVol();
+    ConstVectorXsRef x = scene.getX();
+    ConstVectorXsRef rest_x = scene.getRestPos();
+    ConstVectorXsRef r = scene.getRadius();
+    ConstVectorXsRef vol = scene.getVol();
+    ConstVectorXsRef fvol = scene.getFluidVol();
     const std::vector<int>& group = scene.getParticleGroup();
 
+    // packets are recycled, drop the hairs of the previous frame
+    data->m_hair_vertices.clear();
+    data->m_hair_vertices_rest.clear();
+    data->m_hair_indices.clear();
+    data->m_hair_sat.clear();
+    data->m_hair_radii.clear();
+    data->m_hair_group.clear();
 
     const int num_soft_elasto = scene.getNumSoftElastoParticles();
     const MatrixXi& edges = scene.getEdges();
@@ -234,8 +348,8 @@ void TwoDSceneSerializer::updateFluid(const TwoDScene& scene, SerializePacket* d
     data->m_fluid_radii.resize( scene.getNumFluidParticles() );
 
     const std::vector<int>& indices = scene.getFluidIndices();
-    const VectorXs& x = scene.getX();
-    const VectorXs& r = scene.getRadius();
+    ConstVectorXsRef x = scene.getX();
+    ConstVectorXsRef r = scene.getRadius();
 
     threadutils::for_each(0, scene.getNumFluidParticles(), [&] (int idx) {
         data->m_fluid_vertices[idx] = x.segment<3>( indices[idx] * 4 );
@@ -245,6 +359,12 @@ void TwoDSceneSerializer::updateFluid(const TwoDScene& scene, SerializePacket* d
 
 void TwoDSceneSerializer::updateMesh(const TwoDScene& scene, SerializePacket* data)
 {
+    // packets are recycled, the meshes are appended below
+    data->m_internal_vertices.clear();
+    data->m_internal_indices.clear();
+    data->m_external_vertices.clear();
+    data->m_external_indices.clear();
+
     const std::vector< std::shared_ptr< DistanceField > >& fields = scene.getGroupDistanceField();
     for ( auto& ptr : fields )
     {
@@ -306,8 +426,8 @@ void TwoDSceneSerializer::initializeFaceLoops(const TwoDScene& scene)
 
 void TwoDSceneSerializer::updateAttachSprings(const TwoDScene& scene, SerializePacket* data)
 {
-    const VectorXs& x = scene.getX();
-    const VectorXs& rest_x = scene.getRestPos();
+    ConstVectorXsRef x = scene.getX();
+    ConstVectorXsRef rest_x = scene.getRestPos();
     const auto& forces = scene.getAttachForces();
 
     data->m_attach_spring_vertices.resize(forces.size() * 2);
@@ -322,18 +442,24 @@ void TwoDSceneSerializer::updateAttachSprings(const TwoDScene& scene, SerializeP
 
 void TwoDSceneSerializer::updateDoubleFaceCloth(const TwoDScene& scene, SerializePacket* data)
 {
-    const VectorXs& x = scene.getX();
-    const VectorXs& rest_x = scene.getRestPos();
+    ConstVectorXsRef x = scene.getX();
+    ConstVectorXsRef rest_x = scene.getRestPos();
     const std::vector<int> group = scene.getParticleGroup();
-    const int num_edges = scene.getNumEdges();
     const int num_soft_elasto = scene.getNumSoftElastoParticles();
     const int num_faces = scene.getNumFaces();
     const MatrixXi& faces = scene.getFaces();
-    const MatrixXs& gnorms = scene.getGaussNormal();
-    const VectorXs& radius = scene.getRadius();
-    const VectorXs& fluid_vol = scene.getFluidVol();
-    const VectorXs& vol = scene.getVol();
-    const VectorXs& vol_frac = scene.getVolumeFraction();
+    ConstVectorXsRef radius = scene.getRadius();
+    ConstVectorXsRef fluid_vol = scene.getFluidVol();
+    ConstVectorXsRef vol = scene.getVol();
+
+    // packets are recycled, drop the cloth of the previous frame
+    data->m_dbl_face_cloth_vertices.clear();
+    data->m_dbl_face_cloth_vertices_rest.clear();
+    data->m_dbl_face_cloth_vertices_central.clear();
+    data->m_dbl_face_cloth_sat.clear();
+    data->m_dbl_face_cloth_group.clear();
+    data->m_dbl_face_cloth_dir.clear();
+    data->m_dbl_face_cloth_indices.clear();
 
     if (num_soft_elasto == 0) return;
 
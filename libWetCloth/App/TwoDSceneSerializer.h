@@ -14,7 +14,10 @@
 #include <iostream>
 
 #include "TwoDScene.h"
+#include "WetClothCore.h"
 #include "StringUtilities.h"
+#include "FrameCache.h"
+#include "AsyncWriter.h"
 
 struct SerializePosPacket
 {
@@ -23,6 +26,12 @@ struct SerializePosPacket
     MatrixXs m_d_gauss;
 };
 
+struct SerializeCheckpointPacket
+{
+    std::string fn_checkpoint;
+    CheckpointWriter checkpoint;
+};
+
 struct SerializePacket
 {
     std::string fn_clothes;
@@ -32,6 +41,10 @@ struct SerializePacket
     std::string fn_external_boundaries;
     std::string fn_springs;
 
+    // a single binary frame cache instead of the obj files if not empty
+    std::string fn_frame;
+    FrameCache::Options frame_options;
+
     std::vector< Vector3i > m_dbl_face_cloth_indices;
     std::vector< Vector3s > m_dbl_face_cloth_vertices;
     std::vector< Vector3s > m_dbl_face_cloth_vertices_rest;
@@ -64,7 +77,20 @@ struct SerializePacket
 class TwoDSceneSerializer
 {
     std::vector< std::vector<int> > m_face_loops;
+
+    PacketPool<SerializePacket> m_packets;
+    PacketPool<SerializePosPacket> m_pos_packets;
+    PacketPool<SerializeCheckpointPacket> m_checkpoint_packets;
+
+    // declared last, so pending writes finish before the packets go away
+    AsyncWriter m_writer;
 public:
+    // worker threads and memory budget for the frames waiting to be written
+    void configureOutput( int num_workers, size_t max_bytes );
+
+    // blocks until every frame handed to the serializer is on disk
+    void flush();
+
     void serializeScene( TwoDScene& scene,
                          const std::string& fn_clothes,
                          const std::string& fn_hairs,
@@ -73,9 +99,17 @@ public:
                          const std::string& fn_external_boundaries,
                          const std::string& fn_springs);
 
+    void serializeFrame( TwoDScene& scene,
+                         const std::string& fn_frame,
+                         const FrameCache::Options& options );
+
     void serializePositionOnly( TwoDScene& scene,
                                 const std::string& fn_pos );
 
+    // complete state for a restart, copied now and written in the background
+    void serializeCheckpoint( const WetClothCore& core,
+                              const std::string& fn_checkpoint );
+
     void loadPosOnly( TwoDScene& scene, std::ifstream& inputstream );
 
     void initializeFaceLoops(const TwoDScene& scene);
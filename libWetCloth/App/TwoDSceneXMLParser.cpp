@@ -9,17 +9,49 @@
 
 #include "TwoDSceneXMLParser.h"
 #include "MathDefs.h"
+#include "Viscosity.h"
+#include "ThreadUtils.h"
 
 #include <fstream>
 #include <string>
 
-void TwoDSceneXMLParser::loadExecutableSimulation( const std::string& file_name, bool rendering_enabled, std::shared_ptr<ParticleSimulation>& execsim, Camera& cam, scalar& dt, scalar& max_time, scalar& steps_per_sec_cap, renderingutils::Color& bgcolor, std::string& description, std::string& scenetag, bool& cam_inited, const std::string& input_bin )
+void TwoDSceneXMLParser::loadExecutableSimulation( const std::string& file_name, bool rendering_enabled, std::shared_ptr<ParticleSimulation>& execsim, Camera& cam, scalar& dt, scalar& max_time, scalar& steps_per_sec_cap, renderingutils::Color& bgcolor, std::string& description, std::string& scenetag, bool& cam_inited, const std::string& input_bin, const std::string& restart_file )
 {
+	// Map the checkpoint first, so that it is read ahead while the xml is parsed
+	CheckpointReader checkpoint;
+	if ( !restart_file.empty() && !checkpoint.open(restart_file) )
+	{
+		std::cerr << outputmod::startred << "ERROR IN XMLSCENEPARSER:" << outputmod::endred << " Failed to open checkpoint " << restart_file << ". Exiting." << std::endl;
+		exit(1);
+	}
+
 	// Load the xml document
 	std::vector<char> xmlchars;
 	rapidxml::xml_document<> doc;
 	loadXMLFile( file_name, xmlchars, doc );
 
+	// Only a single run takes its thread count from the scene, see below
+	if ( rapidxml::xml_node<>* node = doc.first_node("scene") ) loadThreads( node );
+
+	loadSceneNode( doc, rendering_enabled, execsim, cam, dt, max_time, steps_per_sec_cap, bgcolor, description, scenetag, cam_inited, input_bin, restart_file.empty() ? NULL : &checkpoint );
+}
+
+void TwoDSceneXMLParser::loadExecutableSimulation( rapidxml::xml_document<>& doc, rapidxml::xml_node<>* overrides, bool rendering_enabled, std::shared_ptr<ParticleSimulation>& execsim, Camera& cam, scalar& dt, scalar& max_time, scalar& steps_per_sec_cap, renderingutils::Color& bgcolor, std::string& description, std::string& scenetag, bool& cam_inited )
+{
+	std::vector<ReplacedNode> replaced;
+	rapidxml::xml_node<>* node = doc.first_node("scene");
+	if ( node != NULL && overrides != NULL ) applyOverrides( doc, node, overrides, replaced );
+
+	// <threads> is ignored here: it would cap the whole process, while the
+	// runs of a batch share the threads through task arenas of their own
+
+	loadSceneNode( doc, rendering_enabled, execsim, cam, dt, max_time, steps_per_sec_cap, bgcolor, description, scenetag, cam_inited, "", NULL );
+
+	revertOverrides( replaced );
+}
+
+void TwoDSceneXMLParser::loadSceneNode( rapidxml::xml_document<>& doc, bool rendering_enabled, std::shared_ptr<ParticleSimulation>& execsim, Camera& cam, scalar& dt, scalar& max_time, scalar& steps_per_sec_cap, renderingutils::Color& bgcolor, std::string& description, std::string& scenetag, bool& cam_inited, const std::string& input_bin, const CheckpointReader* checkpoint )
+{
 	// Attempt to locate the root node
 	rapidxml::xml_node<>* node = doc.first_node("scene");
 	if ( node == NULL )
@@ -43,7 +75,74 @@ void TwoDSceneXMLParser::loadExecutableSimulation( const std::string& file_name,
 
 
 	// Parse the user-requested simulation type. The default is a particle simulation.
-	loadParticleSimulation(rendering_enabled, execsim, dt, bgcolor, node, input_bin);
+	loadParticleSimulation(rendering_enabled, execsim, dt, bgcolor, node, input_bin, checkpoint);
+}
+
+void TwoDSceneXMLParser::applyOverrides( rapidxml::xml_document<>& doc, rapidxml::xml_node<>* node, rapidxml::xml_node<>* overrides, std::vector<ReplacedNode>& replaced )
+{
+	for ( rapidxml::xml_node<>* ov = overrides->first_node(); ov; ov = ov->next_sibling() )
+	{
+		if ( ov->type() != rapidxml::node_element ) continue;
+
+		// the index-th node of that name, <StrandParameters index="1"> for the second set of strand parameters
+		int index = 0;
+		rapidxml::xml_attribute<>* atrbnde = ov->first_attribute("index");
+		if ( atrbnde != NULL && !stringutils::extractFromString(std::string(atrbnde->value()), index) )
+		{
+			std::cerr << outputmod::startred << "ERROR IN XMLSCENEPARSER:" << outputmod::endred << " Failed to parse 'index' attribute of override " << ov->name() << ". Value must be integer. Exiting." << std::endl;
+			exit(1);
+		}
+
+		rapidxml::xml_node<>* target = node->first_node(ov->name());
+		for ( int i = 0; i < index && target; ++i ) target = target->next_sibling(ov->name());
+
+		if ( target == NULL && index > 0 )
+		{
+			std::cerr << outputmod::startred << "ERROR IN XMLSCENEPARSER:" << outputmod::endred << " The scene has no " << ov->name() << " " << index << " to override. Exiting." << std::endl;
+			exit(1);
+		}
+
+		// the overrides go into a copy of the node, which stands in for it while the scene is loaded
+		rapidxml::xml_node<>* replacement = target ? doc.clone_node(target) : doc.allocate_node(rapidxml::node_element, ov->name());
+
+		for ( rapidxml::xml_attribute<>* attr = ov->first_attribute(); attr; attr = attr->next_attribute() )
+		{
+			if ( std::string(attr->name()) == "index" ) continue;
+
+			rapidxml::xml_attribute<>* original = replacement->first_attribute(attr->name());
+			if ( original ) replacement->remove_attribute(original);
+			replacement->append_attribute(doc.allocate_attribute(attr->name(), attr->value()));
+		}
+
+		for ( rapidxml::xml_node<>* value = ov->first_node(); value; value = value->next_sibling() )
+		{
+			if ( value->type() != rapidxml::node_element ) continue;
+
+			// <restVolumeFraction remove="1"/> leaves the value to its default
+			rapidxml::xml_node<>* original = replacement->first_node(value->name());
+			rapidxml::xml_attribute<>* remove_attr = value->first_attribute("remove");
+			const bool remove = remove_attr != NULL && std::string(remove_attr->value()) != "0";
+
+			if ( !remove ) replacement->insert_node(original, doc.clone_node(value));
+			if ( original ) replacement->remove_node(original);
+		}
+
+		node->insert_node(target, replacement);
+		if ( target ) node->remove_node(target);
+
+		replaced.push_back(ReplacedNode{node, target, replacement});
+	}
+}
+
+void TwoDSceneXMLParser::revertOverrides( std::vector<ReplacedNode>& replaced )
+{
+	for ( auto r = replaced.rbegin(); r != replaced.rend(); ++r )
+	{
+		if ( r->original ) r->parent->insert_node(r->replacement, r->original);
+		r->parent->remove_node(r->replacement);
+	}
+
+	replaced.clear();
 }
 
 void TwoDSceneXMLParser::loadBucketInfo( rapidxml::xml_node<>* node, const std::shared_ptr<TwoDScene>& twodscene )
@@ -545,7 +644,14 @@ void TwoDSceneXMLParser::loadDistanceFields( rapidxml::xml_node<>* node, const s
 
 }
 
-void TwoDSceneXMLParser::loadParticleSimulation(bool rendering_enabled, std::shared_ptr<ParticleSimulation>& execsim, scalar& dt, renderingutils::Color& bgcolor, rapidxml::xml_node<>* node, const std::string& input_bin )
+/*!
+ * With a checkpoint, the particles come from the checkpoint instead of the
+ * scene file, and the elements are built on their rest positions. The
+ * sampling of the distance fields and the initial grid are skipped: the
+ * checkpoint holds the sampled particles, and the first step rebuilds the
+ * grid anyway.
+ */
+void TwoDSceneXMLParser::loadParticleSimulation(bool rendering_enabled, std::shared_ptr<ParticleSimulation>& execsim, scalar& dt, renderingutils::Color& bgcolor, rapidxml::xml_node<>* node, const std::string& input_bin, const CheckpointReader* checkpoint )
 {
 	auto scene = std::make_shared<TwoDScene>();
 
@@ -560,16 +666,20 @@ void TwoDSceneXMLParser::loadParticleSimulation(bool rendering_enabled, std::sha
 	loadBucketInfo( node, scene );
 
 	int mg_part, mg_df;
-	loadParticles( node, scene, mg_part);
+	if ( checkpoint ) loadParticlesFromCheckpoint( *checkpoint, scene, mg_part );
+	else loadParticles( node, scene, mg_part);
 	loadDistanceFields( node, scene, mg_df );
 
 	loadStrandParameters(node, scene, dt);
 
 	int maxgroup = std::max(mg_part, mg_df);
 	scene->resizeGroups(maxgroup + 1);
-	scene->sampleSolidDistanceFields();
-	scene->sampleLiquidDistanceFields(0.0);
-	scene->updateRestPos();
+	if ( !checkpoint )
+	{
+		scene->sampleSolidDistanceFields();
+		scene->sampleLiquidDistanceFields(0.0);
+		scene->updateRestPos();
+	}
 	scene->initGroupPos();
 
 	loadClothes(node, scene);
@@ -578,29 +688,33 @@ void TwoDSceneXMLParser::loadParticleSimulation(bool rendering_enabled, std::sha
 	loadScripts( node, scene );
 
 	scene->initGaussSystem();
-	scene->updateShapeFactor();
-	scene->updateParticleBoundingBox();
-	scene->rebucketizeParticles();
-	scene->resampleNodes();
-	scene->updateManifoldOperators();
-	scene->computeWeights(0.0);
-	scene->updatePlasticity(0.0);
-	scene->computedEdFe();
-	scene->updateOrientation();
-
-	scene->updateSolidPhi();
-	scene->updateSolidWeights();
-	scene->updateLiquidPhi(0.0);
-	scene->updateIntersection();
-	scene->mapParticleNodesAPIC();
-	scene->mapParticleSaturationPsiNodes();
-	scene->updatePorePressureNodes();
-
-	scene->updateOptiVolume();
-	scene->splitLiquidParticles();
-	scene->mergeLiquidParticles();
-
-	scene->saveParticleVelocity();
+
+	if ( !checkpoint )
+	{
+		scene->updateShapeFactor();
+		scene->updateParticleBoundingBox();
+		scene->rebucketizeParticles();
+		scene->resampleNodes();
+		scene->updateManifoldOperators();
+		scene->computeWeights(0.0);
+		scene->updatePlasticity(0.0);
+		scene->computedEdFe();
+		scene->updateOrientation();
+
+		scene->updateSolidPhi();
+		scene->updateSolidWeights();
+		scene->updateLiquidPhi(0.0);
+		scene->updateIntersection();
+		scene->mapParticleNodesAPIC();
+		scene->mapParticleSaturationPsiNodes();
+		scene->updatePorePressureNodes();
+
+		scene->updateOptiVolume();
+		scene->splitLiquidParticles();
+		scene->mergeLiquidParticles();
+
+		scene->saveParticleVelocity();
+	}
 
 	// Forces
 	scene->loadAttachForces();
@@ -619,7 +733,17 @@ void TwoDSceneXMLParser::loadParticleSimulation(bool rendering_enabled, std::sha
 
 	execsim = std::make_shared< ParticleSimulation >(scene, scene_stepper, scene_renderer);
 
-	if (!input_bin.empty())
+	if ( checkpoint )
+	{
+		if ( !execsim->readCheckpoint(*checkpoint) )
+		{
+			std::cerr << outputmod::startred << "ERROR IN XMLSCENEPARSER:" << outputmod::endred << " The checkpoint does not belong to this scene. Exiting." << std::endl;
+			exit(1);
+		}
+
+		if ( scene_renderer ) scene_renderer->updateParticleSimulationState(*scene);
+	}
+	else if (!input_bin.empty())
 	{
 		execsim->readPos(input_bin);
 		scene->updateGaussSystem(0.0);
@@ -1444,7 +1568,7 @@ void TwoDSceneXMLParser::loadHairs(rapidxml::xml_node<>* node, const std::shared
 
 			particle_radius.resize(count * 2);
 
-			const VectorXs& scene_radius = twodscene->getRadius();
+			ConstVectorXsRef scene_radius = twodscene->getRadius();
 
 			for (int i = 0; i < count; ++i) {
 				const int pidx = particle_indices[i];
@@ -1500,7 +1624,7 @@ void TwoDSceneXMLParser::loadHairs(rapidxml::xml_node<>* node, const std::shared
 
 			particle_radius.resize(count * 2);
 
-			const VectorXs& scene_radius = twodscene->getRadius();
+			ConstVectorXsRef scene_radius = twodscene->getRadius();
 
 			for (int i = 0; i < count; ++i) {
 				const int pidx = start + i;
@@ -1648,6 +1772,7 @@ void TwoDSceneXMLParser::loadLiquidInfo(rapidxml::xml_node<>* node, const std::s
 	info.use_group_precondition = false;
 	info.use_lagrangian_mpm = false;
 	info.use_cosolve_angular = false;
+	info.sort_particles = false;
 	info.levelset_thickness = 0.25;
 	info.iteration_print_step = 0;
 	info.elasto_capture_rate = 1.0;
@@ -1767,6 +1892,16 @@ void TwoDSceneXMLParser::loadLiquidInfo(rapidxml::xml_node<>* node, const std::s
 			}
 		}
 
+		if ( ( subnd = nd->first_node("sortParticles") ) )
+		{
+			std::string attribute( subnd->first_attribute("value")->value() );
+			if ( !stringutils::extractFromString(attribute, info.sort_particles) )
+			{
+				std::cerr << outputmod::startred << "ERROR IN XMLSCENEPARSER:" << outputmod::endred << " Failed to parse value of sortParticles attribute for LiquidInfo. Value must be boolean. Exiting." << std::endl;
+				exit(1);
+			}
+		}
+
 		if ( ( subnd = nd->first_node("initNonuniformFraction") ) )
 		{
 			std::string attribute( subnd->first_attribute("value")->value() );
@@ -2659,6 +2794,20 @@ void TwoDSceneXMLParser::loadParticles( rapidxml::xml_node<>* node, const std::s
 	}
 }
 
+void TwoDSceneXMLParser::loadParticlesFromCheckpoint( const CheckpointReader& checkpoint, const std::shared_ptr<TwoDScene>& twodscene, int& maxgroup )
+{
+	if ( !twodscene->loadRestConfiguration(checkpoint) )
+	{
+		std::cerr << outputmod::startred << "ERROR IN XMLSCENEPARSER:" << outputmod::endred << " Failed to load the particles of the checkpoint. Exiting." << std::endl;
+		exit(1);
+	}
+
+	const std::vector<int>& groups = twodscene->getParticleGroup();
+
+	maxgroup = 0;
+	for (int group : groups) maxgroup = std::max(maxgroup, group);
+}
+
 void TwoDSceneXMLParser::loadSceneTag( rapidxml::xml_node<>* node, std::string& scenetag )
 {
 	assert( node != NULL );
@@ -2776,7 +2925,21 @@ void TwoDSceneXMLParser::loadIntegrator( rapidxml::xml_node<>* node, std::shared
 			}
 		}
 
-		scenestepper = std::make_shared< LinearizedImplicitEuler >(criterion, pressure_criterion, quasi_static_criterion, viscous_criterion, maxiters, manifoldsubsteps, viscositysubsteps, surftensionsubsteps);
+		int viscositysolver = viscosity::VS_MIC_PCG;
+		subnd = nd->first_attribute("viscositysolver");
+		if ( subnd ) {
+			std::string solvertype(subnd->value());
+			if ( solvertype == "mic" ) {
+				viscositysolver = viscosity::VS_MIC_PCG;
+			} else if ( solvertype == "block" ) {
+				viscositysolver = viscosity::VS_BLOCK_PCG;
+			} else {
+				std::cerr << outputmod::startred << "ERROR IN XMLSCENEPARSER:" << outputmod::endred << " Invalid 'viscositysolver' attribute for integrator. Value must be 'mic' or 'block'. Exiting." << std::endl;
+				exit(1);
+			}
+		}
+
+		scenestepper = std::make_shared< LinearizedImplicitEuler >(criterion, pressure_criterion, quasi_static_criterion, viscous_criterion, maxiters, manifoldsubsteps, viscositysubsteps, surftensionsubsteps, viscositysolver);
 	}
 	else
 	{
@@ -2908,6 +3071,31 @@ void TwoDSceneXMLParser::loadMaxSimFrequency( rapidxml::xml_node<>* node, scalar
 
 
 
+void TwoDSceneXMLParser::loadThreads( rapidxml::xml_node<>* node )
+{
+	assert( node != NULL );
+
+	rapidxml::xml_node<>* nd = node->first_node("threads");
+	if ( nd == NULL ) return;
+
+	rapidxml::xml_attribute<>* atrbnde = nd->first_attribute("count");
+	if ( atrbnde == NULL )
+	{
+		std::cerr << outputmod::startred << "ERROR IN XMLSCENEPARSER:" << outputmod::endred << " No threads 'count' attribute specified. Exiting." << std::endl;
+		exit(1);
+	}
+
+	int count = 0;
+	if ( !stringutils::extractFromString(std::string(atrbnde->value()), count) )
+	{
+		std::cerr << outputmod::startred << "ERROR IN XMLSCENEPARSER:" << outputmod::endred << " Failed to parse 'count' attribute for threads. Value must be integer. Exiting." << std::endl;
+		exit(1);
+	}
+
+	// the command line takes precedence
+	if ( !threadutils::num_threads_configured() ) threadutils::set_num_threads(count);
+}
+
 void TwoDSceneXMLParser::loadBackgroundColor( rapidxml::xml_node<>* node, renderingutils::Color& color )
 {
 	if ( rapidxml::xml_node<>* nd = node->first_node("backgroundcolor") )
@@ -58,16 +58,38 @@ class TwoDSceneXMLParser
 {
 public:
 
-	void loadExecutableSimulation( const std::string& file_name, bool rendering_enabled, std::shared_ptr<ParticleSimulation>& execsim, Camera& cam, scalar& dt, scalar& max_time, scalar& steps_per_sec_cap, renderingutils::Color& bgcolor, std::string& description, std::string& scenetag, bool& cam_inited, const std::string& input_bin );
+	void loadExecutableSimulation( const std::string& file_name, bool rendering_enabled, std::shared_ptr<ParticleSimulation>& execsim, Camera& cam, scalar& dt, scalar& max_time, scalar& steps_per_sec_cap, renderingutils::Color& bgcolor, std::string& description, std::string& scenetag, bool& cam_inited, const std::string& input_bin, const std::string& restart_file = "" );
+
+	// Loads a simulation from a scene parsed with loadXMLFile. The attributes
+	// and children of each node under overrides (<liquidinfo>, <StrandParameters
+	// index="i">, <integrator>, ...) replace those of the same name in the
+	// matching node of the scene, a child with remove="1" drops it. The document
+	// is restored afterwards, to be loaded again with other overrides. The
+	// <threads> of the scene is ignored, the caller sets up the threads.
+	void loadExecutableSimulation( rapidxml::xml_document<>& doc, rapidxml::xml_node<>* overrides, bool rendering_enabled, std::shared_ptr<ParticleSimulation>& execsim, Camera& cam, scalar& dt, scalar& max_time, scalar& steps_per_sec_cap, renderingutils::Color& bgcolor, std::string& description, std::string& scenetag, bool& cam_inited );
+
+	void loadXMLFile( const std::string& filename, std::vector<char>& xmlchars, rapidxml::xml_document<>& doc );
 
 	// TODO: NEED AN EIGEN_ALIGNED_THING_HERE ?
 private:
 
-	void loadParticleSimulation( bool rendering_enabled, std::shared_ptr<ParticleSimulation>& execsim, scalar& dt, renderingutils::Color& bgcolor, rapidxml::xml_node<>* node, const std::string& input_bin );
+	// a node of the scene replaced by an override, to put back once loaded
+	struct ReplacedNode
+	{
+		rapidxml::xml_node<>* parent;
+		rapidxml::xml_node<>* original; // null if the override added the node
+		rapidxml::xml_node<>* replacement;
+	};
 
-	void loadLiquidInfo(rapidxml::xml_node<>* node, const std::shared_ptr<TwoDScene>& twodscene);
+	void loadSceneNode( rapidxml::xml_document<>& doc, bool rendering_enabled, std::shared_ptr<ParticleSimulation>& execsim, Camera& cam, scalar& dt, scalar& max_time, scalar& steps_per_sec_cap, renderingutils::Color& bgcolor, std::string& description, std::string& scenetag, bool& cam_inited, const std::string& input_bin, const CheckpointReader* checkpoint );
 
-	void loadXMLFile( const std::string& filename, std::vector<char>& xmlchars, rapidxml::xml_document<>& doc );
+	void applyOverrides( rapidxml::xml_document<>& doc, rapidxml::xml_node<>* node, rapidxml::xml_node<>* overrides, std::vector<ReplacedNode>& replaced );
+
+	void revertOverrides( std::vector<ReplacedNode>& replaced );
+
+	void loadParticleSimulation( bool rendering_enabled, std::shared_ptr<ParticleSimulation>& execsim, scalar& dt, renderingutils::Color& bgcolor, rapidxml::xml_node<>* node, const std::string& input_bin, const CheckpointReader* checkpoint );
+
+	void loadLiquidInfo(rapidxml::xml_node<>* node, const std::shared_ptr<TwoDScene>& twodscene);
 
 	bool loadTextFileIntoString( const std::string& filename, std::string& filecontents );
 
@@ -85,6 +107,8 @@ private:
 
 	void loadParticles(rapidxml::xml_node<>* node, const std::shared_ptr<TwoDScene>& twodscene, int& maxgroup );
 
+	void loadParticlesFromCheckpoint( const CheckpointReader& checkpoint, const std::shared_ptr<TwoDScene>& twodscene, int& maxgroup );
+
 	void loadSceneTag( rapidxml::xml_node<>* node, std::string& scenetag );
 
 	void loadDistanceFields( rapidxml::xml_node<>* node, const std::shared_ptr<TwoDScene>& twodscene, int& maxgroup );
@@ -103,6 +127,8 @@ private:
 
 	void loadMaxSimFrequency( rapidxml::xml_node<>* node, scalar& max_freq );
 
+	void loadThreads( rapidxml::xml_node<>* node );
+
 	void loadViewport( rapidxml::xml_node<> *node, renderingutils::Viewport &view);
 
 	void loadBackgroundColor( rapidxml::xml_node<>* node, renderingutils::Color& color );
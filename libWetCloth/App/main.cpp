@@ -34,9 +34,12 @@
 #include "Force.h"
 #include "TwoDSceneXMLParser.h"
 #include "TwoDSceneSerializer.h"
+#include "AsyncWriter.h"
+#include "BatchRunner.h"
 #include "StringUtilities.h"
 #include "MathDefs.h"
 #include "TimingUtilities.h"
+#include "ThreadUtils.h"
 #include "Camera.h"
 
 #ifdef RENDER_ENABLED
@@ -79,11 +82,24 @@ std::string g_scene_tag = "";
 ///////////////////////////////////////////////////////////////////////////////
 // Scene input/output/comparison state
 int g_save_to_binary = 0;
+bool g_binary_frames = false;
+FrameCache::Options g_frame_options;
+int g_num_writers = 1;
+int g_output_memory = (int) (AsyncWriter::default_max_bytes >> 20);
 std::string g_binary_file_name;
+int g_save_checkpoint = 0;
+std::string g_restart_file_name;
 std::ofstream g_binary_output;
 std::string g_short_file_name;
 
 
+///////////////////////////////////////////////////////////////////////////////
+// Batch state
+std::string g_batch_file_name;
+int g_batch_jobs = 1;
+int g_batch_threads = 0;
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // Simulation state
 int g_dump_png = 0;
@@ -91,6 +107,7 @@ bool g_paused = true;
 scalar g_dt = 0.0;
 int g_num_steps = 0;
 int g_current_step = 0;
+bool g_interactive = true;
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -108,7 +125,11 @@ void stepSystem()
 	miscOutputCallback();
 
 	// Determine if the simulation is complete
-	if ( g_current_step >= g_num_steps )
+	if ( g_current_step >= g_num_steps && !g_interactive )
+	{
+		g_paused = true;
+	}
+	else if ( g_current_step >= g_num_steps )
 	{
 		std::cout << "Complete Simulation! Enter time to continue (exit with 0): " << std::endl;
 		double new_time = 0.0;
@@ -131,6 +152,9 @@ void headlessSimLoop()
 			stepSystem();
 		}
 
+		// without interaction the run ends at the duration of the scene
+		if ( !g_interactive ) break;
+
 		std::cout << "Complete Simulation! Enter time to continue (exit with 0): " << std::endl;
 		double new_time = 0.0;
 		std::cin >> new_time;
@@ -141,12 +165,15 @@ void headlessSimLoop()
 }
 
 #ifdef RENDER_ENABLED
-void dumpPNGsubprog(YImage* image, char* fnstr)
+// the pool is declared first, so the writer is done with the images before they go away
+PacketPool<YImage> g_png_images;
+AsyncWriter g_png_writer;
+
+void dumpPNGsubprog(YImage* image, const std::string& filename)
 {
 	image->flip();
-	image->save(fnstr);
-	delete image;
-	delete fnstr;
+	image->save(filename.c_str());
+	g_png_images.release(image);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -154,9 +181,7 @@ void dumpPNGsubprog(YImage* image, char* fnstr)
 
 void dumpPNG(const std::string &filename)
 {
-	YImage* image = new YImage;
-	char* fnstr = new char[filename.length() + 1];
-	strcpy(fnstr, filename.data());
+	YImage* image = g_png_images.acquire();
 
 	image->resize(g_executable_simulation->getWindowWidth(), g_executable_simulation->getWindowHeight());
 
@@ -171,9 +196,8 @@ void dumpPNG(const std::string &filename)
 	glFinish();
 	glReadPixels(0, 0, g_executable_simulation->getWindowWidth(), g_executable_simulation->getWindowHeight(), GL_RGBA, GL_UNSIGNED_BYTE, image->data());
 
-	std::thread t(std::bind(dumpPNGsubprog, image, fnstr));
-
-	t.detach();
+	const size_t bytes = sizeof(YPixel) * image->width() * image->height();
+	g_png_writer.submit(bytes, [image, filename] { dumpPNGsubprog(image, filename); });
 }
 
 
@@ -422,7 +446,7 @@ void loadScene( const std::string& file_name )
 	Camera cam;
 
 	xml_scene_parser.loadExecutableSimulation( file_name, g_rendering_enabled, g_executable_simulation,
-	        cam, g_dt, max_time, steps_per_sec_cap, g_bgcolor, g_description, g_scene_tag, cam_init, g_binary_file_name );
+	        cam, g_dt, max_time, steps_per_sec_cap, g_bgcolor, g_description, g_scene_tag, cam_init, g_binary_file_name, g_restart_file_name );
 	assert( g_executable_simulation != NULL );
 
 	// If the user did not request a custom viewport, try to compute a reasonable default.
@@ -442,8 +466,8 @@ void loadScene( const std::string& file_name )
 	g_sec_per_frame = 1.0 / steps_per_sec_cap;
 	// Integer number of timesteps to take
 	g_num_steps = ceil(max_time / g_dt);
-	// We begin at the 0th timestep
-	g_current_step = 0;
+	// We begin at the 0th timestep, or where the checkpoint was taken
+	g_current_step = g_executable_simulation->getCurrentStep();
 }
 
 void parseCommandLine( int argc, char** argv )
@@ -466,10 +490,31 @@ void parseCommandLine( int argc, char** argv )
 
 		// These cannot be set at the same time
 		// File to save output to
-		TCLAP::ValueArg<int> output("o", "outputfile", "Binary file to save simulation state to", false, 0, "integer", cmd);
+		TCLAP::ValueArg<std::string> output("o", "outputfile", "Save a frame every N steps; N[:obj|bin[,f32][,z]], obj files by default, or one binary frame cache (float32, compressed) per frame", false, "0", "string", cmd);
 		// File to load for comparisons
 		TCLAP::ValueArg<std::string> input("i", "inputfile", "Binary file to load simulation pos from", false, "", "string", cmd);
 
+		// Checkpoints of the complete state, to resume from with -r
+		TCLAP::ValueArg<int> checkpoint("c", "checkpoint", "Save a checkpoint every N steps (0 for none)", false, 0, "integer", cmd);
+		TCLAP::ValueArg<std::string> restart("r", "restart", "Checkpoint file to resume the simulation from", false, "", "string", cmd);
+
+		// Number of worker threads, overrides the scene file
+		TCLAP::ValueArg<int> threads("t", "threads", "Number of worker threads (0 for the scene file setting or all hardware threads)", false, 0, "integer", cmd);
+
+		// Output is written in the background, bounded in memory
+		TCLAP::ValueArg<int> writers("w", "writers", "Number of threads writing output files", false, g_num_writers, "integer", cmd);
+		TCLAP::ValueArg<int> outputmemory("m", "outputmemory", "Memory budget in MB for frames waiting to be written (0 for one frame at a time)", false, g_output_memory, "integer", cmd);
+
+		// Parameter studies: variants of the scene, run without interaction
+		TCLAP::ValueArg<std::string> batch("b", "batch", "Batch file of parameter variants of the scene to run, each into its own output directory", false, "", "string", cmd);
+		TCLAP::ValueArg<std::string> jobs("j", "jobs", "Run N variants of a batch at the same time; N[:T], with T threads each (the threads split evenly by default)", false, "1", "string", cmd);
+
+		// Finish at the duration of the scene instead of asking for more time
+		TCLAP::ValueArg<bool> quit("q", "quit", "Exit at the end of the scene without waiting for input if 1, ask for more time if 0", false, false, "boolean", cmd);
+
+		// Reproduce the same results regardless of the number of threads
+		TCLAP::ValueArg<bool> deterministic("D", "deterministic", "Run in deterministic mode (bit-identical multithreaded runs) if 1, not if 0", false, false, "boolean", cmd);
+
 		cmd.parse(argc, argv);
 
 		assert( scene.isSet() );
@@ -477,8 +522,21 @@ void parseCommandLine( int argc, char** argv )
 		g_paused = paused.getValue();
 		g_rendering_enabled = display.getValue();
 		g_dump_png = dumppng.getValue();
-		g_save_to_binary = output.getValue();
+		std::vector<std::string> output_spec = stringutils::split(output.getValue(), ':');
+		g_save_to_binary = output_spec.empty() ? 0 : std::max(0, atoi(output_spec[0].c_str()));
+		if (output_spec.size() > 1) g_binary_frames = FrameCache::parseFormat(output_spec[1], g_frame_options);
 		g_binary_file_name = input.getValue();
+		g_save_checkpoint = std::max(0, checkpoint.getValue());
+		g_restart_file_name = restart.getValue();
+		g_num_writers = std::max(1, writers.getValue());
+		g_output_memory = std::max(0, outputmemory.getValue());
+		g_batch_file_name = batch.getValue();
+		std::vector<std::string> jobs_spec = stringutils::split(jobs.getValue(), ':');
+		g_batch_jobs = jobs_spec.empty() ? 1 : std::max(1, atoi(jobs_spec[0].c_str()));
+		g_batch_threads = jobs_spec.size() > 1 ? std::max(0, atoi(jobs_spec[1].c_str())) : 0;
+		g_interactive = !quit.getValue() && g_batch_file_name.empty();
+		threadutils::set_deterministic(deterministic.getValue());
+		if (threads.getValue() > 0) threadutils::set_num_threads(threads.getValue());
 	}
 	catch (TCLAP::ArgException& e)
 	{
@@ -487,8 +545,33 @@ void parseCommandLine( int argc, char** argv )
 	}
 }
 
+void runBatch()
+{
+	BatchRunner::Options options;
+	options.jobs = g_batch_jobs;
+	options.threads_per_run = g_batch_threads > 0 ? g_batch_threads : std::max(1, (int) threadutils::get_num_threads() / g_batch_jobs);
+	options.save_every = g_save_to_binary;
+	options.binary_frames = g_binary_frames;
+	options.frame_options = g_frame_options;
+	options.save_checkpoint = g_save_checkpoint;
+	options.num_writers = g_num_writers;
+	options.output_memory = (size_t) g_output_memory << 20;
+
+	Eigen::setNbThreads(options.threads_per_run);
+
+	std::cout << outputmod::startblue << "Batch: " << outputmod::endblue << g_batch_file_name << ", " << options.jobs << " at a time, " << options.threads_per_run << " threads each" << std::endl;
+
+	BatchRunner runner(g_xml_scene_file, g_batch_file_name, g_short_file_name, options);
+	runner.run();
+}
+
 void cleanupAtExit()
 {
+	// finish the frames still being written
+	if ( g_executable_simulation ) g_executable_simulation->flushOutput();
+#ifdef RENDER_ENABLED
+	g_png_writer.flush();
+#endif
 }
 
 std::ostream& main_header( std::ostream& stream )
@@ -511,7 +594,14 @@ void miscOutputCallback()
 {
 
 	// If the user wants to save output to a binary
-	if ( g_save_to_binary && !(g_current_step % g_save_to_binary) && g_current_step <= g_num_steps )
+	if ( g_save_to_binary && g_binary_frames && !(g_current_step % g_save_to_binary) && g_current_step <= g_num_steps )
+	{
+		std::stringstream oss_frame;
+		oss_frame << g_short_file_name << "/cache" << std::setw(5) << std::setfill('0') << (g_current_step / g_save_to_binary) << ".wcf";
+
+		g_executable_simulation->serializeFrame(oss_frame.str(), g_frame_options);
+	}
+	else if ( g_save_to_binary && !(g_current_step % g_save_to_binary) && g_current_step <= g_num_steps )
 	{
 		std::stringstream oss_cloth;
 		oss_cloth << g_short_file_name << "/cloth" << std::setw(5) << std::setfill('0') << (g_current_step / g_save_to_binary) << ".obj";
@@ -534,6 +624,14 @@ void miscOutputCallback()
 		g_executable_simulation->serializeScene(oss_cloth.str(), oss_hairs.str(), oss_fluid.str(), oss_inbd.str(), oss_exbd.str(), oss_spring.str());
 	}
 
+	if ( g_save_checkpoint && !(g_current_step % g_save_checkpoint) && g_current_step <= g_num_steps )
+	{
+		std::stringstream oss_checkpoint;
+		oss_checkpoint << g_short_file_name << "/checkpoint" << std::setw(5) << std::setfill('0') << (g_current_step / g_save_checkpoint) << ".wcc";
+
+		g_executable_simulation->serializeCheckpoint(oss_checkpoint.str());
+	}
+
 	// Update the state of the renderers
 #ifdef RENDER_ENABLED
 	if ( g_rendering_enabled ) g_executable_simulation->updateOpenGLRendererState();
@@ -553,7 +651,6 @@ void miscOutputCallback()
 int main( int argc, char** argv )
 {
 	Eigen::initParallel();
-	Eigen::setNbThreads(std::thread::hardware_concurrency());
 
 	srand(0x0108170F);
 
@@ -580,9 +677,27 @@ int main( int argc, char** argv )
 	// Function to cleanup at progarm exit
 	atexit(cleanupAtExit);
 
+	// A batch loads the scene once per variant by itself
+	if ( !g_batch_file_name.empty() )
+	{
+		std::cout << main_header << std::endl;
+		std::cout << outputmod::startblue << "Scene: " << outputmod::endblue << g_xml_scene_file << std::endl;
+
+		runBatch();
+		return 0;
+	}
+
 	// Load the user-specified scene
 	loadScene(g_xml_scene_file);
 
+	// The thread count is known after the command line and the scene file
+	Eigen::setNbThreads(threadutils::get_num_threads());
+
+	g_executable_simulation->configureOutput(g_num_writers, (size_t) g_output_memory << 20);
+#ifdef RENDER_ENABLED
+	g_png_writer.configure(g_num_writers, (size_t) g_output_memory << 20);
+#endif
+
 	// If requested, open the input file for the scene to benchmark
 #ifdef RENDER_ENABLED
 	// Initialization for OpenGL and GLUT
@@ -20,6 +20,7 @@
 #include "pcgsolver/sparse_matrix.h"
 #include "pcgsolver/blas_wrapper.h"
 #include "GeometricLevelGen.h"
+#include "ThreadUtils.h"
 /*
 given A_L, R_L, P_L, b,compute x using
 Multigrid Cycles.
@@ -29,86 +30,74 @@ Multigrid Cycles.
 
 using namespace std;
 using namespace BLAS;
+
+/*
+relax row index of A against the off-diagonal values in x_in. Rows of
+the same color are relaxed concurrently; in the deterministic mode
+(threadutils::is_deterministic) x_in is a snapshot taken before the
+color sweep, so that rows of the same color coupled on the coarse
+(Galerkin) levels read the same values regardless of the schedule.
+*/
+template<class T>
+inline void RBGS_relax_row(const FixedSparseMatrix<T> &A,
+                           const vector<T> &b,
+                           const vector<T> &x_in,
+                           vector<T> &x,
+                           unsigned int index)
+{
+	T sum = 0;
+	T diag = 0;
+	for (unsigned int ii = A.rowstart[index]; ii < A.rowstart[index + 1]; ii++)
+	{
+		if (A.colindex[ii] != index) //none diagonal terms
+		{
+			sum += A.value[ii] * x_in[A.colindex[ii]];
+		}
+		else//record diagonal value A(i,i)
+		{
+			diag = A.value[ii];
+		}
+	}//A(i,:)*x for off-diag terms
+	if (diag != 0)
+	{
+		x[index] = (b[index] - sum) / diag;
+	}
+	else
+	{
+		x[index] = 0;
+	}
+}
+
 template<class T>
 void RBGS(const FixedSparseMatrix<T> &A,
           const vector<T> &b,
           vector<T> &x,
           int ni, int nj, int nk, int iternum)
 {
+	size_t num = ni * nj * nk;
+	size_t slice = ni * nj;
+	const bool snapshot = threadutils::is_deterministic();
+	vector<T> x_copy;
+	const vector<T>& x_in = snapshot ? x_copy : x;
 
 	for (int iter = 0; iter < iternum; iter++)
 	{
-		size_t num = ni * nj * nk;
-		size_t slice = ni * nj;
-		tbb::parallel_for((size_t)0, num, (size_t)1, [&](size_t thread_idx) {
-			int k = thread_idx / slice;
-			int j = (thread_idx % slice) / ni;
-			int i = thread_idx % ni;
-			if (k < nk && j < nj && i < ni)
-			{
-				if ((i + j + k) % 2 == 1)
-				{
-					unsigned int index = (unsigned int)thread_idx;
-					T sum = 0;
-					T diag = 0;
-					for (int ii = A.rowstart[index]; ii < A.rowstart[index + 1]; ii++)
-					{
-						if (A.colindex[ii] != index) //none diagonal terms
-						{
-							sum += A.value[ii] * x[A.colindex[ii]];
-						}
-						else//record diagonal value A(i,i)
-						{
-							diag = A.value[ii];
-						}
-					}//A(i,:)*x for off-diag terms
-					if (diag != 0)
-					{
-						x[index] = (b[index] - sum) / diag;
-					}
-					else
-					{
-						x[index] = 0;
-					}
-				}
-			}
-
-		});
-
-		tbb::parallel_for((size_t)0, num, (size_t)1, [&](size_t thread_idx) {
-			int k = thread_idx / slice;
-			int j = (thread_idx % slice) / ni;
-			int i = thread_idx % ni;
-			if (k < nk && j < nj && i < ni)
-			{
-				if ((i + j + k) % 2 == 0)
+		for (int color = 1; color >= 0; --color)
+		{
+			if (snapshot) x_copy = x;
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, num, BLAS::block_size), [&](const tbb::blocked_range<size_t>& range) {
+				for (size_t thread_idx = range.begin(); thread_idx != range.end(); ++thread_idx)
 				{
-					unsigned int index = (unsigned int)thread_idx;
-					T sum = 0;
-					T diag = 0;
-					for (int ii = A.rowstart[index]; ii < A.rowstart[index + 1]; ii++)
-					{
-						if (A.colindex[ii] != index) //none diagonal terms
-						{
-							sum += A.value[ii] * x[A.colindex[ii]];
-						}
-						else//record diagonal value A(i,i)
-						{
-							diag = A.value[ii];
-						}
-					}//A(i,:)*x for off-diag terms
-					if (diag != 0)
+					int k = thread_idx / slice;
+					int j = (thread_idx % slice) / ni;
+					int i = thread_idx % ni;
+					if ((i + j + k) % 2 == color)
 					{
-						x[index] = (b[index] - sum) / diag;
-					}
-					else
-					{
-						x[index] = 0;
+						RBGS_relax_row(A, b, x_in, x, (unsigned int)thread_idx);
 					}
 				}
-			}
-
-		});
+			});
+		}
 	}
 }
 
@@ -119,23 +108,34 @@ void restriction(const FixedSparseMatrix<T> &R,
                  const vector<T>            &b_curr,
                  vector<T>                  &b_next)
 {
-	b_next.assign(b_next.size(), 0);
-	vector<T> r = b_curr;
-	multiply_and_subtract(A, x, r);
+	// r = b - A*x, fused into a single pass
+	vector<T> r(A.n);
+	tbb::parallel_for(tbb::blocked_range<unsigned int>(0, A.n, BLAS::block_size), [&](const tbb::blocked_range<unsigned int>& range) {
+		for (unsigned int i = range.begin(); i != range.end(); ++i)
+		{
+			T sum = b_curr[i];
+			for (unsigned int j = A.rowstart[i]; j < A.rowstart[i + 1]; ++j)
+				sum -= A.value[j] * x[A.colindex[j]];
+			r[i] = sum;
+		}
+	});
 	multiply(R, r, b_next);
-	r.resize(0);
 }
 template<class T>
 void prolongatoin(const FixedSparseMatrix<T> &P,
                   const vector<T>            &x_curr,
                   vector<T>                  &x_next)
 {
-	static vector<T> xx;
-	xx.resize(x_next.size());
-	xx.assign(xx.size(), 0);
-	multiply(P, x_curr, xx); //xx = P*x_curr;
-	add_scaled(1.0, xx, x_next);
-	xx.resize(0);
+	// x_next += P*x_curr, row by row without a temporary
+	tbb::parallel_for(tbb::blocked_range<unsigned int>(0, P.n, BLAS::block_size), [&](const tbb::blocked_range<unsigned int>& range) {
+		for (unsigned int i = range.begin(); i != range.end(); ++i)
+		{
+			T sum = 0;
+			for (unsigned int j = P.rowstart[i]; j < P.rowstart[i + 1]; ++j)
+				sum += P.value[j] * x_curr[P.colindex[j]];
+			x_next[i] += sum;
+		}
+	});
 }
 
 
@@ -146,72 +146,27 @@ void RBGS_with_pattern(const FixedSparseMatrix<T> &A,
                        vector<bool> & pattern,
                        int iternum)
 {
+	size_t num = std::min(x.size(), std::min((size_t) A.n, pattern.size()));
+	const bool snapshot = threadutils::is_deterministic();
+	vector<T> x_copy;
+	const vector<T>& x_in = snapshot ? x_copy : x;
 
 	for (int iter = 0; iter < iternum; iter++)
 	{
-		size_t num = x.size();
-
-		tbb::parallel_for((size_t)0, num, (size_t)1, [&](size_t thread_idx) {
-			if (thread_idx >= A.rowstart.size() - 1 || thread_idx >= pattern.size()) return;
-			if (pattern[thread_idx] == true)
-			{
-				T sum = 0;
-				T diag = 0;
-				for (int ii = A.rowstart[thread_idx]; ii < A.rowstart[thread_idx + 1]; ii++)
-				{
-					if (ii >= A.colindex.size() || ii >= A.value.size()) continue;
-
-					if (A.colindex[ii] != thread_idx && A.colindex[ii] < num) //none diagonal terms
-					{
-						sum += A.value[ii] * x[A.colindex[ii]];
-					}
-					else//record diagonal value A(i,i)
-					{
-						diag = A.value[ii];
-					}
-				}//A(i,:)*x for off-diag terms
-				if (diag != 0)
-				{
-					x[thread_idx] = (b[thread_idx] - sum) / diag;
-				}
-				else
-				{
-					x[thread_idx] = 0;
-				}
-			}
-
-		});
-
-		tbb::parallel_for((size_t)0, num, (size_t)1, [&](size_t thread_idx) {
-			if (thread_idx >= A.rowstart.size() - 1 || thread_idx >= pattern.size()) return;
-			if (pattern[thread_idx] == false)
-			{
-				T sum = 0;
-				T diag = 0;
-				for (int ii = A.rowstart[thread_idx]; ii < A.rowstart[thread_idx + 1]; ii++)
+		for (int color = 1; color >= 0; --color)
+		{
+			if (snapshot) x_copy = x;
+			// vector<bool> is only read here, each thread writes its own rows of x
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, num, BLAS::block_size), [&](const tbb::blocked_range<size_t>& range) {
+				for (size_t thread_idx = range.begin(); thread_idx != range.end(); ++thread_idx)
 				{
-					if (ii >= A.colindex.size() || ii >= A.value.size()) continue;
-
-					if (A.colindex[ii] != thread_idx && A.colindex[ii] < num) //none diagonal terms
+					if (pattern[thread_idx] == (color == 1))
 					{
-						sum += A.value[ii] * x[A.colindex[ii]];
+						RBGS_relax_row(A, b, x_in, x, (unsigned int)thread_idx);
 					}
-					else//record diagonal value A(i,i)
-					{
-						diag = A.value[ii];
-					}
-				}//A(i,:)*x for off-diag terms
-				if (diag != 0)
-				{
-					x[thread_idx] = (b[thread_idx] - sum) / diag;
-				}
-				else
-				{
-					x[thread_idx] = 0;
 				}
-			}
-
-		});
+			});
+		}
 	}
 }
 
@@ -292,53 +247,80 @@ void amgPrecondCompressed(vector< std::shared_ptr< FixedSparseMatrix<T> > > &A_L
 	//printf("preconditioning finished\n");
 }
 
+/*
+AMG hierarchy of a linear system. The finest level A is assembled by the
+caller; keeping the object across solves lets AMGPCGSolveFixed reuse the
+coarsening (R_L, P_L, p_L) while the unknowns stay the same, and the
+symbolic Galerkin products while the sparsity pattern stays the same too.
+*/
 template<class T>
-bool AMGPCGSolveSparse(const SparseMatrix<T> &matrix,
-                       const std::vector<T> &rhs,
-                       std::vector<T> &result,
-                       vector<Vector3i> &Dof_ijk,
-                       T tolerance_factor,
-                       int max_iterations,
-                       T &residual_out,
-                       int &iterations_out,
-                       int ni, int nj, int nk)
+struct AMGLevels
 {
-	static std::shared_ptr< FixedSparseMatrix<T> > fixed_matrix = std::make_shared< FixedSparseMatrix<T> >();
-	fixed_matrix->construct_from_matrix(matrix);
-	static vector< std::shared_ptr< FixedSparseMatrix<T> > > A_L;
-	static vector<FixedSparseMatrix<T> > R_L;
-	static vector<FixedSparseMatrix<T> > P_L;
-	static vector<vector<bool> >          p_L;
-	vector<T>                      m, z, s, r;
+	AMGLevels()
+		: A(std::make_shared< FixedSparseMatrix<T> >()), total_level(0), ni(0), nj(0), nk(0)
+	{}
+
+	std::shared_ptr< FixedSparseMatrix<T> > A;
+	vector< std::shared_ptr< FixedSparseMatrix<T> > > A_L;
+	vector<FixedSparseMatrix<T> > R_L;
+	vector<FixedSparseMatrix<T> > P_L;
+	vector<FixedSparseMatrix<T> > AP_L;
+	vector<vector<bool> >          p_L;
 	int total_level;
-	levelGen<T> amg_levelGen;
-#ifdef AMG_VERBOSE
-	std::cout << "[AMG: generate levels]" << std::endl;
-#endif
-	amg_levelGen.generateLevelsGalerkinCoarseningSparse
-	(A_L, R_L, P_L, p_L, total_level, fixed_matrix, Dof_ijk, ni, nj, nk);
 
-	unsigned int n = matrix.n;
-	if (m.size() != n) { m.resize(n); s.resize(n); z.resize(n); r.resize(n); }
-	zero(result);
-	r = rhs;
-	residual_out = BLAS::abs_max(r);
-	if (residual_out == 0) {
-		iterations_out = 0;
+	// what the coarsening and the Galerkin patterns were built from
+	vector<Vector3i>               Dof_ijk;
+	int ni, nj, nk;
+	vector<unsigned int>           rowstart;
+	vector<unsigned int>           colindex;
 
+	// fixed-width rows the caller assembles A in, kept for the next solve
+	// (clear() leaves them, they are not part of the hierarchy)
+	vector<unsigned int>           slot_colindex;
+	vector<T>                      slot_value;
 
+	void clear()
+	{
 		for (int i = 0; i < total_level; i++)
 		{
 			A_L[i]->clear();
 		}
 		for (int i = 0; i < total_level - 1; i++)
 		{
-
 			R_L[i].clear();
 			P_L[i].clear();
-
 		}
+		AP_L.clear();
+		Dof_ijk.clear();
+		rowstart.clear();
+		colindex.clear();
+		total_level = 0;
+	}
+};
 
+template<class T>
+bool AMGPCGSolveLevels(AMGLevels<T> &levels,
+                       const std::vector<T> &rhs,
+                       std::vector<T> &result,
+                       T tolerance_factor,
+                       int max_iterations,
+                       T &residual_out,
+                       int &iterations_out)
+{
+	const FixedSparseMatrix<T> &fixed_matrix = *(levels.A);
+	vector< std::shared_ptr< FixedSparseMatrix<T> > > &A_L = levels.A_L;
+	vector<FixedSparseMatrix<T> > &R_L = levels.R_L;
+	vector<FixedSparseMatrix<T> > &P_L = levels.P_L;
+	vector<vector<bool> >          &p_L = levels.p_L;
+	vector<T>                      m, z, s, r;
+
+	unsigned int n = fixed_matrix.n;
+	if (m.size() != n) { m.resize(n); s.resize(n); z.resize(n); r.resize(n); }
+	zero(result);
+	r = rhs;
+	residual_out = BLAS::abs_max(r);
+	if (residual_out == 0) {
+		iterations_out = 0;
 		return true;
 	}
 	double tol = tolerance_factor * residual_out;
@@ -351,18 +333,6 @@ bool AMGPCGSolveSparse(const SparseMatrix<T> &matrix,
 #endif
 	double rho = BLAS::dot(z, r);
 	if (rho == 0 || rho != rho) {
-		for (int i = 0; i < total_level; i++)
-		{
-			A_L[i]->clear();
-
-		}
-		for (int i = 0; i < total_level - 1; i++)
-		{
-
-			R_L[i].clear();
-			P_L[i].clear();
-
-		}
 		iterations_out = 0;
 		return false;
 	}
@@ -373,7 +343,7 @@ bool AMGPCGSolveSparse(const SparseMatrix<T> &matrix,
 #endif
 	int iteration;
 	for (iteration = 0; iteration < max_iterations; ++iteration) {
-		multiply(*fixed_matrix, s, z);
+		multiply(fixed_matrix, s, z);
 		//printf("multiply done\n");
 		double alpha = rho / BLAS::dot(s, z);
 		//printf("%d,%d,%d,%d\n",s.size(),z.size(),r.size(),result.size());
@@ -383,20 +353,6 @@ bool AMGPCGSolveSparse(const SparseMatrix<T> &matrix,
 
 		if (residual_out <= tol) {
 			iterations_out = iteration + 1;
-
-			for (int i = 0; i < total_level; i++)
-			{
-				A_L[i]->clear();
-
-			}
-			for (int i = 0; i < total_level - 1; i++)
-			{
-
-				R_L[i].clear();
-				P_L[i].clear();
-
-			}
-
 			return true;
 		}
 #ifdef AMG_VERBOSE
@@ -412,19 +368,82 @@ bool AMGPCGSolveSparse(const SparseMatrix<T> &matrix,
 		rho = rho_new;
 	}
 	iterations_out = iteration;
-	for (int i = 0; i < total_level; i++)
-	{
-		A_L[i]->clear();
+	return false;
+}
 
-	}
-	for (int i = 0; i < total_level - 1; i++)
-	{
+template<class T>
+bool AMGPCGSolveSparse(const SparseMatrix<T> &matrix,
+                       const std::vector<T> &rhs,
+                       std::vector<T> &result,
+                       vector<Vector3i> &Dof_ijk,
+                       T tolerance_factor,
+                       int max_iterations,
+                       T &residual_out,
+                       int &iterations_out,
+                       int ni, int nj, int nk)
+{
+	// the hierarchy is rebuilt by every solve; it is not static, so that the
+	// simulations of a batch run can solve at the same time
+	AMGLevels<T> levels;
+	levels.A->construct_from_matrix(matrix);
+	levelGen<T> amg_levelGen;
+#ifdef AMG_VERBOSE
+	std::cout << "[AMG: generate levels]" << std::endl;
+#endif
+	amg_levelGen.generateLevelsGalerkinCoarseningSparse
+	(levels.A_L, levels.R_L, levels.P_L, levels.p_L, levels.total_level, levels.A, Dof_ijk, ni, nj, nk);
 
-		R_L[i].clear();
-		P_L[i].clear();
+	return AMGPCGSolveLevels(levels, rhs, result, tolerance_factor, max_iterations, residual_out, iterations_out);
+}
 
+/*
+same as AMGPCGSolveSparse, for a system already assembled into levels.A. The
+hierarchy is kept in levels for the next solve.
+*/
+template<class T>
+bool AMGPCGSolveFixed(AMGLevels<T> &levels,
+                      const std::vector<T> &rhs,
+                      std::vector<T> &result,
+                      vector<Vector3i> &Dof_ijk,
+                      T tolerance_factor,
+                      int max_iterations,
+                      T &residual_out,
+                      int &iterations_out,
+                      int ni, int nj, int nk)
+{
+	levelGen<T> amg_levelGen;
+	const FixedSparseMatrix<T> &A = *(levels.A);
+
+	const bool same_dofs = levels.total_level > 0 &&
+	                       levels.ni == ni && levels.nj == nj && levels.nk == nk &&
+	                       levels.Dof_ijk == Dof_ijk;
+
+	if (same_dofs) {
+		const bool same_pattern = (int) levels.AP_L.size() == levels.total_level - 1 &&
+		                          levels.rowstart == A.rowstart &&
+		                          levels.colindex == A.colindex;
+#ifdef AMG_VERBOSE
+		std::cout << "[AMG: refresh levels, same pattern: " << same_pattern << "]" << std::endl;
+#endif
+		amg_levelGen.refreshLevelsGalerkinSparse
+		(levels.A_L, levels.R_L, levels.P_L, levels.AP_L, levels.total_level, levels.A, same_pattern);
+	} else {
+#ifdef AMG_VERBOSE
+		std::cout << "[AMG: generate levels]" << std::endl;
+#endif
+		amg_levelGen.generateLevelsGalerkinCoarseningSparse
+		(levels.A_L, levels.R_L, levels.P_L, levels.p_L, levels.total_level, levels.A, Dof_ijk, ni, nj, nk);
+		levels.AP_L.clear();
+		levels.Dof_ijk = Dof_ijk;
+		levels.ni = ni;
+		levels.nj = nj;
+		levels.nk = nk;
 	}
-	return false;
+
+	levels.rowstart = A.rowstart;
+	levels.colindex = A.colindex;
+
+	return AMGPCGSolveLevels(levels, rhs, result, tolerance_factor, max_iterations, residual_out, iterations_out);
 }
 
 #endif
@@ -10,6 +10,7 @@
 
 #include "AttachForce.h"
 #include "TwoDScene.h"
+#include "Checkpoint.h"
 
 AttachForce::AttachForce( const int pidx, const std::shared_ptr<TwoDScene>& scene, const scalar& k, const scalar& k_twist, const scalar& b, const scalar& b_twist )
 	: Force()
@@ -27,7 +28,7 @@ AttachForce::AttachForce( const int pidx, const std::shared_ptr<TwoDScene>& scen
 AttachForce::~AttachForce()
 {}
 
-void AttachForce::addEnergyToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, scalar& E )
+void AttachForce::addEnergyToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, scalar& E )
 {
 	assert( x.size() == v.size() );
 	assert( x.size() % 4 == 0 );
@@ -47,7 +48,7 @@ int AttachForce::getParticleIndex() const
 	return m_pidx;
 }
 
-void AttachForce::addGradEToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, VectorXs& gradE )
+void AttachForce::addGradEToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, VectorXs& gradE )
 {
 	const Vector4s& endpoint = m_scene->getRestPos().segment<4>(m_pidx * 4);
 	// Compute the elastic component
@@ -64,21 +65,21 @@ void AttachForce::addGradEToTotal( const VectorXs& x, const VectorXs& v, const V
 	}
 }
 
-void AttachForce::addHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
+void AttachForce::addHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
 {
 	hessE[hessE_index + 0] = Triplets(4 * m_pidx + 0, 4 * m_pidx + 0, (m_k + m_b));
 	hessE[hessE_index + 1] = Triplets(4 * m_pidx + 1, 4 * m_pidx + 1, (m_k + m_b));
 	hessE[hessE_index + 2] = Triplets(4 * m_pidx + 2, 4 * m_pidx + 2, (m_k + m_b));
 }
 
-void AttachForce::addAngularHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
+void AttachForce::addAngularHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
 {
 
 
 	hessE[hessE_index] = Triplets(m_pidx, m_pidx, (m_k_twist + m_b_twist));
 }
 
-void AttachForce::updateMultipliers( const VectorXs& x, const VectorXs& vplus, const VectorXs& m, const VectorXs& psi, const scalar& lambda, const scalar& dt )
+void AttachForce::updateMultipliers( const ConstVectorXsRef& x, const ConstVectorXsRef& vplus, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, const scalar& dt )
 {}
 
 scalar AttachForce::getKs() const
@@ -119,3 +120,19 @@ int AttachForce::flag() const
 {
 	return 1;
 }
+
+void AttachForce::saveState( CheckpointWriter& out, const std::string& prefix ) const
+{
+	out.addValue(prefix + "k", m_k);
+	out.addValue(prefix + "k_twist", m_k_twist);
+	out.addValue(prefix + "b", m_b);
+	out.addValue(prefix + "b_twist", m_b_twist);
+}
+
+bool AttachForce::loadState( const CheckpointReader& in, const std::string& prefix )
+{
+	return in.readValue(prefix + "k", m_k) &&
+		in.readValue(prefix + "k_twist", m_k_twist) &&
+		in.readValue(prefix + "b", m_b) &&
+		in.readValue(prefix + "b_twist", m_b_twist);
+}
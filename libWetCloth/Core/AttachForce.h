@@ -25,15 +25,15 @@ public:
 
 	virtual ~AttachForce();
 
-	virtual void addEnergyToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, scalar& E );
+	virtual void addEnergyToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, scalar& E );
 
-	virtual void addGradEToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, VectorXs& gradE );
+	virtual void addGradEToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, VectorXs& gradE );
 
-	virtual void addHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt );
+	virtual void addHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt );
 
-	virtual void addAngularHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt );
+	virtual void addAngularHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt );
 
-	virtual void updateMultipliers( const VectorXs& x, const VectorXs& vplus, const VectorXs& m, const VectorXs& psi, const scalar& lambda, const scalar& dt );
+	virtual void updateMultipliers( const ConstVectorXsRef& x, const ConstVectorXsRef& vplus, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, const scalar& dt );
 
 	virtual void preCompute();
 
@@ -47,6 +47,11 @@ public:
 
 	virtual int flag() const;
 
+	// the stiffness is set from the rest configuration the scene was built with
+	virtual void saveState( CheckpointWriter& out, const std::string& prefix ) const;
+
+	virtual bool loadState( const CheckpointReader& in, const std::string& prefix );
+
 	int getParticleIndex() const;
 
 	scalar getKs() const;
@@ -0,0 +1,295 @@
+//
+// This file is part of the libWetCloth open source project
+//
+// Copyright 2018 Yun (Raymond) Fei, Christopher Batty, Eitan Grinspun, and Changxi Zheng
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "Checkpoint.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const char Checkpoint::magic[8] = { 'W', 'C', 'C', 'H', 'K', 'P', 'T', '\0' };
+const uint32_t Checkpoint::version;
+const uint64_t Checkpoint::alignment;
+
+namespace {
+inline uint64_t align_up( uint64_t offset )
+{
+	return (offset + Checkpoint::alignment - 1) / Checkpoint::alignment * Checkpoint::alignment;
+}
+}
+
+CheckpointWriter::CheckpointWriter()
+	: m_num_blocks(0)
+	, m_name_too_long(false)
+{}
+
+void CheckpointWriter::clear()
+{
+	m_num_blocks = 0;
+	m_name_too_long = false;
+}
+
+CheckpointWriter::Block& CheckpointWriter::nextBlock( const std::string& name, uint64_t count, uint32_t elem_size, uint32_t cols )
+{
+	if (name.size() >= sizeof(Checkpoint::Entry::name)) {
+		// a truncated name could match another block, the write is refused
+		std::cerr << "[checkpoint: block name " << name << " is too long]" << std::endl;
+		m_name_too_long = true;
+	}
+
+	if (m_num_blocks == (int) m_blocks.size()) m_blocks.emplace_back();
+
+	Block& b = m_blocks[m_num_blocks++];
+	b.name = name;
+	b.count = count;
+	b.elem_size = elem_size;
+	b.cols = cols;
+	b.data.resize(count * elem_size);
+
+	return b;
+}
+
+void CheckpointWriter::addBytes( const std::string& name, const void* data, uint64_t count, uint32_t elem_size, uint32_t cols )
+{
+	Block& b = nextBlock(name, count, elem_size, cols);
+	if (count) std::memcpy(b.data.data(), data, count * elem_size);
+}
+
+size_t CheckpointWriter::bytes() const
+{
+	size_t total = sizeof(Checkpoint::Header);
+	for (int i = 0; i < m_num_blocks; ++i) total += sizeof(Checkpoint::Entry) + m_blocks[i].data.capacity();
+	return total;
+}
+
+bool CheckpointWriter::write( const std::string& filename ) const
+{
+	if (m_name_too_long) {
+		std::cerr << "[checkpoint: not writing " << filename << ", a block name is too long]" << std::endl;
+		return false;
+	}
+
+	std::vector<Checkpoint::Entry> entries(m_num_blocks);
+
+	uint64_t offset = align_up(sizeof(Checkpoint::Header) + sizeof(Checkpoint::Entry) * m_num_blocks);
+	for (int i = 0; i < m_num_blocks; ++i) {
+		const Block& b = m_blocks[i];
+		Checkpoint::Entry& e = entries[i];
+
+		std::memset(&e, 0, sizeof(e));
+		std::strncpy(e.name, b.name.c_str(), sizeof(e.name) - 1);
+		e.offset = offset;
+		e.count = b.count;
+		e.elem_size = b.elem_size;
+		e.cols = b.cols;
+
+		offset = align_up(offset + b.data.size());
+	}
+
+	Checkpoint::Header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, Checkpoint::magic, sizeof(header.magic));
+	header.version = Checkpoint::version;
+	header.num_blocks = (uint32_t) m_num_blocks;
+	header.file_size = offset;
+
+	const std::string tmpname = filename + ".tmp";
+	std::ofstream ofs(tmpname.c_str(), std::ios::binary);
+	if (!ofs) {
+		std::cerr << "[checkpoint: cannot open " << tmpname << "]" << std::endl;
+		return false;
+	}
+
+	const char zeros[Checkpoint::alignment] = {};
+
+	ofs.write((const char*) &header, sizeof(header));
+	ofs.write((const char*) entries.data(), sizeof(Checkpoint::Entry) * m_num_blocks);
+
+	uint64_t pos = sizeof(header) + sizeof(Checkpoint::Entry) * m_num_blocks;
+	for (int i = 0; i < m_num_blocks; ++i) {
+		ofs.write(zeros, entries[i].offset - pos);
+		ofs.write((const char*) m_blocks[i].data.data(), m_blocks[i].data.size());
+		pos = entries[i].offset + m_blocks[i].data.size();
+	}
+	ofs.write(zeros, header.file_size - pos);
+
+	ofs.close();
+	if (!ofs) {
+		std::cerr << "[checkpoint: failed writing " << tmpname << "]" << std::endl;
+		std::remove(tmpname.c_str());
+		return false;
+	}
+
+	if (std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+		std::cerr << "[checkpoint: cannot rename " << tmpname << " to " << filename << "]" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+CheckpointReader::CheckpointReader()
+	: m_file(NULL)
+	, m_size(0)
+{}
+
+CheckpointReader::~CheckpointReader()
+{
+	close();
+}
+
+#ifndef WIN32
+bool CheckpointReader::map( const std::string& filename )
+{
+	const int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		::close(fd);
+		return false;
+	}
+
+	void* addr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (addr == MAP_FAILED) return false;
+
+	// start reading ahead while the scene file is parsed
+	madvise(addr, (size_t) st.st_size, MADV_WILLNEED);
+
+	m_file = (const unsigned char*) addr;
+	m_size = (uint64_t) st.st_size;
+	return true;
+}
+
+void CheckpointReader::unmap()
+{
+	if (m_file && m_buffer.empty()) munmap((void*) m_file, (size_t) m_size);
+}
+#else
+bool CheckpointReader::map( const std::string& filename )
+{
+	std::ifstream ifs(filename.c_str(), std::ios::binary | std::ios::ate);
+	if (!ifs) return false;
+
+	const std::streamoff size = ifs.tellg();
+	if (size <= 0) return false;
+
+	m_buffer.resize((size_t) size);
+	ifs.seekg(0);
+	if (!ifs.read((char*) m_buffer.data(), size)) {
+		m_buffer.clear();
+		return false;
+	}
+
+	m_file = m_buffer.data();
+	m_size = (uint64_t) size;
+	return true;
+}
+
+void CheckpointReader::unmap()
+{
+}
+#endif
+
+bool CheckpointReader::open( const std::string& filename )
+{
+	close();
+
+	if (!map(filename)) {
+		std::cerr << "[checkpoint: cannot open " << filename << "]" << std::endl;
+		return false;
+	}
+
+	Checkpoint::Header header;
+	if (m_size < sizeof(header)) {
+		std::cerr << "[checkpoint: " << filename << " is not a checkpoint]" << std::endl;
+		close();
+		return false;
+	}
+
+	std::memcpy(&header, m_file, sizeof(header));
+	if (std::memcmp(header.magic, Checkpoint::magic, sizeof(header.magic)) != 0) {
+		std::cerr << "[checkpoint: " << filename << " is not a checkpoint]" << std::endl;
+		close();
+		return false;
+	}
+
+	if (header.version != Checkpoint::version) {
+		std::cerr << "[checkpoint: " << filename << " has version " << header.version << ", expected " << Checkpoint::version << "]" << std::endl;
+		close();
+		return false;
+	}
+
+	if (header.file_size != m_size) {
+		std::cerr << "[checkpoint: " << filename << " is truncated]" << std::endl;
+		close();
+		return false;
+	}
+
+	if (sizeof(header) + sizeof(Checkpoint::Entry) * (uint64_t) header.num_blocks > m_size) {
+		std::cerr << "[checkpoint: " << filename << " has a corrupt directory]" << std::endl;
+		close();
+		return false;
+	}
+
+	m_entries.resize(header.num_blocks);
+	if (header.num_blocks) std::memcpy(m_entries.data(), m_file + sizeof(header), sizeof(Checkpoint::Entry) * header.num_blocks);
+
+	for (Checkpoint::Entry& e : m_entries) {
+		e.name[sizeof(e.name) - 1] = '\0';
+		if (e.offset > m_size || (e.elem_size && e.count > (m_size - e.offset) / e.elem_size)) {
+			std::cerr << "[checkpoint: block " << e.name << " of " << filename << " is out of bounds]" << std::endl;
+			close();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void CheckpointReader::close()
+{
+	unmap();
+
+	m_file = NULL;
+	m_size = 0;
+	m_buffer.clear();
+	m_entries.clear();
+}
+
+const Checkpoint::Entry* CheckpointReader::find( const std::string& name ) const
+{
+	for (const Checkpoint::Entry& e : m_entries) {
+		if (name == e.name) return &e;
+	}
+
+	return NULL;
+}
+
+const unsigned char* CheckpointReader::data( const Checkpoint::Entry& entry ) const
+{
+	return m_file + entry.offset;
+}
+
+bool CheckpointReader::readBytes( const std::string& name, void* data, uint64_t count, uint32_t elem_size ) const
+{
+	const Checkpoint::Entry* e = find(name);
+	if (!e || e->elem_size != elem_size || e->count != count) return false;
+
+	if (count) std::memcpy(data, this->data(*e), count * elem_size);
+	return true;
+}
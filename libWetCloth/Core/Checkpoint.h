@@ -0,0 +1,253 @@
+//
+// This file is part of the libWetCloth open source project
+//
+// Copyright 2018 Yun (Raymond) Fei, Christopher Batty, Eitan Grinspun, and Changxi Zheng
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <Eigen/Core>
+
+/*!
+ * Binary checkpoint of the full simulation state, made of named blocks such
+ * as "particles/x" or "gauss/Fe". A block is count elements of elem_size
+ * bytes each, copied verbatim from memory (host byte order); matrices also
+ * record their number of columns. Lists of variable length (the faces of a
+ * particle, ...) are stored as two blocks, name + "/offsets" (count + 1
+ * entries) and name + "/values".
+ *
+ * File layout, for memory mapping:
+ *   Header, at 0
+ *   Entry[num_blocks], at sizeof(Header)
+ *   block payloads, each at an offset that is a multiple of alignment
+ *
+ * Files are written under a temporary name and renamed when complete, so
+ * an interrupted write never replaces a good checkpoint. Readers map the
+ * file instead of reading it: pages are faulted in from the page cache as
+ * the blocks are copied out, and only the blocks that are used are read.
+ */
+class Checkpoint
+{
+public:
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t num_blocks;
+		uint64_t file_size;
+		uint64_t reserved;
+	};
+
+	struct Entry
+	{
+		char name[48];
+		uint64_t offset;
+		uint64_t count;
+		uint32_t elem_size;
+		uint32_t cols;
+	};
+
+	static const char magic[8];
+	static const uint32_t version = 1;
+	static const uint64_t alignment = 64;
+};
+
+class CheckpointWriter
+{
+public:
+	CheckpointWriter();
+
+	// drops the blocks but keeps their buffers for the next checkpoint
+	void clear();
+
+	void addBytes( const std::string& name, const void* data, uint64_t count, uint32_t elem_size, uint32_t cols = 1 );
+
+	template<typename T>
+	void addValue( const std::string& name, const T& value )
+	{
+		addBytes(name, &value, 1, sizeof(T));
+	}
+
+	template<typename S, int R, int C, int O, int MR, int MC>
+	void add( const std::string& name, const Eigen::Matrix<S, R, C, O, MR, MC>& m )
+	{
+		addBytes(name, m.data(), m.size(), sizeof(S), (uint32_t) m.cols());
+	}
+
+	template<typename T, typename A>
+	void add( const std::string& name, const std::vector<T, A>& v )
+	{
+		addBytes(name, v.data(), v.size(), sizeof(T));
+	}
+
+	template<typename A>
+	void add( const std::string& name, const std::vector<bool, A>& v )
+	{
+		std::vector<unsigned char> bytes(v.begin(), v.end());
+		addBytes(name, bytes.data(), bytes.size(), sizeof(bool));
+	}
+
+	template<typename T, typename A0, typename A1>
+	void add( const std::string& name, const std::vector< std::vector<T, A0>, A1 >& lists )
+	{
+		addLists(name, lists, sizeof(T), [] (const std::vector<T, A0>& l) { return (const void*) l.data(); });
+	}
+
+	template<typename S, typename A>
+	void add( const std::string& name, const std::vector< Eigen::Matrix<S, Eigen::Dynamic, 1>, A >& lists )
+	{
+		addLists(name, lists, sizeof(S), [] (const Eigen::Matrix<S, Eigen::Dynamic, 1>& l) { return (const void*) l.data(); });
+	}
+
+	// bytes held by the blocks, for the output memory budget
+	size_t bytes() const;
+
+	// fails if a block name did not fit Checkpoint::Entry::name
+	bool write( const std::string& filename ) const;
+
+private:
+	struct Block
+	{
+		std::string name;
+		uint64_t count;
+		uint32_t elem_size;
+		uint32_t cols;
+		std::vector<unsigned char> data;
+	};
+
+	template<typename L, typename F>
+	void addLists( const std::string& name, const L& lists, uint32_t elem_size, F data_of )
+	{
+		const uint64_t n = lists.size();
+		std::vector<uint64_t> offsets(n + 1, 0);
+		for (uint64_t i = 0; i < n; ++i) offsets[i + 1] = offsets[i] + (uint64_t) lists[i].size();
+
+		addBytes(name + "/offsets", offsets.data(), n + 1, sizeof(uint64_t));
+
+		Block& values = nextBlock(name + "/values", offsets[n], elem_size, 1);
+		for (uint64_t i = 0; i < n; ++i) {
+			if (lists[i].size()) std::memcpy(values.data.data() + offsets[i] * elem_size, data_of(lists[i]), lists[i].size() * elem_size);
+		}
+	}
+
+	Block& nextBlock( const std::string& name, uint64_t count, uint32_t elem_size, uint32_t cols );
+
+	std::vector<Block> m_blocks;
+	int m_num_blocks;
+	bool m_name_too_long;
+};
+
+class CheckpointReader
+{
+public:
+	CheckpointReader();
+	~CheckpointReader();
+
+	CheckpointReader( const CheckpointReader& ) = delete;
+	CheckpointReader& operator=( const CheckpointReader& ) = delete;
+
+	bool open( const std::string& filename );
+
+	void close();
+
+	// null if the checkpoint has no such block
+	const Checkpoint::Entry* find( const std::string& name ) const;
+
+	const unsigned char* data( const Checkpoint::Entry& entry ) const;
+
+	// copies count elements of elem_size bytes; false if missing or the sizes differ
+	bool readBytes( const std::string& name, void* data, uint64_t count, uint32_t elem_size ) const;
+
+	template<typename T>
+	bool readValue( const std::string& name, T& value ) const
+	{
+		return readBytes(name, &value, 1, sizeof(T));
+	}
+
+	template<typename S, int R, int C, int O, int MR, int MC>
+	bool read( const std::string& name, Eigen::Matrix<S, R, C, O, MR, MC>& m ) const
+	{
+		const Checkpoint::Entry* e = find(name);
+		if (!e || e->elem_size != sizeof(S) || e->cols == 0) return false;
+
+		m.resize(e->count / e->cols, e->cols);
+		return readBytes(name, m.data(), m.size(), sizeof(S));
+	}
+
+	template<typename T, typename A>
+	bool read( const std::string& name, std::vector<T, A>& v ) const
+	{
+		const Checkpoint::Entry* e = find(name);
+		if (!e || e->elem_size != sizeof(T)) return false;
+
+		v.resize(e->count);
+		return readBytes(name, v.data(), v.size(), sizeof(T));
+	}
+
+	template<typename A>
+	bool read( const std::string& name, std::vector<bool, A>& v ) const
+	{
+		std::vector<unsigned char> bytes;
+		if (!read(name, bytes)) return false;
+
+		v.assign(bytes.begin(), bytes.end());
+		return true;
+	}
+
+	template<typename T, typename A0, typename A1>
+	bool read( const std::string& name, std::vector< std::vector<T, A0>, A1 >& lists ) const
+	{
+		return readLists(name, lists, sizeof(T), [] (std::vector<T, A0>& l, uint64_t n) { l.resize(n); return (void*) l.data(); });
+	}
+
+	template<typename S, typename A>
+	bool read( const std::string& name, std::vector< Eigen::Matrix<S, Eigen::Dynamic, 1>, A >& lists ) const
+	{
+		return readLists(name, lists, sizeof(S), [] (Eigen::Matrix<S, Eigen::Dynamic, 1>& l, uint64_t n) { l.resize(n); return (void*) l.data(); });
+	}
+
+private:
+	template<typename L, typename F>
+	bool readLists( const std::string& name, L& lists, uint32_t elem_size, F resize_list ) const
+	{
+		std::vector<uint64_t> offsets;
+		if (!read(name + "/offsets", offsets) || offsets.empty() || offsets[0] != 0) return false;
+
+		const Checkpoint::Entry* values = find(name + "/values");
+		if (!values || values->elem_size != elem_size || values->count != offsets.back()) return false;
+
+		// non-decreasing and ending at values->count, so every list is in the block
+		for (size_t i = 1; i < offsets.size(); ++i) {
+			if (offsets[i] < offsets[i - 1]) return false;
+		}
+
+		const uint64_t n = offsets.size() - 1;
+		const unsigned char* src = data(*values);
+		lists.resize(n);
+		for (uint64_t i = 0; i < n; ++i) {
+			const uint64_t len = offsets[i + 1] - offsets[i];
+			void* dst = resize_list(lists[i], len);
+			if (len) std::memcpy(dst, src + offsets[i] * elem_size, len * elem_size);
+		}
+
+		return true;
+	}
+
+	bool map( const std::string& filename );
+	void unmap();
+
+	const unsigned char* m_file;
+	uint64_t m_size;
+	std::vector<unsigned char> m_buffer; // the file itself where it cannot be mapped
+	std::vector<Checkpoint::Entry> m_entries;
+};
+
+#endif
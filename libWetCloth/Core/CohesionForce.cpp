@@ -19,16 +19,16 @@ CohesionForce::CohesionForce( const std::shared_ptr<TwoDScene>& scene_ptr )
 CohesionForce::~CohesionForce()
 {}
 
-void CohesionForce::addEnergyToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, scalar& E )
+void CohesionForce::addEnergyToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, scalar& E )
 {
 }
 
-void CohesionForce::updateMultipliers( const VectorXs& x, const VectorXs& vplus, const VectorXs& m, const VectorXs& psi, const scalar& lambda, const scalar& dt )
+void CohesionForce::updateMultipliers( const ConstVectorXsRef& x, const ConstVectorXsRef& vplus, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, const scalar& dt )
 {
 
 }
 
-void CohesionForce::addGradEToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, VectorXs& gradE )
+void CohesionForce::addGradEToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, VectorXs& gradE )
 {
     const std::vector< std::vector<RayTriInfo> >& intersections = m_scene->getIntersections();
 
@@ -107,7 +107,7 @@ bool CohesionForce::parallelized() const
     return true;
 }
 
-void CohesionForce::addHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
+void CohesionForce::addHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
 {
     const std::vector< std::vector<RayTriInfo> >& intersections = m_scene->getIntersections();
 
@@ -25,13 +25,13 @@ public:
 
 	virtual ~CohesionForce();
 
-	virtual void addEnergyToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, scalar& E );
+	virtual void addEnergyToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, scalar& E );
 
-	virtual void addGradEToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, VectorXs& gradE );
+	virtual void addGradEToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, VectorXs& gradE );
 
-	virtual void addHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt );
+	virtual void addHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt );
 
-	virtual void updateMultipliers( const VectorXs& x, const VectorXs& vplus, const VectorXs& m, const VectorXs& psi, const scalar& lambda, const scalar& dt );
+	virtual void updateMultipliers( const ConstVectorXsRef& x, const ConstVectorXsRef& vplus, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, const scalar& dt );
 
 	virtual void preCompute();
 
@@ -16,6 +16,7 @@
 #include "Forces/ViscousOrNotViscous.h"
 #include "Dependencies/BendingProducts.h"
 #include "../ThreadUtils.h"
+#include "../Checkpoint.h"
 
 // To match with rest of FilmFlow framework sign convention
 //  (we compute Forces and Force Jacobians, FilmFlow expects Energy gradients and Hessians)
@@ -126,8 +127,8 @@ StartState::StartState( const VecX& initDoFs ):
 
 void StrandForce::updateStartState()
 {
-    const VectorXs& x = m_scene->getX();
-    const VectorXs& psi = m_scene->getVolumeFraction();
+    ConstVectorXsRef x = m_scene->getX();
+    ConstVectorXsRef psi = m_scene->getVolumeFraction();
 
     VecX currentStrandDoFs( getNumVertices() * 4 );
     currentStrandDoFs.setZero();
@@ -328,13 +329,112 @@ int StrandForce::numConstraintViscous()
 
 const char* StrandForce::name() { return "Strand Material Forces"; }
 
-void StrandForce::addEnergyToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, scalar& E )
+namespace {
+// the history of a state: its DoFs, and the reference frames and twists
+// with their previous tangents, together with whether they are up to date
+template<typename State>
+void saveHistory( CheckpointWriter& out, const std::string& key, State& state )
+{
+    const unsigned char dirty[2] = { state.m_referenceFrames1.isDirty(), state.m_referenceTwists.isDirty() };
+
+    out.add(key + "dofs", state.m_dofs.get());
+    out.add(key + "frames", state.m_referenceFrames1.getDirty());
+    out.add(key + "prev_tangents", state.m_referenceFrames1.getPreviousTangents());
+    out.add(key + "ref_twists", state.m_referenceTwists.getDirty());
+    out.addBytes(key + "dirty", dirty, 2, 1);
+}
+
+// a state holds 4 * nv - 1 DoFs when built, and 4 * nv (with a zero
+// trailing twist) once set from the scene in updateStartState
+template<typename State>
+bool loadHistory( const CheckpointReader& in, const std::string& key, State& state, int num_verts )
+{
+    VecX dofs;
+    Vec3Array frames;
+    Vec3Array prev_tangents;
+    std::vector<scalar> ref_twists;
+    unsigned char dirty[2];
+
+    if (!in.read(key + "dofs", dofs) || (dofs.size() != num_verts * 4 && dofs.size() != num_verts * 4 - 1) ||
+            !in.read(key + "frames", frames) || !in.read(key + "prev_tangents", prev_tangents) ||
+            !in.read(key + "ref_twists", ref_twists) || !in.readBytes(key + "dirty", dirty, 2, 1)) return false;
+
+    state.m_dofs.set(dofs);
+
+    // this recomputes the tangents and fresh frames, which are replaced right after
+    state.m_referenceFrames1.setPreviousTangents(prev_tangents);
+    state.m_referenceFrames1.cleanSet(frames);
+    state.m_referenceTwists.cleanSet(ref_twists);
+
+    if (dirty[0]) state.m_referenceFrames1.setDirty();
+    else state.m_referenceFrames1.setClean();
+
+    if (dirty[1]) state.m_referenceTwists.setDirty();
+    else state.m_referenceTwists.setClean();
+
+    return true;
+}
+}
+
+void StrandForce::saveState( CheckpointWriter& out, const std::string& prefix ) const
+{
+    out.add(prefix + "rest_lengths", m_restLengths);
+    out.add(prefix + "rest_kappas", m_restKappas);
+    out.add(prefix + "rest_twists", m_restTwists);
+
+    saveHistory(out, prefix + "start/", *m_startState);
+    saveHistory(out, prefix + "future/", *m_strandState);
+
+    // the geometric stiffness of the next solve uses the multipliers of the last step
+    out.add(prefix + "multipliers/stretch", m_stretching_multipliers);
+    out.add(prefix + "multipliers/bend", m_bending_multipliers);
+    out.add(prefix + "multipliers/twist", m_twisting_multipliers);
+    out.add(prefix + "multipliers/viscous_stretch", m_viscous_stretching_multipliers);
+    out.add(prefix + "multipliers/viscous_bend", m_viscous_bending_multipliers);
+    out.add(prefix + "multipliers/viscous_twist", m_viscous_twisting_multipliers);
+}
+
+bool StrandForce::loadState( const CheckpointReader& in, const std::string& prefix )
+{
+    // the rest shape as well, in case the strand was built in another pose
+    std::vector<scalar> rest_lengths;
+    Vec2Array rest_kappas;
+    std::vector<scalar> rest_twists;
+
+    if (!in.read(prefix + "rest_lengths", rest_lengths) || rest_lengths.size() != m_restLengths.size() ||
+            !in.read(prefix + "rest_kappas", rest_kappas) || rest_kappas.size() != m_restKappas.size() ||
+            !in.read(prefix + "rest_twists", rest_twists) || rest_twists.size() != m_restTwists.size()) return false;
+
+    m_restLengths.swap(rest_lengths);
+    m_restKappas.swap(rest_kappas);
+    m_restTwists.swap(rest_twists);
+    updateEverythingThatDependsOnRestLengths();
+
+    if (!loadHistory(in, prefix + "start/", *m_startState, getNumVertices()) ||
+            !loadHistory(in, prefix + "future/", *m_strandState, getNumVertices())) return false;
+
+    auto load_multipliers = [&] (const std::string& key, VectorXs& multipliers) -> bool {
+        VectorXs values;
+        if (!in.read(prefix + key, values) || values.size() != multipliers.size()) return false;
+        multipliers.swap(values);
+        return true;
+    };
+
+    return load_multipliers("multipliers/stretch", m_stretching_multipliers) &&
+           load_multipliers("multipliers/bend", m_bending_multipliers) &&
+           load_multipliers("multipliers/twist", m_twisting_multipliers) &&
+           load_multipliers("multipliers/viscous_stretch", m_viscous_stretching_multipliers) &&
+           load_multipliers("multipliers/viscous_bend", m_viscous_bending_multipliers) &&
+           load_multipliers("multipliers/viscous_twist", m_viscous_twisting_multipliers);
+}
+
+void StrandForce::addEnergyToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, scalar& E )
 {
     // TODO
     E += m_strandEnergyUpdate;
 }
 
-void StrandForce::addGradEToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, VectorXs& gradE )
+void StrandForce::addGradEToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, VectorXs& gradE )
 {
     const int num_verts = m_verts.size();
 
@@ -346,7 +446,7 @@ void StrandForce::addGradEToTotal( const VectorXs& x, const VectorXs& v, const V
     });
 }
 
-void StrandForce::addHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
+void StrandForce::addHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
 {
     const int num_hess = numHessX();
 
@@ -360,7 +460,7 @@ void StrandForce::addHessXToTotal( const VectorXs& x, const VectorXs& v, const V
     });
 }
 
-void StrandForce::addAngularHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
+void StrandForce::addAngularHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
 {
     const int num_hess = numAngularHessX();
 
@@ -372,7 +472,7 @@ void StrandForce::addAngularHessXToTotal( const VectorXs& x, const VectorXs& v,
     });
 }
 
-void StrandForce::updateMultipliers( const VectorXs& x, const VectorXs& vplus, const VectorXs& m, const VectorXs& psi, const scalar& lambda, const scalar& dt )
+void StrandForce::updateMultipliers( const ConstVectorXsRef& x, const ConstVectorXsRef& vplus, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, const scalar& dt )
 {
     const int num_verts = getNumVertices();
     for (int i = 0; i < num_verts; ++i)
@@ -0,0 +1,235 @@
+//
+// This file is part of the libWetCloth open source project
+//
+// Copyright 2018 Yun (Raymond) Fei, Christopher Batty, Eitan Grinspun, and Changxi Zheng
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "DistanceFieldQuery.h"
+
+#include <algorithm>
+
+namespace {
+// squared distance between two boxes, zero if they overlap
+inline scalar box_dist2( const Vector3s& low_a, const Vector3s& high_a, const Vector3s& low_b, const Vector3s& high_b )
+{
+	scalar d2 = 0.0;
+	for (int r = 0; r < 3; ++r) {
+		const scalar d = std::max(scalar(0.0), std::max(low_a(r) - high_b(r), low_b(r) - high_a(r)));
+		d2 += d * d;
+	}
+	return d2;
+}
+
+const int max_depth = 64;
+};
+
+bool DistanceFieldQuery::cullingBox( const std::shared_ptr< DistanceField >& dfptr, Vector3s& low, Vector3s& high ) const
+{
+	auto op = std::dynamic_pointer_cast<DistanceFieldOperator>(dfptr);
+	if (!op) {
+		// objects with sign < 0 (inverted) are negative outside of their box
+		return !dfptr->local_bounding_box(low, high);
+	}
+
+	// phi of a union or an intersection is bounded below by the distance to
+	// the union of the children boxes (the intersection box is not a bound)
+	low = Vector3s::Constant(1e+20);
+	high = Vector3s::Constant(-1e+20);
+
+	for (auto& child : op->children)
+	{
+		Vector3s l, h;
+		if (!cullingBox(child, l, h)) return false;
+
+		low = low.cwiseMin(l);
+		high = high.cwiseMax(h);
+	}
+
+	return true;
+}
+
+int DistanceFieldQuery::buildNode( Tree& tree, int begin, int end )
+{
+	const int node_idx = (int) tree.nodes.size();
+	tree.nodes.push_back(Node());
+
+	Vector3s low = Vector3s::Constant(1e+20);
+	Vector3s high = Vector3s::Constant(-1e+20);
+	for (int i = begin; i < end; ++i) {
+		low = low.cwiseMin(m_low[tree.items[i]]);
+		high = high.cwiseMax(m_high[tree.items[i]]);
+	}
+
+	int left = -1;
+	int right = -1;
+
+	if (end - begin > 2) {
+		// median split along the longest axis of the box centers
+		int axis;
+		(high - low).maxCoeff(&axis);
+
+		const int mid = (begin + end) / 2;
+		std::nth_element(tree.items.begin() + begin, tree.items.begin() + mid, tree.items.begin() + end, [&] (int a, int b) {
+			return m_low[a](axis) + m_high[a](axis) < m_low[b](axis) + m_high[b](axis);
+		});
+
+		left = buildNode(tree, begin, mid);
+		right = buildNode(tree, mid, end);
+	}
+
+	Node& node = tree.nodes[node_idx];
+	node.low = low;
+	node.high = high;
+	node.left = left;
+	node.right = right;
+	node.begin = begin;
+	node.end = end;
+
+	return node_idx;
+}
+
+void DistanceFieldQuery::build( const std::vector< std::shared_ptr< DistanceField > >& fields )
+{
+	m_fields = fields;
+
+	const int num_fields = (int) fields.size();
+	m_low.resize(num_fields);
+	m_high.resize(num_fields);
+	m_cullable.resize(num_fields);
+
+	for (int i = 0; i < num_fields; ++i) {
+		m_cullable[i] = cullingBox(fields[i], m_low[i], m_high[i]);
+	}
+
+	for (int u = 0; u < DFU_COUNT; ++u)
+	{
+		Tree& tree = m_trees[u];
+		tree.nodes.resize(0);
+		tree.items.resize(0);
+		tree.always.resize(0);
+
+		for (int i = 0; i < num_fields; ++i) {
+			if (fields[i]->usage != (DISTANCE_FIELD_USAGE) u) continue;
+
+			if (m_cullable[i]) tree.items.push_back(i);
+			else tree.always.push_back(i);
+		}
+
+		if (!tree.items.empty()) buildNode(tree, 0, (int) tree.items.size());
+	}
+}
+
+template<typename Callable>
+void DistanceFieldQuery::traverse( const Tree& tree, const Vector3s& low, const Vector3s& high, const scalar& cutoff, Callable func ) const
+{
+	for (int i : tree.always) func(i);
+
+	if (tree.nodes.empty()) return;
+
+	const scalar cutoff2 = cutoff * cutoff;
+
+	int stack[max_depth];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const Node& node = tree.nodes[stack[--top]];
+		if (box_dist2(node.low, node.high, low, high) > cutoff2) continue;
+
+		if (node.left < 0 || top + 2 > max_depth) {
+			for (int k = node.begin; k < node.end; ++k) {
+				const int i = tree.items[k];
+				if (box_dist2(m_low[i], m_high[i], low, high) <= cutoff2) func(i);
+			}
+		} else {
+			stack[top++] = node.right;
+			stack[top++] = node.left;
+		}
+	}
+}
+
+void DistanceFieldQuery::gather( DISTANCE_FIELD_USAGE usage, const Vector3s& low, const Vector3s& high, const scalar& cutoff, std::vector<int>& candidates ) const
+{
+	candidates.resize(0);
+	traverse(m_trees[usage], low, high, cutoff, [&] (int i) {
+		candidates.push_back(i);
+	});
+
+	std::sort(candidates.begin(), candidates.end());
+}
+
+scalar DistanceFieldQuery::computePhiVel( DISTANCE_FIELD_USAGE usage, const Vector3s& pos, Vector3s& vel, const scalar& cutoff ) const
+{
+	scalar min_phi = cutoff;
+	int min_idx = -1;
+	Vector3s min_vel = Vector3s::Zero();
+
+	traverse(m_trees[usage], pos, pos, cutoff, [&] (int i) {
+		Vector3s v;
+		const scalar phi = m_fields[i]->compute_phi_vel(pos, v);
+		if (phi < min_phi || (phi == min_phi && i < min_idx)) {
+			min_phi = phi;
+			min_idx = i;
+			min_vel = v;
+		}
+	});
+
+	vel = min_vel;
+
+	return min_phi;
+}
+
+scalar DistanceFieldQuery::computePhi( DISTANCE_FIELD_USAGE usage, const Vector3s& pos, const scalar& cutoff ) const
+{
+	scalar min_phi = cutoff;
+
+	traverse(m_trees[usage], pos, pos, cutoff, [&] (int i) {
+		min_phi = std::min(min_phi, m_fields[i]->compute_phi(pos));
+	});
+
+	return min_phi;
+}
+
+scalar DistanceFieldQuery::computePhiVel( const std::vector<int>& candidates, const Vector3s& pos, Vector3s& vel, const scalar& cutoff ) const
+{
+	scalar min_phi = cutoff;
+	Vector3s min_vel = Vector3s::Zero();
+
+	const scalar cutoff2 = cutoff * cutoff;
+
+	for (int i : candidates)
+	{
+		if (m_cullable[i] && box_dist2(m_low[i], m_high[i], pos, pos) > cutoff2) continue;
+
+		Vector3s v;
+		const scalar phi = m_fields[i]->compute_phi_vel(pos, v);
+		if (phi < min_phi) {
+			min_phi = phi;
+			min_vel = v;
+		}
+	}
+
+	vel = min_vel;
+
+	return min_phi;
+}
+
+scalar DistanceFieldQuery::computePhi( const std::vector<int>& candidates, const Vector3s& pos, const scalar& cutoff ) const
+{
+	scalar min_phi = cutoff;
+
+	const scalar cutoff2 = cutoff * cutoff;
+
+	for (int i : candidates)
+	{
+		if (m_cullable[i] && box_dist2(m_low[i], m_high[i], pos, pos) > cutoff2) continue;
+
+		min_phi = std::min(min_phi, m_fields[i]->compute_phi(pos));
+	}
+
+	return min_phi;
+}
@@ -0,0 +1,83 @@
+//
+// This file is part of the libWetCloth open source project
+//
+// Copyright 2018 Yun (Raymond) Fei, Christopher Batty, Eitan Grinspun, and Changxi Zheng
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef DISTANCE_FIELD_QUERY_H
+#define DISTANCE_FIELD_QUERY_H
+
+#include <memory>
+#include <vector>
+
+#include "MathDefs.h"
+#include "DistanceFields.h"
+
+/*!
+ * Spatial index over the group distance fields, one BVH per usage.
+ *
+ * Queries return the minimum of phi over the fields of a usage, clamped to
+ * a cutoff, the same way TwoDScene::computePhiVel did by looping over all
+ * fields: a field whose bounding box is farther than the cutoff from the
+ * query can not lower the minimum and is skipped. Fields that are negative
+ * outside their box (inverted objects) are always evaluated. Ties go to the
+ * field that comes first in the group order.
+ *
+ * The index stores boxes, so it has to be rebuilt after the fields move.
+ */
+class DistanceFieldQuery
+{
+public:
+	void build( const std::vector< std::shared_ptr< DistanceField > >& fields );
+
+	// indices of the fields of usage that may be closer than cutoff to [low, high], in group order
+	void gather( DISTANCE_FIELD_USAGE usage, const Vector3s& low, const Vector3s& high, const scalar& cutoff, std::vector<int>& candidates ) const;
+
+	scalar computePhiVel( DISTANCE_FIELD_USAGE usage, const Vector3s& pos, Vector3s& vel, const scalar& cutoff ) const;
+
+	scalar computePhi( DISTANCE_FIELD_USAGE usage, const Vector3s& pos, const scalar& cutoff ) const;
+
+	// evaluate a batch of points against candidates from gather
+	scalar computePhiVel( const std::vector<int>& candidates, const Vector3s& pos, Vector3s& vel, const scalar& cutoff ) const;
+
+	scalar computePhi( const std::vector<int>& candidates, const Vector3s& pos, const scalar& cutoff ) const;
+
+private:
+	struct Node
+	{
+		Node() : low(Vector3s::Zero()), high(Vector3s::Zero()), left(-1), right(-1), begin(0), end(0) {}
+
+		Vector3s low;
+		Vector3s high;
+		int left; // leaf if left < 0, then [begin, end) of the items
+		int right;
+		int begin;
+		int end;
+	};
+
+	struct Tree
+	{
+		std::vector<Node> nodes;
+		std::vector<int> items; // field indices, leaves refer to ranges of it
+		std::vector<int> always; // fields that can not be culled
+	};
+
+	int buildNode( Tree& tree, int begin, int end );
+
+	template<typename Callable>
+	void traverse( const Tree& tree, const Vector3s& low, const Vector3s& high, const scalar& cutoff, Callable func ) const;
+
+	bool cullingBox( const std::shared_ptr< DistanceField >& dfptr, Vector3s& low, Vector3s& high ) const;
+
+	std::vector< std::shared_ptr< DistanceField > > m_fields;
+	std::vector<Vector3s> m_low;
+	std::vector<Vector3s> m_high;
+	std::vector<unsigned char> m_cullable;
+
+	Tree m_trees[DFU_COUNT];
+};
+
+#endif
@@ -22,11 +22,31 @@
 #include "RoundCylinder.h"
 #include "RoundCornerBox.h"
 #include "makelevelset3.h"
+#include "ThreadUtils.h"
+#include "Checkpoint.h"
 
+#include <map>
+#include <mutex>
 #include <numeric>
+#include <sstream>
 
 using namespace mathutils;
 
+namespace {
+// meshes of DFT_FILE objects, centered, with their level sets. They never
+// change once built, so every simulation of the process (the variants of a
+// batch run load the same scene) shares them instead of rebuilding them.
+struct FileMesh
+{
+	std::shared_ptr<SolidMesh> mesh;
+	Vector3s centre;
+	std::shared_ptr<const SparseLevelSet3> volume;
+};
+
+std::mutex file_mesh_mutex;
+std::map<std::string, FileMesh> file_meshes;
+}
+
 inline scalar sphere_phi(const Vector3s& position, const Vector3s& centre, scalar radius) {
 	return ((position - centre).norm() - radius);
 }
@@ -148,6 +168,9 @@ void DistanceField::resample_internal( const std::shared_ptr< TwoDScene >& paren
 		phi_init(ix, iy, iz) = compute_phi_vel(cp, vel);
 	});
 
+	const uint64_t step = parent->getStepCount();
+	const uint64_t key = stream_key(step, mathutils::RS_RESAMPLE);
+
 	// first pass of selection for new + existing particles
 	threadutils::for_each(0, num_total, [&] (int pidx) {
 		Vector3s cp;
@@ -157,7 +180,7 @@ void DistanceField::resample_internal( const std::shared_ptr< TwoDScene >& paren
 			int iy = (pidx - iz * nxyz(0) * nxyz(1)) / nxyz(0);
 			int ix = pidx - iz * nxyz(0) * nxyz(1) - iy * nxyz(0);
 
-			cp = bbx_low + (Vector3s(ix, iy, iz) + Vector3s::Constant(0.5)) * dx + Vector3s(mathutils::scalarRand(-dx, dx), mathutils::scalarRand(-dx, dx), mathutils::scalarRand(-dx, dx));
+			cp = bbx_low + (Vector3s(ix, iy, iz) + Vector3s::Constant(0.5)) * dx + Vector3s(mathutils::streamRand(key, pidx * 3 + 0, -dx, dx), mathutils::streamRand(key, pidx * 3 + 1, -dx, dx), mathutils::streamRand(key, pidx * 3 + 2, -dx, dx));
 		} else {
 			int qidx = pidx - num_init;
 
@@ -171,9 +194,7 @@ void DistanceField::resample_internal( const std::shared_ptr< TwoDScene >& paren
 		if (dist > dx * sqrt(3.0))
 			return;
 
-		if (parent->computePhiVel(cp, vel, [] (const std::shared_ptr<DistanceField>& dfptr) -> bool {
-		return dfptr->usage == DFU_SOLID;
-	}) < 0.0) return;
+		if (parent->computePhiVel(cp, vel, DFU_SOLID) < 0.0) return;
 
 		Vector3s grad;
 
@@ -216,21 +237,23 @@ void DistanceField::resample_internal( const std::shared_ptr< TwoDScene >& paren
 	for (int i = 0; i < num_parts; ++i) available[i] = 1;
 
 	// sort all used particles in buffer
-	Sorter sorter( nxyz(0), nxyz(1), nxyz(2) );
+	if (resample_sorter.ni != nxyz(0) || resample_sorter.nj != nxyz(1) || resample_sorter.nk != nxyz(2)) {
+		resample_sorter.resize( nxyz(0), nxyz(1), nxyz(2) );
+	}
 
-	sorter.sort(num_parts, [&] (int pidx, int& i, int& j, int& k) {
+	resample_sorter.sort(num_parts, [&] (int pidx, int& i, int& j, int& k) {
 		i = (int) floor((pos_selected(pidx * 3 + 0) - bbx_low(0)) / dx);
 		j = (int) floor((pos_selected(pidx * 3 + 1) - bbx_low(1)) / dx);
 		k = (int) floor((pos_selected(pidx * 3 + 2) - bbx_low(2)) / dx);
 	});
 
 	// for each new particles, do second pass of selection by dart-picking
-	sorter.for_each_bucket_particles_colored_randomized([&] (int pidx, int bucket_idx) {
+	resample_sorter.for_each_bucket_particles_colored_randomized([&] (int pidx, int bucket_idx) {
 		// we ignore existing particles
 		if (pidx >= num_parts_new || !available[pidx]) return;
 
 		const Vector3s& pos = pos_selected.segment<3>(pidx * 3);
-		sorter.loop_neighbor_bucket_particles(bucket_idx, [&] (int npidx, int np_bucket_idx) -> bool {
+		resample_sorter.loop_neighbor_bucket_particles(bucket_idx, [&] (int npidx, int np_bucket_idx) -> bool {
 			if (pidx == npidx || !available[npidx]) return false;
 
 			const Vector3s& npos = pos_selected.segment<3>(npidx * 3);
@@ -243,7 +266,7 @@ void DistanceField::resample_internal( const std::shared_ptr< TwoDScene >& paren
 
 			return false;
 		});
-	}, 3);
+	}, 3, stream_key(step, mathutils::RS_DART_ORDER));
 
 	// only map new particles
 	mapping.resize( num_parts_new );
@@ -281,6 +304,9 @@ void DistanceField::sample(const scalar& dx, VectorXs& result, VectorXs& normals
 	std::vector<int> available( num_init, 0 );
 	VectorXs pos_init( num_init * 3 );
 
+	// sampled once at the start, before any step
+	const uint64_t key = stream_key(0, mathutils::RS_SAMPLE);
+
 	const int num_nodes = (nxyz(0) + 1) * (nxyz(1) + 1) * (nxyz(2) + 1);
 
 	Array3s phi_init( nxyz(0) + 1, nxyz(1) + 1, nxyz(2) + 1 );
@@ -301,7 +327,7 @@ void DistanceField::sample(const scalar& dx, VectorXs& result, VectorXs& normals
 		int iy = (pidx - iz * nxyz(0) * nxyz(1)) / nxyz(0);
 		int ix = pidx - iz * nxyz(0) * nxyz(1) - iy * nxyz(0);
 
-		Vector3s cp = bbx_low + Vector3s(ix, iy, iz) * dx + Vector3s(mathutils::scalarRand(0.0, dx), mathutils::scalarRand(0.0, dx), mathutils::scalarRand(0.0, dx));
+		Vector3s cp = bbx_low + Vector3s(ix, iy, iz) * dx + Vector3s(mathutils::streamRand(key, pidx * 3 + 0, 0.0, dx), mathutils::streamRand(key, pidx * 3 + 1, 0.0, dx), mathutils::streamRand(key, pidx * 3 + 2, 0.0, dx));
 
 		Vector3s vel;
 
@@ -370,7 +396,7 @@ void DistanceField::sample(const scalar& dx, VectorXs& result, VectorXs& normals
 
 			return false;
 		});
-	}, 3);
+	}, 3, stream_key(0, mathutils::RS_DART_ORDER));
 
 	mapping.resize( num_parts );
 	std::partial_sum(available.begin(), available.end(), mapping.begin());
@@ -422,6 +448,9 @@ DistanceFieldObject::DistanceFieldObject(const Vector3s& center_, const VectorXs
 	V.setZero();
 	omega.setZero();
 
+	irot = rot.normalized().conjugate().toRotationMatrix();
+	volume_dx = 0.0;
+
 	switch (type_) {
 	case DFT_BOX:
 		mesh = std::make_shared<RoundCornerBox>(32, Vector3s(parameter(0), parameter(1), parameter(2)), parameter(3));
@@ -436,8 +465,7 @@ DistanceFieldObject::DistanceFieldObject(const Vector3s& center_, const VectorXs
 		mesh = std::make_shared<RoundCylinder>(32, 8, parameter(0), parameter(1), parameter(2));
 		break;
 	case DFT_FILE:
-		mesh = std::make_shared<SolidMesh>(szfn, parameter(0));
-		process_file_mesh(szfn_cache);
+		process_file_mesh(szfn, szfn_cache);
 		break;
 	default:
 		mesh = nullptr;
@@ -489,17 +517,19 @@ void DistanceFieldObject::resample_mesh(const scalar& dx, VectorXs& result, Vect
 
 	Eigen::AngleAxis<scalar> rotaa(rot);
 
+	const uint64_t key = stream_key(0, mathutils::RS_SAMPLE_MESH);
+
 	for (int i = 0; i < num_samples; ++i)
 	{
-		const scalar seed0 = mathutils::scalarRand(0.0, 1.0);
+		const scalar seed0 = mathutils::streamRand(key, i * 3 + 0, 0.0, 1.0);
 		std::vector<scalar>::iterator low = std::lower_bound(PDF.begin(), PDF.end(), seed0);
 		const int tri_idx = (int) (low - PDF.begin());
 
 		if (tri_idx < 0 || tri_idx >= num_tris)
 			continue;
 
-		const scalar s1 = mathutils::scalarRand(0.0, 1.0);
-		const scalar s2 = mathutils::scalarRand(0.0, 1.0);
+		const scalar s1 = mathutils::streamRand(key, i * 3 + 1, 0.0, 1.0);
+		const scalar s2 = mathutils::streamRand(key, i * 3 + 2, 0.0, 1.0);
 
 		const Vector3s& x0 = verts[indices[tri_idx](0)];
 		const Vector3s& x1 = verts[indices[tri_idx](1)];
@@ -531,86 +561,139 @@ void DistanceFieldObject::apply_translation(const Vector3s& t)
 	future_center += t;
 }
 
+scalar DistanceFieldObject::compute_local_phi(const Vector3s& local) const
+{
+	switch (type) {
+	case DFT_BOX:
+		return box_phi(local, Vector3s::Zero(), Vector3s(parameter(0), parameter(1), parameter(2)), parameter(3));
+	case DFT_SPHERE:
+		return sphere_phi(local, Vector3s::Zero(), parameter(0));
+	case DFT_CAPSULE:
+		return capsule_phi(local, Vector3s::Zero(), parameter(0), parameter(1));
+	case DFT_CYLINDER:
+		return cylinder_phi(local, Vector3s::Zero(), parameter(0), parameter(1), parameter(2));
+	default:
+		return 0.0;
+	}
+}
+
 scalar DistanceFieldObject::compute_phi(const Vector3s& pos) const
 {
-	scalar phi = 0.0;
+	if (type == DFT_SPHERE) return sign * sphere_phi(pos, center, parameter(0));
 
-	Vector3s dx = pos - center;
+	const Vector3s local = irot * (pos - center);
 
-	switch (type) {
-	case DFT_BOX:
-	{
-		Eigen::Quaternion<scalar> p0(0.0, dx(0), dx(1), dx(2));
-		Eigen::Quaternion<scalar> irot = rot.conjugate();
-		Vector3s rotp = (irot * p0 * irot.inverse()).vec() + center;
-		phi = sign * box_phi(rotp, center, Vector3s(parameter(0), parameter(1), parameter(2)), parameter(3));
-		break;
+	if (type == DFT_FILE) {
+		return sign * mesh_volume->interpolate(Vector3s((local - volume_origin) / volume_dx));
 	}
 
-	case DFT_SPHERE:
-	{
-		phi = sign * sphere_phi(pos, center, parameter(0));
-		break;
+	if (volume_dx > 0.0) {
+		const Vector3s coord = (local - volume_origin) / volume_dx;
+		if (coord(0) >= 0.0 && coord(1) >= 0.0 && coord(2) >= 0.0 &&
+		        coord(0) <= (scalar) (volume.ni - 1) && coord(1) <= (scalar) (volume.nj - 1) && coord(2) <= (scalar) (volume.nk - 1)) {
+			return sign * interpolate_value(coord, volume);
+		}
 	}
 
+	return sign * compute_local_phi(local);
+}
+
+void DistanceField::build_cache(const scalar&)
+{
+}
+
+void DistanceFieldObject::build_cache(const scalar& dx)
+{
+	// spheres are cheaper to evaluate than to interpolate, files are sampled already
+	if (type != DFT_BOX && type != DFT_CAPSULE && type != DFT_CYLINDER) return;
+
+	Vector3s bbx_low, bbx_high;
+	const Eigen::Quaternion<scalar> identity = Eigen::Quaternion<scalar>::Identity();
+
+	switch (type) {
 	case DFT_CAPSULE:
-	{
-		Eigen::Quaternion<scalar> p0(0.0, dx(0), dx(1), dx(2));
-		Eigen::Quaternion<scalar> irot = rot.conjugate();
-		Vector3s rotp = (irot * p0 * irot.inverse()).vec() + center;
-		phi = sign * capsule_phi(rotp, center, parameter(0), parameter(1));
+		capsule_phi_bbx(Vector3s::Zero(), identity, parameter(0), parameter(1), bbx_low, bbx_high);
 		break;
-	}
-
 	case DFT_CYLINDER:
-	{
-		Eigen::Quaternion<scalar> p0(0.0, dx(0), dx(1), dx(2));
-		Eigen::Quaternion<scalar> irot = rot.conjugate();
-		Vector3s rotp = (irot * p0 * irot.inverse()).vec() + center;
-		phi = sign * cylinder_phi(rotp, center, parameter(0), parameter(1), parameter(2));
+		cylinder_phi_bbx(Vector3s::Zero(), identity, parameter(0), parameter(1), parameter(2), bbx_low, bbx_high);
 		break;
-	}
-
-	case DFT_FILE:
-	{
-		Eigen::Quaternion<scalar> p0(0.0, dx(0), dx(1), dx(2));
-		Eigen::Quaternion<scalar> irot = rot.conjugate();
-		Vector3s rotp_coord = ((irot * p0 * irot.inverse()).vec() - volume_origin) / parameter(1);
-		phi = sign * interpolate_value(rotp_coord, volume);
-		break;
-	}
 	default:
+		box_phi_bbx(Vector3s::Zero(), identity, Vector3s(parameter(0), parameter(1), parameter(2)), parameter(3), bbx_low, bbx_high);
 		break;
 	}
 
-	return phi;
+	// a band of a few cells around the shape, farther away the analytic phi is used
+	bbx_low -= Vector3s::Constant(dx * 3.0);
+	bbx_high += Vector3s::Constant(dx * 3.0);
+
+	const Vector3s extend = (bbx_high - bbx_low) / dx;
+	const int nx = (int) ceil(extend(0)) + 1;
+	const int ny = (int) ceil(extend(1)) + 1;
+	const int nz = (int) ceil(extend(2)) + 1;
+
+	// large shapes stay analytic rather than taking a huge grid
+	const long max_cells = 1L << 22;
+	if ((long) nx * (long) ny * (long) nz > max_cells) return;
+
+	volume.resize(nx, ny, nz);
+	volume_origin = bbx_low;
+
+	threadutils::for_each(0, nz, [&] (int k) {
+		for (int j = 0; j < ny; ++j) for (int i = 0; i < nx; ++i) {
+				volume(i, j, k) = compute_local_phi(bbx_low + Vector3s(i, j, k) * dx);
+			}
+	});
+
+	volume_dx = dx;
 }
 
-void DistanceFieldObject::process_file_mesh(const std::string& szfn_cache)
+void DistanceFieldObject::process_file_mesh(const std::string& szfn, const std::string& szfn_cache)
 {
-	// pre-process mesh
-	Vector3s centre = mesh->getCenter();
-	mesh->translate(-centre);
+	const scalar dx = parameter(1);
+
+	std::ostringstream oss;
+	oss.precision(17);
+	oss << szfn << "|" << parameter(0) << "|" << dx;
 
-	center += centre;
+	// loaded once per process, the other objects wait for it
+	std::lock_guard<std::mutex> lock(file_mesh_mutex);
+	FileMesh& shared = file_meshes[oss.str()];
+
+	if (!shared.mesh) {
+		// pre-process mesh
+		auto file_mesh = std::make_shared<SolidMesh>(szfn, parameter(0));
+		shared.centre = file_mesh->getCenter();
+		file_mesh->translate(-shared.centre);
+		shared.mesh = file_mesh;
+	}
+
+	mesh = shared.mesh;
+	center += shared.centre;
 
 	Vector3s bbx_min, bbx_max;
 	mesh->boundingBox(bbx_min, bbx_max);
 
-	const scalar dx = parameter(1);
 	bbx_min -= Vector3s::Constant(dx * 3.0);
 	bbx_max += Vector3s::Constant(dx * 3.0);
 
 	volume_origin = bbx_min;
+	volume_dx = dx;
+
+	if (shared.volume) {
+		mesh_volume = shared.volume;
+		return;
+	}
+
+	auto file_volume = std::make_shared<SparseLevelSet3>();
 
 	// check if cache exist
 	if (!szfn_cache.empty()) {
 		std::ifstream ifs(szfn_cache, std::ios::binary);
 
-		if (ifs.good()) {
-			// read from file directly
-			read_binary_array(ifs, volume);
+		// read from file directly, caches in the older dense format are rebuilt
+		if (ifs.good() && file_volume->read(ifs)) {
 			ifs.close();
+			shared.volume = mesh_volume = file_volume;
 			return;
 		}
 	}
@@ -621,13 +704,15 @@ void DistanceFieldObject::process_file_mesh(const std::string& szfn_cache)
 	int ny = (int) ceil(extend(1));
 	int nz = (int) ceil(extend(2));
 
-	make_level_set3(mesh->getIndices(), mesh->getVertices(), volume_origin, dx, nx, ny, nz, volume);
+	make_level_set3(mesh->getIndices(), mesh->getVertices(), volume_origin, dx, nx, ny, nz, *file_volume);
 
 	if (!szfn_cache.empty()) {
 		std::ofstream ofs(szfn_cache, std::ios::binary);
-		write_binary_array(ofs, volume);
+		file_volume->write(ofs);
 		ofs.close();
 	}
+
+	shared.volume = mesh_volume = file_volume;
 }
 
 scalar DistanceFieldObject::compute_phi_vel(const Vector3s& pos, Vector3s& vel) const
@@ -641,6 +726,44 @@ scalar DistanceFieldObject::compute_phi_vel(const Vector3s& pos, Vector3s& vel)
 	return phi;
 }
 
+void DistanceField::save_state(CheckpointWriter& /*out*/, const std::string& /*prefix*/) const
+{
+}
+
+bool DistanceField::load_state(const CheckpointReader& /*in*/, const std::string& /*prefix*/)
+{
+	return true;
+}
+
+void DistanceFieldObject::save_state(CheckpointWriter& out, const std::string& prefix) const
+{
+	out.add(prefix + "center", center);
+	out.add(prefix + "rot", rot.coeffs());
+	out.add(prefix + "future_center", future_center);
+	out.add(prefix + "future_rot", future_rot.coeffs());
+	out.add(prefix + "V", V);
+	out.add(prefix + "omega", omega);
+}
+
+bool DistanceFieldObject::load_state(const CheckpointReader& in, const std::string& prefix)
+{
+	Vector4s rot_coeffs;
+	Vector4s future_rot_coeffs;
+
+	if (!in.read(prefix + "center", center) ||
+	        !in.read(prefix + "rot", rot_coeffs) ||
+	        !in.read(prefix + "future_center", future_center) ||
+	        !in.read(prefix + "future_rot", future_rot_coeffs) ||
+	        !in.read(prefix + "V", V) ||
+	        !in.read(prefix + "omega", omega)) return false;
+
+	rot.coeffs() = rot_coeffs;
+	future_rot.coeffs() = future_rot_coeffs;
+	irot = rot.normalized().conjugate().toRotationMatrix();
+
+	return true;
+}
+
 void DistanceFieldObject::advance(const scalar& dt)
 {
 	V = (future_center - center) / dt;
@@ -655,6 +778,7 @@ void DistanceFieldObject::advance(const scalar& dt)
 
 	center = future_center;
 	rot = future_rot;
+	irot = rot.normalized().conjugate().toRotationMatrix();
 }
 
 bool DistanceFieldObject::local_bounding_box(Vector3s& bbx_low, Vector3s& bbx_high) const
@@ -755,6 +879,24 @@ void DistanceFieldOperator::advance(const scalar& dt)
 	});
 }
 
+void DistanceFieldOperator::save_state(CheckpointWriter& out, const std::string& prefix) const
+{
+	int nb = children.size();
+	for (int i = 0; i < nb; ++i) {
+		children[i]->save_state(out, prefix + std::to_string(i) + "/");
+	}
+}
+
+bool DistanceFieldOperator::load_state(const CheckpointReader& in, const std::string& prefix)
+{
+	int nb = children.size();
+	for (int i = 0; i < nb; ++i) {
+		if (!children[i]->load_state(in, prefix + std::to_string(i) + "/")) return false;
+	}
+
+	return true;
+}
+
 void DistanceFieldOperator::render(const std::function<void(const std::vector<Vector3s>&, const std::vector<Vector3i>&, const Eigen::Quaternion<scalar>&, const Vector3s&, const scalar&)>& func) const
 {
 	int nb = children.size();
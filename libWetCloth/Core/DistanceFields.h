@@ -17,8 +17,12 @@
 #include "SolidMesh.h"
 #include "array3.h"
 #include "array3_utils.h"
+#include "makelevelset3.h"
+#include "sorter.h"
 
 class TwoDScene;
+class CheckpointWriter;
+class CheckpointReader;
 
 struct DF_SOURCE_DURATION
 {
@@ -63,6 +67,7 @@ struct DistanceField
 	virtual void resample_mesh(const scalar& dx, VectorXs& result, VectorXs& normals) = 0;
 	virtual void resample_internal( const std::shared_ptr< TwoDScene >& parent, const scalar& dx, const VectorXs& exist, VectorXs& additional);
 	virtual bool local_bounding_box(Vector3s& low, Vector3s& high) const = 0;
+	virtual void build_cache(const scalar& dx);
 	virtual void apply_global_rotation(const Eigen::Quaternion<scalar>& rot) = 0;
 	virtual void apply_local_rotation(const Eigen::Quaternion<scalar>& rot) = 0;
 	virtual void apply_translation(const Vector3s& t) = 0;
@@ -74,6 +79,16 @@ struct DistanceField
 
 	virtual void center(Vector3s& cent) const;
 
+	// rigid motion of the objects, for checkpoints; the shapes come from the scene file
+	virtual void save_state(CheckpointWriter& out, const std::string& prefix) const;
+	virtual bool load_state(const CheckpointReader& in, const std::string& prefix);
+
+	// random stream of this object in a step
+	inline uint64_t stream_key(uint64_t step, mathutils::RAND_STREAM stream) const
+	{
+		return mathutils::streamKey(step, stream, ((uint64_t) group << 32) | (uint64_t) (unsigned) params_index);
+	}
+
 	inline bool is_root() const
 	{
 		return (parent == NULL);
@@ -85,6 +100,9 @@ struct DistanceField
 	int group;
 	int params_index;
 	bool sampled;
+
+	// buckets of the emitted and nearby particles, kept across substeps
+	Sorter resample_sorter;
 };
 
 struct DistanceFieldOperator : public DistanceField
@@ -103,6 +121,8 @@ struct DistanceFieldOperator : public DistanceField
 	virtual int vote_param_indices();
 	virtual DISTANCE_FIELD_USAGE vote_usage();
 	virtual bool vote_sampled();
+	virtual void save_state(CheckpointWriter& out, const std::string& prefix) const;
+	virtual bool load_state(const CheckpointReader& in, const std::string& prefix);
 
 	virtual void render(const std::function<void(const std::vector<Vector3s>&, const std::vector<Vector3i>&, const Eigen::Quaternion<scalar>&, const Vector3s&, const scalar&)>&) const;
 
@@ -119,18 +139,27 @@ struct DistanceFieldObject : public DistanceField
 	virtual scalar compute_phi_vel(const Vector3s& pos, Vector3s& vel) const;
 	virtual scalar compute_phi(const Vector3s& pos) const;
 	virtual bool local_bounding_box(Vector3s& low, Vector3s& high) const;
+	virtual void build_cache(const scalar& dx);
 	virtual void apply_global_rotation(const Eigen::Quaternion<scalar>& rot);
 	virtual void apply_local_rotation(const Eigen::Quaternion<scalar>& rot);
 	virtual void apply_translation(const Vector3s& t);
+	virtual void save_state(CheckpointWriter& out, const std::string& prefix) const;
+	virtual bool load_state(const CheckpointReader& in, const std::string& prefix);
 
 	virtual void render(const std::function<void(const std::vector<Vector3s>&, const std::vector<Vector3i>&, const Eigen::Quaternion<scalar>&, const Vector3s&, const scalar&)>&) const;
 
-	void process_file_mesh(const std::string& szfn_cache);
+	// loads the mesh and its level set, or shares them with an object of the
+	// process that loaded the same file at the same scale and resolution
+	void process_file_mesh(const std::string& szfn, const std::string& szfn_cache);
+
+	// phi of the shape in its own frame (centered at the origin, unrotated)
+	scalar compute_local_phi(const Vector3s& local) const;
 
 	Vector3s center;
 	VectorXs parameter;
 
 	Eigen::Quaternion<scalar> rot;
+	Matrix3s irot; // inverse of rot as a matrix, follows rot
 
 	Vector3s future_center;
 	Eigen::Quaternion<scalar> future_rot;
@@ -141,8 +170,15 @@ struct DistanceFieldObject : public DistanceField
 	scalar sign;
 
 	std::shared_ptr<SolidMesh> mesh;
+
+	// sampled phi in the frame of the object: the level set of a mesh file
+	// (in sparse tiles, read-only and shared), or a cache of the analytic shapes
+	// (they only move rigidly, so the samples stay valid as long as the
+	// parameters do not change)
+	std::shared_ptr<const SparseLevelSet3> mesh_volume;
 	Array3s volume;
 	Vector3s volume_origin;
+	scalar volume_dx;
 
 	std::vector< DF_SOURCE_DURATION > durations;
 };
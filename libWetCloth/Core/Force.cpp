@@ -8,6 +8,7 @@
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include "Force.h"
+#include "Checkpoint.h"
 
 Force::~Force()
 {}
@@ -15,7 +16,7 @@ Force::~Force()
 void Force::addLiquidGradEToNode( const TwoDScene& scene, std::vector< VectorXs >& node_rhs_x, std::vector< VectorXs >& node_rhs_y, std::vector< VectorXs >& node_rhs_z, const scalar& coeff )
 {}
 
-void Force::addAngularHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
+void Force::addAngularHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
 {}
 
 int Force::numAngularHessX()
@@ -23,7 +24,7 @@ int Force::numAngularHessX()
 	return 0;
 }
 
-void Force::postCompute(VectorXs& v, const scalar& dt)
+void Force::postCompute(VectorXsRef v, const scalar& dt)
 {
 
 }
@@ -32,3 +33,11 @@ bool Force::parallelized() const
 {
 	return false;
 }
+
+void Force::saveState( CheckpointWriter& /*out*/, const std::string& /*prefix*/ ) const
+{}
+
+bool Force::loadState( const CheckpointReader& /*in*/, const std::string& /*prefix*/ )
+{
+	return true;
+}
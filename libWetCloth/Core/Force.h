@@ -11,10 +11,13 @@
 #define FORCE_H
 
 #include <Eigen/Core>
+#include <string>
 
 #include "MathDefs.h"
 
 class TwoDScene;
+class CheckpointWriter;
+class CheckpointReader;
 
 class Force
 {
@@ -22,15 +25,15 @@ public:
 
 	virtual ~Force();
 
-	virtual void addEnergyToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, scalar& E ) = 0;
+	virtual void addEnergyToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, scalar& E ) = 0;
 
-	virtual void addGradEToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, VectorXs& gradE ) = 0;
+	virtual void addGradEToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, VectorXs& gradE ) = 0;
 
 	virtual void addLiquidGradEToNode( const TwoDScene& scene, std::vector< VectorXs >& node_rhs_x, std::vector< VectorXs >& node_rhs_y, std::vector< VectorXs >& node_rhs_z, const scalar& coeff );
 
-	virtual void addHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt ) = 0;
+	virtual void addHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt ) = 0;
 
-	virtual void addAngularHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt );
+	virtual void addAngularHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt );
 
 	virtual int numHessX() = 0;
 
@@ -38,17 +41,22 @@ public:
 
 	virtual void preCompute() = 0;
 
-	virtual void updateMultipliers( const VectorXs& x, const VectorXs& vplus, const VectorXs& m, const VectorXs& psi, const scalar& lambda, const scalar& dt ) = 0;
+	virtual void updateMultipliers( const ConstVectorXsRef& x, const ConstVectorXsRef& vplus, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, const scalar& dt ) = 0;
 
 	virtual void updateStartState() = 0;
 
 	virtual Force* createNewCopy() = 0;
 
-	virtual void postCompute(VectorXs& v, const scalar& dt);
+	virtual void postCompute(VectorXsRef v, const scalar& dt);
 
 	virtual int flag() const = 0;
 
 	virtual bool parallelized() const;
+
+	// state carried from step to step, beyond the scene arrays (none by default)
+	virtual void saveState( CheckpointWriter& out, const std::string& prefix ) const;
+
+	virtual bool loadState( const CheckpointReader& in, const std::string& prefix );
 };
 
 #endif
@@ -294,6 +294,32 @@ struct levelGen {
 #endif
 	}
 
+	// recompute the Galerkin operators of an existing coarsening for a new
+	// finest matrix A. If A has the same pattern as before, the products
+	// A * P (kept in AP_L) and R * (A * P) are only refilled numerically.
+	void refreshLevelsGalerkinSparse
+	(vector< std::shared_ptr< FixedSparseMatrix<T> > > &A_L,
+	 const vector<FixedSparseMatrix<T> > &R_L,
+	 const vector<FixedSparseMatrix<T> > &P_L,
+	 vector<FixedSparseMatrix<T> > &AP_L,
+	 int total_level,
+	 const std::shared_ptr< FixedSparseMatrix<T> > &A,
+	 bool same_pattern) {
+		A_L[0] = A;
+		AP_L.resize(total_level - 1);
+
+		for (int i = 0; i < total_level - 1; i++)
+		{
+			if (same_pattern) {
+				multiplyMatNumeric(*(A_L[i]), (P_L[i]), AP_L[i], (T) 1.0);
+				multiplyMatNumeric((R_L[i]), AP_L[i], *(A_L[i + 1]), (T) 0.5);
+			} else {
+				multiplyMat(*(A_L[i]), (P_L[i]), AP_L[i], (T) 1.0);
+				multiplyMat((R_L[i]), AP_L[i], *(A_L[i + 1]), (T) 0.5);
+			}
+		}
+	}
+
 
 
 
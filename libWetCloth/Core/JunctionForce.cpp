@@ -15,7 +15,7 @@ JunctionForce::JunctionForce(const std::shared_ptr< TwoDScene >& scene)
 {
 	const int num_elasto = scene->getNumSoftElastoParticles();
 	const int num_edges = scene->getNumEdges();
-	const VectorXs& radius = scene->getRadius();
+	ConstVectorXsRef radius = scene->getRadius();
 	const MatrixXi& edges = scene->getEdges();
 
 	m_junctions_indices.reserve(num_elasto);
@@ -56,7 +56,7 @@ JunctionForce::JunctionForce(const std::shared_ptr< TwoDScene >& scene)
 
 	preCompute();
 
-	const VectorXs& x = scene->getRestPos();
+	ConstVectorXsRef x = scene->getRestPos();
 
 	m_junction_signs.resize(m_junctions_indices.size());
 
@@ -75,12 +75,12 @@ JunctionForce::JunctionForce(const std::shared_ptr< TwoDScene >& scene)
 	});
 }
 
-void JunctionForce::addEnergyToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, scalar& E )
+void JunctionForce::addEnergyToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, scalar& E )
 {
 	std::cerr << "NOT IMPLEMENTED!" << std::endl;
 }
 
-void JunctionForce::addGradEToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, VectorXs& gradE )
+void JunctionForce::addGradEToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, VectorXs& gradE )
 {
 	threadutils::for_each(0, (int) m_junctions_indices.size(), [&] (int i) {
 		const int pidx = m_junctions_indices[i];
@@ -131,7 +131,7 @@ bool JunctionForce::parallelized() const
 	return true;
 }
 
-void JunctionForce::addHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
+void JunctionForce::addHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
 {
 	threadutils::for_each(0, (int) m_junctions_indices.size(), [&] (int i) {
 		const int pidx = m_junctions_indices[i];
@@ -200,7 +200,7 @@ void JunctionForce::addHessXToTotal( const VectorXs& x, const VectorXs& v, const
 	});
 }
 
-void JunctionForce::updateMultipliers( const VectorXs& x, const VectorXs& vplus, const VectorXs& m, const VectorXs& psi, const scalar& lambda, const scalar& dt )
+void JunctionForce::updateMultipliers( const ConstVectorXsRef& x, const ConstVectorXsRef& vplus, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, const scalar& dt )
 {
 
 }
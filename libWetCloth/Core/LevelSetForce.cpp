@@ -24,14 +24,14 @@ LevelSetForce::LevelSetForce( const std::shared_ptr<TwoDScene>& scene, const sca
 LevelSetForce::~LevelSetForce()
 {}
 
-void LevelSetForce::addEnergyToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, scalar& E )
+void LevelSetForce::addEnergyToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, scalar& E )
 {
     assert( x.size() == v.size() );
     assert( x.size() % 4 == 0 );
     std::cerr << "NOT IMPLEMENTED!" << std::endl;
 }
 
-void LevelSetForce::addGradEToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, VectorXs& gradE )
+void LevelSetForce::addGradEToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, VectorXs& gradE )
 {
     assert( x.size() == v.size() );
     assert( x.size() == gradE.size() );
@@ -40,7 +40,7 @@ void LevelSetForce::addGradEToTotal( const VectorXs& x, const VectorXs& v, const
     const int num_elasto = m_process_list.size();
     const std::vector< VectorXs >& solid_phi = m_scene->getNodeSolidPhi();
 
-    const VectorXs& vol = m_scene->getVol();
+    ConstVectorXsRef vol = m_scene->getVol();
 
     const scalar K = m_scene->getLiquidInfo().levelset_young_modulus;
 
@@ -92,7 +92,7 @@ bool LevelSetForce::parallelized() const
     return true;
 }
 
-void LevelSetForce::addHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
+void LevelSetForce::addHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
 {
     assert( x.size() == v.size() );
     assert( x.size() == m.size() );
@@ -101,7 +101,7 @@ void LevelSetForce::addHessXToTotal( const VectorXs& x, const VectorXs& v, const
     const int num_elasto = m_process_list.size();
     const std::vector< VectorXs >& solid_phi = m_scene->getNodeSolidPhi();
 
-    const VectorXs& vol = m_scene->getVol();
+    ConstVectorXsRef vol = m_scene->getVol();
 
     const scalar K = m_scene->getLiquidInfo().levelset_young_modulus;
 
@@ -156,7 +156,7 @@ void LevelSetForce::addHessXToTotal( const VectorXs& x, const VectorXs& v, const
     });
 }
 
-void LevelSetForce::updateMultipliers( const VectorXs& x, const VectorXs& vplus, const VectorXs& m, const VectorXs& psi, const scalar& lambda, const scalar& dt )
+void LevelSetForce::updateMultipliers( const ConstVectorXsRef& x, const ConstVectorXsRef& vplus, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, const scalar& dt )
 {
 
 }
@@ -164,7 +164,7 @@ void LevelSetForce::updateMultipliers( const VectorXs& x, const VectorXs& vplus,
 void LevelSetForce::preCompute()
 {
     const int num_elasto = m_scene->getNumSoftElastoParticles();
-    const VectorXs& x = m_scene->getX();
+    ConstVectorXsRef x = m_scene->getX();
     m_process_list.resize(0);
     m_process_list.reserve(num_elasto);
 
@@ -172,8 +172,12 @@ void LevelSetForce::preCompute()
     {
         if (m_scene->isFixed(i) & 1) continue;
 
-        Vector3s vel;
-        scalar phi = m_scene->computePhiVel(x.segment<3>(i * 4), vel);
+        // the minimum over the group fields of every usage
+        const Vector3s pos = x.segment<3>(i * 4);
+        scalar phi = m_scene->computePhi(pos, DFU_SOLID);
+        for (int u = DFU_SOURCE; u < DFU_COUNT; ++u) {
+            phi = std::min(phi, m_scene->computePhi(pos, (DISTANCE_FIELD_USAGE) u));
+        }
 
         if (phi < m_l0) m_process_list.push_back(i);
     }
@@ -15,15 +15,31 @@
 #include "Viscosity.h"
 #include "array3_utils.h"
 #include "AlgebraicMultigrid.h"
+#include "pcgsolver/pcg_solver.h"
 
 #include <unordered_map>
+#include <atomic>
+#include <numeric>
 
 //#define OPTIMIZE_SAT
 //#define CHECK_EQU_24
 
-LinearizedImplicitEuler::LinearizedImplicitEuler(const scalar& criterion, const scalar& pressure_criterion, const scalar& quasi_static_criterion, const scalar& viscous_criterion, int maxiters, int manifold_substeps, int viscosity_substeps, int surf_tension_substeps)
-	: SceneStepper(), m_pcg_criterion(criterion), m_pressure_criterion(pressure_criterion), m_quasi_static_criterion(quasi_static_criterion), m_viscous_criterion(viscous_criterion), m_maxiters(maxiters), m_manifold_substeps(manifold_substeps), m_viscosity_substeps(viscosity_substeps), m_surf_tension_substeps(surf_tension_substeps)
-{}
+LinearizedImplicitEuler::LinearizedImplicitEuler(const scalar& criterion, const scalar& pressure_criterion, const scalar& quasi_static_criterion, const scalar& viscous_criterion, int maxiters, int manifold_substeps, int viscosity_substeps, int surf_tension_substeps, int viscosity_solver)
+	: SceneStepper(), m_pcg_criterion(criterion), m_pressure_criterion(pressure_criterion), m_quasi_static_criterion(quasi_static_criterion), m_viscous_criterion(viscous_criterion), m_maxiters(maxiters), m_manifold_substeps(manifold_substeps), m_viscosity_substeps(viscosity_substeps), m_surf_tension_substeps(surf_tension_substeps), m_viscosity_solver(viscosity_solver), m_fine_pressure_amg(std::make_shared< AMGLevels<scalar> >()), m_visc_block_solver(std::make_shared< robertbridson::BlockPCGSolver<scalar> >())
+{
+	NodeVectorView* temporaries[] = {
+		&m_node_r_x, &m_node_r_y, &m_node_r_z,
+		&m_node_z_x, &m_node_z_y, &m_node_z_z,
+		&m_node_p_x, &m_node_p_y, &m_node_p_z,
+		&m_node_q_x, &m_node_q_y, &m_node_q_z,
+		&m_node_w_x, &m_node_w_y, &m_node_w_z,
+		&m_node_t_x, &m_node_t_y, &m_node_t_z
+	};
+
+	for (NodeVectorView* v : temporaries) {
+		*v = NodeVectorView(m_node_arena, m_node_arena.addField());
+	}
+}
 
 LinearizedImplicitEuler::~LinearizedImplicitEuler()
 {
@@ -54,34 +70,32 @@ bool LinearizedImplicitEuler::stepScene( TwoDScene& scene, scalar dt )
 }
 
 void LinearizedImplicitEuler::performInvLocalSolve( const TwoDScene& scene,
-        const std::vector< VectorXs >& node_rhs_x,
-        const std::vector< VectorXs >& node_rhs_y,
-        const std::vector< VectorXs >& node_rhs_z,
-        const std::vector< VectorXs >& node_inv_mass_x,
-        const std::vector< VectorXs >& node_inv_mass_y,
-        const std::vector< VectorXs >& node_inv_mass_z,
-        std::vector< VectorXs >& out_node_vec_x,
-        std::vector< VectorXs >& out_node_vec_y,
-        std::vector< VectorXs >& out_node_vec_z )
+        const ConstNodeVectorView& node_rhs_x,
+        const ConstNodeVectorView& node_rhs_y,
+        const ConstNodeVectorView& node_rhs_z,
+        const ConstNodeVectorView& node_inv_mass_x,
+        const ConstNodeVectorView& node_inv_mass_y,
+        const ConstNodeVectorView& node_inv_mass_z,
+        NodeVectorView out_node_vec_x,
+        NodeVectorView out_node_vec_y,
+        NodeVectorView out_node_vec_z )
 {
 	const Sorter& buckets = scene.getParticleBuckets();
 
-	buckets.for_each_bucket([&] (int bucket_idx) {
-		if (!scene.isBucketActivated(bucket_idx)) return;
-
+	buckets.for_each_active_bucket([&] (int bucket_idx) {
 		const int num_nodes = scene.getNumNodes(bucket_idx);
 
-		const VectorXs& bucket_node_masses_x = node_inv_mass_x[bucket_idx];
-		const VectorXs& bucket_node_masses_y = node_inv_mass_y[bucket_idx];
-		const VectorXs& bucket_node_masses_z = node_inv_mass_z[bucket_idx];
+		auto bucket_node_masses_x = node_inv_mass_x[bucket_idx];
+		auto bucket_node_masses_y = node_inv_mass_y[bucket_idx];
+		auto bucket_node_masses_z = node_inv_mass_z[bucket_idx];
 
-		const VectorXs& bucket_node_rhs_x = node_rhs_x[bucket_idx];
-		const VectorXs& bucket_node_rhs_y = node_rhs_y[bucket_idx];
-		const VectorXs& bucket_node_rhs_z = node_rhs_z[bucket_idx];
+		auto bucket_node_rhs_x = node_rhs_x[bucket_idx];
+		auto bucket_node_rhs_y = node_rhs_y[bucket_idx];
+		auto bucket_node_rhs_z = node_rhs_z[bucket_idx];
 
-		VectorXs& bucket_out_node_vec_x = out_node_vec_x[bucket_idx];
-		VectorXs& bucket_out_node_vec_y = out_node_vec_y[bucket_idx];
-		VectorXs& bucket_out_node_vec_z = out_node_vec_z[bucket_idx];
+		auto bucket_out_node_vec_x = out_node_vec_x[bucket_idx];
+		auto bucket_out_node_vec_y = out_node_vec_y[bucket_idx];
+		auto bucket_out_node_vec_z = out_node_vec_z[bucket_idx];
 
 		for (int i = 0; i < num_nodes; ++i)
 		{
@@ -96,7 +110,7 @@ void LinearizedImplicitEuler::performInvLocalSolve( const TwoDScene& scene,
 	});
 }
 
-void LinearizedImplicitEuler::performLocalSolve( const TwoDScene& scene, const VectorXs& rhs, const VectorXs& m, VectorXs& out)
+void LinearizedImplicitEuler::performLocalSolve( const TwoDScene& scene, const VectorXs& rhs, const ConstVectorXsRef& m, VectorXs& out)
 {
 	const int num_elasto = scene.getNumSoftElastoParticles();
 
@@ -105,7 +119,7 @@ void LinearizedImplicitEuler::performLocalSolve( const TwoDScene& scene, const V
 	});
 }
 
-void LinearizedImplicitEuler::performLocalSolveTwist( const TwoDScene& scene, const VectorXs& rhs, const VectorXs& m, VectorXs& out)
+void LinearizedImplicitEuler::performLocalSolveTwist( const TwoDScene& scene, const VectorXs& rhs, const ConstVectorXsRef& m, VectorXs& out)
 {
 	const int num_elasto = scene.getNumSoftElastoParticles();
 
@@ -127,9 +141,7 @@ void LinearizedImplicitEuler::performLocalSolve( const TwoDScene& scene,
 {
 	const Sorter& buckets = scene.getParticleBuckets();
 
-	buckets.for_each_bucket([&] (int bucket_idx) {
-		if (!scene.isBucketActivated(bucket_idx)) return;
-
+	buckets.for_each_active_bucket([&] (int bucket_idx) {
 		const int num_nodes = scene.getNumNodes(bucket_idx);
 
 		const VectorXs& bucket_node_masses_x = node_masses_x[bucket_idx];
@@ -161,8 +173,8 @@ bool LinearizedImplicitEuler::stepVelocityLagrangian( TwoDScene& scene, scalar d
 	scene.precompute();
 
 	const int num_elasto = scene.getNumSoftElastoParticles();
-	const VectorXs& m = scene.getM();
-	const VectorXs& v = scene.getV();
+	ConstVectorXsRef m = scene.getM();
+	ConstVectorXsRef v = scene.getV();
 
 	int ndof = num_elasto * 4;
 
@@ -299,7 +311,7 @@ bool LinearizedImplicitEuler::stepVelocity( TwoDScene& scene, scalar dt )
 
 
 void LinearizedImplicitEuler::performAngularGlobalMultiply( const TwoDScene& scene, const scalar& dt,
-        const VectorXs& m,
+        const ConstVectorXsRef& m,
         const VectorXs& v,
         VectorXs& out)
 {
@@ -327,7 +339,7 @@ void LinearizedImplicitEuler::performAngularGlobalMultiply( const TwoDScene& sce
 }
 
 void LinearizedImplicitEuler::performGlobalMultiply( const TwoDScene& scene, const scalar& dt,
-        const VectorXs& m,
+        const ConstVectorXsRef& m,
         const VectorXs& vec,
         VectorXs& out)
 {
@@ -335,26 +347,15 @@ void LinearizedImplicitEuler::performGlobalMultiply( const TwoDScene& scene, con
 
 	if (num_elasto == 0) return;
 
-	struct Triplets_override
-	{
-		int m_row, m_col;
-		scalar m_value;
-	};
-
 	const int ndof = num_elasto * 4;
 
 	if (m_multiply_buffer.size() != num_elasto * 4) m_multiply_buffer.resize( ndof );
 	// Ax
 	threadutils::for_each(0, ndof, [&] (int i) {
-		const int idata_start = m_triA_sup[i].first;
-		const int idata_end = m_triA_sup[i].second;
-
 		scalar val = 0.0;
-		for (int j = idata_start; j < idata_end; ++j)
+		for (int j = m_hess_rowstart[i]; j < m_hess_rowstart[i + 1]; ++j)
 		{
-			const Triplets_override& tri = *((const Triplets_override*) &m_triA[j]);
-
-			val += tri.m_value * vec[tri.m_col];
+			val += m_hess_value[j] * vec[m_hess_colindex[j]];
 		}
 		m_multiply_buffer[i] = val;
 	});
@@ -363,15 +364,15 @@ void LinearizedImplicitEuler::performGlobalMultiply( const TwoDScene& scene, con
 }
 
 void LinearizedImplicitEuler::performGlobalMultiply( const TwoDScene& scene, const scalar& dt,
-        const std::vector< VectorXs >& node_m_x,
-        const std::vector< VectorXs >& node_m_y,
-        const std::vector< VectorXs >& node_m_z,
-        const std::vector< VectorXs >& node_v_x,
-        const std::vector< VectorXs >& node_v_y,
-        const std::vector< VectorXs >& node_v_z,
-        std::vector< VectorXs >& out_node_vec_x,
-        std::vector< VectorXs >& out_node_vec_y,
-        std::vector< VectorXs >& out_node_vec_z )
+        const ConstNodeVectorView& node_m_x,
+        const ConstNodeVectorView& node_m_y,
+        const ConstNodeVectorView& node_m_z,
+        const ConstNodeVectorView& node_v_x,
+        const ConstNodeVectorView& node_v_y,
+        const ConstNodeVectorView& node_v_z,
+        NodeVectorView out_node_vec_x,
+        NodeVectorView out_node_vec_y,
+        NodeVectorView out_node_vec_z )
 {
 	const int num_elasto = scene.getNumSoftElastoParticles();
 
@@ -382,23 +383,12 @@ void LinearizedImplicitEuler::performGlobalMultiply( const TwoDScene& scene, con
 	// Wx
 	mapNodeToSoftParticles( scene, node_v_x, node_v_y, node_v_z, m_pre_mult_buffer );
 
-	struct Triplets_override
-	{
-		int m_row, m_col;
-		scalar m_value;
-	};
-
 	// AWx
 	threadutils::for_each(0, num_elasto * 4, [&] (int i) {
-		const int idata_start = m_triA_sup[i].first;
-		const int idata_end = m_triA_sup[i].second;
-
 		scalar val = 0.0;
-		for (int j = idata_start; j < idata_end; ++j)
+		for (int j = m_hess_rowstart[i]; j < m_hess_rowstart[i + 1]; ++j)
 		{
-			const Triplets_override& tri = *((const Triplets_override*) &m_triA[j]);
-
-			val += tri.m_value * m_pre_mult_buffer[tri.m_col];
+			val += m_hess_value[j] * m_pre_mult_buffer[m_hess_colindex[j]];
 		}
 		m_multiply_buffer[i] = val;
 	});
@@ -410,9 +400,9 @@ void LinearizedImplicitEuler::performGlobalMultiply( const TwoDScene& scene, con
 	const Sorter& buckets = scene.getParticleBuckets();
 
 	buckets.for_each_bucket([&] (int bucket_idx) {
-		VectorXs& bucket_node_vec_x = out_node_vec_x[bucket_idx];
-		VectorXs& bucket_node_vec_y = out_node_vec_y[bucket_idx];
-		VectorXs& bucket_node_vec_z = out_node_vec_z[bucket_idx];
+		auto bucket_node_vec_x = out_node_vec_x[bucket_idx];
+		auto bucket_node_vec_y = out_node_vec_y[bucket_idx];
+		auto bucket_node_vec_z = out_node_vec_z[bucket_idx];
 
 		// (M+h^2(W^TAW+H)x
 		bucket_node_vec_x = bucket_node_vec_x * (dt * dt) + VectorXs(node_m_x[bucket_idx].array() * node_v_x[bucket_idx].array());
@@ -423,16 +413,16 @@ void LinearizedImplicitEuler::performGlobalMultiply( const TwoDScene& scene, con
 }
 
 void LinearizedImplicitEuler::performGlobalMultiply( const TwoDScene& scene, const scalar& dt,
-        const std::vector< VectorXs >& node_m_x,
-        const std::vector< VectorXs >& node_m_y,
-        const std::vector< VectorXs >& node_m_z,
-        const std::vector< VectorXs >& node_v_x,
-        const std::vector< VectorXs >& node_v_y,
-        const std::vector< VectorXs >& node_v_z,
-        std::vector< VectorXs >& out_node_vec_x,
-        std::vector< VectorXs >& out_node_vec_y,
-        std::vector< VectorXs >& out_node_vec_z,
-        const VectorXs& m,
+        const ConstNodeVectorView& node_m_x,
+        const ConstNodeVectorView& node_m_y,
+        const ConstNodeVectorView& node_m_z,
+        const ConstNodeVectorView& node_v_x,
+        const ConstNodeVectorView& node_v_y,
+        const ConstNodeVectorView& node_v_z,
+        NodeVectorView out_node_vec_x,
+        NodeVectorView out_node_vec_y,
+        NodeVectorView out_node_vec_z,
+        const ConstVectorXsRef& m,
         const VectorXs& angular_vec,
         VectorXs& out)
 {
@@ -450,23 +440,12 @@ void LinearizedImplicitEuler::performGlobalMultiply( const TwoDScene& scene, con
 		m_pre_mult_buffer[i * 4 + 3] = angular_vec(i);
 	});
 
-	struct Triplets_override
-	{
-		int m_row, m_col;
-		scalar m_value;
-	};
-
 	// AWx
 	threadutils::for_each(0, num_elasto * 4, [&] (int i) {
-		const int idata_start = m_triA_sup[i].first;
-		const int idata_end = m_triA_sup[i].second;
-
 		scalar val = 0.0;
-		for (int j = idata_start; j < idata_end; ++j)
+		for (int j = m_hess_rowstart[i]; j < m_hess_rowstart[i + 1]; ++j)
 		{
-			const Triplets_override& tri = *((const Triplets_override*) &m_triA[j]);
-
-			val += tri.m_value * m_pre_mult_buffer[tri.m_col];
+			val += m_hess_value[j] * m_pre_mult_buffer[m_hess_colindex[j]];
 		}
 		m_multiply_buffer[i] = val;
 	});
@@ -484,9 +463,9 @@ void LinearizedImplicitEuler::performGlobalMultiply( const TwoDScene& scene, con
 	const Sorter& buckets = scene.getParticleBuckets();
 
 	buckets.for_each_bucket([&] (int bucket_idx) {
-		VectorXs& bucket_node_vec_x = out_node_vec_x[bucket_idx];
-		VectorXs& bucket_node_vec_y = out_node_vec_y[bucket_idx];
-		VectorXs& bucket_node_vec_z = out_node_vec_z[bucket_idx];
+		auto bucket_node_vec_x = out_node_vec_x[bucket_idx];
+		auto bucket_node_vec_y = out_node_vec_y[bucket_idx];
+		auto bucket_node_vec_z = out_node_vec_z[bucket_idx];
 
 		// (M+h^2(W^TAW+H)x
 		bucket_node_vec_x = bucket_node_vec_x * (dt * dt) + VectorXs(node_m_x[bucket_idx].array() * node_v_x[bucket_idx].array());
@@ -499,8 +478,8 @@ void LinearizedImplicitEuler::performGlobalMultiply( const TwoDScene& scene, con
 void LinearizedImplicitEuler::constructNodeForce( TwoDScene& scene, const scalar& dt, std::vector< VectorXs >& node_rhs_x, std::vector< VectorXs >& node_rhs_y, std::vector< VectorXs >& node_rhs_z, std::vector< VectorXs >& node_rhs_fluid_x, std::vector< VectorXs >& node_rhs_fluid_y, std::vector< VectorXs >& node_rhs_fluid_z )
 {
 	const int num_elasto = scene.getNumSoftElastoParticles();
-	const VectorXs& m = scene.getM();
-	const VectorXs& v = scene.getV();
+	ConstVectorXsRef m = scene.getM();
+	ConstVectorXsRef v = scene.getV();
 
 	int ndof = num_elasto * 4;
 
@@ -600,9 +579,7 @@ void LinearizedImplicitEuler::addSolidDrag( TwoDScene& scene,
 {
 	const Sorter& buckets = scene.getParticleBuckets();
 
-	buckets.for_each_bucket([&] (int bucket_idx) {
-		if (!scene.isBucketActivated(bucket_idx)) return;
-
+	buckets.for_each_active_bucket([&] (int bucket_idx) {
 		const int num_nodes = scene.getNumNodes(bucket_idx);
 
 		for (int i = 0; i < num_nodes; ++i)
@@ -628,9 +605,7 @@ void LinearizedImplicitEuler::addSolidDragRHS( TwoDScene& scene,
 	const std::vector< VectorXs >& node_mass_y = scene.getNodeMassY();
 	const std::vector< VectorXs >& node_mass_z = scene.getNodeMassZ();
 
-	buckets.for_each_bucket([&] (int bucket_idx) {
-		if (!scene.isBucketActivated(bucket_idx)) return;
-
+	buckets.for_each_active_bucket([&] (int bucket_idx) {
 		const int num_nodes = scene.getNumNodes(bucket_idx);
 
 		for (int i = 0; i < num_nodes; ++i)
@@ -657,9 +632,7 @@ void LinearizedImplicitEuler::addFluidDragRHS( TwoDScene& scene,
 	const std::vector< VectorXs >& node_mass_fluid_y = scene.getNodeFluidMassY();
 	const std::vector< VectorXs >& node_mass_fluid_z = scene.getNodeFluidMassZ();
 
-	buckets.for_each_bucket([&] (int bucket_idx) {
-		if (!scene.isBucketActivated(bucket_idx)) return;
-
+	buckets.for_each_active_bucket([&] (int bucket_idx) {
 		const int num_nodes = scene.getNumNodes(bucket_idx);
 
 		for (int i = 0; i < num_nodes; ++i)
@@ -673,41 +646,79 @@ void LinearizedImplicitEuler::addFluidDragRHS( TwoDScene& scene,
 
 void LinearizedImplicitEuler::constructHessianPreProcess( TwoDScene& scene, const scalar& dt )
 {
+	// zero triplets are kept so that every force keeps its slots in m_triA
 	scene.accumulateddUdxdx(m_triA, dt, 0);
-
-	m_triA.erase(std::remove_if(m_triA.begin(), m_triA.end(), [] (const auto & info) {return info.value() == 0.0;}), m_triA.end());
 }
 
-void LinearizedImplicitEuler::constructHessianPostProcess( TwoDScene& scene, const scalar& dt)
+void LinearizedImplicitEuler::buildHessianPattern( int ndof )
 {
-	const int num_soft_elasto = scene.getNumSoftElastoParticles();
-
-	tbb::parallel_sort(m_triA.begin(), m_triA.end(), [] (const Triplets & x, const Triplets & y) {
-		return x.row() < y.row();
+	const int num_slots = (int) m_triA.size();
+
+	// order the slots by (row, col), slots of the same entry stay in slot order
+	std::vector<int> order(num_slots);
+	for (int i = 0; i < num_slots; ++i) order[i] = i;
+
+	tbb::parallel_sort(order.begin(), order.end(), [&] (int x, int y) {
+		const Triplets& tx = m_triA[x];
+		const Triplets& ty = m_triA[y];
+		if (tx.row() != ty.row()) return tx.row() < ty.row();
+		if (tx.col() != ty.col()) return tx.col() < ty.col();
+		return x < y;
 	});
 
-	if ((int) m_triA_sup.size() != num_soft_elasto * 4) m_triA_sup.resize(num_soft_elasto * 4);
+	m_hess_rowstart.assign(ndof + 1, 0);
+	m_hess_colindex.resize(0);
+	m_hess_slot_start.resize(0);
 
-	memset(&m_triA_sup[0], 0, num_soft_elasto * 4 * sizeof(std::pair<int, int>));
+	for (int k = 0; k < num_slots; ++k)
+	{
+		const Triplets& tri = m_triA[order[k]];
+		if (k > 0) {
+			const Triplets& prev = m_triA[order[k - 1]];
+			if (prev.row() == tri.row() && prev.col() == tri.col()) continue;
+		}
 
-	const int num_tris = m_triA.size();
+		++m_hess_rowstart[tri.row() + 1];
+		m_hess_colindex.push_back(tri.col());
+		m_hess_slot_start.push_back(k);
+	}
+	m_hess_slot_start.push_back(num_slots);
 
-	threadutils::for_each(0, num_tris, [&] (int pidx) {
-		int G_ID = pidx;
-		int G_ID_PREV = G_ID - 1;
-		int G_ID_NEXT = G_ID + 1;
+	std::partial_sum(m_hess_rowstart.begin(), m_hess_rowstart.end(), m_hess_rowstart.begin());
 
-		unsigned int cell = m_triA[G_ID].row();
-		unsigned int cell_prev = G_ID_PREV < 0 ? -1U : m_triA[G_ID_PREV].row();
-		unsigned int cell_next = G_ID_NEXT >= num_tris ? -1U : m_triA[G_ID_NEXT].row();
+	m_hess_slots.swap(order);
+	m_hess_value.resize(m_hess_colindex.size());
 
-		if (cell != cell_prev) {
-			m_triA_sup[cell].first = G_ID;
-		}
+	m_hess_slot_pattern.resize(num_slots);
+	threadutils::for_each(0, num_slots, [&] (int i) {
+		m_hess_slot_pattern[i] = std::pair<int, int>(m_triA[i].row(), m_triA[i].col());
+	});
+}
 
-		if (cell != cell_next) {
-			m_triA_sup[cell].second = G_ID_NEXT;
-		}
+void LinearizedImplicitEuler::constructHessianPostProcess( TwoDScene& scene, const scalar& dt)
+{
+	const int ndof = scene.getNumSoftElastoParticles() * 4;
+	const int num_slots = (int) m_triA.size();
+
+	// symbolic phase, only when the forces changed their connectivity
+	bool pattern_changed = (int) m_hess_rowstart.size() != ndof + 1 || (int) m_hess_slot_pattern.size() != num_slots;
+	if (!pattern_changed) {
+		std::atomic<bool> slot_changed(false);
+		threadutils::for_each(0, num_slots, [&] (int i) {
+			if (m_hess_slot_pattern[i].first != m_triA[i].row() || m_hess_slot_pattern[i].second != m_triA[i].col())
+				slot_changed = true;
+		});
+		pattern_changed = slot_changed;
+	}
+
+	if (pattern_changed) buildHessianPattern(ndof);
+
+	// numeric phase
+	threadutils::for_each(0, (int) m_hess_value.size(), [&] (int e) {
+		scalar val = 0.0;
+		for (int k = m_hess_slot_start[e]; k < m_hess_slot_start[e + 1]; ++k)
+			val += m_triA[m_hess_slots[k]].value();
+		m_hess_value[e] = val;
 	});
 
 	if (scene.getLiquidInfo().use_group_precondition) {
@@ -728,8 +739,11 @@ void LinearizedImplicitEuler::constructAngularHessianPostProcess( TwoDScene& sce
 {
 	const int num_soft_elasto = scene.getNumSoftElastoParticles();
 
+	// a total order, so the entries of a row are summed in the same order on any schedule
 	tbb::parallel_sort(m_angular_triA.begin(), m_angular_triA.end(), [] (const Triplets & x, const Triplets & y) {
-		return x.row() < y.row();
+		if (x.row() != y.row()) return x.row() < y.row();
+		if (x.col() != y.col()) return x.col() < y.col();
+		return x.value() < y.value();
 	});
 
 	if ((int) m_angular_triA_sup.size() != num_soft_elasto) m_angular_triA_sup.resize(num_soft_elasto);
@@ -803,9 +817,7 @@ void LinearizedImplicitEuler::constructHDV( TwoDScene& scene, const scalar& dt )
 
 	if (scene.getLiquidInfo().drag_by_air)
 	{
-		buckets.for_each_bucket([&] (int bucket_idx) {
-			if (!scene.isBucketActivated(bucket_idx)) return;
-
+		buckets.for_each_active_bucket([&] (int bucket_idx) {
 			const int num_nodes = scene.getNumNodes(bucket_idx);
 
 			for (int i = 0; i < num_nodes; ++i)
@@ -835,9 +847,7 @@ void LinearizedImplicitEuler::constructHDV( TwoDScene& scene, const scalar& dt )
 		m_node_damped_z = node_mass_z;
 	}
 
-	buckets.for_each_bucket([&] (int bucket_idx) {
-		if (!scene.isBucketActivated(bucket_idx)) return;
-
+	buckets.for_each_active_bucket([&] (int bucket_idx) {
 		const int num_nodes = scene.getNumNodes(bucket_idx);
 
 		for (int i = 0; i < num_nodes; ++i)
@@ -895,9 +905,7 @@ void LinearizedImplicitEuler::constructMsDVs( TwoDScene& scene )
 
 	const Sorter& buckets = scene.getParticleBuckets();
 
-	buckets.for_each_bucket([&] (int bucket_idx) {
-		if (!scene.isBucketActivated(bucket_idx)) return;
-
+	buckets.for_each_active_bucket([&] (int bucket_idx) {
 		const int num_nodes = scene.getNumNodes(bucket_idx);
 
 		for (int i = 0; i < num_nodes; ++i)
@@ -952,9 +960,7 @@ void LinearizedImplicitEuler::constructPsiSF( TwoDScene& scene )
 
 	const Sorter& buckets = scene.getParticleBuckets();
 
-	buckets.for_each_bucket([&] (int bucket_idx) {
-		if (!scene.isBucketActivated(bucket_idx)) return;
-
+	buckets.for_each_active_bucket([&] (int bucket_idx) {
 		const int num_nodes = scene.getNumNodes(bucket_idx);
 
 		for (int i = 0; i < num_nodes; ++i)
@@ -986,9 +992,7 @@ void LinearizedImplicitEuler::constructInvMDV( TwoDScene& scene )
 
 	const Sorter& buckets = scene.getParticleBuckets();
 
-	buckets.for_each_bucket([&] (int bucket_idx) {
-		if (!scene.isBucketActivated(bucket_idx)) return;
-
+	buckets.for_each_active_bucket([&] (int bucket_idx) {
 		const int num_nodes = scene.getNumNodes(bucket_idx);
 
 		for (int i = 0; i < num_nodes; ++i)
@@ -1357,12 +1361,12 @@ bool LinearizedImplicitEuler::stepImplicitElastoDiagonalPCR( TwoDScene& scene, s
 }
 
 void LinearizedImplicitEuler::performGroupedLocalSolve( const TwoDScene& scene,
-        const std::vector< VectorXs >& node_rhs_x,
-        const std::vector< VectorXs >& node_rhs_y,
-        const std::vector< VectorXs >& node_rhs_z,
-        std::vector< VectorXs >& out_node_vec_x,
-        std::vector< VectorXs >& out_node_vec_y,
-        std::vector< VectorXs >& out_node_vec_z )
+        const ConstNodeVectorView& node_rhs_x,
+        const ConstNodeVectorView& node_rhs_y,
+        const ConstNodeVectorView& node_rhs_z,
+        NodeVectorView out_node_vec_x,
+        NodeVectorView out_node_vec_y,
+        NodeVectorView out_node_vec_z )
 {
 	const std::vector< VectorXi >& groups = scene.getSolveGroup();
 
@@ -1430,20 +1434,17 @@ void LinearizedImplicitEuler::prepareGroupPrecondition(
 		for (auto p : finder) {
 			for (int r = 0; r < 3; ++r) {
 				int i = p.first * 4 + r;
-				const int idata_start = m_triA_sup[i].first;
-				const int idata_end = m_triA_sup[i].second;
-
-				for (int j = idata_start; j < idata_end; ++j)
+				for (int j = m_hess_rowstart[i]; j < m_hess_rowstart[i + 1]; ++j)
 				{
-					const Triplets& tri = m_triA[j];
-					const int qidx = tri.col() / 4;
-					const int s = tri.col() - qidx * 4;
+					const int col = m_hess_colindex[j];
+					const int qidx = col / 4;
+					const int s = col - qidx * 4;
 					if (s >= 3) continue;
 
 					auto q = finder.find(qidx);
 					if (q == finder.end()) continue;
 
-					tri_sub_A.push_back(Triplets(p.second * 3 + r, q->second * 3 + s, tri.value() * dt * dt));
+					tri_sub_A.push_back(Triplets(p.second * 3 + r, q->second * 3 + s, m_hess_value[j] * dt * dt));
 				}
 			}
 		}
@@ -1481,7 +1482,7 @@ bool LinearizedImplicitEuler::stepImplicitElastoLagrangian( TwoDScene& scene, sc
 		allocateLagrangianVectors(scene, m_p);
 		allocateLagrangianVectors(scene, m_q);
 
-		const VectorXs& m = scene.getM();
+		ConstVectorXsRef m = scene.getM();
 
 		performGlobalMultiply(scene, dt, m, m_v_plus, m_r);
 
@@ -1942,6 +1943,13 @@ bool LinearizedImplicitEuler::stepImplicitViscosityDiagonalPCG( const TwoDScene&
 			                                       node_vel_src_x, node_vel_src_y, node_vel_src_z,
 			                                       m_visc_matrix, m_visc_rhs,
 			                                       offset_nodes_x, offset_nodes_y, offset_nodes_z, sub_dt);
+
+			// the matrix is the same for all the sub-steps
+			if (m_viscosity_solver == viscosity::VS_BLOCK_PCG) {
+				viscosity::formViscosityBlockPreconditioner(scene, m_effective_node_indices_x, m_effective_node_indices_y, m_effective_node_indices_z,
+				        offset_nodes_x, offset_nodes_y, offset_nodes_z,
+				        m_visc_matrix, *m_visc_block_solver, m_viscous_criterion, m_maxiters);
+			}
 		} else {
 			viscosity::updateViscosityRHS(scene, m_node_visc_indices_x, m_node_visc_indices_y, m_node_visc_indices_z,
 			                              m_effective_node_indices_x, m_effective_node_indices_y, m_effective_node_indices_z,
@@ -1953,12 +1961,20 @@ bool LinearizedImplicitEuler::stepImplicitViscosityDiagonalPCG( const TwoDScene&
 		int iter_out;
 		scalar residual;
 
-		viscosity::applyNodeViscosityImplicit(scene, m_node_visc_indices_x, m_node_visc_indices_y, m_node_visc_indices_z,
-		                                      offset_nodes_x, offset_nodes_y, offset_nodes_z,
-		                                      m_visc_matrix, m_visc_rhs, m_visc_solution,
-		                                      node_vel_x, node_vel_y, node_vel_z,
-		                                      residual, iter_out,
-		                                      m_viscous_criterion, m_maxiters);
+		if (m_viscosity_solver == viscosity::VS_BLOCK_PCG) {
+			viscosity::applyNodeViscosityImplicit(scene, m_node_visc_indices_x, m_node_visc_indices_y, m_node_visc_indices_z,
+			                                      offset_nodes_x, offset_nodes_y, offset_nodes_z,
+			                                      *m_visc_block_solver, m_visc_rhs, m_visc_solution,
+			                                      node_vel_x, node_vel_y, node_vel_z,
+			                                      residual, iter_out);
+		} else {
+			viscosity::applyNodeViscosityImplicit(scene, m_node_visc_indices_x, m_node_visc_indices_y, m_node_visc_indices_z,
+			                                      offset_nodes_x, offset_nodes_y, offset_nodes_z,
+			                                      m_visc_matrix, m_visc_rhs, m_visc_solution,
+			                                      node_vel_x, node_vel_y, node_vel_z,
+			                                      residual, iter_out,
+			                                      m_viscous_criterion, m_maxiters);
+		}
 
 		std::cout << "[implicit viscosity sub-step: " << i << ", total iter: " << iter_out << ", res: " << residual << "]" << std::endl;
 	}
@@ -2286,7 +2302,7 @@ bool LinearizedImplicitEuler::projectFine( TwoDScene& scene, scalar dt )
 	allocateCenterNodeVectors(scene, m_fine_global_indices);
 
 	pressure::solveNodePressure(scene, scene.getNodePressure(), m_fine_pressure_rhs,
-	                            m_fine_pressure_matrix, m_fine_global_indices,
+	                            *m_fine_pressure_amg, m_fine_global_indices,
 	                            m_node_psi_fs_x, m_node_psi_fs_y, m_node_psi_fs_z,
 	                            m_node_psi_sf_x, m_node_psi_sf_y, m_node_psi_sf_z,
 	                            m_node_v_fluid_plus_x, m_node_v_fluid_plus_y, m_node_v_fluid_plus_z,
@@ -2376,10 +2392,10 @@ bool LinearizedImplicitEuler::manifoldPropagate( TwoDScene& scene, scalar dt )
 {
 	const scalar subdt = dt / (scalar) m_manifold_substeps;
 
-	VectorXs& fluid_vol = scene.getFluidVol();
-	VectorXs& fluid_m = scene.getFluidM();
-	VectorXs& elasto_v = scene.getV();
-	VectorXs& elasto_m = scene.getM();
+	VectorXsRef fluid_vol = scene.getFluidVol();
+	VectorXsRef fluid_m = scene.getFluidM();
+	VectorXsRef elasto_v = scene.getV();
+	VectorXsRef elasto_m = scene.getM();
 
 	const VectorXs& fluid_m_gauss = scene.getGaussFluidM();
 	const VectorXs& fluid_vol_gauss = scene.getGaussFluidVol();
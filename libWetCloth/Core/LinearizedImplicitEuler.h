@@ -18,10 +18,17 @@
 #include "array3.h"
 #include "pcgsolver/sparse_matrix.h"
 
+template<class T>
+struct AMGLevels;
+
+namespace robertbridson {
+template <class T> struct BlockPCGSolver;
+}
+
 class LinearizedImplicitEuler : public SceneStepper
 {
 public:
-  LinearizedImplicitEuler( const scalar& criterion, const scalar& pressure_criterion, const scalar& quasi_static_criterion, const scalar& viscous_criterion, int maxiters, int manifold_substeps, int viscosity_substeps, int surf_tension_substeps );
+  LinearizedImplicitEuler( const scalar& criterion, const scalar& pressure_criterion, const scalar& quasi_static_criterion, const scalar& viscous_criterion, int maxiters, int manifold_substeps, int viscosity_substeps, int surf_tension_substeps, int viscosity_solver );
 
   virtual ~LinearizedImplicitEuler();
 
@@ -100,61 +107,61 @@ private:
     const std::vector< VectorXs >& node_m_z,
     const scalar& dt );
 
-  void performLocalSolveTwist( const TwoDScene& scene, const VectorXs& rhs, const VectorXs& m, VectorXs& out);
+  void performLocalSolveTwist( const TwoDScene& scene, const VectorXs& rhs, const ConstVectorXsRef& m, VectorXs& out);
 
-  void performLocalSolve( const TwoDScene& scene, const VectorXs& rhs, const VectorXs& m, VectorXs& out);
+  void performLocalSolve( const TwoDScene& scene, const VectorXs& rhs, const ConstVectorXsRef& m, VectorXs& out);
 
   void performInvLocalSolve( const TwoDScene& scene,
-                             const std::vector< VectorXs >& node_rhs_x,
-                             const std::vector< VectorXs >& node_rhs_y,
-                             const std::vector< VectorXs >& node_rhs_z,
-                             const std::vector< VectorXs >& node_inv_mass_x,
-                             const std::vector< VectorXs >& node_inv_mass_y,
-                             const std::vector< VectorXs >& node_inv_mass_z,
-                             std::vector< VectorXs >& out_node_vec_x,
-                             std::vector< VectorXs >& out_node_vec_y,
-                             std::vector< VectorXs >& out_node_vec_z );
+                             const ConstNodeVectorView& node_rhs_x,
+                             const ConstNodeVectorView& node_rhs_y,
+                             const ConstNodeVectorView& node_rhs_z,
+                             const ConstNodeVectorView& node_inv_mass_x,
+                             const ConstNodeVectorView& node_inv_mass_y,
+                             const ConstNodeVectorView& node_inv_mass_z,
+                             NodeVectorView out_node_vec_x,
+                             NodeVectorView out_node_vec_y,
+                             NodeVectorView out_node_vec_z );
 
   void performGroupedLocalSolve( const TwoDScene& scene,
-                                 const std::vector< VectorXs >& node_rhs_x,
-                                 const std::vector< VectorXs >& node_rhs_y,
-                                 const std::vector< VectorXs >& node_rhs_z,
-                                 std::vector< VectorXs >& out_node_vec_x,
-                                 std::vector< VectorXs >& out_node_vec_y,
-                                 std::vector< VectorXs >& out_node_vec_z );
+                                 const ConstNodeVectorView& node_rhs_x,
+                                 const ConstNodeVectorView& node_rhs_y,
+                                 const ConstNodeVectorView& node_rhs_z,
+                                 NodeVectorView out_node_vec_x,
+                                 NodeVectorView out_node_vec_y,
+                                 NodeVectorView out_node_vec_z );
 
   void performGlobalMultiply( const TwoDScene& scene, const scalar& dt,
-                              const std::vector< VectorXs >& node_m_x,
-                              const std::vector< VectorXs >& node_m_y,
-                              const std::vector< VectorXs >& node_m_z,
-                              const std::vector< VectorXs >& node_v_x,
-                              const std::vector< VectorXs >& node_v_y,
-                              const std::vector< VectorXs >& node_v_z,
-                              std::vector< VectorXs >& out_node_vec_x,
-                              std::vector< VectorXs >& out_node_vec_y,
-                              std::vector< VectorXs >& out_node_vec_z );
+                              const ConstNodeVectorView& node_m_x,
+                              const ConstNodeVectorView& node_m_y,
+                              const ConstNodeVectorView& node_m_z,
+                              const ConstNodeVectorView& node_v_x,
+                              const ConstNodeVectorView& node_v_y,
+                              const ConstNodeVectorView& node_v_z,
+                              NodeVectorView out_node_vec_x,
+                              NodeVectorView out_node_vec_y,
+                              NodeVectorView out_node_vec_z );
 
   void performGlobalMultiply( const TwoDScene& scene, const scalar& dt,
-                              const std::vector< VectorXs >& node_m_x,
-                              const std::vector< VectorXs >& node_m_y,
-                              const std::vector< VectorXs >& node_m_z,
-                              const std::vector< VectorXs >& node_v_x,
-                              const std::vector< VectorXs >& node_v_y,
-                              const std::vector< VectorXs >& node_v_z,
-                              std::vector< VectorXs >& out_node_vec_x,
-                              std::vector< VectorXs >& out_node_vec_y,
-                              std::vector< VectorXs >& out_node_vec_z,
-                              const VectorXs& m,
+                              const ConstNodeVectorView& node_m_x,
+                              const ConstNodeVectorView& node_m_y,
+                              const ConstNodeVectorView& node_m_z,
+                              const ConstNodeVectorView& node_v_x,
+                              const ConstNodeVectorView& node_v_y,
+                              const ConstNodeVectorView& node_v_z,
+                              NodeVectorView out_node_vec_x,
+                              NodeVectorView out_node_vec_y,
+                              NodeVectorView out_node_vec_z,
+                              const ConstVectorXsRef& m,
                               const VectorXs& angular_vec,
                               VectorXs& out);
 
   void performGlobalMultiply( const TwoDScene& scene, const scalar& dt,
-                              const VectorXs& m,
+                              const ConstVectorXsRef& m,
                               const VectorXs& vec,
                               VectorXs& out);
 
   void performAngularGlobalMultiply( const TwoDScene& scene, const scalar& dt,
-                                     const VectorXs& m,
+                                     const ConstVectorXsRef& m,
                                      const VectorXs& v,
                                      VectorXs& out);
 
@@ -267,6 +274,8 @@ private:
 
   void constructHessianPostProcess( TwoDScene& scene, const scalar& dt );
 
+  void buildHessianPattern( int ndof );
+
   void constructAngularHessianPreProcess( TwoDScene& scene, const scalar& dt );
 
   void constructAngularHessianPostProcess( TwoDScene& scene, const scalar& dt );
@@ -275,9 +284,19 @@ private:
   //    std::vector< Eigen::SimplicialLDLT< SparseXs >* > m_local_solvers;
 
   //    SparseXs m_A;
-  std::vector< std::pair<int, int> > m_triA_sup;
   std::vector< std::pair<int, int> > m_angular_triA_sup;
   TripletXs m_triA;
+
+  // Hessian of the soft elastic particles in CSR form. Every force writes
+  // its triplets into fixed slots of m_triA; the pattern (and the slots
+  // summed into each entry) is rebuilt only when the (row, col) of a slot
+  // changes, otherwise the values are gathered from the slots directly.
+  std::vector<int> m_hess_rowstart;
+  std::vector<int> m_hess_colindex;
+  std::vector<scalar> m_hess_value;
+  std::vector<int> m_hess_slot_start;
+  std::vector<int> m_hess_slots;
+  std::vector< std::pair<int, int> > m_hess_slot_pattern;
   TripletXs m_angular_triA;
   VectorXs m_multiply_buffer;
   VectorXs m_pre_mult_buffer;
@@ -295,6 +314,7 @@ private:
   const int m_manifold_substeps;
   const int m_viscosity_substeps;
   const int m_surf_tension_substeps;
+  const int m_viscosity_solver;
 
   std::vector< VectorXs > m_node_rhs_x;
   std::vector< VectorXs > m_node_rhs_y;
@@ -311,24 +331,27 @@ private:
   std::vector< VectorXs > m_node_v_tmp_x;
   std::vector< VectorXs > m_node_v_tmp_y;
   std::vector< VectorXs > m_node_v_tmp_z;
-  std::vector< VectorXs > m_node_r_x; //r0
-  std::vector< VectorXs > m_node_r_y;
-  std::vector< VectorXs > m_node_r_z;
-  std::vector< VectorXs > m_node_z_x; // s
-  std::vector< VectorXs > m_node_z_y;
-  std::vector< VectorXs > m_node_z_z;
-  std::vector< VectorXs > m_node_p_x; // p
-  std::vector< VectorXs > m_node_p_y;
-  std::vector< VectorXs > m_node_p_z;
-  std::vector< VectorXs > m_node_q_x; // h
-  std::vector< VectorXs > m_node_q_y;
-  std::vector< VectorXs > m_node_q_z;
-  std::vector< VectorXs > m_node_w_x; // v
-  std::vector< VectorXs > m_node_w_y;
-  std::vector< VectorXs > m_node_w_z;
-  std::vector< VectorXs > m_node_t_x; // t
-  std::vector< VectorXs > m_node_t_y;
-  std::vector< VectorXs > m_node_t_z;
+
+  // Krylov temporaries, flat and reused across the solves of all substeps
+  NodeVectorArena m_node_arena;
+  NodeVectorView m_node_r_x; //r0
+  NodeVectorView m_node_r_y;
+  NodeVectorView m_node_r_z;
+  NodeVectorView m_node_z_x; // s
+  NodeVectorView m_node_z_y;
+  NodeVectorView m_node_z_z;
+  NodeVectorView m_node_p_x; // p
+  NodeVectorView m_node_p_y;
+  NodeVectorView m_node_p_z;
+  NodeVectorView m_node_q_x; // h
+  NodeVectorView m_node_q_y;
+  NodeVectorView m_node_q_z;
+  NodeVectorView m_node_w_x; // v
+  NodeVectorView m_node_w_y;
+  NodeVectorView m_node_w_z;
+  NodeVectorView m_node_t_x; // t
+  NodeVectorView m_node_t_y;
+  NodeVectorView m_node_t_z;
 
   VectorXs m_angular_r;
   VectorXs m_angular_z;
@@ -474,7 +497,7 @@ private:
   robertbridson::SparseMatrix<scalar> m_arr_pressure_matrix;
 
   std::vector<double> m_fine_pressure_rhs;
-  robertbridson::SparseMatrix<scalar> m_fine_pressure_matrix;
+  std::shared_ptr< AMGLevels<scalar> > m_fine_pressure_amg;
   std::vector< VectorXi > m_fine_global_indices;
 
   SparseXs m_A;
@@ -507,6 +530,7 @@ private:
   robertbridson::SparseMatrix<scalar> m_visc_matrix;
   std::vector< scalar > m_visc_rhs;
   std::vector< scalar > m_visc_solution;
+  std::shared_ptr< robertbridson::BlockPCGSolver<scalar> > m_visc_block_solver;
 
   std::vector< Vector2i > m_effective_node_indices_x;
   std::vector< Vector2i > m_effective_node_indices_y;
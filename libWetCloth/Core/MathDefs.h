@@ -545,6 +545,11 @@ typedef Eigen::Matrix<int, 125, 3> Matrix125x3i;
 typedef Eigen::Matrix<scalar, Eigen::Dynamic, Eigen::Dynamic> MatrixXs;
 typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic> MatrixXf;
 typedef Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic> MatrixXi;
+typedef Eigen::Matrix<scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> MatrixRXs;
+
+// bind a VectorXs (or a segment or head of one) without a copy
+typedef Eigen::Ref<VectorXs> VectorXsRef;
+typedef Eigen::Ref<const VectorXs> ConstVectorXsRef;
 
 typedef Eigen::SparseMatrix<scalar, Eigen::ColMajor> SparseXs;
 typedef Eigen::SparseMatrix<scalar, Eigen::RowMajor> SparseRXs;
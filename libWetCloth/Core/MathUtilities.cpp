@@ -27,6 +27,30 @@ scalar scalarRand( const scalar min, const scalar max )
 	return distribution(generator);
 }
 
+scalar streamRand( uint64_t key, int draw, const scalar min, const scalar max )
+{
+	if (threadutils::is_deterministic()) return hashRand(key + (uint64_t) draw, min, max);
+
+	return scalarRand(min, max);
+}
+
+int streamRandInt( uint64_t key, int n )
+{
+	if (threadutils::is_deterministic()) return (int) (hash64(key) % (uint64_t) n);
+
+	return rand() % n;
+}
+
+void fisherYates( int n, std::vector<int>& indices, uint64_t key )
+{
+	indices.resize(n);
+	for (int i = 0; i < n; ++i) indices[i] = i;
+	for (int i = n - 1; i >= 1; --i) {
+		const int j = streamRandInt(key + (uint64_t) i, i + 1);
+		std::swap(indices[i], indices[j]);
+	}
+}
+
 void print_histogram_analysis(const std::vector< VectorXs >& vec, int num_bins, const std::string& name, bool nonzero)
 {
 	if (!vec.size()) return;
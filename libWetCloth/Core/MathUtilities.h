@@ -11,6 +11,7 @@
 #define MATH_UTILITIES_H
 
 #include <Eigen/Core>
+#include <cstdint>
 #include "MathDefs.h"
 #include <iostream>
 #include <random>
@@ -240,20 +241,54 @@ inline void swap(Eigen::Matrix<S, Eigen::Dynamic, Eigen::Dynamic>& v, int i, int
 	v.template block<K, K>(j * K, 0) = c;
 }
 
-inline void fisherYates( int n, std::vector<int>& indices )
-{
-	indices.resize(n);
-	for (int i = 0; i < n; ++i) indices[i] = i;
-	for (int i = n - 1; i >= 1; --i) {
-		const int j = rand() % (i + 1);
-		std::swap(indices[i], indices[j]);
-	}
-}
+// shuffle drawn from rand(), or from the stream key in the deterministic mode
+void fisherYates( int n, std::vector<int>& indices, uint64_t key = 0 );
 
 bool approxSymmetric( const MatrixXs& A, const scalar& eps );
 
 scalar scalarRand(const scalar min, const scalar max);
 
+// splitmix64 finalizer, a well-mixed 64-bit hash
+inline uint64_t hash64(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+// uniform in [min, max), a pure function of the key (safe to call from parallel loops)
+inline scalar hashRand(uint64_t key, const scalar min, const scalar max)
+{
+	return min + (max - min) * (scalar) (hash64(key) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// independent random streams of a step, see streamKey
+enum RAND_STREAM
+{
+	RS_SAMPLE,
+	RS_SAMPLE_MESH,
+	RS_RESAMPLE,
+	RS_DART_ORDER,
+	RS_CORRECTION,
+	RS_RELEASE,
+
+	RS_COUNT
+};
+
+// key of the counter-based stream of an element (particle, cell, edge...)
+// in a step, so draws do not depend on which thread makes them
+inline uint64_t streamKey(uint64_t step, RAND_STREAM stream, uint64_t id)
+{
+	return hash64(hash64(hash64(step) ^ (uint64_t) stream) ^ id);
+}
+
+// the draw-th number of a stream in the deterministic mode, scalarRand otherwise
+scalar streamRand(uint64_t key, int draw, const scalar min, const scalar max);
+
+// integer in [0, n), from the stream in the deterministic mode, rand() otherwise
+int streamRandInt(uint64_t key, int n);
+
 inline scalar perimeter(const scalar& ra, const scalar& rb)
 {
 	// The second-Ramanujan approximation to ellipse perimeter
@@ -472,6 +507,27 @@ inline scalar grad_linear_kernel(const scalar& x) {
 	else return 0.0;
 }
 
+/*!
+ * Quadratic weights of a whole 3x3x3 stencil, with node (i, j, k) stored at
+ * k * 9 + j * 3 + i (the order of TwoDScene::findNodes). d is the offset of
+ * the sample from node (0, 0, 0) in cells. The kernel is separable, so only
+ * 9 1D kernels are evaluated and the tensor product is a branch-free loop
+ * that the compiler vectorizes. The weights are stored per particle, so
+ * evaluating several particles per vector lane only adds a transpose on the
+ * way out, and float weights would be widened again by every transfer.
+ */
+inline void quad_kernel_stencil(const Vector3s& d, Eigen::Matrix<scalar, 27, 1>& w) {
+	scalar w1d[3][3];
+	for (int r = 0; r < 3; ++r)
+		for (int i = 0; i < 3; ++i)
+			w1d[r][i] = quad_kernel(d(r) - (scalar) i);
+
+	for (int k = 0; k < 3; ++k) for (int j = 0; j < 3; ++j) {
+		const scalar wjk = w1d[1][j] * w1d[2][k];
+		for (int i = 0; i < 3; ++i) w(k * 9 + j * 3 + i) = w1d[0][i] * wjk;
+	}
+}
+
 template<int order>
 inline scalar N_kernel(const Vector3s& x) {
 	if (order == 2)
@@ -0,0 +1,124 @@
+//
+// This file is part of the libWetCloth open source project
+//
+// Copyright 2018 Yun (Raymond) Fei, Christopher Batty, Eitan Grinspun, and Changxi Zheng
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef NODE_PARTICLE_PAIRS_H
+#define NODE_PARTICLE_PAIRS_H
+
+#include <vector>
+#include <numeric>
+
+/*!
+ * Node-to-particle adjacency of one staggered grid, stored per bucket in
+ * compressed sparse row form: the pairs (particle id, id in particle
+ * neighborhoods) of node i are pairs[offsets[i]], ..., pairs[offsets[i + 1] - 1].
+ *
+ * Building is a counting sort in two passes over the particle stencils
+ * (count, then insert), so the storage of each bucket is reused across
+ * substeps and no per-node allocation happens.
+ */
+class NodeParticlePairs
+{
+public:
+	typedef std::pair<int, int> Pair;
+
+	class Range
+	{
+	public:
+		Range( const Pair* b, const Pair* e ) : m_begin(b), m_end(e) {}
+
+		inline const Pair* begin() const { return m_begin; }
+		inline const Pair* end() const { return m_end; }
+		inline int size() const { return (int) (m_end - m_begin); }
+		inline bool empty() const { return m_end == m_begin; }
+		inline const Pair& operator[]( int i ) const { return m_begin[i]; }
+
+	private:
+		const Pair* m_begin;
+		const Pair* m_end;
+	};
+
+	class BucketView
+	{
+	public:
+		BucketView( const NodeParticlePairs& pairs, int bucket_idx ) : m_pairs(pairs), m_bucket_idx(bucket_idx) {}
+
+		inline Range operator[]( int node_idx ) const
+		{
+			return m_pairs.get(m_bucket_idx, node_idx);
+		}
+
+	private:
+		const NodeParticlePairs& m_pairs;
+		int m_bucket_idx;
+	};
+
+	inline int size() const
+	{
+		return (int) m_offsets.size();
+	}
+
+	void resize( int num_buckets )
+	{
+		if ((int) m_offsets.size() != num_buckets) {
+			m_offsets.resize(num_buckets);
+			m_cursors.resize(num_buckets);
+			m_pairs.resize(num_buckets);
+		}
+	}
+
+	// reset the counters of a bucket, inactive buckets have no nodes
+	void clear( int bucket_idx, int num_nodes )
+	{
+		m_offsets[bucket_idx].assign(num_nodes + 1, 0);
+		m_pairs[bucket_idx].resize(0);
+	}
+
+	// first pass: count the pairs of a node
+	inline void count( int bucket_idx, int node_idx )
+	{
+		++m_offsets[bucket_idx][node_idx + 1];
+	}
+
+	// between the passes: turn counts into offsets and size the storage
+	void allocate( int bucket_idx )
+	{
+		std::vector<int>& offsets = m_offsets[bucket_idx];
+		std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+		m_cursors[bucket_idx].assign(offsets.begin(), offsets.end());
+		m_pairs[bucket_idx].resize(offsets.back());
+	}
+
+	// second pass: pairs are stored in the order they are inserted
+	inline void insert( int bucket_idx, int node_idx, int pidx, int local_idx )
+	{
+		m_pairs[bucket_idx][m_cursors[bucket_idx][node_idx]++] = Pair(pidx, local_idx);
+	}
+
+	inline Range get( int bucket_idx, int node_idx ) const
+	{
+		const std::vector<int>& offsets = m_offsets[bucket_idx];
+		if (node_idx + 1 >= (int) offsets.size()) return Range(nullptr, nullptr);
+
+		const Pair* data = m_pairs[bucket_idx].data();
+		return Range(data + offsets[node_idx], data + offsets[node_idx + 1]);
+	}
+
+	inline BucketView operator[]( int bucket_idx ) const
+	{
+		return BucketView(*this, bucket_idx);
+	}
+
+private:
+	std::vector< std::vector<int> > m_offsets;
+	std::vector< std::vector<int> > m_cursors;
+	std::vector< std::vector<Pair> > m_pairs;
+};
+
+#endif
@@ -0,0 +1,242 @@
+//
+// This file is part of the libWetCloth open source project
+//
+// Copyright 2018 Yun (Raymond) Fei, Christopher Batty, Eitan Grinspun, and Changxi Zheng
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef NODE_VECTOR_ARENA_H
+#define NODE_VECTOR_ARENA_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+
+#include "MathDefs.h"
+#include "ThreadUtils.h"
+
+/*!
+ * Flat storage for solver temporaries that live on the sparse grid.
+ *
+ * All the fields of an arena share one layout: the nodes of bucket b are
+ * stored at [offset(b), offset(b) + numNodes(b)) of a contiguous buffer, and
+ * every bucket starts on a 64-byte boundary. The padding between buckets
+ * is kept at zero, so reductions can run over the whole buffer at once.
+ *
+ * The layout is keyed by the node counts of the buckets. Setting the same
+ * counts again is a no-op; new counts zero all the fields. Buffers only
+ * grow, so the storage is recycled across substeps.
+ */
+class NodeVectorArena
+{
+public:
+	NodeVectorArena() : m_offsets(1, 0) {}
+
+	// returns true if the node counts differ from the current layout
+	template<typename Callable>
+	bool setLayout( int num_buckets, Callable num_nodes )
+	{
+		bool changed = ((int) m_counts.size() != num_buckets);
+		if (changed) m_counts.resize(num_buckets);
+
+		for (int i = 0; i < num_buckets; ++i) {
+			const int n = num_nodes(i);
+			if (n != m_counts[i]) {
+				m_counts[i] = n;
+				changed = true;
+			}
+		}
+
+		if (!changed) return false;
+
+		m_offsets.resize(num_buckets + 1);
+		m_offsets[0] = 0;
+		for (int i = 0; i < num_buckets; ++i) {
+			m_offsets[i + 1] = m_offsets[i] + padded(m_counts[i]);
+		}
+
+		for (auto& field : m_fields) {
+			reserve(field);
+			std::fill(data(field), data(field) + flatSize(), scalar(0.));
+		}
+
+		return true;
+	}
+
+	// fields registered later follow the current layout
+	int addField()
+	{
+		m_fields.push_back(std::vector<scalar>());
+		reserve(m_fields.back());
+		return (int) m_fields.size() - 1;
+	}
+
+	void zero( int field )
+	{
+		std::fill(data(field), data(field) + flatSize(), scalar(0.));
+	}
+
+	inline int size() const
+	{
+		return (int) m_counts.size();
+	}
+
+	inline int numNodes( int bucket_idx ) const
+	{
+		return m_counts[bucket_idx];
+	}
+
+	inline int offset( int bucket_idx ) const
+	{
+		return m_offsets[bucket_idx];
+	}
+
+	inline int flatSize() const
+	{
+		return m_offsets.back();
+	}
+
+	inline scalar* data( int field )
+	{
+		return data(m_fields[field]);
+	}
+
+	inline const scalar* data( int field ) const
+	{
+		return data(const_cast<std::vector<scalar>&>(m_fields[field]));
+	}
+
+	// sum of func(begin, end) over fixed blocks of the flat range, in block order
+	template<typename Callable>
+	scalar reduce( Callable func ) const
+	{
+		return threadutils::reduction(flatSize(), (scalar) 0., func, std::plus<scalar>());
+	}
+
+private:
+	static const int align_bytes = 64;
+	static const int align_scalars = (align_bytes + (int) sizeof(scalar) - 1) / (int) sizeof(scalar);
+
+	static inline int padded( int n )
+	{
+		return (n + align_scalars - 1) / align_scalars * align_scalars;
+	}
+
+	inline void reserve( std::vector<scalar>& field )
+	{
+		// one extra line to shift the start onto the boundary
+		const size_t needed = (size_t) flatSize() + align_scalars;
+		if (field.size() < needed) field.resize(std::max(needed, field.size() * 2));
+	}
+
+	static inline scalar* data( std::vector<scalar>& field )
+	{
+		const uintptr_t p = reinterpret_cast<uintptr_t>(field.data());
+		return reinterpret_cast<scalar*>((p + align_bytes - 1) & ~(uintptr_t) (align_bytes - 1));
+	}
+
+	std::vector<int> m_counts;
+	std::vector<int> m_offsets;
+	std::vector< std::vector<scalar> > m_fields;
+};
+
+/*!
+ * Per-bucket access to a node field, either a std::vector< VectorXs > or a
+ * field of a NodeVectorArena, so the solver kernels take both. Views do not
+ * own storage and are cheap to copy; buckets are returned as Eigen maps.
+ * Inputs that are only read are taken as ConstNodeVectorView below.
+ */
+class NodeVectorView
+{
+public:
+	NodeVectorView() : m_vec(nullptr), m_arena(nullptr), m_field(-1) {}
+
+	NodeVectorView( std::vector< VectorXs >& vec ) : m_vec(&vec), m_arena(nullptr), m_field(-1) {}
+
+	NodeVectorView( NodeVectorArena& arena, int field ) : m_vec(nullptr), m_arena(&arena), m_field(field) {}
+
+	inline int size() const
+	{
+		return m_arena ? m_arena->size() : (int) m_vec->size();
+	}
+
+	inline Eigen::Map<VectorXs> operator[]( int bucket_idx )
+	{
+		if (m_arena) return Eigen::Map<VectorXs>(m_arena->data(m_field) + m_arena->offset(bucket_idx), m_arena->numNodes(bucket_idx));
+		VectorXs& v = (*m_vec)[bucket_idx];
+		return Eigen::Map<VectorXs>(v.data(), v.size());
+	}
+
+	inline Eigen::Map<const VectorXs> operator[]( int bucket_idx ) const
+	{
+		if (m_arena) return Eigen::Map<const VectorXs>(m_arena->data(m_field) + m_arena->offset(bucket_idx), m_arena->numNodes(bucket_idx));
+		const VectorXs& v = (*m_vec)[bucket_idx];
+		return Eigen::Map<const VectorXs>(v.data(), v.size());
+	}
+
+	// the arena and field backing this view, or null for per-bucket vectors
+	inline NodeVectorArena* arena() const
+	{
+		return m_arena;
+	}
+
+	inline int field() const
+	{
+		return m_field;
+	}
+
+private:
+	friend class ConstNodeVectorView;
+
+	std::vector< VectorXs >* m_vec;
+	NodeVectorArena* m_arena;
+	int m_field;
+};
+
+/*!
+ * Read-only counterpart of NodeVectorView, for the inputs of the kernels:
+ * it also takes const per-bucket vectors, which it never writes through.
+ */
+class ConstNodeVectorView
+{
+public:
+	ConstNodeVectorView() : m_vec(nullptr), m_arena(nullptr), m_field(-1) {}
+
+	ConstNodeVectorView( const std::vector< VectorXs >& vec ) : m_vec(&vec), m_arena(nullptr), m_field(-1) {}
+
+	ConstNodeVectorView( const NodeVectorArena& arena, int field ) : m_vec(nullptr), m_arena(&arena), m_field(field) {}
+
+	ConstNodeVectorView( const NodeVectorView& view ) : m_vec(view.m_vec), m_arena(view.m_arena), m_field(view.m_field) {}
+
+	inline int size() const
+	{
+		return m_arena ? m_arena->size() : (int) m_vec->size();
+	}
+
+	inline Eigen::Map<const VectorXs> operator[]( int bucket_idx ) const
+	{
+		if (m_arena) return Eigen::Map<const VectorXs>(m_arena->data(m_field) + m_arena->offset(bucket_idx), m_arena->numNodes(bucket_idx));
+		const VectorXs& v = (*m_vec)[bucket_idx];
+		return Eigen::Map<const VectorXs>(v.data(), v.size());
+	}
+
+	inline const NodeVectorArena* arena() const
+	{
+		return m_arena;
+	}
+
+	inline int field() const
+	{
+		return m_field;
+	}
+
+private:
+	const std::vector< VectorXs >* m_vec;
+	const NodeVectorArena* m_arena;
+	int m_field;
+};
+
+#endif
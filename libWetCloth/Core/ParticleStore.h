@@ -0,0 +1,459 @@
+//
+// This file is part of the libWetCloth open source project
+//
+// Copyright 2018 Yun (Raymond) Fei, Christopher Batty, Eitan Grinspun, and Changxi Zheng
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef PARTICLE_STORE_H
+#define PARTICLE_STORE_H
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "MathDefs.h"
+#include "ThreadUtils.h"
+#include "Checkpoint.h"
+
+/*!
+ * Column registry for per-particle state. Every per-particle array of the
+ * scene is registered once as a column (with its number of entries per
+ * particle), so that resizing, swapping, permuting and compacting the
+ * particle system is done in a single place and in a single pass per column.
+ *
+ * The store grows its capacity geometrically and keeps an explicit live
+ * count. std::vector columns reserve the capacity. Eigen columns are sized
+ * to the capacity, and only their first size() particles are live: the
+ * scene hands out the live prefix (head) as an Eigen::Ref, which forces and
+ * steppers take without a copy. So growing within the capacity does not
+ * move any particle, and compaction moves the survivors down in place.
+ *
+ * Columns are named, and checkpoints hold every column that is not
+ * transient under its name.
+ *
+ * The store does not change the layout of the arrays: the state vectors
+ * (x, v, fluid_v, ...) stay interleaved with a stride of 4 per particle,
+ * since the forces and the solvers take them as the vector of the 4N
+ * degrees of freedom. Splitting them into per-component columns changes
+ * that interface and is left to a change of its own.
+ */
+class ParticleStore
+{
+	struct Column
+	{
+		Column() : name(NULL), transient(false) {}
+		virtual ~Column() {}
+		virtual void resize( int n ) = 0;
+		virtual void conservativeResize( int n ) = 0;
+		// room for n particles, the live ones are kept
+		virtual void reserve( int n ) = 0;
+		virtual void swap( int i, int j ) = 0;
+		// new[i] = old[src[i]], the column ends up with src.size() particles
+		virtual void gather( const std::vector<int>& src ) = 0;
+		// new[first + i] = old[moved[i]] with moved ascending and > first, the
+		// column ends up with first + moved.size() particles. Since moved[i] >
+		// first + i, copying in ascending order never overwrites a later source.
+		virtual void compact( int first, const std::vector<int>& moved ) = 0;
+		// the first n particles are live
+		virtual void save( CheckpointWriter& out, const std::string& key, int n ) const = 0;
+		// false unless the checkpoint holds exactly n particles of this column
+		virtual bool load( const CheckpointReader& in, const std::string& key, int n ) = 0;
+
+		const char* name;
+
+		// transient columns are recomputed every step: they follow the size
+		// of the store but their content is not carried along when moving.
+		bool transient;
+	};
+
+	// Eigen columns hold the capacity; the live count is kept by the store,
+	// so growing and shrinking within the capacity leaves them alone.
+	template<typename S>
+	struct VectorColumn : public Column
+	{
+		typedef Eigen::Matrix<S, Eigen::Dynamic, 1> Storage;
+
+		Storage& data;
+		const int stride;
+
+		VectorColumn( Storage& d, int s ) : data(d), stride(s) {}
+
+		void resize( int ) override {}
+
+		void conservativeResize( int ) override {}
+
+		void reserve( int n ) override
+		{
+			data.conservativeResize(n * stride);
+		}
+
+		void swap( int i, int j ) override
+		{
+			for (int r = 0; r < stride; ++r) std::swap(data(i * stride + r), data(j * stride + r));
+		}
+
+		void gather( const std::vector<int>& src ) override
+		{
+			const int n = (int) src.size();
+			Storage buffer(std::max(data.size(), (Eigen::Index) n * stride));
+			threadutils::for_each(0, n, [&] (int i) {
+				buffer.segment(i * stride, stride) = data.segment(src[i] * stride, stride);
+			});
+			data.swap(buffer);
+		}
+
+		void compact( int first, const std::vector<int>& moved ) override
+		{
+			const int n = (int) moved.size();
+			for (int i = 0; i < n; ++i) data.segment((first + i) * stride, stride) = data.segment(moved[i] * stride, stride);
+		}
+
+		void save( CheckpointWriter& out, const std::string& key, int n ) const override
+		{
+			out.addBytes(key, data.data(), (uint64_t) n * stride, sizeof(S));
+		}
+
+		bool load( const CheckpointReader& in, const std::string& key, int n ) override
+		{
+			// the store reserved n particles before loading
+			return in.readBytes(key, data.data(), (uint64_t) n * stride, sizeof(S));
+		}
+	};
+
+	// row-major, so that the live particles are a contiguous prefix
+	template<typename S>
+	struct MatrixColumn : public Column
+	{
+		typedef Eigen::Matrix<S, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Storage;
+
+		Storage& data;
+		const int rows;
+		const int cols;
+
+		MatrixColumn( Storage& d, int r, int c ) : data(d), rows(r), cols(c) {}
+
+		void resize( int ) override {}
+
+		void conservativeResize( int ) override {}
+
+		void reserve( int n ) override
+		{
+			data.conservativeResize(n * rows, cols);
+		}
+
+		void swap( int i, int j ) override
+		{
+			data.middleRows(i * rows, rows).swap(data.middleRows(j * rows, rows));
+		}
+
+		void gather( const std::vector<int>& src ) override
+		{
+			const int n = (int) src.size();
+			Storage buffer(std::max(data.rows(), (Eigen::Index) n * rows), cols);
+			threadutils::for_each(0, n, [&] (int i) {
+				buffer.middleRows(i * rows, rows) = data.middleRows(src[i] * rows, rows);
+			});
+			data.swap(buffer);
+		}
+
+		void compact( int first, const std::vector<int>& moved ) override
+		{
+			const int n = (int) moved.size();
+			for (int i = 0; i < n; ++i) data.middleRows((first + i) * rows, rows) = data.middleRows(moved[i] * rows, rows);
+		}
+
+		void save( CheckpointWriter& out, const std::string& key, int n ) const override
+		{
+			out.addBytes(key, data.data(), (uint64_t) n * rows * cols, sizeof(S), (uint32_t) cols);
+		}
+
+		bool load( const CheckpointReader& in, const std::string& key, int n ) override
+		{
+			const Checkpoint::Entry* e = in.find(key);
+			if (!e || e->cols != (uint32_t) cols) return false;
+			return in.readBytes(key, data.data(), (uint64_t) n * rows * cols, sizeof(S));
+		}
+	};
+
+	template<typename T, typename A>
+	struct StdColumn : public Column
+	{
+		typedef std::vector<T, A> Storage;
+
+		Storage& data;
+		const T fill;
+
+		StdColumn( Storage& d, const T& f ) : data(d), fill(f) {}
+
+		void resize( int n ) override
+		{
+			data.resize(n, fill);
+		}
+
+		void conservativeResize( int n ) override
+		{
+			data.resize(n, fill);
+		}
+
+		void reserve( int n ) override
+		{
+			data.reserve(n);
+		}
+
+		void swap( int i, int j ) override
+		{
+			using std::swap;
+			swap(data[i], data[j]);
+		}
+
+		void gather( const std::vector<int>& src ) override
+		{
+			const int n = (int) src.size();
+			Storage buffer;
+			buffer.reserve(std::max(data.capacity(), src.size()));
+			buffer.resize(n);
+			threadutils::for_each(0, n, [&] (int i) {
+				buffer[i] = std::move(data[src[i]]);
+			});
+			data.swap(buffer);
+		}
+
+		void compact( int first, const std::vector<int>& moved ) override
+		{
+			const int n = (int) moved.size();
+			for (int i = 0; i < n; ++i) data[first + i] = std::move(data[moved[i]]);
+			data.resize(first + n, fill);
+		}
+
+		void save( CheckpointWriter& out, const std::string& key, int ) const override
+		{
+			out.add(key, data);
+		}
+
+		bool load( const CheckpointReader& in, const std::string& key, int n ) override
+		{
+			return in.read(key, data) && (int) data.size() == n;
+		}
+	};
+
+	// std::vector<bool> packs bits into shared words, so it can be neither
+	// swapped through references nor written concurrently.
+	template<typename A>
+	struct StdColumn<bool, A> : public Column
+	{
+		typedef std::vector<bool, A> Storage;
+
+		Storage& data;
+		const bool fill;
+
+		StdColumn( Storage& d, bool f ) : data(d), fill(f) {}
+
+		void resize( int n ) override
+		{
+			data.resize(n, fill);
+		}
+
+		void conservativeResize( int n ) override
+		{
+			data.resize(n, fill);
+		}
+
+		void reserve( int n ) override
+		{
+			data.reserve(n);
+		}
+
+		void swap( int i, int j ) override
+		{
+			const bool c = data[i];
+			data[i] = data[j];
+			data[j] = c;
+		}
+
+		void gather( const std::vector<int>& src ) override
+		{
+			const int n = (int) src.size();
+			Storage buffer(n);
+			for (int i = 0; i < n; ++i) buffer[i] = data[src[i]];
+			data.swap(buffer);
+		}
+
+		void compact( int first, const std::vector<int>& moved ) override
+		{
+			const int n = (int) moved.size();
+			for (int i = 0; i < n; ++i) data[first + i] = data[moved[i]];
+			data.resize(first + n, fill);
+		}
+
+		void save( CheckpointWriter& out, const std::string& key, int ) const override
+		{
+			out.add(key, data);
+		}
+
+		bool load( const CheckpointReader& in, const std::string& key, int n ) override
+		{
+			return in.read(key, data) && (int) data.size() == n;
+		}
+	};
+
+public:
+	ParticleStore() : m_size(0), m_capacity(0) {}
+
+	ParticleStore( const ParticleStore& ) = delete;
+
+	// data is sized to the capacity; its first size() particles are live
+	template<typename S>
+	void addColumn( const char* name, Eigen::Matrix<S, Eigen::Dynamic, 1>& data, int stride = 1 )
+	{
+		m_columns.emplace_back(new VectorColumn<S>(data, stride));
+		m_columns.back()->name = name;
+		m_columns.back()->reserve(m_capacity);
+	}
+
+	// a particle owns a block of `rows` consecutive rows of the matrix
+	template<typename S>
+	void addColumn( const char* name, Eigen::Matrix<S, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>& data, int rows, int cols )
+	{
+		m_columns.emplace_back(new MatrixColumn<S>(data, rows, cols));
+		m_columns.back()->name = name;
+		m_columns.back()->reserve(m_capacity);
+	}
+
+	template<typename T, typename A>
+	void addColumn( const char* name, std::vector<T, A>& data, const T& fill = T() )
+	{
+		m_columns.emplace_back(new StdColumn<T, A>(data, fill));
+		m_columns.back()->name = name;
+	}
+
+	// scratch data that is rebuilt before use (weights, stencils, ...)
+	template<typename T, typename A>
+	void addTransientColumn( std::vector<T, A>& data )
+	{
+		m_columns.emplace_back(new StdColumn<T, A>(data, T()));
+		m_columns.back()->transient = true;
+	}
+
+	inline int size() const
+	{
+		return m_size;
+	}
+
+	inline int capacity() const
+	{
+		return m_capacity;
+	}
+
+	void reserve( int n )
+	{
+		if (n <= m_capacity) return;
+		for (auto& c : m_columns) c->reserve(n);
+		m_capacity = n;
+	}
+
+	void resize( int n )
+	{
+		reserve(n);
+		for (auto& c : m_columns) c->resize(n);
+		m_size = n;
+	}
+
+	// growing past the capacity reserves half as much again
+	void conservativeResize( int n )
+	{
+		if (n > m_capacity) reserve(std::max(n, m_capacity + m_capacity / 2));
+		for (auto& c : m_columns) c->conservativeResize(n);
+		m_size = n;
+	}
+
+	void swap( int i, int j )
+	{
+		for (auto& c : m_columns) {
+			if (!c->transient) c->swap(i, j);
+		}
+	}
+
+	/*!
+	 * reorder all columns so that new particle i is old particle order[i].
+	 * order may be shorter than the current size, in which case the particles
+	 * not referenced are dropped.
+	 */
+	void permute( const std::vector<int>& order )
+	{
+		const int n = (int) order.size();
+		threadutils::for_each(0, (int) m_columns.size(), [&] (int c) {
+			if (m_columns[c]->transient) m_columns[c]->conservativeResize(n);
+			else m_columns[c]->gather(order);
+		});
+		m_size = n;
+	}
+
+	/*!
+	 * remove all particles whose keep flag is zero, preserving the relative
+	 * order of the survivors. Only the survivors after the first removed
+	 * particle move, in one pass per column (the columns in parallel).
+	 * Returns the new number of particles.
+	 */
+	int compact( const std::vector<unsigned char>& keep )
+	{
+		int first = 0;
+		while (first < m_size && keep[first]) ++first;
+		if (first == m_size) return m_size;
+
+		m_moved.resize(0);
+		for (int i = first + 1; i < m_size; ++i) {
+			if (keep[i]) m_moved.push_back(i);
+		}
+
+		const int n = first + (int) m_moved.size();
+		threadutils::for_each(0, (int) m_columns.size(), [&] (int c) {
+			if (m_columns[c]->transient) m_columns[c]->conservativeResize(n);
+			else m_columns[c]->compact(first, m_moved);
+		});
+		m_size = n;
+
+		return m_size;
+	}
+
+	void save( CheckpointWriter& out, const std::string& prefix ) const
+	{
+		out.addValue(prefix + "count", m_size);
+		for (auto& c : m_columns) {
+			if (!c->transient) c->save(out, prefix + c->name, m_size);
+		}
+	}
+
+	/*!
+	 * replace all columns by the ones of a checkpoint; transient columns are
+	 * only resized. Returns false if a column is missing or has the wrong size.
+	 */
+	bool load( const CheckpointReader& in, const std::string& prefix )
+	{
+		int n = 0;
+		if (!in.readValue(prefix + "count", n)) return false;
+
+		reserve(n);
+		for (auto& c : m_columns) {
+			if (c->transient) {
+				c->resize(n);
+			} else if (!c->load(in, prefix + c->name, n)) {
+				std::cerr << "[checkpoint: particle column " << c->name << " is missing or has a wrong size]" << std::endl;
+				return false;
+			}
+		}
+		m_size = n;
+
+		return true;
+	}
+
+private:
+	std::vector< std::unique_ptr<Column> > m_columns;
+	std::vector<int> m_moved;
+	int m_size;
+	int m_capacity;
+};
+
+#endif
@@ -222,7 +222,7 @@ void constructNodeIncompressibleCondition(const TwoDScene& scene,
 void solveNodePressure( const TwoDScene& scene,
                         std::vector< VectorXs >& pressure,
                         std::vector<double>& rhs,
-                        robertbridson::SparseMatrix<scalar>& matrix,
+                        AMGLevels<scalar>& amg_levels,
                         std::vector< VectorXi >& node_global_indices,
                         const std::vector< VectorXs >& node_psi_fs_x,
                         const std::vector< VectorXs >& node_psi_fs_y,
@@ -281,9 +281,7 @@ void solveNodePressure( const TwoDScene& scene,
 
 	std::vector<int> num_effective_nodes( buckets.size() );
 	// assign global indices to nodes
-	buckets.for_each_bucket([&] (int bucket_idx) {
-		if (!scene.isBucketActivated(bucket_idx)) return;
-
+	buckets.for_each_active_bucket([&] (int bucket_idx) {
 		const int num_nodes_p = node_liquid_phi[bucket_idx].size();
 		const VectorXi& bucket_pn = pressure_neighbors[bucket_idx];
 
@@ -337,14 +335,23 @@ void solveNodePressure( const TwoDScene& scene,
 
 	if ((int) rhs.size() != total_num_nodes) {
 		rhs.resize(total_num_nodes);
-		matrix.resize(total_num_nodes);
 	}
 
-	matrix.zero();
-
-	buckets.for_each_bucket([&] (int bucket_idx) {
-		if (!scene.isBucketActivated(bucket_idx)) return;
-
+	// each row holds the diagonal and at most 6 neighbors. Rows are built in
+	// parallel into fixed slots, then packed into the CSR arrays once their
+	// lengths are known. The slots are kept in amg_levels, so they are only
+	// reallocated when the system grows.
+	const int max_row_entries = 7;
+	std::vector<unsigned int>& slot_colindex = amg_levels.slot_colindex;
+	std::vector<scalar>& slot_value = amg_levels.slot_value;
+	slot_colindex.resize(total_num_nodes * max_row_entries);
+	slot_value.resize(total_num_nodes * max_row_entries);
+
+	robertbridson::FixedSparseMatrix<scalar>& matrix = *(amg_levels.A);
+	matrix.resize(total_num_nodes);
+	matrix.rowstart[0] = 0;
+
+	buckets.for_each_active_bucket([&] (int bucket_idx) {
 		const int num_nodes_p = node_liquid_phi[bucket_idx].size();
 		const Vector3i handle = buckets.bucket_handle(bucket_idx);
 
@@ -378,6 +385,22 @@ void solveNodePressure( const TwoDScene& scene,
 		const scalar center_phi = node_liquid_phi[bucket_idx][node_idx];
 		rhs[dof_idx] = 0.0;
 
+		unsigned int* row_colindex = &slot_colindex[dof_idx * max_row_entries];
+		scalar* row_value = &slot_value[dof_idx * max_row_entries];
+		int row_size = 0;
+
+		auto add_to_row = [&] (int col, scalar increment_value) {
+			for (int k = 0; k < row_size; ++k) {
+				if (row_colindex[k] == (unsigned int) col) {
+					row_value[k] += increment_value;
+					return;
+				}
+			}
+			row_colindex[row_size] = (unsigned int) col;
+			row_value[row_size] = increment_value;
+			++row_size;
+		};
+
 		const VectorXi& bucket_pn = pressure_neighbors[bucket_idx];
 
 		const int bucket_idx_left = bucket_pn[node_idx * 12 + 0];
@@ -411,12 +434,12 @@ void solveNodePressure( const TwoDScene& scene,
 						assert(dof_left >= 0);
 
 						if (dof_left >= 0) {
-							matrix.add_to_element(dof_idx, dof_idx, term);
-							matrix.add_to_element(dof_idx, dof_left, -term);
+							add_to_row(dof_idx, term);
+							add_to_row(dof_left, -term);
 						}
 					} else {
 						const scalar theta = std::max(mathutils::fraction_inside(center_phi, left_phi), theta_criterion);
-						matrix.add_to_element(dof_idx, dof_idx, term / theta);
+						add_to_row(dof_idx, term / theta);
 					}
 				}
 			}
@@ -452,12 +475,12 @@ void solveNodePressure( const TwoDScene& scene,
 						assert(dof_right >= 0);
 
 						if (dof_right >= 0) {
-							matrix.add_to_element(dof_idx, dof_idx, term);
-							matrix.add_to_element(dof_idx, dof_right, -term);
+							add_to_row(dof_idx, term);
+							add_to_row(dof_right, -term);
 						}
 					} else {
 						const scalar theta = std::max(mathutils::fraction_inside(center_phi, right_phi), theta_criterion);
-						matrix.add_to_element(dof_idx, dof_idx, term / theta);
+						add_to_row(dof_idx, term / theta);
 					}
 				}
 			}
@@ -493,12 +516,12 @@ void solveNodePressure( const TwoDScene& scene,
 						assert(dof_bottom >= 0);
 
 						if (dof_bottom >= 0) {
-							matrix.add_to_element(dof_idx, dof_idx, term);
-							matrix.add_to_element(dof_idx, dof_bottom, -term);
+							add_to_row(dof_idx, term);
+							add_to_row(dof_bottom, -term);
 						}
 					} else {
 						const scalar theta = std::max(mathutils::fraction_inside(center_phi, bottom_phi), theta_criterion);
-						matrix.add_to_element(dof_idx, dof_idx, term / theta);
+						add_to_row(dof_idx, term / theta);
 					}
 				}
 			}
@@ -534,12 +557,12 @@ void solveNodePressure( const TwoDScene& scene,
 						assert(dof_top >= 0);
 
 						if (dof_top >= 0) {
-							matrix.add_to_element(dof_idx, dof_idx, term);
-							matrix.add_to_element(dof_idx, dof_top, -term);
+							add_to_row(dof_idx, term);
+							add_to_row(dof_top, -term);
 						}
 					} else {
 						const scalar theta = std::max(mathutils::fraction_inside(center_phi, top_phi), theta_criterion);
-						matrix.add_to_element(dof_idx, dof_idx, term / theta);
+						add_to_row(dof_idx, term / theta);
 					}
 				}
 			}
@@ -575,12 +598,12 @@ void solveNodePressure( const TwoDScene& scene,
 						assert(dof_near >= 0);
 
 						if (dof_near >= 0) {
-							matrix.add_to_element(dof_idx, dof_idx, term);
-							matrix.add_to_element(dof_idx, dof_near, -term);
+							add_to_row(dof_idx, term);
+							add_to_row(dof_near, -term);
 						}
 					} else {
 						const scalar theta = std::max(mathutils::fraction_inside(center_phi, near_phi), theta_criterion);
-						matrix.add_to_element(dof_idx, dof_idx, term / theta);
+						add_to_row(dof_idx, term / theta);
 					}
 				}
 			}
@@ -616,23 +639,44 @@ void solveNodePressure( const TwoDScene& scene,
 						assert(dof_far >= 0);
 
 						if (dof_far >= 0) {
-							matrix.add_to_element(dof_idx, dof_idx, term);
-							matrix.add_to_element(dof_idx, dof_far, -term);
+							add_to_row(dof_idx, term);
+							add_to_row(dof_far, -term);
 						}
 					} else {
 						const scalar theta = std::max(mathutils::fraction_inside(center_phi, far_phi), theta_criterion);
-						matrix.add_to_element(dof_idx, dof_idx, term / theta);
+						add_to_row(dof_idx, term / theta);
 					}
 				}
 			}
 		}
+
+		// sort the row by column, as the solver expects
+		for (int k = 1; k < row_size; ++k) {
+			for (int j = k; j > 0 && row_colindex[j - 1] > row_colindex[j]; --j) {
+				std::swap(row_colindex[j - 1], row_colindex[j]);
+				std::swap(row_value[j - 1], row_value[j]);
+			}
+		}
+
+		matrix.rowstart[dof_idx + 1] = row_size;
+	});
+
+	std::partial_sum(matrix.rowstart.begin(), matrix.rowstart.end(), matrix.rowstart.begin());
+
+	matrix.colindex.resize(matrix.rowstart[total_num_nodes]);
+	matrix.value.resize(matrix.rowstart[total_num_nodes]);
+
+	threadutils::for_each(0, total_num_nodes, [&] (int dof_idx) {
+		const int row_size = matrix.rowstart[dof_idx + 1] - matrix.rowstart[dof_idx];
+		std::copy(slot_colindex.begin() + dof_idx * max_row_entries, slot_colindex.begin() + dof_idx * max_row_entries + row_size, matrix.colindex.begin() + matrix.rowstart[dof_idx]);
+		std::copy(slot_value.begin() + dof_idx * max_row_entries, slot_value.begin() + dof_idx * max_row_entries + row_size, matrix.value.begin() + matrix.rowstart[dof_idx]);
 	});
 
 	bool success = false;
 	scalar tolerance = 0.0;
 	int iterations = 0;
 
-	success = AMGPCGSolveSparse(matrix, rhs, result, dof_ijk, criterion, maxiters, tolerance, iterations, ni, nj, nk);
+	success = AMGPCGSolveFixed(amg_levels, rhs, result, dof_ijk, criterion, maxiters, tolerance, iterations, ni, nj, nk);
 
 	std::cout << "[amg pcg total iter: " << iterations << ", res: " << tolerance << "]" << std::endl;
 
@@ -689,9 +733,7 @@ void multiplyPressureMatrix( const TwoDScene& scene, const std::vector< VectorXs
 	const scalar dx = scene.getCellSize();
 	const scalar coeff = dt / (dx * dx);
 
-	buckets.for_each_bucket([&] (int bucket_idx) {
-		if (!scene.isBucketActivated(bucket_idx)) return;
-
+	buckets.for_each_active_bucket([&] (int bucket_idx) {
 		const VectorXs& bucket_liquid_phi = node_liquid_phi[bucket_idx];
 		const VectorXi& bucket_pn = pressure_neighbors[bucket_idx];;
 
@@ -912,9 +954,7 @@ void applyPressureGradsFluidRHS( TwoDScene& scene,
 	const std::vector< VectorXs >& node_vol_fluid_y = scene.getNodeFluidVolY();
 	const std::vector< VectorXs >& node_vol_fluid_z = scene.getNodeFluidVolZ();
 
-	buckets.for_each_bucket([&] (int bucket_idx) {
-		if (!scene.isBucketActivated(bucket_idx)) return;
-
+	buckets.for_each_active_bucket([&] (int bucket_idx) {
 		VectorXs& bucket_rhs_x = rhs_vec_x[bucket_idx];
 		VectorXs& bucket_rhs_y = rhs_vec_y[bucket_idx];
 		VectorXs& bucket_rhs_z = rhs_vec_z[bucket_idx];
@@ -1057,9 +1097,7 @@ void applyPressureGradsElastoRHS( TwoDScene& scene,
 	const std::vector< VectorXs >& node_vol_fluid_y = scene.getNodeFluidVolY();
 	const std::vector< VectorXs >& node_vol_fluid_z = scene.getNodeFluidVolZ();
 
-	buckets.for_each_bucket([&] (int bucket_idx) {
-		if (!scene.isBucketActivated(bucket_idx)) return;
-
+	buckets.for_each_active_bucket([&] (int bucket_idx) {
 		VectorXs& bucket_rhs_x = rhs_vec_x[bucket_idx];
 		VectorXs& bucket_rhs_y = rhs_vec_y[bucket_idx];
 		VectorXs& bucket_rhs_z = rhs_vec_z[bucket_idx];
@@ -1315,9 +1353,7 @@ void applyPressureGradsFluid( TwoDScene& scene, const std::vector< VectorXs >& p
 	const std::vector< VectorXs >& node_vol_y = scene.getNodeFluidVolY();
 	const std::vector< VectorXs >& node_vol_z = scene.getNodeFluidVolZ();
 
-	buckets.for_each_bucket([&] (int bucket_idx) {
-		if (!scene.isBucketActivated(bucket_idx)) return;
-
+	buckets.for_each_active_bucket([&] (int bucket_idx) {
 		VectorXs& bucket_rhs_x = rhs_vec_x[bucket_idx];
 		VectorXs& bucket_rhs_y = rhs_vec_y[bucket_idx];
 		VectorXs& bucket_rhs_z = rhs_vec_z[bucket_idx];
@@ -1454,9 +1490,7 @@ void extrapolate( const TwoDScene& scene, std::vector< VectorXuc >& node_valid,
 		std::vector< VectorXs > node_vel_copy = node_vel;
 		std::vector< VectorXuc > node_valid_copy = node_valid;
 
-		buckets.for_each_bucket([&] (int bucket_idx) {
-			if (!scene.isBucketActivated(bucket_idx)) return;
-
+		buckets.for_each_active_bucket([&] (int bucket_idx) {
 			const Vector3i bucket_handle = buckets.bucket_handle(bucket_idx);
 
 			const VectorXuc& bucket_valid = node_valid_copy[bucket_idx];
@@ -1537,9 +1571,7 @@ void constructJacobiPreconditioner( const TwoDScene& scene, std::vector< VectorX
 	const scalar dx = scene.getCellSize();
 	const scalar coeff = dt / (dx * dx);
 
-	buckets.for_each_bucket([&] (int bucket_idx) {
-		if (!scene.isBucketActivated(bucket_idx)) return;
-
+	buckets.for_each_active_bucket([&] (int bucket_idx) {
 		const VectorXs& bucket_liquid_phi = node_liquid_phi[bucket_idx];
 		const VectorXi& bucket_pn = pressure_neighbors[bucket_idx];;
 
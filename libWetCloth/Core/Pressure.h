@@ -18,6 +18,9 @@
 
 class TwoDScene;
 
+template<class T>
+struct AMGLevels;
+
 namespace pressure {
 void constructNodeIncompressibleCondition(const TwoDScene& scene,
     std::vector< VectorXs >& node_ic,
@@ -32,7 +35,7 @@ void multiplyPressureMatrix( const TwoDScene& scene, const std::vector< VectorXs
 void solveNodePressure( const TwoDScene& scene,
                         std::vector< VectorXs >& pressure,
                         std::vector<double>& rhs,
-                        robertbridson::SparseMatrix<scalar>& matrix,
+                        AMGLevels<scalar>& amg_levels,
                         std::vector< VectorXi >& node_global_indices,
                         const std::vector< VectorXs >& node_psi_fs_x,
                         const std::vector< VectorXs >& node_psi_fs_y,
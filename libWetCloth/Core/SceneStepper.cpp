@@ -16,9 +16,9 @@ SceneStepper::~SceneStepper()
 
 bool SceneStepper::advectScene( TwoDScene& scene, scalar dt )
 {
-    VectorXs& x = scene.getX();
-    const VectorXs& v = scene.getV();
-    const VectorXs& fv = scene.getFluidV();
+    VectorXsRef x = scene.getX();
+    ConstVectorXsRef v = scene.getV();
+    ConstVectorXsRef fv = scene.getFluidV();
 
     assert(!std::isnan(v.sum()));
     assert(!std::isnan(x.sum()));
@@ -51,7 +51,7 @@ bool SceneStepper::useApic() const
     return m_apic;
 }
 
-void SceneStepper::mapNodeToSoftParticles( const TwoDScene& scene, const std::vector< VectorXs >& node_vec_x, const std::vector< VectorXs >& node_vec_y, const std::vector< VectorXs >& node_vec_z, VectorXs& part_vec ) const
+void SceneStepper::mapNodeToSoftParticles( const TwoDScene& scene, const ConstNodeVectorView& node_vec_x, const ConstNodeVectorView& node_vec_y, const ConstNodeVectorView& node_vec_z, VectorXs& part_vec ) const
 {
     part_vec.setZero();
 
@@ -303,25 +303,34 @@ void SceneStepper::mapSoftParticlesToNode( const TwoDScene& scene, std::vector<
     if ((int) node_vec_y.size() != buckets.size()) node_vec_y.resize(buckets.size());
     if ((int) node_vec_z.size() != buckets.size()) node_vec_z.resize(buckets.size());
 
+    buckets.for_each_active_bucket([&] (int bucket_idx) {
+        const int num_nodes = scene.getNumNodes(bucket_idx);
+
+        if (node_vec_x[ bucket_idx ].size() != num_nodes) node_vec_x[ bucket_idx ].resize( num_nodes );
+        if (node_vec_y[ bucket_idx ].size() != num_nodes) node_vec_y[ bucket_idx ].resize( num_nodes );
+        if (node_vec_z[ bucket_idx ].size() != num_nodes) node_vec_z[ bucket_idx ].resize( num_nodes );
+    });
+
+    mapSoftParticlesToNode( scene, NodeVectorView(node_vec_x), NodeVectorView(node_vec_y), NodeVectorView(node_vec_z), part_vec );
+}
+
+void SceneStepper::mapSoftParticlesToNode( const TwoDScene& scene, NodeVectorView node_vec_x, NodeVectorView node_vec_y, NodeVectorView node_vec_z, const VectorXs& part_vec ) const
+{
+    const Sorter& buckets = scene.getParticleBuckets();
+
     const std::vector<int>& particle_to_surfels = scene.getParticleToSurfels();
     const int num_elasto = scene.getNumElastoParticles();
     const std::vector< Matrix27x4s >& particle_weights = scene.getParticleWeights();
 
-    buckets.for_each_bucket([&] (int bucket_idx) {
-        if (!scene.isBucketActivated(bucket_idx)) return;
-
+    buckets.for_each_active_bucket([&] (int bucket_idx) {
         const int num_nodes = scene.getNumNodes(bucket_idx);
 
-        VectorXs& bucket_node_vec_x = node_vec_x[ bucket_idx ];
-        VectorXs& bucket_node_vec_y = node_vec_y[ bucket_idx ];
-        VectorXs& bucket_node_vec_z = node_vec_z[ bucket_idx ];
-
-        if (bucket_node_vec_x.size() != num_nodes) bucket_node_vec_x.resize( num_nodes );
-        if (bucket_node_vec_y.size() != num_nodes) bucket_node_vec_y.resize( num_nodes );
-        if (bucket_node_vec_z.size() != num_nodes) bucket_node_vec_z.resize( num_nodes );
+        auto bucket_node_vec_x = node_vec_x[ bucket_idx ];
+        auto bucket_node_vec_y = node_vec_y[ bucket_idx ];
+        auto bucket_node_vec_z = node_vec_z[ bucket_idx ];
 
         for (int i = 0; i < num_nodes; ++i) {
-            auto& particle_indices = scene.getNodeParticlePairsX(bucket_idx, i);
+            const auto& particle_indices = scene.getNodeParticlePairsX(bucket_idx, i);
 
             scalar ret(0.);
             for (auto& pp : particle_indices)
@@ -337,7 +346,7 @@ void SceneStepper::mapSoftParticlesToNode( const TwoDScene& scene, std::vector<
         }
 
         for (int i = 0; i < num_nodes; ++i) {
-            auto& particle_indices = scene.getNodeParticlePairsY(bucket_idx, i);
+            const auto& particle_indices = scene.getNodeParticlePairsY(bucket_idx, i);
 
             scalar ret(0.);
             for (auto& pp : particle_indices)
@@ -352,7 +361,7 @@ void SceneStepper::mapSoftParticlesToNode( const TwoDScene& scene, std::vector<
         }
 
         for (int i = 0; i < num_nodes; ++i) {
-            auto& particle_indices = scene.getNodeParticlePairsZ(bucket_idx, i);
+            const auto& particle_indices = scene.getNodeParticlePairsZ(bucket_idx, i);
 
             scalar ret(0.);
             for (auto& pp : particle_indices)
@@ -381,9 +390,7 @@ void SceneStepper::mapSoftParticlesToNodeSqr( const TwoDScene& scene, std::vecto
     const int num_elasto = scene.getNumElastoParticles();
     const std::vector< Matrix27x4s >& particle_weights = scene.getParticleWeights();
 
-    buckets.for_each_bucket([&] (int bucket_idx) {
-        if (!scene.isBucketActivated(bucket_idx)) return;
-
+    buckets.for_each_active_bucket([&] (int bucket_idx) {
         const int num_nodes = scene.getNumNodes(bucket_idx);
 
         VectorXs& bucket_node_vec_x = node_vec_x[ bucket_idx ];
@@ -395,7 +402,7 @@ void SceneStepper::mapSoftParticlesToNodeSqr( const TwoDScene& scene, std::vecto
         if (bucket_node_vec_z.size() != num_nodes) bucket_node_vec_z.resize( num_nodes );
 
         for (int i = 0; i < num_nodes; ++i) {
-            auto& particle_indices = scene.getNodeParticlePairsX(bucket_idx, i);
+            const auto& particle_indices = scene.getNodeParticlePairsX(bucket_idx, i);
 
             scalar ret(0.);
             for (auto& pp : particle_indices)
@@ -412,7 +419,7 @@ void SceneStepper::mapSoftParticlesToNodeSqr( const TwoDScene& scene, std::vecto
         }
 
         for (int i = 0; i < num_nodes; ++i) {
-            auto& particle_indices = scene.getNodeParticlePairsY(bucket_idx, i);
+            const auto& particle_indices = scene.getNodeParticlePairsY(bucket_idx, i);
 
             scalar ret(0.);
             for (auto& pp : particle_indices)
@@ -428,7 +435,7 @@ void SceneStepper::mapSoftParticlesToNodeSqr( const TwoDScene& scene, std::vecto
         }
 
         for (int i = 0; i < num_nodes; ++i) {
-            auto& particle_indices = scene.getNodeParticlePairsZ(bucket_idx, i);
+            const auto& particle_indices = scene.getNodeParticlePairsZ(bucket_idx, i);
 
             scalar ret(0.);
             for (auto& pp : particle_indices)
@@ -575,6 +582,21 @@ void SceneStepper::allocateNodeVectors( const TwoDScene& scene, std::vector< Vec
     });
 }
 
+void SceneStepper::allocateNodeVectors( const TwoDScene& scene, NodeVectorView node_vec_x, NodeVectorView node_vec_y, NodeVectorView node_vec_z ) const
+{
+    NodeVectorArena* arena = node_vec_x.arena();
+    if (!arena) return;
+
+    assert(node_vec_y.arena() == arena && node_vec_z.arena() == arena);
+
+    // zeroes every field of the arena if the grid has changed
+    if (arena->setLayout(scene.getNumBuckets(), [&] (int bucket_idx) { return scene.getNumNodes(bucket_idx); })) return;
+
+    arena->zero(node_vec_x.field());
+    arena->zero(node_vec_y.field());
+    arena->zero(node_vec_z.field());
+}
+
 scalar SceneStepper::dotNodeVectors( const std::vector< VectorXs >& node_vec_ax, const std::vector< VectorXs >& node_vec_ay, const std::vector< VectorXs >& node_vec_az, const std::vector< VectorXs >& node_vec_bx, const std::vector< VectorXs >& node_vec_by, const std::vector< VectorXs >& node_vec_bz ) const
 {
     VectorXs bucket_dot(node_vec_ax.size());
@@ -651,4 +673,64 @@ scalar SceneStepper::lengthNodeVectors( const std::vector< VectorXs >& node_vec
     return sqrt(bucket_length.sum());
 }
 
+static const NodeVectorArena* commonArena( std::initializer_list< const ConstNodeVectorView* > views )
+{
+    const NodeVectorArena* arena = (*views.begin())->arena();
+    for (const ConstNodeVectorView* v : views) {
+        if (v->arena() != arena) return nullptr;
+    }
+    return arena;
+}
+
+scalar SceneStepper::dotNodeVectors( const ConstNodeVectorView& node_vec_ax, const ConstNodeVectorView& node_vec_ay, const ConstNodeVectorView& node_vec_az, const ConstNodeVectorView& node_vec_bx, const ConstNodeVectorView& node_vec_by, const ConstNodeVectorView& node_vec_bz ) const
+{
+    const NodeVectorArena* arena = commonArena({ &node_vec_ax, &node_vec_ay, &node_vec_az, &node_vec_bx, &node_vec_by, &node_vec_bz });
+
+    if (arena) {
+        const scalar* ax = arena->data(node_vec_ax.field());
+        const scalar* ay = arena->data(node_vec_ay.field());
+        const scalar* az = arena->data(node_vec_az.field());
+        const scalar* bx = arena->data(node_vec_bx.field());
+        const scalar* by = arena->data(node_vec_by.field());
+        const scalar* bz = arena->data(node_vec_bz.field());
+
+        return arena->reduce([&] (int begin, int end) {
+            scalar sum = 0.;
+            for (int i = begin; i < end; ++i) {
+                sum += ax[i] * bx[i] + ay[i] * by[i] + az[i] * bz[i];
+            }
+            return sum;
+        });
+    }
+
+    assert(node_vec_ax.size() == node_vec_bx.size());
+    assert(node_vec_ay.size() == node_vec_by.size());
+    assert(node_vec_az.size() == node_vec_bz.size());
+
+    const int num_buckets = node_vec_ax.size();
+
+    VectorXs bucket_dot(num_buckets);
+
+    threadutils::for_each(0, num_buckets, [&] (int bucket_idx) {
+        bucket_dot[bucket_idx] = node_vec_ax[bucket_idx].dot(node_vec_bx[bucket_idx]) + node_vec_ay[bucket_idx].dot(node_vec_by[bucket_idx]) + node_vec_az[bucket_idx].dot(node_vec_bz[bucket_idx]);
+    });
+
+    return bucket_dot.sum();
+}
+
+scalar SceneStepper::dotNodeVectors( const ConstNodeVectorView& node_vec_ax, const ConstNodeVectorView& node_vec_ay, const ConstNodeVectorView& node_vec_az, const ConstNodeVectorView& node_vec_bx, const ConstNodeVectorView& node_vec_by, const ConstNodeVectorView& node_vec_bz, const VectorXs& twist_vec_a, const VectorXs& twist_vec_b ) const
+{
+    return dotNodeVectors(node_vec_ax, node_vec_ay, node_vec_az, node_vec_bx, node_vec_by, node_vec_bz) + twist_vec_a.dot(twist_vec_b);
+}
+
+scalar SceneStepper::lengthNodeVectors( const ConstNodeVectorView& node_vec_ax, const ConstNodeVectorView& node_vec_ay, const ConstNodeVectorView& node_vec_az, const VectorXs& twist_vec ) const
+{
+    return sqrt(dotNodeVectors(node_vec_ax, node_vec_ay, node_vec_az, node_vec_ax, node_vec_ay, node_vec_az) + twist_vec.squaredNorm());
+}
+
+scalar SceneStepper::lengthNodeVectors( const ConstNodeVectorView& node_vec_ax, const ConstNodeVectorView& node_vec_ay, const ConstNodeVectorView& node_vec_az ) const
+{
+    return sqrt(dotNodeVectors(node_vec_ax, node_vec_ay, node_vec_az, node_vec_ax, node_vec_ay, node_vec_az));
+}
+
 
@@ -14,6 +14,7 @@
 #include <stack>
 
 #include "MathDefs.h"
+#include "NodeVectorArena.h"
 
 class SceneStepper
 {
@@ -61,7 +62,7 @@ public:
 	virtual bool useApic() const;
 
 	// tools function
-	void mapNodeToSoftParticles( const TwoDScene& scene, const std::vector< VectorXs >& node_vec_x, const std::vector< VectorXs >& node_vec_y, const std::vector< VectorXs >& node_vec_z, VectorXs& part_vec ) const;
+	void mapNodeToSoftParticles( const TwoDScene& scene, const ConstNodeVectorView& node_vec_x, const ConstNodeVectorView& node_vec_y, const ConstNodeVectorView& node_vec_z, VectorXs& part_vec ) const;
 
 	// tools function
 	void buildNodeToSoftParticlesMat( const TwoDScene& scene,
@@ -81,12 +82,18 @@ public:
 
 	void mapSoftParticlesToNode( const TwoDScene& scene, std::vector< VectorXs >& node_vec_x, std::vector< VectorXs >& node_vec_y, std::vector< VectorXs >& node_vec_z, const VectorXs& part_vec ) const;
 
+	// the views have to be allocated already
+	void mapSoftParticlesToNode( const TwoDScene& scene, NodeVectorView node_vec_x, NodeVectorView node_vec_y, NodeVectorView node_vec_z, const VectorXs& part_vec ) const;
+
 	void mapSoftParticlesToNodeSqr( const TwoDScene& scene, std::vector< VectorXs >& node_vec_x, std::vector< VectorXs >& node_vec_y, std::vector< VectorXs >& node_vec_z, const VectorXs& part_vec ) const;
 
 	void allocateNodeVectors( const TwoDScene& scene, std::vector< VectorXs >& node_vec_x, std::vector< VectorXs >& node_vec_y, std::vector< VectorXs >& node_vec_z) const;
 
 	void allocateNodeVectors( const TwoDScene& scene, std::vector< VectorXi >& node_vec_x, std::vector< VectorXi >& node_vec_y, std::vector< VectorXi >& node_vec_z) const;
 
+	// arena fields follow the current grid layout and are zeroed
+	void allocateNodeVectors( const TwoDScene& scene, NodeVectorView node_vec_x, NodeVectorView node_vec_y, NodeVectorView node_vec_z) const;
+
 	void allocateCenterNodeVectors( const TwoDScene& scene, std::vector< VectorXi >& node_vec_p ) const;
 
 	void allocateCenterNodeVectors( const TwoDScene& scene, std::vector< VectorXs >& node_vec_p ) const;
@@ -103,6 +110,15 @@ public:
 
 	scalar lengthNodeVectors( const std::vector< VectorXs >& node_vec ) const;
 
+	// fields of one arena are reduced over the flat storage
+	scalar dotNodeVectors( const ConstNodeVectorView& node_vec_ax, const ConstNodeVectorView& node_vec_ay, const ConstNodeVectorView& node_vec_az, const ConstNodeVectorView& node_vec_bx, const ConstNodeVectorView& node_vec_by, const ConstNodeVectorView& node_vec_bz ) const;
+
+	scalar dotNodeVectors( const ConstNodeVectorView& node_vec_ax, const ConstNodeVectorView& node_vec_ay, const ConstNodeVectorView& node_vec_az, const ConstNodeVectorView& node_vec_bx, const ConstNodeVectorView& node_vec_by, const ConstNodeVectorView& node_vec_bz, const VectorXs& twist_vec_a, const VectorXs& twist_vec_b ) const;
+
+	scalar lengthNodeVectors( const ConstNodeVectorView& node_vec_ax, const ConstNodeVectorView& node_vec_ay, const ConstNodeVectorView& node_vec_az, const VectorXs& twist_vec ) const;
+
+	scalar lengthNodeVectors( const ConstNodeVectorView& node_vec_ax, const ConstNodeVectorView& node_vec_ay, const ConstNodeVectorView& node_vec_az ) const;
+
 	void mapGaussToNode( const TwoDScene& scene, std::vector< VectorXs >& node_vec_x, std::vector< VectorXs >& node_vec_y, std::vector< VectorXs >& node_vec_z, const MatrixXs& gauss_vec ) const;
 
 	void allocateLagrangianVectors( const TwoDScene& scene, VectorXs& vec );
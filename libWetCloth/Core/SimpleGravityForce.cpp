@@ -50,7 +50,7 @@ void SimpleGravityForce::addLiquidGradEToNode( const TwoDScene& scene, std::vect
 	});
 }
 
-void SimpleGravityForce::addEnergyToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, scalar& E )
+void SimpleGravityForce::addEnergyToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, scalar& E )
 {
 	assert( x.size() == v.size() );
 	assert( x.size() == m.size() );
@@ -60,7 +60,7 @@ void SimpleGravityForce::addEnergyToTotal( const VectorXs& x, const VectorXs& v,
 	for ( int i = 0; i < x.size() / 4; ++i ) E -= m(4 * i) * m_gravity.dot(x.segment<3>(4 * i));
 }
 
-void SimpleGravityForce::addGradEToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, VectorXs& gradE )
+void SimpleGravityForce::addGradEToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, VectorXs& gradE )
 {
 	const int num_elasto = gradE.size() / 4;
 	threadutils::for_each(0, num_elasto, [&] (int i) {
@@ -68,7 +68,7 @@ void SimpleGravityForce::addGradEToTotal( const VectorXs& x, const VectorXs& v,
 	});
 }
 
-void SimpleGravityForce::addHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
+void SimpleGravityForce::addHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
 {
 	assert( x.size() == v.size() );
 	assert( x.size() == m.size() );
@@ -77,7 +77,7 @@ void SimpleGravityForce::addHessXToTotal( const VectorXs& x, const VectorXs& v,
 	// Nothing to do.
 }
 
-void SimpleGravityForce::updateMultipliers( const VectorXs& x, const VectorXs& vplus, const VectorXs& m, const VectorXs& psi, const scalar& lambda, const scalar& dt )
+void SimpleGravityForce::updateMultipliers( const ConstVectorXsRef& x, const ConstVectorXsRef& vplus, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, const scalar& dt )
 {
 
 }
@@ -26,7 +26,7 @@ SpringForce::SpringForce( const Vector2iT& endpoints, const scalar& k, const sca
 SpringForce::~SpringForce()
 {}
 
-void SpringForce::addEnergyToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, scalar& E )
+void SpringForce::addEnergyToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, scalar& E )
 {
 	assert( x.size() == v.size() );
 	assert( x.size() % 4 == 0 );
@@ -36,7 +36,7 @@ void SpringForce::addEnergyToTotal( const VectorXs& x, const VectorXs& v, const
 	E += 0.5 * m_k * (l - m_l0) * (l - m_l0) * psi_coeff;
 }
 
-void SpringForce::addGradEToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, VectorXs& gradE )
+void SpringForce::addGradEToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, VectorXs& gradE )
 {
 	assert( x.size() == v.size() );
 	assert( x.size() == gradE.size() );
@@ -60,7 +60,7 @@ void SpringForce::addGradEToTotal( const VectorXs& x, const VectorXs& v, const V
 	}
 }
 
-void SpringForce::addHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
+void SpringForce::addHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
 {
 	assert( x.size() == v.size() );
 	assert( x.size() == m.size() );
@@ -97,7 +97,7 @@ void SpringForce::addHessXToTotal( const VectorXs& x, const VectorXs& v, const V
 	}
 }
 
-void SpringForce::updateMultipliers( const VectorXs& x, const VectorXs& vplus, const VectorXs& m, const VectorXs& psi, const scalar& lambda, const scalar& dt )
+void SpringForce::updateMultipliers( const ConstVectorXsRef& x, const ConstVectorXsRef& vplus, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, const scalar& dt )
 {
 
 }
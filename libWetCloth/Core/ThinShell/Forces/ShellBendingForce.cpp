@@ -10,6 +10,8 @@
 
 #include "ShellBendingForce.h"
 #include <iostream>
+#include "../../Checkpoint.h"
+#include "../../TwoDScene.h"
 #include "../../ThreadUtils.h"
 #undef isnan
 #undef isinf
@@ -19,8 +21,7 @@
 ShellBendingForce::~ShellBendingForce()
 {}
 
-ShellBendingForce::ShellBendingForce(const VectorXs & pos,
-                                     const VectorXs & rest_pos,
+ShellBendingForce::ShellBendingForce(const std::shared_ptr<TwoDScene>& scene,
                                      const MatrixXi & F,
                                      const VectorXs & triangle_rest_area,
                                      const MatrixXi & E_unique,
@@ -33,7 +34,7 @@ ShellBendingForce::ShellBendingForce(const VectorXs & pos,
                                      const scalar& thickness,
                                      int bending_mode,
 									 bool apply_viscous)
-: m_pos(pos), m_rest_pos(rest_pos), m_F(F), m_triangle_rest_area(triangle_rest_area), m_E_unique(E_unique),
+: m_scene(scene), m_F(F), m_triangle_rest_area(triangle_rest_area), m_E_unique(E_unique),
 m_per_unique_edge_triangles(per_unique_edge_triangles), m_per_unique_edge_triangles_local_corners(per_unique_edge_triangles_local_corners), m_per_triangles_unique_edges(per_triangles_unique_edges), m_young_modulus(young_modulus), m_viscous_modulus(viscous_modulus),
 m_poisson_ratio(poisson_ratio), m_thickness(thickness), m_bending_mode(bending_mode), m_apply_viscous(apply_viscous)
 {
@@ -54,10 +55,10 @@ m_poisson_ratio(poisson_ratio), m_thickness(thickness), m_bending_mode(bending_m
 	m_multipliers.resize(m_E_unique.rows());
 	m_multipliers.setZero();
 	
-	computeBendingRestPhi(m_rest_pos, m_per_edge_rest_phi);
+	computeBendingRestPhi(m_scene->getRestPos(), m_per_edge_rest_phi);
 }
 
-void ShellBendingForce::computeBendingRestPhi(const VectorXs & rest_pos, VectorXs & rest_phis)
+void ShellBendingForce::computeBendingRestPhi(const ConstVectorXsRef& rest_pos, VectorXs & rest_phis)
 {
 	auto l_bending_rest_phi = [&] (int idx[4], scalar & rest_phi)
 	{
@@ -126,13 +127,15 @@ void ShellBendingForce::computeBendingRestPhi(const VectorXs & rest_pos, VectorX
 	});
 }
 
-void ShellBendingForce::addEnergyToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, scalar& E )
+void ShellBendingForce::addEnergyToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, scalar& E )
 {
 	std::cerr << "NOT IMPLEMENTED!" << std::endl;
 }
 
-void ShellBendingForce::addGradEToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, VectorXs& gradE )
+void ShellBendingForce::addGradEToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, VectorXs& gradE )
 {
+	ConstVectorXsRef rest_pos = m_scene->getRestPos();
+	
 	for (int e : m_unique_edge_usable)
 	{
 		assert ( (m_per_unique_edge_triangles(e,0) != -1) && (m_per_unique_edge_triangles(e,1) != -1) );
@@ -173,7 +176,7 @@ void ShellBendingForce::addGradEToTotal( const VectorXs& x, const VectorXs& v, c
 		const Vector3s& x3 = x.segment<3>(idx[3] * 4);
 		
 		scalar restareas = m_triangle_rest_area(m_per_unique_edge_triangles(e,0)) + m_triangle_rest_area(m_per_unique_edge_triangles(e,1));
-		scalar e0_rest_sqnorm = (m_rest_pos.segment<3>(idx[2] * 4) - m_rest_pos.segment<3>(idx[1] * 4)).squaredNorm();
+		scalar e0_rest_sqnorm = (rest_pos.segment<3>(idx[2] * 4) - rest_pos.segment<3>(idx[1] * 4)).squaredNorm();
 		const scalar psi_coeff = pow((psi(idx[2]) + psi(idx[1])) * 0.5, lambda);
 		
 		Vector3s e0 = x2 - x1;
@@ -222,8 +225,10 @@ void ShellBendingForce::addGradEToTotal( const VectorXs& x, const VectorXs& v, c
 	assert(!std::isnan(gradE.sum()));
 }
 
-void ShellBendingForce::addHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
+void ShellBendingForce::addHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
 {
+	ConstVectorXsRef rest_pos = m_scene->getRestPos();
+	
 	auto l_bending_stencil_gradientPart = [&] (int e, int idx[4], MatrixXs & dfdx_bending_gradpart, scalar & dPsi_dTheta)
 	{
 		auto l_compute_dPsi_tantheta = [this] (const Vector3s & n, const Vector3s & n_tilde, const Vector3s & e0, const scalar rest_phi, const scalar ka, const scalar start_phi, const scalar kb, scalar & dPsi_dTheta, scalar & dPsi_dTheta_dTheta)
@@ -261,7 +266,7 @@ void ShellBendingForce::addHessXToTotal( const VectorXs& x, const VectorXs& v, c
 		const Vector3s& x3 = x.segment<3>(idx[3] * 4);
 		
 		scalar restareas = m_triangle_rest_area(m_per_unique_edge_triangles(e,0)) + m_triangle_rest_area(m_per_unique_edge_triangles(e,1));
-		scalar e0_rest_sqnorm = (m_rest_pos.segment<3>(idx[2] * 4) - m_rest_pos.segment<3>(idx[1] * 4)).squaredNorm();
+		scalar e0_rest_sqnorm = (rest_pos.segment<3>(idx[2] * 4) - rest_pos.segment<3>(idx[1] * 4)).squaredNorm();
 		const scalar psi_coeff = pow((psi(idx[2]) + psi(idx[1])) * 0.5, lambda);
 		
 		Vector3s e0 = x2 - x1;
@@ -473,8 +478,10 @@ int ShellBendingForce::numHessX()
 	;
 }
 
-void ShellBendingForce::updateMultipliers( const VectorXs& x, const VectorXs& vplus, const VectorXs& m, const VectorXs& psi, const scalar& lambda, const scalar& dt )
+void ShellBendingForce::updateMultipliers( const ConstVectorXsRef& x, const ConstVectorXsRef& vplus, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, const scalar& dt )
 {
+	ConstVectorXsRef rest_pos = m_scene->getRestPos();
+	
 	for (int e : m_unique_edge_usable)
 	{
 		assert ( (m_per_unique_edge_triangles(e,0) != -1) && (m_per_unique_edge_triangles(e,1) != -1) );
@@ -521,7 +528,7 @@ void ShellBendingForce::updateMultipliers( const VectorXs& x, const VectorXs& vp
 		const Vector3s& x3 = x.segment<3>(idx[3] * 4);
 		
 		scalar restareas = m_triangle_rest_area(m_per_unique_edge_triangles(e,0)) + m_triangle_rest_area(m_per_unique_edge_triangles(e,1));
-		scalar e0_rest_sqnorm = (m_rest_pos.segment<3>(idx[2] * 4) - m_rest_pos.segment<3>(idx[1] * 4)).squaredNorm();
+		scalar e0_rest_sqnorm = (rest_pos.segment<3>(idx[2] * 4) - rest_pos.segment<3>(idx[1] * 4)).squaredNorm();
 		const scalar psi_coeff = pow((psi(idx[2]) + psi(idx[1])) * 0.5, lambda);
 		
 		Vector3s e0 = x2 - x1;
@@ -585,7 +592,25 @@ void ShellBendingForce::preCompute()
 void ShellBendingForce::updateStartState()
 {
 	m_per_edge_start_phi.resize(m_per_edge_rest_phi.size());
-	computeBendingRestPhi(m_pos, m_per_edge_start_phi);
+	computeBendingRestPhi(m_scene->getX(), m_per_edge_start_phi);
+}
+
+void ShellBendingForce::saveState( CheckpointWriter& out, const std::string& prefix ) const
+{
+	out.add(prefix + "rest_phi", m_per_edge_rest_phi);
+	out.add(prefix + "start_phi", m_per_edge_start_phi);
+	out.add(prefix + "multipliers", m_multipliers);
+}
+
+bool ShellBendingForce::loadState( const CheckpointReader& in, const std::string& prefix )
+{
+	VectorXs rest_phi;
+	if (!in.read(prefix + "rest_phi", rest_phi) || rest_phi.size() != m_per_edge_rest_phi.size()) return false;
+	
+	m_per_edge_rest_phi.swap(rest_phi);
+	
+	return in.read(prefix + "start_phi", m_per_edge_start_phi) &&
+		in.read(prefix + "multipliers", m_multipliers) && m_multipliers.size() == m_E_unique.rows();
 }
 
 Force* ShellBendingForce::createNewCopy()
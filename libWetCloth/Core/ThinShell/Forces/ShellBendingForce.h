@@ -11,15 +11,17 @@
 #define __SHELL_BENDING_FORCE_H__
 
 #include <Eigen/Core>
+#include <memory>
 
 #include "../../MathDefs.h"
 #include "../../Force.h"
 
+class TwoDScene;
+
 class ShellBendingForce : public Force
 {
 protected:
-	const VectorXs & m_pos;
-	const VectorXs & m_rest_pos;
+	std::shared_ptr<TwoDScene> m_scene; // positions are read through the scene, whose particle arrays move
 	const MatrixXi & m_F;
 	const VectorXs & m_triangle_rest_area;
 	
@@ -31,7 +33,7 @@ protected:
 	
 	const scalar& m_young_modulus;
 	const scalar& m_viscous_modulus;
-	const scalar& m_poisson_ratio;
+	scalar m_poisson_ratio;
 	
 	scalar m_thickness;
 	
@@ -44,14 +46,13 @@ protected:
 	std::vector<int> m_unique_edge_usable;
 	VectorXs m_multipliers;
 	
-	void computeBendingRestPhi(const VectorXs & rest_pos, VectorXs & rest_phis);
+	void computeBendingRestPhi(const ConstVectorXsRef& rest_pos, VectorXs & rest_phis);
     
     int m_bending_mode;
 	
 public:
 	
-	ShellBendingForce(const VectorXs & pos,
-					  const VectorXs & rest_pos,
+	ShellBendingForce(const std::shared_ptr<TwoDScene>& scene,
 					  const MatrixXi & F,
 					  const VectorXs & triangle_rest_area,
 					  const MatrixXi & E_unique,
@@ -67,13 +68,13 @@ public:
 	
 	virtual ~ShellBendingForce();
 	
-	virtual void addEnergyToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, scalar& E );
+	virtual void addEnergyToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, scalar& E );
 	
-	virtual void addGradEToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, VectorXs& gradE );
+	virtual void addGradEToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, VectorXs& gradE );
 	
-	virtual void addHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt );
+	virtual void addHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt );
 
-	virtual void updateMultipliers( const VectorXs& x, const VectorXs& vplus, const VectorXs& m, const VectorXs& psi, const scalar& lambda, const scalar& dt );
+	virtual void updateMultipliers( const ConstVectorXsRef& x, const ConstVectorXsRef& vplus, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, const scalar& dt );
 	
 	virtual int numHessX();
 	
@@ -81,6 +82,11 @@ public:
 	
 	virtual void updateStartState();
 	
+	// the rest shape as well, it may have been built in another pose
+	virtual void saveState( CheckpointWriter& out, const std::string& prefix ) const;
+	
+	virtual bool loadState( const CheckpointReader& in, const std::string& prefix );
+	
 	virtual Force* createNewCopy();
 	
 	virtual int flag() const;
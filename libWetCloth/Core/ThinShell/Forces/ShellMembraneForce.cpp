@@ -9,13 +9,15 @@
 
 
 #include "ShellMembraneForce.h"
+#include "../../Checkpoint.h"
+#include "../../TwoDScene.h"
 #include "../../ThreadUtils.h"
 #include <iostream>
 
 ShellMembraneForce::~ShellMembraneForce()
 {}
 
-void ShellMembraneForce::perFaceNormals( const VectorXs& V, const MatrixXi& F, MatrixXs& N )
+void ShellMembraneForce::perFaceNormals( const ConstVectorXsRef& V, const MatrixXi& F, MatrixXs& N )
 {
 	N.resize(F.rows(), 3);
 	
@@ -34,8 +36,7 @@ void ShellMembraneForce::perFaceNormals( const VectorXs& V, const MatrixXi& F, M
 	});
 }
 
-ShellMembraneForce::ShellMembraneForce(const VectorXs & rest_pos,
-									   const VectorXs & pos,
+ShellMembraneForce::ShellMembraneForce(const std::shared_ptr<TwoDScene>& scene,
 									   const MatrixXi & F,
 									   const VectorXs & triangle_rest_area,
 									   const scalar& young_modulus,
@@ -43,8 +44,7 @@ ShellMembraneForce::ShellMembraneForce(const VectorXs & rest_pos,
 									   const scalar& poisson_ratio,
 									   const scalar& thickness,
 									   bool apply_viscous)
-: m_rest_pos(rest_pos),
-m_pos(pos),
+: m_scene(scene),
 m_F(F),
 m_triangle_rest_area(triangle_rest_area),
 m_young_modulus(young_modulus),
@@ -53,7 +53,8 @@ m_poisson_ratio(poisson_ratio),
 m_apply_viscous(apply_viscous),
 m_thickness(thickness)
 {
-	perFaceNormals(m_rest_pos, m_F, m_triangle_normals);
+	ConstVectorXsRef rest_pos = m_scene->getRestPos();
+	perFaceNormals(rest_pos, m_F, m_triangle_normals);
 	m_membrane_ru.resize(m_F.rows(), 3);
 	m_membrane_rv.resize(m_F.rows(), 3);
 	m_membrane_multiplier.resize(m_F.rows() * 3);
@@ -62,9 +63,9 @@ m_thickness(thickness)
 	m_viscous_multipler.setZero();
 	
 	threadutils::for_each(0, (int) m_F.rows(), [&] (int f) {
-		const Vector3s& x0 = m_rest_pos.segment<3>(m_F(f,0) * 4).transpose();
-		const Vector3s& x1 = m_rest_pos.segment<3>(m_F(f,1) * 4).transpose();
-		const Vector3s& x2 = m_rest_pos.segment<3>(m_F(f,2) * 4).transpose();
+		const Vector3s& x0 = rest_pos.segment<3>(m_F(f,0) * 4).transpose();
+		const Vector3s& x1 = rest_pos.segment<3>(m_F(f,1) * 4).transpose();
+		const Vector3s& x2 = rest_pos.segment<3>(m_F(f,2) * 4).transpose();
 		
 		const Vector3s normal = m_triangle_normals.row(f);
 		
@@ -87,12 +88,12 @@ m_thickness(thickness)
 	m_membrane_material_tensor = m_membrane_material_tensor_base * (m_young_modulus * thickness / (1 - m_poisson_ratio * m_poisson_ratio)); //dyne/cm
 }
 
-void ShellMembraneForce::addEnergyToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, scalar& E )
+void ShellMembraneForce::addEnergyToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, scalar& E )
 {
 	std::cerr << "NOT IMPLEMENTED!" << std::endl;
 }
 
-void ShellMembraneForce::addGradEToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, VectorXs& gradE )
+void ShellMembraneForce::addGradEToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, VectorXs& gradE )
 {
 	for (int f = 0; f < m_F.rows(); ++f) {
 		const scalar psi_base = (psi(m_F(f,0)) + psi(m_F(f,1)) + psi(m_F(f,2))) / 3.0;
@@ -138,7 +139,7 @@ void ShellMembraneForce::addGradEToTotal( const VectorXs& x, const VectorXs& v,
 	}
 }
 
-void ShellMembraneForce::addHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
+void ShellMembraneForce::addHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
 {
 	threadutils::for_each(0, (int) m_F.rows(), [&] (int f) {
 		const scalar psi_base = (psi(m_F(f,0)) + psi(m_F(f,1)) + psi(m_F(f,2))) / 3.0;
@@ -188,7 +189,7 @@ void ShellMembraneForce::addHessXToTotal( const VectorXs& x, const VectorXs& v,
 	});
 }
 
-void ShellMembraneForce::updateMultipliers( const VectorXs& x, const VectorXs& vplus, const VectorXs& m, const VectorXs& psi, const scalar& lambda, const scalar& dt )
+void ShellMembraneForce::updateMultipliers( const ConstVectorXsRef& x, const ConstVectorXsRef& vplus, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, const scalar& dt )
 {
 	threadutils::for_each(0, (int) m_F.rows(), [&] (int f) {
 		const scalar psi_base = (psi(m_F(f,0)) + psi(m_F(f,1)) + psi(m_F(f,2))) / 3.0;
@@ -235,7 +236,7 @@ int ShellMembraneForce::numHessX()
 
 void ShellMembraneForce::preCompute()
 {
-	perFaceNormals(m_pos, m_F, m_triangle_normals);
+	perFaceNormals(m_scene->getX(), m_F, m_triangle_normals);
 	
 	// update viscous tensor in-case dt changes
 	m_membrane_material_viscous_tensor = m_membrane_material_tensor_base * (m_viscous_modulus * m_thickness / (1 - m_poisson_ratio * m_poisson_ratio));
@@ -243,7 +244,31 @@ void ShellMembraneForce::preCompute()
 
 void ShellMembraneForce::updateStartState()
 {
-	m_start_pos = m_pos;
+	m_start_pos = m_scene->getX();
+}
+
+void ShellMembraneForce::saveState( CheckpointWriter& out, const std::string& prefix ) const
+{
+	out.add(prefix + "ru", m_membrane_ru);
+	out.add(prefix + "rv", m_membrane_rv);
+	out.add(prefix + "start_pos", m_start_pos);
+	out.add(prefix + "membrane_multiplier", m_membrane_multiplier);
+	out.add(prefix + "viscous_multiplier", m_viscous_multipler);
+}
+
+bool ShellMembraneForce::loadState( const CheckpointReader& in, const std::string& prefix )
+{
+	MatrixXs ru;
+	MatrixXs rv;
+	if (!in.read(prefix + "ru", ru) || ru.rows() != m_membrane_ru.rows() || ru.cols() != m_membrane_ru.cols() ||
+		!in.read(prefix + "rv", rv) || rv.rows() != m_membrane_rv.rows() || rv.cols() != m_membrane_rv.cols()) return false;
+	
+	m_membrane_ru.swap(ru);
+	m_membrane_rv.swap(rv);
+	
+	return in.read(prefix + "start_pos", m_start_pos) &&
+		in.read(prefix + "membrane_multiplier", m_membrane_multiplier) && m_membrane_multiplier.size() == m_F.rows() * 3 &&
+		in.read(prefix + "viscous_multiplier", m_viscous_multipler) && m_viscous_multipler.size() == m_F.rows() * 3;
 }
 
 Force* ShellMembraneForce::createNewCopy()
@@ -11,15 +11,17 @@
 #define __SHELL_MEMBRANE_FORCE_H__
 
 #include <Eigen/Core>
+#include <memory>
 
 #include "../../MathDefs.h"
 #include "../../Force.h"
 
+class TwoDScene;
+
 class ShellMembraneForce : public Force
 {
 protected:
-	const VectorXs & m_rest_pos;
-	const VectorXs & m_pos;
+	std::shared_ptr<TwoDScene> m_scene; // positions are read through the scene, whose particle arrays move
 	const MatrixXi & m_F;
 	const VectorXs & m_triangle_rest_area;
 	
@@ -27,7 +29,7 @@ protected:
 	
 	const scalar& m_young_modulus;
 	const scalar& m_viscous_modulus;
-	const scalar& m_poisson_ratio;
+	scalar m_poisson_ratio;
 	Matrix3s m_membrane_material_tensor_base;
 	Matrix3s m_membrane_material_tensor;
 	Matrix3s m_membrane_material_viscous_tensor;
@@ -42,12 +44,11 @@ protected:
 	bool m_apply_viscous;
 	scalar m_thickness;
 	
-	void perFaceNormals( const VectorXs& V, const MatrixXi& F, MatrixXs& N );
+	void perFaceNormals( const ConstVectorXsRef& V, const MatrixXi& F, MatrixXs& N );
 	
 public:
 	
-	ShellMembraneForce(const VectorXs & rest_pos,
-					   const VectorXs & pos,
+	ShellMembraneForce(const std::shared_ptr<TwoDScene>& scene,
 					   const MatrixXi & F,
 					   const VectorXs & triangle_rest_area,
 					   const scalar& young_modulus,
@@ -58,13 +59,13 @@ public:
 	
 	virtual ~ShellMembraneForce();
 	
-	virtual void addEnergyToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, scalar& E );
+	virtual void addEnergyToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, scalar& E );
 	
-	virtual void addGradEToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, VectorXs& gradE );
+	virtual void addGradEToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, VectorXs& gradE );
 	
-	virtual void addHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt );
+	virtual void addHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt );
 
-	virtual void updateMultipliers( const VectorXs& x, const VectorXs& vplus, const VectorXs& m, const VectorXs& psi, const scalar& lambda, const scalar& dt );
+	virtual void updateMultipliers( const ConstVectorXsRef& x, const ConstVectorXsRef& vplus, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, const scalar& dt );
 	
 	virtual int numHessX();
 	
@@ -72,6 +73,11 @@ public:
 	
 	virtual void updateStartState();
 	
+	// the rest shape as well, it may have been built in another pose
+	virtual void saveState( CheckpointWriter& out, const std::string& prefix ) const;
+	
+	virtual bool loadState( const CheckpointReader& in, const std::string& prefix );
+	
 	virtual Force* createNewCopy();
 
 	virtual int flag() const;
@@ -11,6 +11,7 @@
 
 #include "ThinShellForce.h"
 #include "../DER/StrandParameters.h"
+#include "../Checkpoint.h"
 
 #include <igl/per_vertex_normals.h>
 #include <igl/vertex_triangle_adjacency.h>
@@ -34,7 +35,7 @@ ThinShellForce::~ThinShellForce()
 ThinShellForce::ThinShellForce(const std::shared_ptr<TwoDScene>& scene, const std::vector< Vector3i >& faces, const int& parameterIndex, int globalIndex)
 : m_scene(scene)
 {
-	const VectorXs& rest_pos = scene->getRestPos();
+	ConstVectorXsRef rest_pos = scene->getRestPos();
 	const int num_particles = scene->getNumParticles();
 	
 	m_F.resize(faces.size(), 3);
@@ -120,7 +121,7 @@ ThinShellForce::ThinShellForce(const std::shared_ptr<TwoDScene>& scene, const st
 	const scalar poisson_ratio = params->m_youngsModulus.get() / (2.0 * params->m_shearModulus.get()) - 1.0;
 	
 	m_forces.push_back( std::make_shared<ShellMembraneForce>( 
-		rest_pos, scene->getX(), 
+		scene, 
 		m_F, m_triangle_rest_areas, 
 		params->m_youngsModulus.get(),
 		params->m_viscousBendingCoefficientBase,
@@ -128,7 +129,7 @@ ThinShellForce::ThinShellForce(const std::shared_ptr<TwoDScene>& scene, const st
 		params->m_physicalRadius.get()(0) + params->m_physicalRadius.get()(1),
 		params->m_accumulateWithViscous && !params->m_accumulateViscousOnlyForBendingModes) );
 	m_forces.push_back( std::make_shared<ShellBendingForce>(
-		scene->getX(), rest_pos, 
+		scene, 
 		m_F, m_triangle_rest_areas, 
 		m_E_unique, m_per_unique_edge_triangles, 
 		m_per_unique_edge_triangles_local_corners, 
@@ -141,7 +142,7 @@ ThinShellForce::ThinShellForce(const std::shared_ptr<TwoDScene>& scene, const st
 		params->m_accumulateWithViscous) );
 }
 
-void ThinShellForce::updateMultipliers( const VectorXs& x, const VectorXs& vplus, const VectorXs& m, const VectorXs& psi, const scalar& lambda, const scalar& dt )
+void ThinShellForce::updateMultipliers( const ConstVectorXsRef& x, const ConstVectorXsRef& vplus, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, const scalar& dt )
 {
 	for(auto& force : m_forces)
 	{
@@ -150,7 +151,7 @@ void ThinShellForce::updateMultipliers( const VectorXs& x, const VectorXs& vplus
 }
 
 
-void ThinShellForce::addEnergyToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, scalar& E )
+void ThinShellForce::addEnergyToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, scalar& E )
 {
 	for(auto& force : m_forces)
 	{
@@ -158,7 +159,7 @@ void ThinShellForce::addEnergyToTotal( const VectorXs& x, const VectorXs& v, con
 	}
 }
 
-void ThinShellForce::addGradEToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, VectorXs& gradE )
+void ThinShellForce::addGradEToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, VectorXs& gradE )
 {
 	for(auto& force : m_forces)
 	{
@@ -166,7 +167,7 @@ void ThinShellForce::addGradEToTotal( const VectorXs& x, const VectorXs& v, cons
 	}
 }
 
-void ThinShellForce::addHessXToTotal( const VectorXs& x, const VectorXs& v, const VectorXs& m, const VectorXs& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
+void ThinShellForce::addHessXToTotal( const ConstVectorXsRef& x, const ConstVectorXsRef& v, const ConstVectorXsRef& m, const ConstVectorXsRef& psi, const scalar& lambda, TripletXs& hessE, int hessE_index, const scalar& dt )
 {
 	int idx = hessE_index;
 	for(auto& force : m_forces)
@@ -202,6 +203,32 @@ void ThinShellForce::updateStartState()
 	}
 }
 
+void ThinShellForce::saveState( CheckpointWriter& out, const std::string& prefix ) const
+{
+	out.add(prefix + "triangle_rest_areas", m_triangle_rest_areas);
+	
+	for(int i = 0; i < (int) m_forces.size(); ++i)
+	{
+		m_forces[i]->saveState(out, prefix + std::to_string(i) + "/");
+	}
+}
+
+bool ThinShellForce::loadState( const CheckpointReader& in, const std::string& prefix )
+{
+	// assigned in place: the membrane and bending forces refer to this vector
+	VectorXs rest_areas;
+	if (!in.read(prefix + "triangle_rest_areas", rest_areas) || rest_areas.size() != m_triangle_rest_areas.size()) return false;
+	
+	m_triangle_rest_areas = rest_areas;
+	
+	for(int i = 0; i < (int) m_forces.size(); ++i)
+	{
+		if (!m_forces[i]->loadState(in, prefix + std::to_string(i) + "/")) return false;
+	}
+	
+	return true;
+}
+
 Force* ThinShellForce::createNewCopy()
 {
 	return new ThinShellForce(*this);
@@ -10,6 +10,11 @@
 #ifndef THREAD_UTILS_H
 #define THREAD_UTILS_H
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <thread>
 #include <tbb/tbb.h>
 #include <vector>
@@ -18,19 +23,154 @@
 // #define NO_PARALLEL 1
 
 namespace threadutils {
+// In the deterministic mode results do not depend on the number of threads
+// or on the schedule: reductions combine fixed blocks in order and random
+// numbers come from counter-based streams (see mathutils::streamRand).
+inline bool& deterministic_flag()
+{
+	static bool flag = false;
+	return flag;
+}
+
+inline bool is_deterministic()
+{
+	return deterministic_flag();
+}
+
+inline void set_deterministic(bool deterministic)
+{
+	deterministic_flag() = deterministic;
+}
+
+// thread count from the command line or the scene file, 0 for the hardware default
+inline int& num_threads_setting()
+{
+	static int num_threads = 0;
+	return num_threads;
+}
+
+inline bool num_threads_configured()
+{
+	return num_threads_setting() > 0;
+}
+
+// limit the TBB scheduler to num_threads workers (0 to lift the limit)
+inline void set_num_threads(int num_threads)
+{
+	static std::unique_ptr<tbb::global_control> control;
+
+	num_threads_setting() = std::max(0, num_threads);
+	control.reset();
+
+	if (num_threads > 0) {
+		control.reset(new tbb::global_control(tbb::global_control::max_allowed_parallelism, (size_t) num_threads));
+	}
+}
+
 inline unsigned get_num_threads()
 {
 #if (defined(NDEBUG) || DEBUG_PARALLEL) && !NO_PARALLEL
-	return std::thread::hardware_concurrency();
+	unsigned num_threads = num_threads_configured() ? (unsigned) num_threads_setting() : std::max(1U, std::thread::hardware_concurrency());
+
+	// the runs of a batch each work in a task arena of their own share of the threads
+	const int arena_threads = tbb::this_task_arena::max_concurrency();
+	if (arena_threads > 0) num_threads = std::min(num_threads, (unsigned) arena_threads);
+
+	return num_threads;
 #else
 	return 1U;
 #endif
 }
 
+// grain of a loop over n items: a few chunks per thread, so that short
+// loop bodies are not scheduled one index at a time
+template<typename Index>
+inline Index grain_size(Index n)
+{
+	const Index chunks = (Index) get_num_threads() * 8;
+	return std::max(Index(1), n / chunks);
+}
+
+/*!
+ * An affinity partitioner that is not shared by copies of its owner.
+ *
+ * Loops over the same range that go through the same partitioner replay the
+ * index-to-thread mapping of the previous loop, so per-index arrays first
+ * touched (allocated and written) in one loop stay in the cache and on the
+ * NUMA node of the thread that processes them in the next ones.
+ */
+class AffinityPartitioner : public tbb::affinity_partitioner
+{
+public:
+	AffinityPartitioner() {}
+	AffinityPartitioner(const AffinityPartitioner&) : tbb::affinity_partitioner() {}
+	AffinityPartitioner& operator=(const AffinityPartitioner&) { return *this; }
+};
+
 template<typename Index, typename Callable>
 static void for_each(Index start, Index end, Callable func) {
 #if (defined(NDEBUG) || DEBUG_PARALLEL) && !NO_PARALLEL
-	tbb::parallel_for(start, end, 1, func);
+	if (end <= start) return;
+
+	tbb::parallel_for(tbb::blocked_range<Index>(start, end, grain_size(end - start)), [&] (const tbb::blocked_range<Index>& r) {
+		for (Index i = r.begin(); i != r.end(); ++i) {
+			func(i);
+		}
+	});
+#else
+	for (Index i = start; i < end; ++i) {
+		func(i);
+	}
+#endif
+}
+
+// for_each that keeps the index-to-thread mapping of the partitioner
+template<typename Index, typename Callable>
+static void for_each(Index start, Index end, AffinityPartitioner& partitioner, Callable func) {
+#if (defined(NDEBUG) || DEBUG_PARALLEL) && !NO_PARALLEL
+	tbb::parallel_for(tbb::blocked_range<Index>(start, end), [&] (const tbb::blocked_range<Index>& r) {
+		for (Index i = r.begin(); i != r.end(); ++i) {
+			func(i);
+		}
+	}, partitioner);
+#else
+	for (Index i = start; i < end; ++i) {
+		func(i);
+	}
+#endif
+}
+
+// for_each split into contiguous chunks of about the same estimated work,
+// weight(i) + 1 per index (e.g. the number of particles in bucket i)
+template<typename Index, typename Weight, typename Callable>
+static void for_each_weighted(Index start, Index end, Weight weight, Callable func) {
+#if (defined(NDEBUG) || DEBUG_PARALLEL) && !NO_PARALLEL
+	if (end <= start) return;
+
+	int64_t total = 0;
+	for (Index i = start; i < end; ++i) {
+		total += (int64_t) weight(i) + 1;
+	}
+
+	const int64_t chunk_work = std::max((int64_t) 1, total / ((int64_t) get_num_threads() * 8));
+
+	std::vector<Index> bounds(1, start);
+	int64_t work = 0;
+	for (Index i = start; i < end; ++i) {
+		work += (int64_t) weight(i) + 1;
+		if (work >= chunk_work) {
+			bounds.push_back(i + 1);
+			work = 0;
+		}
+	}
+	if (bounds.back() != end) bounds.push_back(end);
+
+	const int num_chunks = (int) bounds.size() - 1;
+	tbb::parallel_for(0, num_chunks, 1, [&] (int c) {
+		for (Index i = bounds[c]; i < bounds[c + 1]; ++i) {
+			func(i);
+		}
+	});
 #else
 	for (Index i = start; i < end; ++i) {
 		func(i);
@@ -38,10 +178,55 @@ static void for_each(Index start, Index end, Callable func) {
 #endif
 }
 
+/*!
+ * Run func on the nodes of a dependency graph, a node starts once all of its
+ * predecessors are done: ready lists the nodes without predecessors,
+ * num_preds[n] counts the predecessors of node n, and the successors of n are
+ * succ[succ_offsets[n]], ..., succ[succ_offsets[n + 1] - 1]. Nodes that become
+ * ready are spawned as tasks and stolen by idle threads, so there is no
+ * barrier between the levels of the graph.
+ */
+template<typename Callable>
+static void for_each_dependent(const std::vector<int>& ready, const std::vector<int>& num_preds, const std::vector<int>& succ_offsets, const std::vector<int>& succ, Callable func) {
+#if (defined(NDEBUG) || DEBUG_PARALLEL) && !NO_PARALLEL
+	const int n = (int) num_preds.size();
+	std::unique_ptr< std::atomic<int>[] > remaining(new std::atomic<int>[n]);
+	for (int i = 0; i < n; ++i) {
+		remaining[i].store(num_preds[i], std::memory_order_relaxed);
+	}
+
+	tbb::task_group group;
+	std::function<void(int)> run = [&] (int node) {
+		func(node);
+		for (int s = succ_offsets[node]; s < succ_offsets[node + 1]; ++s) {
+			const int next = succ[s];
+			if (remaining[next].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				group.run([&run, next] { run(next); });
+			}
+		}
+	};
+
+	for (int node : ready) {
+		group.run([&run, node] { run(node); });
+	}
+	group.wait();
+#else
+	std::vector<int> remaining(num_preds);
+	std::vector<int> queue(ready);
+	for (size_t q = 0; q < queue.size(); ++q) {
+		const int node = queue[q];
+		func(node);
+		for (int s = succ_offsets[node]; s < succ_offsets[node + 1]; ++s) {
+			if (--remaining[succ[s]] == 0) queue.push_back(succ[s]);
+		}
+	}
+#endif
+}
+
 template<typename Data, typename Callable>
 static void for_each(std::vector<Data>& vec, Callable func) {
 #if (defined(NDEBUG) || DEBUG_PARALLEL) && !NO_PARALLEL
-	tbb::parallel_for(0, (int) vec.size(), 1, [&] (int i) {
+	for_each(0, (int) vec.size(), [&] (int i) {
 		func(vec[i]);
 	});
 #else
@@ -51,10 +236,51 @@ static void for_each(std::vector<Data>& vec, Callable func) {
 #endif
 }
 
+// size of the fixed blocks of the reductions below
+const int reduction_block_size = 4096;
+
+// combine(base, block_func(begin, end)) over fixed blocks of [0, n), in
+// block order, so the result does not depend on the threads in any mode
+template<typename Index, typename Data, typename BlockCallable, typename Combine>
+static Data reduction(Index n, const Data& base, BlockCallable block_func, Combine combine)
+{
+	const Index block_size = (Index) reduction_block_size;
+	const Index num_blocks = (n + block_size - 1) / block_size;
+	if (num_blocks <= 1) return n > 0 ? combine(base, block_func(Index(0), n)) : base;
+
+	std::vector<Data> partials(num_blocks, base);
+
+#if (defined(NDEBUG) || DEBUG_PARALLEL) && !NO_PARALLEL
+	tbb::parallel_for(Index(0), num_blocks, Index(1), [&] (Index b) {
+		partials[b] = block_func(b * block_size, std::min(n, (b + 1) * block_size));
+	});
+#else
+	for (Index b = 0; b < num_blocks; ++b) {
+		partials[b] = block_func(b * block_size, std::min(n, (b + 1) * block_size));
+	}
+#endif
+
+	Data res = base;
+	for (Index b = 0; b < num_blocks; ++b) {
+		res = combine(res, partials[b]);
+	}
+	return res;
+}
+
 template<typename Index, typename Data, typename Callable>
 static Data reduction(Data* array, Index n, const Data& base, Callable func)
 {
 #if (defined(NDEBUG) || DEBUG_PARALLEL) && !NO_PARALLEL
+	if (is_deterministic()) {
+		return reduction(n, base, [&] (Index begin, Index end) -> Data {
+			Data res = base;
+			for (Index i = begin; i < end; ++i) {
+				res = func(res, array[i]);
+			}
+			return res;
+		}, func);
+	}
+
 	return tbb::parallel_reduce( tbb::blocked_range<Data*>( array, array + n ), base, [&](const tbb::blocked_range<Data*>& r, Data init) -> Data {
 		for ( Data* a = r.begin(); a != r.end(); ++a ) {
 			init = func(init, *a);
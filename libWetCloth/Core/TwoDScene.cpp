@@ -18,6 +18,7 @@
 #include <igl/point_simplex_squared_distance.h>
 #include <igl/ray_mesh_intersect.h>
 #include <stack>
+#include <cstring>
 #include <numeric>
 
 
@@ -64,6 +65,7 @@ std::ostream& operator<<(std::ostream& os, const LiquidInfo& info)
     os << "propagate solid velocity: " <<       info.propagate_solid_velocity << std::endl;
     os << "check divergence: " <<               info.check_divergence << std::endl;
     os << "use varying fraction: " <<           info.use_varying_fraction << std::endl;
+    os << "sort particles: " <<                 info.sort_particles << std::endl;
     return os;
 }
 
@@ -71,16 +73,54 @@ std::ostream& operator<<(std::ostream& os, const LiquidInfo& info)
  * init the Scene structure
  */
 TwoDScene::TwoDScene()
-    : m_x()
-    , m_v()
-    , m_m()
-    , m_fixed()
+    : m_fixed()
     , step_count(0)
     , m_edges()
     , m_num_colors(1)
+    , m_bucket_origin(Vector3i::Zero())
+    , m_bucket_layout_changed(true)
     , m_forces()
 {
     sphere_pattern::generateSpherePattern(m_sphere_pattern);
+
+    m_particles.addColumn("x", m_x, 4);
+    m_particles.addColumn("rest_x", m_rest_x, 4);
+    m_particles.addColumn("v", m_v, 4);
+    m_particles.addColumn("saved_v", m_saved_v, 4);
+    m_particles.addColumn("dv", m_dv, 4);
+    m_particles.addColumn("fluid_v", m_fluid_v, 4);
+    m_particles.addColumn("m", m_m, 4);
+    m_particles.addColumn("fluid_m", m_fluid_m, 4);
+    m_particles.addColumn("orientation", m_orientation, 3);
+    m_particles.addColumn("radius", m_radius, 2);
+    m_particles.addColumn("vol", m_vol);
+    m_particles.addColumn("rest_vol", m_rest_vol);
+    m_particles.addColumn("fluid_vol", m_fluid_vol);
+    m_particles.addColumn("shape_factor", m_shape_factor);
+    m_particles.addColumn("volume_fraction", m_volume_fraction);
+    m_particles.addColumn("rest_volume_fraction", m_rest_volume_fraction);
+    m_particles.addColumn("particle_rest_length", m_particle_rest_length);
+    m_particles.addColumn("particle_rest_area", m_particle_rest_area);
+    m_particles.addColumn("inside", m_inside);
+    m_particles.addColumn("fixed", m_fixed);
+    m_particles.addColumn("twist", m_twist);
+    m_particles.addColumn("particle_to_edge", m_particle_to_edge);
+    m_particles.addColumn("particle_to_face", m_particle_to_face);
+    m_particles.addColumn("particle_to_surfel", m_particle_to_surfel, -1);
+    m_particles.addColumn("particle_group", m_particle_group);
+    m_particles.addColumn("classifier", m_classifier, PC_NONE);
+    m_particles.addColumn("is_strand_tip", m_is_strand_tip);
+    m_particles.addColumn("div", m_div);
+    m_particles.addColumn("B", m_B, 3, 3);
+    m_particles.addColumn("fB", m_fB, 3, 3);
+
+    m_particles.addTransientColumn(m_particle_nodes_x);
+    m_particles.addTransientColumn(m_particle_nodes_y);
+    m_particles.addTransientColumn(m_particle_nodes_z);
+    m_particles.addTransientColumn(m_particle_nodes_p);
+    m_particles.addTransientColumn(m_particle_nodes_solid_phi);
+    m_particles.addTransientColumn(m_particle_weights);
+    m_particles.addTransientColumn(m_particle_weights_p);
 }
 
 TwoDScene::~TwoDScene()
@@ -94,7 +134,7 @@ int TwoDScene::getNumBuckets() const
 
 int TwoDScene::getNumParticles() const
 {
-    return m_x.size() / 4;
+    return m_particles.size();
 }
 
 int TwoDScene::getNumEdges() const
@@ -122,84 +162,84 @@ int TwoDScene::getNumStrandParameters() const
     return m_strandParameters.size();
 }
 
-const VectorXs& TwoDScene::getX() const
+ConstVectorXsRef TwoDScene::getX() const
 {
-    return m_x;
+    return m_x.head(getNumParticles() * 4);
 }
 
-VectorXs& TwoDScene::getX()
+VectorXsRef TwoDScene::getX()
 {
-    return m_x;
+    return m_x.head(getNumParticles() * 4);
 }
 
-const VectorXs& TwoDScene::getV() const
+ConstVectorXsRef TwoDScene::getV() const
 {
-    return m_v;
+    return m_v.head(getNumParticles() * 4);
 }
 
-VectorXs& TwoDScene::getV()
+VectorXsRef TwoDScene::getV()
 {
-    return m_v;
+    return m_v.head(getNumParticles() * 4);
 }
 
-const VectorXs& TwoDScene::getFluidV() const
+ConstVectorXsRef TwoDScene::getFluidV() const
 {
-    return m_fluid_v;
+    return m_fluid_v.head(getNumParticles() * 4);
 }
 
-VectorXs& TwoDScene::getFluidV()
+VectorXsRef TwoDScene::getFluidV()
 {
-    return m_fluid_v;
+    return m_fluid_v.head(getNumParticles() * 4);
 }
 
-const VectorXs& TwoDScene::getM() const
+ConstVectorXsRef TwoDScene::getM() const
 {
-    return m_m;
+    return m_m.head(getNumParticles() * 4);
 }
 
-VectorXs& TwoDScene::getM()
+VectorXsRef TwoDScene::getM()
 {
-    return m_m;
+    return m_m.head(getNumParticles() * 4);
 }
 
-const VectorXs& TwoDScene::getFluidM() const
+ConstVectorXsRef TwoDScene::getFluidM() const
 {
-    return m_fluid_m;
+    return m_fluid_m.head(getNumParticles() * 4);
 }
 
-VectorXs& TwoDScene::getFluidM()
+VectorXsRef TwoDScene::getFluidM()
 {
-    return m_fluid_m;
+    return m_fluid_m.head(getNumParticles() * 4);
 }
 
-const VectorXs& TwoDScene::getFluidVol() const
+ConstVectorXsRef TwoDScene::getFluidVol() const
 {
-    return m_fluid_vol;
+    return m_fluid_vol.head(getNumParticles());
 }
 
-VectorXs& TwoDScene::getFluidVol()
+VectorXsRef TwoDScene::getFluidVol()
 {
-    return m_fluid_vol;
+    return m_fluid_vol.head(getNumParticles());
 }
 
-const VectorXs& TwoDScene::getVol() const
+ConstVectorXsRef TwoDScene::getVol() const
 {
-    return m_vol;
+    return m_vol.head(getNumParticles());
 }
 
-VectorXs& TwoDScene::getVol()
+VectorXsRef TwoDScene::getVol()
 {
-    return m_vol;
+    return m_vol.head(getNumParticles());
 }
 
-const VectorXs& TwoDScene::getRadius() const
+ConstVectorXsRef TwoDScene::getRadius() const
 {
-    return m_radius;
+    return m_radius.head(getNumParticles() * 2);
 }
 
-VectorXs& TwoDScene::getRadius()
+VectorXsRef TwoDScene::getRadius()
 {
-    return m_radius;
+    return m_radius.head(getNumParticles() * 2);
 }
 
 const MatrixXs& TwoDScene::getGaussFe() const
@@ -282,37 +322,15 @@ MatrixXs& TwoDScene::getGaussD() {
  */
 void TwoDScene::swapParticles(int i, int j)
 {
-    mathutils::swap<scalar, 4>(m_x, i, j);
-    mathutils::swap<scalar, 4>(m_rest_x, i, j);
-    mathutils::swap<scalar, 4>(m_v, i, j);
-    mathutils::swap<scalar, 4>(m_saved_v, i, j);
-    mathutils::swap<scalar, 4>(m_dv, i, j);
-    mathutils::swap<scalar, 4>(m_fluid_v, i, j);
-    mathutils::swap<scalar, 4>(m_m, i, j);
-    mathutils::swap<scalar, 4>(m_fluid_m, i, j);
-    mathutils::swap<scalar, 3>(m_orientation, i, j);
-    mathutils::swap<scalar, 2>(m_radius, i, j);
-    std::swap(m_vol(i), m_vol(j));
-    std::swap(m_rest_vol(i), m_rest_vol(j));
-    std::swap(m_fluid_vol(i), m_fluid_vol(j));
-    std::swap(m_shape_factor(i), m_shape_factor(j));
-    std::swap(m_fixed[i], m_fixed[j]);
-    std::swap(m_twist[i], m_twist[j]);
-    std::swap(m_particle_to_edge[i], m_particle_to_edge[j]);
-    std::swap(m_particle_to_face[i], m_particle_to_face[j]);
-    std::swap(m_particle_to_surfel[i], m_particle_to_surfel[j]);
-    std::swap(m_particle_rest_length[i], m_particle_rest_length[j]);
-    std::swap(m_particle_rest_area[i], m_particle_rest_area[j]);
-    std::swap(m_particle_group[i], m_particle_group[j]);
-    std::swap(m_volume_fraction[i], m_volume_fraction[j]);
-    std::swap(m_rest_volume_fraction[i], m_rest_volume_fraction[j]);
-    std::swap(m_inside[i], m_inside[j]);
-    std::swap(m_classifier[i], m_classifier[j]);
-
-    std::swap(m_is_strand_tip[i], m_is_strand_tip[j]);
-
-    mathutils::swap<scalar, 3>(m_B, i, j);
-    mathutils::swap<scalar, 3>(m_fB, i, j);
+    m_particles.swap(i, j);
+}
+
+/*!
+ * reorder all particle buffers so that new particle i is old particle order[i]
+ */
+void TwoDScene::permuteParticles(const std::vector<int>& order)
+{
+    m_particles.permute(order);
 }
 
 std::shared_ptr< DistanceField >& TwoDScene::getGroupDistanceField(int igroup)
@@ -700,9 +718,9 @@ void TwoDScene::markInsideOut()
     });
 }
 
-const VectorXuc& TwoDScene::getOutsideInfo() const
+Eigen::Ref<const VectorXuc> TwoDScene::getOutsideInfo() const
 {
-    return m_inside;
+    return m_inside.head(getNumParticles());
 }
 
 const std::vector< VectorXs >& TwoDScene::getNodeFluidVolX() const
@@ -934,47 +952,7 @@ void TwoDScene::resizeParticleSystem( int num_particles )
 {
     assert( num_particles >= 0 );
 
-    m_x.resize(4 * num_particles);
-    m_rest_x.resize(4 * num_particles);
-    m_v.resize(4 * num_particles);
-    m_saved_v.resize(4 * num_particles);
-    m_dv.resize(4 * num_particles);
-    m_fluid_v.resize(4 * num_particles);
-    m_m.resize(4 * num_particles);
-    m_fluid_m.resize(4 * num_particles);
-    m_vol.resize(num_particles);
-    m_rest_vol.resize(num_particles);
-    m_shape_factor.resize(num_particles);
-    m_fluid_vol.resize(num_particles);
-    m_radius.resize(2 * num_particles);
-    m_fixed.resize(num_particles);
-    m_twist.resize(num_particles);
-    m_particle_to_edge.resize(num_particles);
-    m_particle_to_surfel.resize(num_particles, -1);
-    m_particle_to_face.resize(num_particles);
-    m_particle_rest_length.resize(num_particles);
-    m_particle_rest_area.resize(num_particles);
-    m_particle_group.resize(num_particles);
-    m_volume_fraction.resize(num_particles);
-    m_rest_volume_fraction.resize(num_particles);
-    m_div.resize(num_particles);
-    m_inside.resize(num_particles);
-    m_classifier.resize(num_particles, PC_NONE);
-    m_orientation.resize(3 * num_particles);
-
-    m_B.resize(num_particles * 3, 3);
-    m_fB.resize(num_particles * 3, 3);
-
-    m_particle_nodes_x.resize(num_particles);
-    m_particle_nodes_y.resize(num_particles);
-    m_particle_nodes_z.resize(num_particles);
-    m_particle_nodes_p.resize(num_particles);
-    m_particle_nodes_solid_phi.resize(num_particles);
-
-    m_particle_weights.resize(num_particles);
-    m_particle_weights_p.resize(num_particles);
-
-    m_is_strand_tip.resize(num_particles);
+    m_particles.resize(num_particles);
 
     m_particle_rest_length.setZero();
     m_particle_rest_area.setZero();
@@ -1006,47 +984,7 @@ bool TwoDScene::isOutsideFluid(int pidx) const
  */
 void TwoDScene::conservativeResizeParticles(int num_particles)
 {
-    m_x.conservativeResize(4 * num_particles);
-    m_rest_x.conservativeResize(4 * num_particles);
-    m_v.conservativeResize(4 * num_particles);
-    m_dv.conservativeResize(4 * num_particles);
-    m_saved_v.conservativeResize(4 * num_particles);
-    m_fluid_v.conservativeResize(4 * num_particles);
-    m_m.conservativeResize(4 * num_particles);
-    m_fluid_m.conservativeResize(4 * num_particles);
-    m_fluid_vol.conservativeResize(num_particles);
-    m_vol.conservativeResize(num_particles);
-    m_rest_vol.conservativeResize(num_particles);
-    m_shape_factor.conservativeResize(num_particles);
-    m_radius.conservativeResize(2 * num_particles);
-    m_volume_fraction.conservativeResize(num_particles);
-    m_rest_volume_fraction.conservativeResize(num_particles);
-    m_fixed.resize(num_particles);
-    m_twist.resize(num_particles);
-    m_particle_to_edge.resize(num_particles);
-    m_particle_to_face.resize(num_particles);
-    m_particle_to_surfel.resize(num_particles);
-    m_particle_rest_length.conservativeResize(num_particles);
-    m_particle_rest_area.conservativeResize(num_particles);
-    m_particle_group.resize(num_particles);
-    m_inside.resize(num_particles);
-    m_classifier.resize(num_particles);
-    m_orientation.conservativeResize(3 * num_particles);
-
-    m_B.conservativeResize(num_particles * 3, 3);
-    m_fB.conservativeResize(num_particles * 3, 3);
-
-    m_particle_nodes_x.resize(num_particles);
-    m_particle_nodes_y.resize(num_particles);
-    m_particle_nodes_z.resize(num_particles);
-    m_particle_nodes_p.resize(num_particles);
-    m_particle_nodes_solid_phi.resize(num_particles);
-
-    m_particle_weights.resize(num_particles);
-    m_particle_weights_p.resize(num_particles);
-
-    m_is_strand_tip.resize( num_particles );
-    m_div.resize( num_particles );
+    m_particles.conservativeResize(num_particles);
 }
 
 /*!
@@ -1761,19 +1699,19 @@ const std::vector< VectorXi >& TwoDScene::getNodeColorP() const
     return m_node_color_p;
 }
 
-const std::vector< std::pair<int, int> >& TwoDScene::getNodeParticlePairsX(int bucket_idx, int pidx) const
+NodeParticlePairs::Range TwoDScene::getNodeParticlePairsX(int bucket_idx, int pidx) const
 {
-    return m_node_particles_x[bucket_idx][pidx];
+    return m_node_particles_x.get(bucket_idx, pidx);
 }
 
-const std::vector< std::pair<int, int> >& TwoDScene::getNodeParticlePairsY(int bucket_idx, int pidx) const
+NodeParticlePairs::Range TwoDScene::getNodeParticlePairsY(int bucket_idx, int pidx) const
 {
-    return m_node_particles_y[bucket_idx][pidx];
+    return m_node_particles_y.get(bucket_idx, pidx);
 }
 
-const std::vector< std::pair<int, int> >& TwoDScene::getNodeParticlePairsZ(int bucket_idx, int pidx) const
+NodeParticlePairs::Range TwoDScene::getNodeParticlePairsZ(int bucket_idx, int pidx) const
 {
-    return m_node_particles_z[bucket_idx][pidx];
+    return m_node_particles_z.get(bucket_idx, pidx);
 }
 
 int TwoDScene::getNumBucketColors() const
@@ -1801,30 +1739,39 @@ const Vector3s& TwoDScene::getBucketMinCorner() const
  */
 void TwoDScene::rebucketizeParticles()
 {
-    scalar dx = getCellSize();
+    const int extra_border = 3;
 
-    const scalar extra_border = 3.0;
-
-    Vector3s content_size = m_bbx_max - m_bbx_min + Vector3s::Constant(m_bucket_size * extra_border * 2.0);
+    // buckets are anchored to a fixed world lattice. The layout is kept as
+    // long as it covers the particles without too much extra border, so that
+    // the nodes and node tables of unchanged buckets can be reused.
+    Vector3i bucket_min;
+    Vector3i bucket_max;
+    for (int r = 0; r < 3; ++r) {
+        bucket_min(r) = (int) floor(m_bbx_min(r) / m_bucket_size) - extra_border;
+        bucket_max(r) = (int) floor(m_bbx_max(r) / m_bucket_size) + 1 + extra_border;
+    }
 
-    Vector3i grid_num_cells = Vector3i(std::max(1, (int) ceil(content_size(0) / dx)),
-                                       std::max(1, (int) ceil(content_size(1) / dx)),
-                                       std::max(1, (int) ceil(content_size(2) / dx)));
+    const Vector3i old_num_buckets = Vector3i(m_particle_buckets.ni, m_particle_buckets.nj, m_particle_buckets.nk);
 
-    Vector3s grid_size = Vector3s( (scalar) grid_num_cells[0] * dx,
-                                   (scalar) grid_num_cells[1] * dx,
-                                   (scalar) grid_num_cells[2] * dx );
+    bool keep_layout = m_particle_buckets.size() > 0;
+    for (int r = 0; r < 3 && keep_layout; ++r) {
+        keep_layout = bucket_min(r) >= m_bucket_origin(r) &&
+                      bucket_max(r) <= m_bucket_origin(r) + old_num_buckets(r) &&
+                      old_num_buckets(r) <= bucket_max(r) - bucket_min(r) + extra_border * 2;
+    }
 
-    m_grid_mincorner = m_bbx_min - Vector3s::Constant(m_bucket_size * extra_border);
-    m_bucket_mincorner = m_grid_mincorner;
+    if (!keep_layout) {
+        // leave one bucket of slack on each side
+        m_bucket_origin = bucket_min - Vector3i::Ones();
+        const Vector3i num_buckets = bucket_max - bucket_min + Vector3i::Constant(2);
 
-    Vector3i num_buckets = Vector3i(std::max(1, (int) ceil(grid_size(0) / m_bucket_size)),
-                                    std::max(1, (int) ceil(grid_size(1) / m_bucket_size)),
-                                    std::max(1, (int) ceil(grid_size(2) / m_bucket_size)));
+        m_grid_mincorner = m_bucket_origin.cast<scalar>() * m_bucket_size;
+        m_bucket_mincorner = m_grid_mincorner;
 
-    m_particle_buckets.resize(num_buckets(0), num_buckets(1), num_buckets(2));
-    m_gauss_buckets.resize(num_buckets(0), num_buckets(1), num_buckets(2));
-    m_particle_cells.resize(grid_num_cells(0), grid_num_cells(1), grid_num_cells(2));
+        m_particle_buckets.resize(num_buckets(0), num_buckets(1), num_buckets(2));
+        m_gauss_buckets.resize(num_buckets(0), num_buckets(1), num_buckets(2));
+        m_particle_cells.resize(num_buckets(0) * m_num_nodes, num_buckets(1) * m_num_nodes, num_buckets(2) * m_num_nodes);
+    }
 
     m_particle_buckets.sort(getNumParticles(), [&] (int pidx, int& i, int& j, int& k) {
         i = (int)floor((m_x(pidx * 4 + 0) - m_bucket_mincorner(0)) / m_bucket_size);
@@ -1840,30 +1787,68 @@ void TwoDScene::rebucketizeParticles()
 
     const int total_buckets = m_particle_buckets.size();
 
+    // after a restart there are no node tables to reuse yet
+    m_bucket_layout_changed = !keep_layout || (int) m_node_pos.size() != total_buckets;
+    m_bucket_activated_prev.swap(m_bucket_activated);
     m_bucket_activated.assign(total_buckets, 0U);
 }
 
 /*!
- * remove empty particles.
+ * reorder liquid particles in bucket order, so that per-bucket particle loops
+ * walk through contiguous memory. Elastic vertices are referenced by edges,
+ * faces, strands and Gauss points, hence they keep their indices.
  */
-void TwoDScene::removeEmptyParticles()
+void TwoDScene::sortLiquidParticles()
 {
     const int num_parts = getNumParticles();
     const int num_elasto = getNumElastoParticles();
+    if (num_parts == num_elasto) return;
 
-    int new_num_parts = num_parts;
-    for (int i = num_elasto; i < new_num_parts; )
+    std::vector<uint64_t>& array_idx = m_particle_buckets.array_idx;
+
+    std::vector<int> order(num_parts);
+    std::iota(order.begin(), order.begin() + num_elasto, 0);
+
+    int k = num_elasto;
+    for (uint64_t hash : array_idx)
     {
-        if (m_fluid_vol(i) < 1e-20) {
-            swapParticles(i, --new_num_parts);
-        } else {
-            ++i;
-        }
+        const int pidx = (int) (hash & 0xFFFFFFFFUL);
+        if (pidx >= num_elasto) order[k++] = pidx;
     }
 
-    if (new_num_parts < num_parts) {
-        conservativeResizeParticles(new_num_parts);
+    permuteParticles(order);
+
+    std::vector<int> new_index(num_parts);
+    threadutils::for_each(0, num_parts, [&] (int i) {
+        new_index[order[i]] = i;
+    });
+
+    // the buckets keep their particles, only the indices change. Within a
+    // bucket the new indices are still increasing, so the keys stay sorted.
+    threadutils::for_each(0, num_parts, [&] (int N_ID) {
+        const uint64_t bucket = array_idx[N_ID] >> 32UL;
+        const int pidx = (int) (array_idx[N_ID] & 0xFFFFFFFFUL);
+        array_idx[N_ID] = bucket << 32UL | (uint64_t) new_index[pidx];
+    });
+}
+
+/*!
+ * remove empty particles.
+ */
+void TwoDScene::removeEmptyParticles()
+{
+    const int num_parts = getNumParticles();
+    const int num_elasto = getNumElastoParticles();
+
+    std::vector<unsigned char> keep(num_parts, 1U);
+    threadutils::for_each(num_elasto, num_parts, [&] (int pidx) {
+        keep[pidx] = m_fluid_vol(pidx) >= 1e-20;
+    });
 
+    // survivors keep their relative order, so elasto indices stay intact
+    const int new_num_parts = m_particles.compact(keep);
+
+    if (new_num_parts < num_parts) {
         m_fluids.resize(new_num_parts - num_elasto);
         for (int i = num_elasto; i < new_num_parts; ++i)
         {
@@ -1891,16 +1876,12 @@ void TwoDScene::updateStrandParamViscosity(const scalar& dt)
  */
 void TwoDScene::terminateParticles()
 {
-    auto term_sel = [] (const std::shared_ptr<DistanceField>& dfptr) -> bool {
-        return dfptr->usage == DFU_TERMINATOR;
-    };
-
     const int num_parts = getNumParticles();
     const int num_elasto = getNumElastoParticles();
     threadutils::for_each(num_elasto, num_parts, [&] (int pidx) {
         const Vector3s& pos = m_x.segment<3>(pidx * 4);
         Vector3s vel;
-        const scalar phi = computePhiVel(pos, vel, term_sel);
+        const scalar phi = computePhiVel(pos, vel, DFU_TERMINATOR);
         if (phi < 0.0) m_fluid_vol(pidx) = 0.0;
     });
 
@@ -2014,9 +1995,7 @@ void TwoDScene::updateSolidWeights()
 
     const scalar dx = getCellSize();
 
-    m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
-        if (!m_bucket_activated[bucket_idx]) return;
-
+    m_particle_buckets.for_each_active_bucket([&] (int bucket_idx) {
         const VectorXi& bucket_node_idx_solid_phi_x = m_node_index_solid_phi_x[bucket_idx];
         const VectorXi& bucket_node_idx_solid_phi_y = m_node_index_solid_phi_y[bucket_idx];
         const VectorXi& bucket_node_idx_solid_phi_z = m_node_index_solid_phi_z[bucket_idx];
@@ -2114,7 +2093,7 @@ void TwoDScene::correctLiquidParticles(const scalar& dt)
 
     const scalar iD = getInverseDCoeff();
 
-    const int correction_selector = rand() % m_liquid_info.correction_step;
+    const int correction_selector = mathutils::streamRandInt(mathutils::streamKey(step_count, mathutils::RS_CORRECTION, (uint64_t) -1), m_liquid_info.correction_step);
 
     m_particle_cells.for_each_bucket_particles_colored([&] (int i, int cell_idx) {
 
@@ -2144,9 +2123,10 @@ void TwoDScene::correctLiquidParticles(const scalar& dt)
             if ( dist > 1e-4 * re ) {
                 spring += w * (pos - np) / dist * re;
             } else {
-                spring(0) += re * mathutils::scalarRand(0.0, 1.0);
-                spring(1) += re * mathutils::scalarRand(0.0, 1.0);
-                spring(2) += re * mathutils::scalarRand(0.0, 1.0);
+                const uint64_t key = mathutils::streamKey(step_count, mathutils::RS_CORRECTION, liquid_pidx);
+                spring(0) += re * mathutils::streamRand(key, liquid_npidx * 3 + 0, 0.0, 1.0);
+                spring(1) += re * mathutils::streamRand(key, liquid_npidx * 3 + 1, 0.0, 1.0);
+                spring(2) += re * mathutils::streamRand(key, liquid_npidx * 3 + 2, 0.0, 1.0);
             }
 
             return false;
@@ -2212,6 +2192,8 @@ void TwoDScene::updateParticleWeights(scalar dt, int start, int end)
 {
     const scalar h = getCellSize();
 
+    // the stencils are regular 3x3x3 blocks of nodes, hence only the first
+    // node of each stencil has to be looked up.
     threadutils::for_each(start, end, [&] (int pidx) {
         if (m_inside[pidx] == 0) return;
 
@@ -2226,83 +2208,20 @@ void TwoDScene::updateParticleWeights(scalar dt, int start, int end)
 
         const Vector3s& pos = m_x.segment<3>(pidx * 4);
 
-        for (int nidx = 0; nidx < indices_p.rows(); ++nidx)
-        {
-            const int node_bucket_idx = indices_p(nidx, 0);
-            const int node_idx = indices_p(nidx, 1);
-            Vector3s dx;
-
-            const Vector3s& np = getNodePosP(node_bucket_idx, node_idx);
-            dx = (pos - np) / h;
-
-            const scalar w = mathutils::N_kernel<2>(dx);
-
-            weights_p(nidx) = w;
-        }
-
-        for (int nidx = 0; nidx < indices_sphi.rows(); ++nidx)
-        {
-            const int node_bucket_idx = indices_sphi(nidx, 0);
-            const int node_idx = indices_sphi(nidx, 1);
-
-            Vector3s dx;
-
-            const Vector3s& np = getNodePosSolidPhi(node_bucket_idx, node_idx);
-            dx = (pos - np) / h;
-
-            Vector3s g;
-            const scalar w = mathutils::N_kernel<2>(dx);
-
-            weights(nidx, 3) = w;
-        }
-
-        for (int nidx = 0; nidx < indices_x.rows(); ++nidx)
-        {
-            const int node_bucket_idx = indices_x(nidx, 0);
-            const int node_idx = indices_x(nidx, 1);
-
-            Vector3s dx;
-
-            const Vector3s& np = getNodePosX(node_bucket_idx, node_idx);
-            dx = (pos - np) / h;
-
-            Vector3s g;
-            const scalar w = mathutils::N_kernel<2>(dx);
+        mathutils::quad_kernel_stencil((pos - getNodePosP(indices_p(0, 0), indices_p(0, 1))) / h, weights_p);
 
-            weights(nidx, 0) = w;
-        }
-
-        for (int nidx = 0; nidx < indices_y.rows(); ++nidx)
-        {
-            const int node_bucket_idx = indices_y(nidx, 0);
-            const int node_idx = indices_y(nidx, 1);
-
-            Vector3s dx;
+        Vector27s w;
+        mathutils::quad_kernel_stencil((pos - getNodePosX(indices_x(0, 0), indices_x(0, 1))) / h, w);
+        weights.col(0) = w;
 
-            const Vector3s& np = getNodePosY(node_bucket_idx, node_idx);
-            dx = (pos - np) / h;
+        mathutils::quad_kernel_stencil((pos - getNodePosY(indices_y(0, 0), indices_y(0, 1))) / h, w);
+        weights.col(1) = w;
 
-            Vector3s g;
-            const scalar w = mathutils::N_kernel<2>(dx);
-
-            weights(nidx, 1) = w;
-        }
-
-        for (int nidx = 0; nidx < indices_z.rows(); ++nidx)
-        {
-            const int node_bucket_idx = indices_z(nidx, 0);
-            const int node_idx = indices_z(nidx, 1);
+        mathutils::quad_kernel_stencil((pos - getNodePosZ(indices_z(0, 0), indices_z(0, 1))) / h, w);
+        weights.col(2) = w;
 
-            Vector3s dx;
-
-            const Vector3s& np = getNodePosZ(node_bucket_idx, node_idx);
-            dx = (pos - np) / h;
-
-            Vector3s g;
-            const scalar w = mathutils::N_kernel<2>(dx);
-
-            weights(nidx, 2) = w;
-        }
+        mathutils::quad_kernel_stencil((pos - getNodePosSolidPhi(indices_sphi(0, 0), indices_sphi(0, 1))) / h, w);
+        weights.col(3) = w;
     });
 
 }
@@ -2329,53 +2248,15 @@ void TwoDScene::updateGaussWeights(scalar dt)
 
         const Vector3s& pos = m_x_gauss.segment<3>(pidx * 4);
 
-        for (int nidx = 0; nidx < indices_x.rows(); ++nidx)
-        {
-            const int node_bucket_idx = indices_x(nidx, 0);
-            const int node_idx = indices_x(nidx, 1);
-
-            Vector3s dx;
-
-            const Vector3s& np = getNodePosX(node_bucket_idx, node_idx);
-            dx = (pos - np) / h;
+        Vector27s w;
+        mathutils::quad_kernel_stencil((pos - getNodePosX(indices_x(0, 0), indices_x(0, 1))) / h, w);
+        weights.col(0) = w;
 
-            Vector3s g;
-            const scalar w = mathutils::N_kernel<2>(dx);
+        mathutils::quad_kernel_stencil((pos - getNodePosY(indices_y(0, 0), indices_y(0, 1))) / h, w);
+        weights.col(1) = w;
 
-            weights(nidx, 0) = w;
-        }
-
-        for (int nidx = 0; nidx < indices_y.rows(); ++nidx)
-        {
-            const int node_bucket_idx = indices_y(nidx, 0);
-            const int node_idx = indices_y(nidx, 1);
-
-            Vector3s dx;
-
-            const Vector3s& np = getNodePosY(node_bucket_idx, node_idx);
-            dx = (pos - np) / h;
-
-            Vector3s g;
-            const scalar w = mathutils::N_kernel<2>(dx);
-
-            weights(nidx, 1) = w;
-        }
-
-        for (int nidx = 0; nidx < indices_z.rows(); ++nidx)
-        {
-            const int node_bucket_idx = indices_z(nidx, 0);
-            const int node_idx = indices_z(nidx, 1);
-
-            Vector3s dx;
-
-            const Vector3s& np = getNodePosZ(node_bucket_idx, node_idx);
-            dx = (pos - np) / h;
-
-            Vector3s g;
-            const scalar w = mathutils::N_kernel<2>(dx);
-
-            weights(nidx, 2) = w;
-        }
+        mathutils::quad_kernel_stencil((pos - getNodePosZ(indices_z(0, 0), indices_z(0, 1))) / h, w);
+        weights.col(2) = w;
     });
 }
 
@@ -2395,91 +2276,52 @@ void TwoDScene::buildNodeParticlePairs()
 {
     const int num_buckets = (int) m_particle_buckets.size();
 
-    if ((int) m_node_particles_x.size() != num_buckets) m_node_particles_x.resize( num_buckets );
-    if ((int) m_node_particles_y.size() != num_buckets) m_node_particles_y.resize( num_buckets );
-    if ((int) m_node_particles_z.size() != num_buckets) m_node_particles_z.resize( num_buckets );
-    if ((int) m_node_particles_p.size() != num_buckets) m_node_particles_p.resize( num_buckets );
+    NodeParticlePairs* node_particles[] = { &m_node_particles_x, &m_node_particles_y, &m_node_particles_z, &m_node_particles_p };
+    const std::vector< Matrix27x2i >* particle_nodes[] = { &m_particle_nodes_x, &m_particle_nodes_y, &m_particle_nodes_z, &m_particle_nodes_p };
 
-    // re-allocate space
-    m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
-        int num_nodes = getNumNodes(bucket_idx);
-
-        auto& bucket_node_particles_x = m_node_particles_x[bucket_idx];
-        if ((int) bucket_node_particles_x.size() != num_nodes) bucket_node_particles_x.resize( num_nodes );
-
-        for (int i = 0; i < num_nodes; ++i) {
-            int osize = bucket_node_particles_x[i].size();
-            bucket_node_particles_x[i].resize(0);
-            bucket_node_particles_x[i].reserve(osize);
-        }
-
-        auto& bucket_node_particles_y = m_node_particles_y[bucket_idx];
-        if ((int) bucket_node_particles_y.size() != num_nodes) bucket_node_particles_y.resize( num_nodes );
+    for (NodeParticlePairs* pairs : node_particles) pairs->resize(num_buckets);
 
-        for (int i = 0; i < num_nodes; ++i) {
-            int osize = bucket_node_particles_y[i].size();
-            bucket_node_particles_y[i].resize(0);
-            bucket_node_particles_y[i].reserve(osize);
-        }
-
-        auto& bucket_node_particles_z = m_node_particles_z[bucket_idx];
-        if ((int) bucket_node_particles_z.size() != num_nodes) bucket_node_particles_z.resize( num_nodes );
-
-        for (int i = 0; i < num_nodes; ++i) {
-            int osize = bucket_node_particles_z[i].size();
-            bucket_node_particles_z[i].resize(0);
-            bucket_node_particles_z[i].reserve(osize);
-        }
-
-        auto& bucket_node_particles_p = m_node_particles_p[bucket_idx];
-        if ((int) bucket_node_particles_p.size() != num_nodes) bucket_node_particles_p.resize( num_nodes );
-
-        for (int i = 0; i < num_nodes; ++i) {
-            int osize = bucket_node_particles_p[i].size();
-            bucket_node_particles_p[i].resize(0);
-            bucket_node_particles_p[i].reserve(osize);
-        }
+    m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
+        const int num_nodes = m_bucket_activated[bucket_idx] ? getNumNodes(bucket_idx) : 0;
+        for (NodeParticlePairs* pairs : node_particles) pairs->clear(bucket_idx, num_nodes);
     });
 
-    m_particle_buckets.for_each_bucket_particles_colored([&] (int pidx, int bucket_idx) {
-        if (!m_bucket_activated[bucket_idx]) return;
+    // the pairs are collected with a counting sort: the same colored traversal
+    // runs twice, once to count the pairs of each node and once to store them.
+    auto traverse = [&] (bool counting) {
+        m_particle_buckets.for_each_bucket_particles_colored([&] (int pidx, int bucket_idx) {
+            if (!m_bucket_activated[bucket_idx]) return;
 
-        auto& indices_x = getParticleNodesX(pidx);
-        auto& indices_y = getParticleNodesY(pidx);
-        auto& indices_z = getParticleNodesZ(pidx);
-        auto& indices_p = m_particle_nodes_p[pidx];
+            const auto& weights = m_particle_weights[pidx];
+            const auto& weights_p = m_particle_weights_p[pidx];
 
-        auto& weights = m_particle_weights[pidx];
-        auto& weights_p = m_particle_weights_p[pidx];
+            for (int r = 0; r < 4; ++r)
+            {
+                const Matrix27x2i& indices = (*particle_nodes[r])[pidx];
+                NodeParticlePairs& pairs = *node_particles[r];
 
-        for (int i = 0; i < indices_x.rows(); ++i)
-        {
-            if (m_bucket_activated[indices_x(i, 0)] && weights(i, 0) > 0.0) {
-                m_node_particles_x[ indices_x(i, 0) ][ indices_x(i, 1) ].emplace_back( std::pair<int, int>( pidx, i ) );
-            }
-        }
+                for (int i = 0; i < indices.rows(); ++i)
+                {
+                    const scalar w = (r < 3) ? weights(i, r) : weights_p(i);
+                    if (!m_bucket_activated[indices(i, 0)] || w <= 0.0) continue;
 
-        for (int i = 0; i < indices_y.rows(); ++i)
-        {
-            if (m_bucket_activated[indices_y(i, 0)] && weights(i, 1) > 0.0) {
-                m_node_particles_y[ indices_y(i, 0) ][ indices_y(i, 1) ].emplace_back( std::pair<int, int>( pidx, i ) );
+                    if (counting) {
+                        pairs.count(indices(i, 0), indices(i, 1));
+                    } else {
+                        pairs.insert(indices(i, 0), indices(i, 1), pidx, i);
+                    }
+                }
             }
-        }
+        }, 3);
+    };
 
-        for (int i = 0; i < indices_z.rows(); ++i)
-        {
-            if (m_bucket_activated[indices_z(i, 0)] && weights(i, 2) > 0.0) {
-                m_node_particles_z[ indices_z(i, 0) ][ indices_z(i, 1) ].emplace_back( std::pair<int, int>( pidx, i ) );
-            }
-        }
+    traverse(true);
 
-        for (int i = 0; i < indices_p.rows(); ++i)
-        {
-            if (m_bucket_activated[indices_p(i, 0)] && weights_p(i) > 0.0) {
-                m_node_particles_p[ indices_p(i, 0) ][ indices_p(i, 1) ].emplace_back( std::pair<int, int>( pidx, i ) );
-            }
-        }
-    }, 3);
+    m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
+        for (NodeParticlePairs* pairs : node_particles) pairs->allocate(bucket_idx);
+    });
+
+    traverse(false);
 }
 
 void TwoDScene::updateOptiVolume()
@@ -2517,7 +2359,17 @@ void TwoDScene::splitLiquidParticles()
 
         new_part_pos[fidx].resize(n_split - 1);
 
-        Matrix3s M = Matrix3s::Random();
+        // the random orientation of the pattern is a function of the particle
+        uint64_t key = (uint64_t) pidx;
+        for (int r = 0; r < 3; ++r) {
+            uint64_t bits = 0;
+            memcpy(&bits, &center(r), sizeof(scalar));
+            key = mathutils::hash64(key ^ bits);
+        }
+
+        Matrix3s M;
+        for (int r = 0; r < 9; ++r) M(r % 3, r / 3) = mathutils::hashRand(key + r, -1.0, 1.0);
+
         Matrix3s Q, R;
         mathutils::QRDecompose<scalar, 3>(M, Q, R);
 
@@ -2625,132 +2477,175 @@ void TwoDScene::relabelLiquidParticles()
 }
 
 /*!
- * merge too small particles into large particles
+ * merge too small particles into large particles.
+ *
+ * All decisions are taken on the state before the pass, so every particle is
+ * processed in parallel and the result does not depend on the visiting order:
+ * small particles (PC_S) give all of their volume and slightly large ones
+ * (PC_l) the volume above V_fine to their partners, split evenly. A small
+ * particle that is the largest of the small particles around it keeps its
+ * volume and takes theirs instead. Donors never receive, so receivers pull
+ * the shares of their donors without any conflicting writes. A receiver
+ * stops taking shares once it holds more than V_fine, and a donor keeps the
+ * shares that were turned down.
  */
 void TwoDScene::mergeLiquidParticles()
 {
     const int num_parts = getNumParticles();
     const int num_elasto = getNumElastoParticles();
-    std::vector< unsigned char > removed(num_parts, false);
-
-    std::vector< scalar > gathered_vol(num_parts, 0.0);
-    std::vector< Vector3s > gathered_moment(num_parts, Vector3s::Zero());
 
     const scalar rad_fine = mathutils::defaultRadiusMultiplier() * getCellSize() * m_liquid_info.particle_cell_multiplier;
     const scalar V_fine = 4.0 / 3.0 * M_PI * rad_fine * rad_fine * rad_fine;
+    const scalar should_rad = rad_fine * 2.0;
+
+    std::vector< unsigned char > sink(num_parts, 0U);
+    std::vector< int > num_partners(num_parts, 0);
+    std::vector< int > num_accepted(num_parts, 0);
+    std::vector< int > last_donor(num_parts, -1);
+    std::vector< scalar > share_vol(num_parts, 0.0);
+    std::vector< Vector3s > share_moment(num_parts, Vector3s::Zero());
+    std::vector< scalar > gathered_vol(num_parts, 0.0);
+    std::vector< Vector3s > gathered_moment(num_parts, Vector3s::Zero());
 
-    const int correction_selector = rand() % m_liquid_info.correction_step;
+    auto is_close = [&] (int pidx, int npidx) -> bool {
+        return ( m_x.segment<3>(pidx * 4) - m_x.segment<3>(npidx * 4) ).norm() < should_rad;
+    };
 
-    m_particle_buckets.for_each_bucket_particles_colored_randomized([&] (int pidx, int bucket_idx) {
-        if (!isFluid(pidx) || (m_classifier[pidx] != PC_S && m_classifier[pidx] != PC_l)) return;
+    // larger volume first, ties by index
+    auto is_before = [&] (int pidx, int npidx) -> bool {
+        return m_fluid_vol(pidx) > m_fluid_vol(npidx) || (m_fluid_vol(pidx) == m_fluid_vol(npidx) && pidx < npidx);
+    };
 
-        if (pidx % m_liquid_info.correction_step != correction_selector) return;
+    auto is_donor = [&] (int pidx) -> bool {
+        return (m_classifier[pidx] == PC_S && !sink[pidx]) || m_classifier[pidx] == PC_l;
+    };
 
-        scalar should_rad = rad_fine * 2.0;
+    auto is_partner = [&] (int pidx, int npidx) -> bool {
+        if (pidx == npidx || !isFluid(npidx) || m_fluid_vol(npidx) > V_fine) return false;
 
+        const ParticleClassifier& c = m_classifier[npidx];
         if (m_classifier[pidx] == PC_S) {
-            // try upgrade level
-            const scalar full_vol = m_fluid_vol[pidx] + gathered_vol[pidx];
-            const scalar mrel = full_vol / V_fine;
+            if (c != PC_s && c != PC_o && !(c == PC_S && sink[npidx])) return false;
+        } else if (c != PC_s) {
+            return false;
+        }
 
-            if (mrel >= 0.5) {
-                m_classifier[pidx] = PC_s;
-                return;
-            }
+        return is_close(pidx, npidx);
+    };
 
-            std::vector<int> partners;
+    // small particles with smaller small neighbors only
+    m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
+        m_particle_buckets.get_bucket(bucket_idx, [&] (int pidx) {
+            if (!isFluid(pidx) || m_classifier[pidx] != PC_S) return;
 
-            m_particle_buckets.loop_neighbor_bucket_particles(bucket_idx, [&] (int npidx, int) {
-                if ( !removed[npidx] && pidx != npidx && isFluid(npidx) && (m_classifier[npidx] == PC_S || m_classifier[npidx] == PC_s || m_classifier[npidx] == PC_o) )
-                {
-                    const scalar neigh_vol = m_fluid_vol(npidx) + gathered_vol[npidx];
-                    if (neigh_vol > V_fine) return false;
+            int num_smaller = 0;
+            bool largest = true;
+            m_particle_buckets.loop_neighbor_bucket_particles(bucket_idx, [&] (int npidx, int) -> bool {
+                if (npidx == pidx || !isFluid(npidx) || m_classifier[npidx] != PC_S || !is_close(pidx, npidx)) return false;
 
-                    const scalar dist = ( m_x.segment<3>(pidx * 4) - m_x.segment<3>(npidx * 4) ).norm();
-                    if (dist < should_rad) {
-                        partners.push_back(npidx);
-                    }
+                if (is_before(npidx, pidx)) {
+                    largest = false;
+                    return true;
                 }
 
+                ++num_smaller;
                 return false;
             });
 
-            if (!partners.size()) return;
+            sink[pidx] = largest && num_smaller > 0;
+        });
+    });
 
-            const scalar invN = 1.0 / (scalar) partners.size();
+    // shares of the donors
+    m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
+        m_particle_buckets.get_bucket(bucket_idx, [&] (int pidx) {
+            if (!isFluid(pidx) || !is_donor(pidx) || m_fluid_vol(pidx) < 1e-20) return;
 
-            const scalar distrib_vol = full_vol * invN;
-            Vector3s distrib_moment = (m_fluid_v.segment<3>(pidx * 4) * m_fluid_vol[pidx] + gathered_moment[pidx]) * invN;
+            int count = 0;
+            m_particle_buckets.loop_neighbor_bucket_particles(bucket_idx, [&] (int npidx, int) -> bool {
+                if (is_partner(pidx, npidx)) ++count;
+                return false;
+            });
 
-            for (int npidx : partners)
-            {
-                gathered_vol[npidx] += distrib_vol;
-                gathered_moment[npidx] += distrib_moment;
-            }
+            if (!count) return;
 
-            removed[pidx] = true;
-            m_fluid_vol(pidx) = 0.0;
-            gathered_vol[pidx] = 0.0;
-            gathered_moment[pidx].setZero();
-        } else if (m_classifier[pidx] == PC_l) {
-            // try upgrade level
-            const scalar full_vol = m_fluid_vol[pidx] + gathered_vol[pidx];
-            if (full_vol < 1e-20) return;
-
-            const scalar mrel = full_vol / V_fine;
-
-            if (mrel > 2.0) {
-                m_classifier[pidx] = PC_L;
-                return;
-            }
+            const scalar invN = 1.0 / (scalar) count;
+            const scalar full_vol = m_fluid_vol(pidx);
+            const scalar give_vol = (m_classifier[pidx] == PC_S) ? full_vol : (full_vol - V_fine);
 
-            std::vector<int> partners;
+            num_partners[pidx] = count;
+            share_vol[pidx] = give_vol * invN;
+            share_moment[pidx] = m_fluid_v.segment<3>(pidx * 4) * share_vol[pidx];
+        });
+    });
 
-            m_particle_buckets.loop_neighbor_bucket_particles(bucket_idx, [&] (int npidx, int) {
-                if ( pidx != npidx && isFluid(npidx) && !removed[npidx] && m_classifier[npidx] == PC_s )
-                {
-                    const scalar neigh_vol = m_fluid_vol(npidx) + gathered_vol[npidx];
-                    if (neigh_vol > V_fine) return false;
+    // receivers pull the shares of their donors, larger donors first, as long
+    // as they hold no more than V_fine (as the serial merge did); the accepted
+    // donors are a prefix of that order, ending at last_donor
+    m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
+        std::vector<int> donors;
 
-                    const scalar dist = ( m_x.segment<3>(pidx * 4) - m_x.segment<3>(npidx * 4) ).norm();
-                    if (dist < should_rad) {
-                        partners.push_back(npidx);
-                    }
-                }
+        m_particle_buckets.get_bucket(bucket_idx, [&] (int pidx) {
+            if (!isFluid(pidx) || is_donor(pidx) || m_fluid_vol(pidx) > V_fine) return;
 
+            donors.resize(0);
+            m_particle_buckets.loop_neighbor_bucket_particles(bucket_idx, [&] (int npidx, int) -> bool {
+                if (num_partners[npidx] > 0 && is_partner(npidx, pidx)) donors.push_back(npidx);
                 return false;
             });
 
-            if (!partners.size()) return;
-
-            const scalar invN = 1.0 / (scalar) partners.size();
+            std::sort(donors.begin(), donors.end(), is_before);
 
-            const scalar ex_vol = full_vol - V_fine;
-            const scalar distrib_vol = ex_vol * invN;
-            const scalar coeff = distrib_vol / full_vol;
-
-            Vector3s distrib_moment = (m_fluid_v.segment<3>(pidx * 4) * m_fluid_vol[pidx] + gathered_moment[pidx]) * coeff;
-
-            for (int npidx : partners)
+            for (int npidx : donors)
             {
-                gathered_vol[npidx] += distrib_vol;
-                gathered_moment[npidx] += distrib_moment;
+                if (m_fluid_vol(pidx) + gathered_vol[pidx] > V_fine) break;
+
+                gathered_vol[pidx] += share_vol[npidx];
+                gathered_moment[pidx] += share_moment[npidx];
+                last_donor[pidx] = npidx;
             }
+        });
+    });
 
-            const scalar scaling = V_fine / full_vol;
-            const scalar rad_scaling = pow(scaling, 1.0 / 3.0);
-            m_fluid_vol[pidx] *= scaling;
-            m_fluid_m.segment<3>(pidx * 4) *= scaling;
-            m_radius.segment<2>(pidx * 2) *= rad_scaling;
-            m_particle_rest_length(pidx) *= rad_scaling;
-            m_particle_rest_area(pidx) *= rad_scaling * rad_scaling;
-            m_classifier[pidx] = PC_o;
-        }
-    }, 3);
+    // donors count the receivers that took their share
+    m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
+        m_particle_buckets.get_bucket(bucket_idx, [&] (int pidx) {
+            if (num_partners[pidx] == 0) return;
+
+            m_particle_buckets.loop_neighbor_bucket_particles(bucket_idx, [&] (int npidx, int) -> bool {
+                const int last = last_donor[npidx];
+                if (last >= 0 && is_partner(pidx, npidx) && (last == pidx || is_before(pidx, last))) ++num_accepted[pidx];
+                return false;
+            });
+        });
+    });
 
     // gather and update
     threadutils::for_each(num_elasto, num_parts, [&] (int pidx) {
-        if (removed[pidx] || gathered_vol[pidx] == 0.0) return;
+        if (num_accepted[pidx] == num_partners[pidx] && num_partners[pidx] > 0 && m_classifier[pidx] == PC_S) {
+            // removed below
+            m_fluid_vol(pidx) = 0.0;
+            return;
+        }
+
+        if (num_accepted[pidx] > 0) {
+            // the donor keeps the shares that were turned down
+            const scalar kept_vol = m_fluid_vol(pidx) - share_vol[pidx] * (scalar) num_accepted[pidx];
+
+            if (kept_vol > 0.0) {
+                const scalar scaling = kept_vol / m_fluid_vol(pidx);
+                const scalar rad_scaling = pow(scaling, 1.0 / 3.0);
+                m_fluid_vol[pidx] *= scaling;
+                m_fluid_m.segment<3>(pidx * 4) *= scaling;
+                m_radius.segment<2>(pidx * 2) *= rad_scaling;
+                m_particle_rest_length(pidx) *= rad_scaling;
+                m_particle_rest_area(pidx) *= rad_scaling * rad_scaling;
+            }
+            if (m_classifier[pidx] == PC_l) m_classifier[pidx] = PC_o;
+            return;
+        }
+
+        if (gathered_vol[pidx] == 0.0) return;
 
         const Vector3s full_moment = m_fluid_v.segment<3>(pidx * 4) * m_fluid_vol[pidx] + gathered_moment[pidx];
         const scalar full_vol = m_fluid_vol[pidx] + gathered_vol[pidx];
@@ -3425,20 +3320,23 @@ void TwoDScene::updateLiquidPhi(scalar dt)
         }
     }, 3);
 
-    auto solid_sel = [] (const std::shared_ptr<DistanceField>& dfptr) -> bool {
-        return dfptr->usage == DFU_SOLID;
-    };
+    const scalar solid_cutoff = 3.0 * m_bucket_size;
 
     m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
         VectorXs& bucket_liquid_phi = m_node_liquid_phi[ bucket_idx ];
 
         const int num_pressure = bucket_liquid_phi.size();
+        if (!num_pressure) return;
+
+        // the solids that may reach into this bucket
+        std::vector<int> candidates;
+        const Vector3s bucket_low = m_grid_mincorner + m_particle_buckets.bucket_handle(bucket_idx).cast<scalar>() * m_bucket_size;
+        m_distance_field_query.gather(DFU_SOLID, bucket_low, bucket_low + Vector3s::Constant(m_bucket_size), solid_cutoff, candidates);
 
         for (int i = 0; i < num_pressure; ++i) {
             const Vector3s& np = getNodePosP(bucket_idx, i);
 
-            Vector3s vel;
-            const scalar sphi = computePhiVel(np, vel, solid_sel);
+            const scalar sphi = m_distance_field_query.computePhi(candidates, np, solid_cutoff);
             if (sphi < 0.0)
                 bucket_liquid_phi(i) = -0.5 * dx;
         }
@@ -3734,11 +3632,25 @@ void TwoDScene::preAllocateNodes()
     }
 }
 
+/*!
+ * allocate a per-bucket node array and touch it right away: called from
+ * the bucket loops, this places its pages on the NUMA node of the thread
+ * that owns the bucket in later loops (see Sorter::for_each_bucket)
+ */
+template<typename Vector>
+static inline void allocateNodeArray( Vector& v, int num )
+{
+    if (v.size() == num) return;
+
+    v.resize(num);
+    v.setZero();
+}
+
 /*!
  * for all particles, find the neighbor nodes to construct node structure
  */
 template<typename Callable>
-void TwoDScene::findNodes( const Sorter& buckets, const VectorXs& x, std::vector< Matrix27x2i >& particle_nodes, const Vector3s& offset, Callable func )
+void TwoDScene::findNodes( const Sorter& buckets, const ConstVectorXsRef& x, std::vector< Matrix27x2i >& particle_nodes, const Vector3s& offset, Callable func )
 {
     const scalar dx = getCellSize();
 
@@ -3902,9 +3814,9 @@ void TwoDScene::generateNodes()
 {
     const scalar dx = getCellSize();
 
-    m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
-        // ignore inactivated buckets
-        if (!m_bucket_activated[bucket_idx]) return;
+    m_particle_buckets.for_each_active_bucket([&] (int bucket_idx) {
+        // ignore buckets whose nodes are still valid
+        if (!m_bucket_dirty[bucket_idx]) return;
 
         Vector3i bucket_handle = m_particle_buckets.bucket_handle(bucket_idx);
 
@@ -4266,14 +4178,14 @@ const std::vector< VectorXi >& TwoDScene::getNodeIndexEdgeZ() const
  */
 void TwoDScene::connectEdgeNodes()
 {
-    m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
+    m_particle_buckets.for_each_active_bucket([&] (int bucket_idx) {
         Vector3i bucket_handle = m_particle_buckets.bucket_handle(bucket_idx);
 
         VectorXi& bucket_node_idx_ex = m_node_index_edge_x[bucket_idx];
         VectorXi& bucket_node_idx_ey = m_node_index_edge_y[bucket_idx];
         VectorXi& bucket_node_idx_ez = m_node_index_edge_z[bucket_idx];
 
-        if (!m_bucket_activated[bucket_idx]) return;
+        if (!m_bucket_dirty[bucket_idx]) return;
 
         for (int k = 0; k < m_num_nodes; ++k) for (int j = 0; j < m_num_nodes; ++j) for (int i = 0; i < m_num_nodes; ++i)
                 {
@@ -4461,14 +4373,14 @@ void TwoDScene::connectEdgeNodes()
 
 void TwoDScene::connectSolidPhiNodes()
 {
-    m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
+    m_particle_buckets.for_each_active_bucket([&] (int bucket_idx) {
         Vector3i bucket_handle = m_particle_buckets.bucket_handle(bucket_idx);
 
         VectorXi& bucket_node_idx_solid_phi_x = m_node_index_solid_phi_x[bucket_idx];
         VectorXi& bucket_node_idx_solid_phi_y = m_node_index_solid_phi_y[bucket_idx];
         VectorXi& bucket_node_idx_solid_phi_z = m_node_index_solid_phi_z[bucket_idx];
 
-        if (!m_bucket_activated[bucket_idx]) return;
+        if (!m_bucket_dirty[bucket_idx]) return;
 
         for (int k = 0; k < m_num_nodes; ++k) for (int j = 0; j < m_num_nodes; ++j) for (int i = 0; i < m_num_nodes; ++i)
                 {
@@ -4611,9 +4523,9 @@ void TwoDScene::connectPressureNodes()
         Vector3i(0, 1, 1)
     };
 
-    m_particle_buckets.for_each_bucket_colored([&] (int bucket_idx) {
+    m_particle_buckets.for_each_active_bucket_colored([&] (int bucket_idx) {
         Vector3i bucket_handle = m_particle_buckets.bucket_handle(bucket_idx);
-        if (!m_bucket_activated[bucket_idx]) return;
+        if (!m_bucket_reconnect[bucket_idx]) return;
 
         VectorXi& bucket_node_pressure_neighbors = m_node_pressure_neighbors[bucket_idx];
         VectorXi& bucket_node_pp_neighbors = m_node_pp_neighbors[bucket_idx];
@@ -4803,104 +4715,69 @@ void TwoDScene::postAllocateNodes()
     if ((int) m_node_liquid_valid_y.size() != num_buckets) m_node_liquid_valid_y.resize(num_buckets);
     if ((int) m_node_liquid_valid_z.size() != num_buckets) m_node_liquid_valid_z.resize(num_buckets);
 
-    m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
+    // the nodes of a bucket are first touched by the thread that later
+    // computes on them: the active buckets go through the same range and
+    // partitioner as the loops of the substeps, the inactive ones are emptied
+    auto allocate_nodes = [&] (int bucket_idx) {
         const int num_nodes = getNumNodes(bucket_idx);
 
-        if (m_node_mass_x[bucket_idx].size() != num_nodes)
-            m_node_mass_x[bucket_idx].resize(num_nodes);
-        if (m_node_vel_x[bucket_idx].size() != num_nodes)
-            m_node_vel_x[bucket_idx].resize(num_nodes);
-        if (m_node_vol_x[bucket_idx].size() != num_nodes)
-            m_node_vol_x[bucket_idx].resize(num_nodes);
-        if (m_node_sat_x[bucket_idx].size() != num_nodes)
-            m_node_sat_x[bucket_idx].resize(num_nodes);
-        if (m_node_psi_x[bucket_idx].size() != num_nodes)
-            m_node_psi_x[bucket_idx].resize(num_nodes);
-        if (m_node_shape_factor_x[bucket_idx].size() != num_nodes)
-            m_node_shape_factor_x[bucket_idx].resize(num_nodes);
-        if (m_node_raw_weight_x[bucket_idx].size() != num_nodes)
-            m_node_raw_weight_x[bucket_idx].resize(num_nodes);
-        if (m_node_orientation_x[bucket_idx].size() != num_nodes * 3)
-            m_node_orientation_x[bucket_idx].resize(num_nodes * 3);
-
-        if (m_node_mass_y[bucket_idx].size() != num_nodes)
-            m_node_mass_y[bucket_idx].resize(num_nodes);
-        if (m_node_vel_y[bucket_idx].size() != num_nodes)
-            m_node_vel_y[bucket_idx].resize(num_nodes);
-        if (m_node_vol_y[bucket_idx].size() != num_nodes)
-            m_node_vol_y[bucket_idx].resize(num_nodes);
-        if (m_node_sat_y[bucket_idx].size() != num_nodes)
-            m_node_sat_y[bucket_idx].resize(num_nodes);
-        if (m_node_psi_y[bucket_idx].size() != num_nodes)
-            m_node_psi_y[bucket_idx].resize(num_nodes);
-        if (m_node_shape_factor_y[bucket_idx].size() != num_nodes)
-            m_node_shape_factor_y[bucket_idx].resize(num_nodes);
-        if (m_node_raw_weight_y[bucket_idx].size() != num_nodes)
-            m_node_raw_weight_y[bucket_idx].resize(num_nodes);
-        if (m_node_orientation_y[bucket_idx].size() != num_nodes * 3)
-            m_node_orientation_y[bucket_idx].resize(num_nodes * 3);
-
-        if (m_node_mass_z[bucket_idx].size() != num_nodes)
-            m_node_mass_z[bucket_idx].resize(num_nodes);
-        if (m_node_vel_z[bucket_idx].size() != num_nodes)
-            m_node_vel_z[bucket_idx].resize(num_nodes);
-        if (m_node_vol_z[bucket_idx].size() != num_nodes)
-            m_node_vol_z[bucket_idx].resize(num_nodes);
-        if (m_node_sat_z[bucket_idx].size() != num_nodes)
-            m_node_sat_z[bucket_idx].resize(num_nodes);
-        if (m_node_psi_z[bucket_idx].size() != num_nodes)
-            m_node_psi_z[bucket_idx].resize(num_nodes);
-        if (m_node_shape_factor_z[bucket_idx].size() != num_nodes)
-            m_node_shape_factor_z[bucket_idx].resize(num_nodes);
-        if (m_node_raw_weight_z[bucket_idx].size() != num_nodes)
-            m_node_raw_weight_z[bucket_idx].resize(num_nodes);
-        if (m_node_orientation_z[bucket_idx].size() != num_nodes * 3)
-            m_node_orientation_z[bucket_idx].resize(num_nodes * 3);
-
-        if (m_node_mass_fluid_x[bucket_idx].size() != num_nodes)
-            m_node_mass_fluid_x[bucket_idx].resize(num_nodes);
-        if (m_node_vel_fluid_x[bucket_idx].size() != num_nodes)
-            m_node_vel_fluid_x[bucket_idx].resize(num_nodes);
-        if (m_node_vol_fluid_x[bucket_idx].size() != num_nodes)
-            m_node_vol_fluid_x[bucket_idx].resize(num_nodes);
-        if (m_node_vol_pure_fluid_x[bucket_idx].size() != num_nodes)
-            m_node_vol_pure_fluid_x[bucket_idx].resize(num_nodes);
-
-        if (m_node_mass_fluid_y[bucket_idx].size() != num_nodes)
-            m_node_mass_fluid_y[bucket_idx].resize(num_nodes);
-        if (m_node_vel_fluid_y[bucket_idx].size() != num_nodes)
-            m_node_vel_fluid_y[bucket_idx].resize(num_nodes);
-        if (m_node_vol_fluid_y[bucket_idx].size() != num_nodes)
-            m_node_vol_fluid_y[bucket_idx].resize(num_nodes);
-        if (m_node_vol_pure_fluid_y[bucket_idx].size() != num_nodes)
-            m_node_vol_pure_fluid_y[bucket_idx].resize(num_nodes);
-
-        if (m_node_mass_fluid_z[bucket_idx].size() != num_nodes)
-            m_node_mass_fluid_z[bucket_idx].resize(num_nodes);
-        if (m_node_vel_fluid_z[bucket_idx].size() != num_nodes)
-            m_node_vel_fluid_z[bucket_idx].resize(num_nodes);
-        if (m_node_vol_fluid_z[bucket_idx].size() != num_nodes)
-            m_node_vol_fluid_z[bucket_idx].resize(num_nodes);
-        if (m_node_vol_pure_fluid_z[bucket_idx].size() != num_nodes)
-            m_node_vol_pure_fluid_z[bucket_idx].resize(num_nodes);
-
-        if (m_node_solid_phi[bucket_idx].size() != num_nodes)
-            m_node_solid_phi[bucket_idx].resize(num_nodes);
-
-        if (m_node_solid_vel_x[bucket_idx].size() != num_nodes)
-            m_node_solid_vel_x[bucket_idx].resize(num_nodes);
-        if (m_node_solid_vel_y[bucket_idx].size() != num_nodes)
-            m_node_solid_vel_y[bucket_idx].resize(num_nodes);
-        if (m_node_solid_vel_z[bucket_idx].size() != num_nodes)
-            m_node_solid_vel_z[bucket_idx].resize(num_nodes);
-
-        if (m_node_liquid_valid_x[bucket_idx].size() != num_nodes)
-            m_node_liquid_valid_x[bucket_idx].resize(num_nodes);
-        if (m_node_liquid_valid_y[bucket_idx].size() != num_nodes)
-            m_node_liquid_valid_y[bucket_idx].resize(num_nodes);
-        if (m_node_liquid_valid_z[bucket_idx].size() != num_nodes)
-            m_node_liquid_valid_z[bucket_idx].resize(num_nodes);
+        allocateNodeArray(m_node_mass_x[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_vel_x[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_vol_x[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_sat_x[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_psi_x[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_shape_factor_x[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_raw_weight_x[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_orientation_x[bucket_idx], num_nodes * 3);
+
+        allocateNodeArray(m_node_mass_y[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_vel_y[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_vol_y[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_sat_y[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_psi_y[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_shape_factor_y[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_raw_weight_y[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_orientation_y[bucket_idx], num_nodes * 3);
+
+        allocateNodeArray(m_node_mass_z[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_vel_z[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_vol_z[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_sat_z[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_psi_z[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_shape_factor_z[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_raw_weight_z[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_orientation_z[bucket_idx], num_nodes * 3);
+
+        allocateNodeArray(m_node_mass_fluid_x[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_vel_fluid_x[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_vol_fluid_x[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_vol_pure_fluid_x[bucket_idx], num_nodes);
+
+        allocateNodeArray(m_node_mass_fluid_y[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_vel_fluid_y[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_vol_fluid_y[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_vol_pure_fluid_y[bucket_idx], num_nodes);
+
+        allocateNodeArray(m_node_mass_fluid_z[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_vel_fluid_z[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_vol_fluid_z[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_vol_pure_fluid_z[bucket_idx], num_nodes);
+
+        allocateNodeArray(m_node_solid_phi[bucket_idx], num_nodes);
+
+        allocateNodeArray(m_node_solid_vel_x[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_solid_vel_y[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_solid_vel_z[bucket_idx], num_nodes);
+
+        allocateNodeArray(m_node_liquid_valid_x[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_liquid_valid_y[bucket_idx], num_nodes);
+        allocateNodeArray(m_node_liquid_valid_z[bucket_idx], num_nodes);
+    };
+
+    m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
+        if (!m_bucket_activated[bucket_idx]) allocate_nodes(bucket_idx);
     });
+    m_particle_buckets.for_each_active_bucket(allocate_nodes);
 
     if (m_liquid_info.compute_viscosity) {
         if ((int) m_node_liquid_c_vf.size() != num_buckets) m_node_liquid_c_vf.resize(num_buckets);
@@ -4918,36 +4795,30 @@ void TwoDScene::postAllocateNodes()
         if ((int) m_node_state_v.size() != num_buckets) m_node_state_v.resize(num_buckets);
         if ((int) m_node_state_w.size() != num_buckets) m_node_state_w.resize(num_buckets);
 
-        m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
+        auto allocate_viscosity_nodes = [&] (int bucket_idx) {
             const int num_nodes = getNumNodes(bucket_idx);
 
-            if (m_node_cell_solid_phi[bucket_idx].size() != num_nodes)
-                m_node_cell_solid_phi[bucket_idx].resize(num_nodes);
-
-            if (m_node_liquid_c_vf[bucket_idx].size() != num_nodes)
-                m_node_liquid_c_vf[bucket_idx].resize(num_nodes);
-
-            if (m_node_liquid_u_vf[bucket_idx].size() != num_nodes)
-                m_node_liquid_u_vf[bucket_idx].resize(num_nodes);
-            if (m_node_liquid_v_vf[bucket_idx].size() != num_nodes)
-                m_node_liquid_v_vf[bucket_idx].resize(num_nodes);
-            if (m_node_liquid_w_vf[bucket_idx].size() != num_nodes)
-                m_node_liquid_w_vf[bucket_idx].resize(num_nodes);
-
-            if (m_node_state_u[bucket_idx].size() != num_nodes)
-                m_node_state_u[bucket_idx].resize(num_nodes);
-            if (m_node_state_v[bucket_idx].size() != num_nodes)
-                m_node_state_v[bucket_idx].resize(num_nodes);
-            if (m_node_state_w[bucket_idx].size() != num_nodes)
-                m_node_state_w[bucket_idx].resize(num_nodes);
-
-            if (m_node_liquid_ex_vf[bucket_idx].size() != num_nodes)
-                m_node_liquid_ex_vf[bucket_idx].resize(num_nodes);
-            if (m_node_liquid_ey_vf[bucket_idx].size() != num_nodes)
-                m_node_liquid_ey_vf[bucket_idx].resize(num_nodes);
-            if (m_node_liquid_ez_vf[bucket_idx].size() != num_nodes)
-                m_node_liquid_ez_vf[bucket_idx].resize(num_nodes);
+            allocateNodeArray(m_node_cell_solid_phi[bucket_idx], num_nodes);
+
+            allocateNodeArray(m_node_liquid_c_vf[bucket_idx], num_nodes);
+
+            allocateNodeArray(m_node_liquid_u_vf[bucket_idx], num_nodes);
+            allocateNodeArray(m_node_liquid_v_vf[bucket_idx], num_nodes);
+            allocateNodeArray(m_node_liquid_w_vf[bucket_idx], num_nodes);
+
+            allocateNodeArray(m_node_state_u[bucket_idx], num_nodes);
+            allocateNodeArray(m_node_state_v[bucket_idx], num_nodes);
+            allocateNodeArray(m_node_state_w[bucket_idx], num_nodes);
+
+            allocateNodeArray(m_node_liquid_ex_vf[bucket_idx], num_nodes);
+            allocateNodeArray(m_node_liquid_ey_vf[bucket_idx], num_nodes);
+            allocateNodeArray(m_node_liquid_ez_vf[bucket_idx], num_nodes);
+        };
+
+        m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
+            if (!m_bucket_activated[bucket_idx]) allocate_viscosity_nodes(bucket_idx);
         });
+        m_particle_buckets.for_each_active_bucket(allocate_viscosity_nodes);
     }
 }
 
@@ -5020,6 +4891,46 @@ void TwoDScene::expandFluidNodesMarked(int layers)
     }
 }
 
+/*!
+ * compare bucket activation with the previous step. The node tables of a bucket
+ * only depend on the activation of its 3x3x3 neighborhood, so they are rebuilt
+ * only if something changed there. The pressure tables of a bucket are partly
+ * written by its neighbors, which hence have to connect again as well.
+ */
+void TwoDScene::markChangedBuckets()
+{
+    const int total_buckets = m_particle_buckets.size();
+    const int count = m_num_nodes * m_num_nodes * m_num_nodes;
+
+    std::vector< unsigned char > changed(total_buckets);
+    threadutils::for_each(0, total_buckets, [&] (int bucket_idx) {
+        changed[bucket_idx] = m_bucket_layout_changed ||
+                              m_bucket_activated[bucket_idx] != m_bucket_activated_prev[bucket_idx] ||
+                              (m_liquid_info.compute_viscosity && m_bucket_activated[bucket_idx] &&
+                               m_node_index_edge_x[bucket_idx].size() != count * 8);
+    });
+
+    auto dilate = [this] (const std::vector< unsigned char >& src, std::vector< unsigned char >& dst) {
+        dst.resize(src.size());
+        m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
+            const Vector3i bucket_handle = m_particle_buckets.bucket_handle(bucket_idx);
+
+            unsigned char flag = 0U;
+            for (int t = -1; t <= 1; ++t) for (int s = -1; s <= 1; ++s) for (int r = -1; r <= 1; ++r) {
+                        const Vector3i nb_bucket_handle = bucket_handle + Vector3i(r, s, t);
+                        if (!m_particle_buckets.has_bucket(nb_bucket_handle)) continue;
+
+                        flag |= src[m_particle_buckets.bucket_index(nb_bucket_handle)];
+                    }
+
+            dst[bucket_idx] = flag;
+        });
+    };
+
+    dilate(changed, m_bucket_dirty);
+    dilate(m_bucket_dirty, m_bucket_reconnect);
+}
+
 /*!
  * resample nodes in the scene
  */
@@ -5029,11 +4940,11 @@ void TwoDScene::resampleNodes()
 
     auto particle_node_criteria = [this] (int pidx) -> bool { return isSoft(pidx); };
 
-    findNodes(m_particle_buckets, m_x, m_particle_nodes_x, Vector3s(0.0, 0.5, 0.5), particle_node_criteria);
-    findNodes(m_particle_buckets, m_x, m_particle_nodes_y, Vector3s(0.5, 0.0, 0.5), particle_node_criteria);
-    findNodes(m_particle_buckets, m_x, m_particle_nodes_z, Vector3s(0.5, 0.5, 0.0), particle_node_criteria);
-    findNodes(m_particle_buckets, m_x, m_particle_nodes_solid_phi, Vector3s(0.0, 0.0, 0.0), particle_node_criteria);
-    findNodes(m_particle_buckets, m_x, m_particle_nodes_p, Vector3s(0.5, 0.5, 0.5), particle_node_criteria);
+    findNodes(m_particle_buckets, getX(), m_particle_nodes_x, Vector3s(0.0, 0.5, 0.5), particle_node_criteria);
+    findNodes(m_particle_buckets, getX(), m_particle_nodes_y, Vector3s(0.5, 0.0, 0.5), particle_node_criteria);
+    findNodes(m_particle_buckets, getX(), m_particle_nodes_z, Vector3s(0.5, 0.5, 0.0), particle_node_criteria);
+    findNodes(m_particle_buckets, getX(), m_particle_nodes_solid_phi, Vector3s(0.0, 0.0, 0.0), particle_node_criteria);
+    findNodes(m_particle_buckets, getX(), m_particle_nodes_p, Vector3s(0.5, 0.5, 0.5), particle_node_criteria);
 
     auto gauss_node_criteria = [this] (int pidx) -> bool { return pidx < getNumEdges() + getNumFaces(); };
 
@@ -5047,6 +4958,13 @@ void TwoDScene::resampleNodes()
 
     expandFluidNodesMarked(1);
 
+    markChangedBuckets();
+
+    // compact list of the activated buckets, heaviest first
+    m_particle_buckets.update_active_buckets(m_bucket_activated, [this] (int bucket_idx) {
+        return (int64_t) (m_particle_buckets.get_bucket_size(bucket_idx) + 1) * getNumNodes(bucket_idx);
+    });
+
     // generate nodes in all activated buckets
     generateNodes();
 
@@ -5301,6 +5219,15 @@ void TwoDScene::resizeGroups(int num_group)
         dfptr->vote_usage();
         dfptr->vote_sampled();
     });
+
+    // sample the analytic shapes once at the grid resolution, they only
+    // move rigidly afterwards
+    const scalar dx = getCellSize();
+    for (auto dfptr : m_distance_fields) {
+        dfptr->build_cache(dx);
+    }
+
+    updateDistanceFieldQuery();
 }
 
 void TwoDScene::initGroupPos()
@@ -5339,41 +5266,19 @@ int TwoDScene::getNumFluidParticles() const
     return (int) m_fluids.size();
 }
 
-scalar TwoDScene::computePhi(const Vector3s& pos, const std::function< bool(const std::shared_ptr<DistanceField>&) > selector) const
+scalar TwoDScene::computePhiVel(const Vector3s& pos, Vector3s& vel, DISTANCE_FIELD_USAGE usage) const
 {
-    scalar min_phi = 3.0 * m_bucket_size;
-    for (auto dfptr : m_group_distance_field)
-    {
-        if (selector && !selector(dfptr)) continue;
-
-        scalar phi = dfptr->compute_phi(pos);
-        if (phi < min_phi) {
-            min_phi = phi;
-        }
-    }
-
-    return min_phi;
+    return m_distance_field_query.computePhiVel(usage, pos, vel, 3.0 * m_bucket_size);
 }
 
-scalar TwoDScene::computePhiVel(const Vector3s& pos, Vector3s& vel, const std::function< bool(const std::shared_ptr<DistanceField>&) > selector) const
+scalar TwoDScene::computePhi(const Vector3s& pos, DISTANCE_FIELD_USAGE usage) const
 {
-    scalar min_phi = 3.0 * m_bucket_size;
-    Vector3s min_vel = Vector3s::Zero();
-    for (auto dfptr : m_group_distance_field)
-    {
-        if (selector && !selector(dfptr)) continue;
-
-        Vector3s v;
-        scalar phi = dfptr->compute_phi_vel(pos, v);
-        if (phi < min_phi) {
-            min_phi = phi;
-            min_vel = v;
-        }
-    }
-
-    vel = min_vel;
+    return m_distance_field_query.computePhi(usage, pos, 3.0 * m_bucket_size);
+}
 
-    return min_phi;
+void TwoDScene::updateDistanceFieldQuery()
+{
+    m_distance_field_query.build(m_group_distance_field);
 }
 
 /*!
@@ -5448,6 +5353,57 @@ void TwoDScene::sampleSolidDistanceFields()
     }
 }
 
+/*!
+ * gather liquid particles in a box. The buckets hold the particles as of the
+ * last rebucketizeParticles: the particles have moved less than a bucket
+ * since, and the ones appended afterwards are checked one by one.
+ */
+void TwoDScene::gatherFluidParticles( const Vector3s& low, const Vector3s& high, VectorXs& pos ) const
+{
+    const int num_parts = getNumParticles();
+    const int num_elasto = getNumElastoParticles();
+    const int num_bucketed = (int) m_particle_buckets.array_idx.size();
+
+    auto inside = [&] (int pidx) -> bool {
+        const Vector3s& x = m_x.segment<3>(pidx * 4);
+        return (x.array() >= low.array()).all() && (x.array() <= high.array()).all();
+    };
+
+    std::vector<int> indices;
+
+    if (m_particle_buckets.size() == 0 || num_bucketed > num_parts) {
+        // not bucketized yet (or out of date), scan all
+        for (int pidx = num_elasto; pidx < num_parts; ++pidx) {
+            if (inside(pidx)) indices.push_back(pidx);
+        }
+    } else {
+        Vector3i bucket_low, bucket_high;
+        for (int r = 0; r < 3; ++r) {
+            const int n = m_particle_buckets.dim_size(r);
+            bucket_low(r) = mathutils::clamp((int) floor((low(r) - m_bucket_mincorner(r)) / m_bucket_size) - 1, 0, n - 1);
+            bucket_high(r) = mathutils::clamp((int) floor((high(r) - m_bucket_mincorner(r)) / m_bucket_size) + 1, 0, n - 1);
+        }
+
+        for (int k = bucket_low(2); k <= bucket_high(2); ++k) for (int j = bucket_low(1); j <= bucket_high(1); ++j) for (int i = bucket_low(0); i <= bucket_high(0); ++i) {
+                    m_particle_buckets.get_bucket(i, j, k, [&] (int pidx) {
+                        if (pidx >= num_elasto && inside(pidx)) indices.push_back(pidx);
+                    });
+                }
+
+        for (int pidx = std::max(num_elasto, num_bucketed); pidx < num_parts; ++pidx) {
+            if (inside(pidx)) indices.push_back(pidx);
+        }
+
+        std::sort(indices.begin(), indices.end());
+    }
+
+    const int num_found = (int) indices.size();
+    pos.resize(num_found * 4);
+    for (int i = 0; i < num_found; ++i) {
+        pos.segment<4>(i * 4) = m_x.segment<4>(indices[i] * 4);
+    }
+}
+
 /*!
  * sample liquid particles from level set sources
  */
@@ -5456,41 +5412,84 @@ void TwoDScene::sampleLiquidDistanceFields(scalar cur_time)
     int num_group = (int) m_group_distance_field.size();
 
     const scalar dx = getCellSize(); // we use denser dx to prevent penetration
+    const scalar sample_dx = dx * m_liquid_info.particle_cell_multiplier;
+
+    std::vector< VectorXs > additional_pos(num_group);
+    std::vector< Vector3s > shooting_vels(num_group, Vector3s::Zero());
+    VectorXs emitted_pos; // emitted by the groups before, not appended yet
 
     for (int igroup = 0; igroup < num_group; ++igroup)
     {
-        Vector3s shooting_vel = Vector3s::Zero();
+        Vector3s& shooting_vel = shooting_vels[igroup];
 
         if (!m_group_distance_field[igroup]->sampled ||
                 m_group_distance_field[igroup]->usage != DFU_SOURCE ||
                 !m_group_distance_field[igroup]->check_durations(cur_time, m_shooting_vol_accum[igroup], shooting_vel)) continue;
 
-        const VectorXs& existing_fluids = m_x.segment( getNumElastoParticles() * 4, getNumFluidParticles() * 4 );
-
-        VectorXs additional_pos;
+        // only the particles close to the source take part in the dart throwing
+        Vector3s bbx_low, bbx_high;
+        m_group_distance_field[igroup]->local_bounding_box(bbx_low, bbx_high);
+        bbx_low -= Vector3s::Constant(sample_dx * 3.0);
+        bbx_high += Vector3s::Constant(sample_dx * 3.0);
+
+        VectorXs existing_fluids;
+        gatherFluidParticles(bbx_low, bbx_high, existing_fluids);
+
+        if (emitted_pos.size() > 0) {
+            const int num_found = existing_fluids.size() / 4;
+            const int num_emitted = emitted_pos.size() / 3;
+            existing_fluids.conservativeResize((num_found + num_emitted) * 4);
+            for (int i = 0; i < num_emitted; ++i) {
+                existing_fluids.segment<4>((num_found + i) * 4) = Vector4s(emitted_pos(i * 3 + 0), emitted_pos(i * 3 + 1), emitted_pos(i * 3 + 2), 0.0);
+            }
+        }
 
-        m_group_distance_field[igroup]->resample_internal(shared_from_this(), dx * m_liquid_info.particle_cell_multiplier, existing_fluids, additional_pos);
+        m_group_distance_field[igroup]->resample_internal(shared_from_this(), sample_dx, existing_fluids, additional_pos[igroup]);
 
-        const int df_index = getNumParticles();
-        const int df_size = additional_pos.size() / 3;
+        const int df_size = additional_pos[igroup].size() / 3;
 
         if (df_size == 0) continue;
 
-        const int sp_index = (int) m_fluids.size();
-
-        m_fluids.resize(sp_index + df_size);
-        conservativeResizeParticles(df_index + df_size);
-
-        const scalar rad = mathutils::defaultRadiusMultiplier() * dx * m_liquid_info.particle_cell_multiplier;
+        const scalar rad = mathutils::defaultRadiusMultiplier() * sample_dx;
         const scalar pvol = 4.0 / 3.0 * M_PI * rad * rad * rad;
 
         m_shooting_vol_accum[igroup] += pvol * (scalar) df_size;
 
-        auto params = m_strandParameters[m_group_distance_field[igroup]->params_index];
+        const int num_emitted = emitted_pos.size() / 3;
+        emitted_pos.conservativeResize((num_emitted + df_size) * 3);
+        emitted_pos.segment(num_emitted * 3, df_size * 3) = additional_pos[igroup];
+    }
+
+    const int num_new = emitted_pos.size() / 3;
+    if (num_new == 0) return;
+
+    // append the particles of all sources at once
+    const int df_base = getNumParticles();
+    const int sp_base = (int) m_fluids.size();
+
+    m_fluids.resize(sp_base + num_new);
+    conservativeResizeParticles(df_base + num_new);
+
+    int offset = 0;
+    for (int igroup = 0; igroup < num_group; ++igroup)
+    {
+        const VectorXs& group_pos = additional_pos[igroup];
+        const int df_size = group_pos.size() / 3;
+
+        if (df_size == 0) continue;
+
+        const int df_index = df_base + offset;
+        const int sp_index = sp_base + offset;
+        offset += df_size;
+
+        const Vector3s& shooting_vel = shooting_vels[igroup];
+
+        const scalar rad = mathutils::defaultRadiusMultiplier() * sample_dx;
+        const scalar pvol = 4.0 / 3.0 * M_PI * rad * rad * rad;
 
         threadutils::for_each(0, df_size, [&] (int i) {
             const int part_idx = df_index + i;
-            m_x.segment<4>(part_idx * 4) = Vector4s(additional_pos( i * 3 + 0 ), additional_pos( i * 3 + 1 ), additional_pos( i * 3 + 2 ), 0.0);
+            m_x.segment<4>(part_idx * 4) = Vector4s(group_pos( i * 3 + 0 ), group_pos( i * 3 + 1 ), group_pos( i * 3 + 2 ), 0.0);
             m_rest_x.segment<4>(part_idx * 4) = m_x.segment<4>(part_idx * 4);
             m_v.segment<4>(part_idx * 4).setZero();
             m_dv.segment<4>(part_idx * 4).setZero();
@@ -5817,7 +5816,7 @@ void TwoDScene::updateSolidVolumeFraction()
         }
     });
 
-    assert(!std::isnan(m_volume_fraction.sum()));
+    assert(!std::isnan(getVolumeFraction().sum()));
 }
 
 scalar TwoDScene::getCellSize() const
@@ -5825,6 +5824,236 @@ scalar TwoDScene::getCellSize() const
     return m_bucket_size / (scalar) m_num_nodes;
 }
 
+uint64_t TwoDScene::getStepCount() const
+{
+    return step_count;
+}
+
+void TwoDScene::setStepCount( uint64_t count )
+{
+    step_count = count;
+}
+
+void TwoDScene::advanceStepCount()
+{
+    ++step_count;
+}
+
+/*!
+ * the per-particle and per-Gauss state, the moving parts of the scene (groups,
+ * scripts, distance fields, strand frames) and the bucket layout, so that a
+ * restart continues with the same nodes in the same order. The topology and
+ * the parameters come from the scene file, only their sizes are checked.
+ */
+void TwoDScene::saveCheckpoint( CheckpointWriter& out ) const
+{
+    out.addValue("scene/step_count", step_count);
+    out.addValue("scene/num_edges", (int) m_edges.rows());
+    out.addValue("scene/num_faces", (int) m_faces.rows());
+
+    m_particles.save(out, "particles/");
+
+    out.add("scene/fluids", m_fluids);
+    out.add("scene/surfels", m_surfels);
+    out.add("scene/surfel_norms", m_surfel_norms);
+
+    out.add("elements/edge_rest_length", m_edge_rest_length);
+    out.add("elements/face_rest_area", m_face_rest_area);
+    out.add("elements/face_weights", m_face_weights);
+
+    out.add("gauss/x", m_x_gauss);
+    out.add("gauss/v", m_v_gauss);
+    out.add("gauss/dv", m_dv_gauss);
+    out.add("gauss/fluid_v", m_fluid_v_gauss);
+    out.add("gauss/m", m_m_gauss);
+    out.add("gauss/vol", m_vol_gauss);
+    out.add("gauss/rest_vol", m_rest_vol_gauss);
+    out.add("gauss/radius", m_radius_gauss);
+    out.add("gauss/fluid_m", m_fluid_m_gauss);
+    out.add("gauss/fluid_vol", m_fluid_vol_gauss);
+    out.add("gauss/volume_fraction", m_volume_fraction_gauss);
+    out.add("gauss/rest_volume_fraction", m_rest_volume_fraction_gauss);
+    out.add("gauss/Fe", m_Fe_gauss);
+    out.add("gauss/d", m_d_gauss);
+    out.add("gauss/d_old", m_d_old_gauss);
+    out.add("gauss/D", m_D_gauss);
+    out.add("gauss/D_inv", m_D_inv_gauss);
+    out.add("gauss/dFe", m_dFe_gauss);
+    out.add("gauss/grad", m_grad_gauss);
+    out.add("gauss/norm", m_norm_gauss);
+
+    out.add("groups/pos", m_group_pos);
+    out.add("groups/rot", m_group_rot);
+    out.add("groups/prev_pos", m_group_prev_pos);
+    out.add("groups/prev_rot", m_group_prev_rot);
+    out.add("groups/shooting_vol_accum", m_shooting_vol_accum);
+
+    const int num_scripts = (int) m_scripts.size();
+    for (int i = 0; i < num_scripts; ++i) {
+        const std::string key = "scripts/" + std::to_string(i) + "/";
+        out.add(key + "v", m_scripts[i]->v);
+        out.addValue(key + "base_pos", m_scripts[i]->base_pos);
+    }
+
+    const int num_fields = (int) m_distance_fields.size();
+    for (int i = 0; i < num_fields; ++i) {
+        m_distance_fields[i]->save_state(out, "fields/" + std::to_string(i) + "/");
+    }
+
+    const int num_forces = (int) m_forces.size();
+    for (int i = 0; i < num_forces; ++i) {
+        m_forces[i]->saveState(out, "forces/" + std::to_string(i) + "/");
+    }
+
+    const Vector3i num_buckets(m_particle_buckets.ni, m_particle_buckets.nj, m_particle_buckets.nk);
+    out.add("buckets/origin", m_bucket_origin);
+    out.add("buckets/count", num_buckets);
+    out.add("buckets/particle_keys", m_particle_buckets.array_idx);
+    out.add("buckets/gauss_keys", m_gauss_buckets.array_idx);
+    out.add("buckets/activated", m_bucket_activated);
+}
+
+/*!
+ * particles of a checkpoint, moved back to their rest positions, to build the
+ * elements on (their rest lengths, areas and shapes are restored afterwards
+ * by loadCheckpoint). Replaces the particles of the scene file.
+ */
+bool TwoDScene::loadRestConfiguration( const CheckpointReader& in )
+{
+    if (!m_particles.load(in, "particles/") ||
+            !in.read("scene/fluids", m_fluids) ||
+            !in.read("scene/surfels", m_surfels) ||
+            !in.read("scene/surfel_norms", m_surfel_norms)) {
+        std::cerr << "[checkpoint: missing particles]" << std::endl;
+        return false;
+    }
+
+    m_x = m_rest_x;
+
+    // the elements of the scene file are set up again on these particles,
+    // which lists them per particle from scratch
+    for (auto& edges : m_particle_to_edge) edges.clear();
+    for (auto& faces : m_particle_to_face) faces.clear();
+
+    return true;
+}
+
+bool TwoDScene::loadCheckpoint( const CheckpointReader& in )
+{
+    int num_edges = 0;
+    int num_faces = 0;
+    if (!in.readValue("scene/num_edges", num_edges) || num_edges != m_edges.rows() ||
+            !in.readValue("scene/num_faces", num_faces) || num_faces != m_faces.rows()) {
+        std::cerr << "[checkpoint: the topology differs from the scene]" << std::endl;
+        return false;
+    }
+
+    if (!in.readValue("scene/step_count", step_count) || !m_particles.load(in, "particles/")) return false;
+
+    const int num_gausses = getNumGausses();
+
+    bool ok =
+        in.read("scene/fluids", m_fluids) &&
+        in.read("scene/surfels", m_surfels) &&
+        in.read("scene/surfel_norms", m_surfel_norms) &&
+        in.read("elements/edge_rest_length", m_edge_rest_length) && m_edge_rest_length.size() == num_edges &&
+        in.read("elements/face_rest_area", m_face_rest_area) && m_face_rest_area.size() == num_faces &&
+        in.read("elements/face_weights", m_face_weights) && (int) m_face_weights.size() == num_faces &&
+        in.read("gauss/x", m_x_gauss) && m_x_gauss.size() == num_gausses * 4 &&
+        in.read("gauss/v", m_v_gauss) &&
+        in.read("gauss/dv", m_dv_gauss) &&
+        in.read("gauss/fluid_v", m_fluid_v_gauss) &&
+        in.read("gauss/m", m_m_gauss) &&
+        in.read("gauss/vol", m_vol_gauss) &&
+        in.read("gauss/rest_vol", m_rest_vol_gauss) &&
+        in.read("gauss/radius", m_radius_gauss) &&
+        in.read("gauss/fluid_m", m_fluid_m_gauss) &&
+        in.read("gauss/fluid_vol", m_fluid_vol_gauss) &&
+        in.read("gauss/volume_fraction", m_volume_fraction_gauss) &&
+        in.read("gauss/rest_volume_fraction", m_rest_volume_fraction_gauss) &&
+        in.read("gauss/Fe", m_Fe_gauss) &&
+        in.read("gauss/d", m_d_gauss) &&
+        in.read("gauss/d_old", m_d_old_gauss) &&
+        in.read("gauss/D", m_D_gauss) &&
+        in.read("gauss/D_inv", m_D_inv_gauss) &&
+        in.read("gauss/dFe", m_dFe_gauss) &&
+        in.read("gauss/grad", m_grad_gauss) &&
+        in.read("gauss/norm", m_norm_gauss) &&
+        in.read("groups/pos", m_group_pos) &&
+        in.read("groups/rot", m_group_rot) &&
+        in.read("groups/prev_pos", m_group_prev_pos) &&
+        in.read("groups/prev_rot", m_group_prev_rot) &&
+        in.read("groups/shooting_vol_accum", m_shooting_vol_accum);
+
+    const int num_scripts = (int) m_scripts.size();
+    for (int i = 0; i < num_scripts && ok; ++i) {
+        const std::string key = "scripts/" + std::to_string(i) + "/";
+        ok = in.read(key + "v", m_scripts[i]->v) && in.readValue(key + "base_pos", m_scripts[i]->base_pos);
+    }
+
+    const int num_fields = (int) m_distance_fields.size();
+    for (int i = 0; i < num_fields && ok; ++i) {
+        ok = m_distance_fields[i]->load_state(in, "fields/" + std::to_string(i) + "/");
+    }
+
+    const int num_forces = (int) m_forces.size();
+    for (int i = 0; i < num_forces && ok; ++i) {
+        ok = m_forces[i]->loadState(in, "forces/" + std::to_string(i) + "/");
+    }
+
+    Vector3i num_buckets;
+    std::vector<uint64_t> particle_keys;
+    std::vector<uint64_t> gauss_keys;
+    if (!ok || !in.read("buckets/origin", m_bucket_origin) || !in.read("buckets/count", num_buckets) ||
+            !in.read("buckets/particle_keys", particle_keys) || !in.read("buckets/gauss_keys", gauss_keys) ||
+            !in.read("buckets/activated", m_bucket_activated)) {
+        std::cerr << "[checkpoint: the state does not match the scene]" << std::endl;
+        return false;
+    }
+
+    // same buckets with the same particles as before the checkpoint, so that
+    // the next step walks them in the same order. There are no node tables
+    // yet, the next rebucketization notices and builds them all.
+    m_grid_mincorner = m_bucket_origin.cast<scalar>() * m_bucket_size;
+    m_bucket_mincorner = m_grid_mincorner;
+
+    m_particle_buckets.resize(num_buckets(0), num_buckets(1), num_buckets(2));
+    m_gauss_buckets.resize(num_buckets(0), num_buckets(1), num_buckets(2));
+    m_particle_cells.resize(num_buckets(0) * m_num_nodes, num_buckets(1) * m_num_nodes, num_buckets(2) * m_num_nodes);
+
+    auto restore_buckets = [] (Sorter& buckets, const std::vector<uint64_t>& keys) -> bool {
+        const int n = (int) keys.size();
+        std::vector<int> bucket_of(n, -1);
+        for (uint64_t key : keys) {
+            const uint64_t pidx = key & 0xFFFFFFFFUL;
+            const uint64_t bucket = key >> 32UL;
+            if (pidx >= (uint64_t) n || bucket >= (uint64_t) buckets.size()) return false;
+            bucket_of[pidx] = (int) bucket;
+        }
+
+        if (n == 0) return true;
+
+        buckets.sort(n, [&] (int pidx, int& i, int& j, int& k) {
+            const Vector3i handle = buckets.bucket_handle(bucket_of[pidx]);
+            i = handle(0);
+            j = handle(1);
+            k = handle(2);
+        });
+
+        return true;
+    };
+
+    if (!restore_buckets(m_particle_buckets, particle_keys) || !restore_buckets(m_gauss_buckets, gauss_keys) ||
+            (int) m_bucket_activated.size() != m_particle_buckets.size()) {
+        std::cerr << "[checkpoint: the buckets are corrupt]" << std::endl;
+        return false;
+    }
+
+    updateParticleBoundingBox();
+
+    return true;
+}
+
 scalar TwoDScene::getInverseDCoeff() const
 {
     return mathutils::inverse_D_coeff(getCellSize(), m_kernel_order);
@@ -5912,7 +6141,7 @@ void TwoDScene::distributeElastoFluid()
     const int num_edges = getNumEdges();
     const int num_faces = getNumFaces();
 
-    VectorXs back_vol = m_fluid_vol;
+    VectorXs back_vol = getFluidVol();
     scalar old_sum_vol = back_vol.sum();
 
     m_gauss_buckets.for_each_bucket_particles_colored([&] (int gidx, int bucket_idx) {
@@ -5939,8 +6168,10 @@ void TwoDScene::distributeElastoFluid()
 
             const scalar total_rel_vol = num_release * rel_vol;
 
+            const uint64_t key = mathutils::streamKey(step_count, mathutils::RS_RELEASE, gidx);
+
             for (int i = 0; i < num_release; ++i) {
-                const scalar a0 = mathutils::scalarRand(0.0, 1.0);
+                const scalar a0 = mathutils::streamRand(key, i, 0.0, 1.0);
 
                 const Vector3s pos = m_x.segment<3>(e(0) * 4) * (1.0 - a0) + m_x.segment<3>(e(1) * 4) * a0;
                 const Vector3s vel = m_v.segment<3>(e(0) * 4) * (1.0 - a0) + m_v.segment<3>(e(1) * 4) * a0;
@@ -5981,9 +6212,11 @@ void TwoDScene::distributeElastoFluid()
 
             const scalar total_rel_vol = num_release * rel_vol;
 
+            const uint64_t key = mathutils::streamKey(step_count, mathutils::RS_RELEASE, gidx);
+
             for (int i = 0; i < num_release; ++i) {
-                const scalar r0 = mathutils::scalarRand(0.0, 1.0);
-                const scalar r1 = mathutils::scalarRand(0.0, 1.0);
+                const scalar r0 = mathutils::streamRand(key, i * 2 + 0, 0.0, 1.0);
+                const scalar r1 = mathutils::streamRand(key, i * 2 + 1, 0.0, 1.0);
 
                 const scalar a0 = 1.0 - sqrt(r0);
                 const scalar a1 = sqrt(r0) * (1.0 - r1);
@@ -6073,7 +6306,7 @@ void TwoDScene::distributeElastoFluid()
         k = (int)floor((m_x(pidx * 4 + 2) - m_bucket_mincorner(2)) / m_bucket_size);
     });
 
-    scalar new_sum_vol = m_fluid_vol.sum();
+    scalar new_sum_vol = getFluidVol().sum();
     if (new_sum_vol > 1e-20) {
         const scalar prop = old_sum_vol / new_sum_vol;
         m_fluid_vol *= prop;
@@ -6160,11 +6393,9 @@ void TwoDScene::distributeFluidElasto(const scalar& dt)
 {
     const int num_elasto_parts = getNumElastoParticles();
 
-    const scalar old_sum_vol = m_fluid_vol.sum();
+    const scalar old_sum_vol = getFluidVol().sum();
     // put fluid onto nodes
-    m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
-        if (!m_bucket_activated[bucket_idx]) return;
-
+    m_particle_buckets.for_each_active_bucket([&] (int bucket_idx) {
         m_node_vol_pure_fluid_x[bucket_idx].setZero();
         m_node_vol_pure_fluid_y[bucket_idx].setZero();
         m_node_vol_pure_fluid_z[bucket_idx].setZero();
@@ -6319,9 +6550,7 @@ void TwoDScene::distributeFluidElasto(const scalar& dt)
         captured(pidx) = fvol_captured;
     });
 
-    m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
-        if (!m_bucket_activated[bucket_idx]) return;
-
+    m_particle_buckets.for_each_active_bucket([&] (int bucket_idx) {
         const auto& bucket_node_particles_x = m_node_particles_x[bucket_idx];
         const auto& bucket_node_particles_y = m_node_particles_y[bucket_idx];
         const auto& bucket_node_particles_z = m_node_particles_z[bucket_idx];
@@ -6453,7 +6682,7 @@ void TwoDScene::distributeFluidElasto(const scalar& dt)
         m_radius(pidx * 2 + 0) = m_radius(pidx * 2 + 1) = pow(fvol * 0.75 / M_PI, 1.0 / 3.0);
     });
 
-    const scalar new_sum_vol = m_fluid_vol.sum();
+    const scalar new_sum_vol = getFluidVol().sum();
     if (new_sum_vol > 1e-20) {
         const scalar prop = old_sum_vol / new_sum_vol;
         m_fluid_vol *= prop;
@@ -6474,303 +6703,152 @@ void TwoDScene::mapParticleNodesAPIC()
 {
     const scalar dx = getCellSize();
     const scalar dV = dx * dx * dx;
-    //    std::cout << "FVb: " << m_fluid_v << std::endl;
-    m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
-        if (!m_bucket_activated[bucket_idx]) return;
-
-        m_node_mass_x[bucket_idx].setZero();
-        m_node_vel_x[bucket_idx].setZero();
-        m_node_vol_x[bucket_idx].setZero();
-
-        m_node_mass_y[bucket_idx].setZero();
-        m_node_vel_y[bucket_idx].setZero();
-        m_node_vol_y[bucket_idx].setZero();
-
-        m_node_mass_z[bucket_idx].setZero();
-        m_node_vel_z[bucket_idx].setZero();
-        m_node_vol_z[bucket_idx].setZero();
-
-        m_node_mass_fluid_x[bucket_idx].setZero();
-        m_node_vel_fluid_x[bucket_idx].setZero();
-        m_node_vol_fluid_x[bucket_idx].setZero();
-
-        m_node_mass_fluid_y[bucket_idx].setZero();
-        m_node_vel_fluid_y[bucket_idx].setZero();
-        m_node_vol_fluid_y[bucket_idx].setZero();
-
-        m_node_mass_fluid_z[bucket_idx].setZero();
-        m_node_vel_fluid_z[bucket_idx].setZero();
-        m_node_vol_fluid_z[bucket_idx].setZero();
-
-        m_node_psi_x[bucket_idx].setZero();
-        m_node_sat_x[bucket_idx].setZero();
+    const int num_elasto = getNumElastoParticles();
 
-        m_node_psi_y[bucket_idx].setZero();
-        m_node_sat_y[bucket_idx].setZero();
+    std::vector< VectorXs >* node_vel[] = { &m_node_vel_x, &m_node_vel_y, &m_node_vel_z };
+    std::vector< VectorXs >* node_mass[] = { &m_node_mass_x, &m_node_mass_y, &m_node_mass_z };
+    std::vector< VectorXs >* node_vol[] = { &m_node_vol_x, &m_node_vol_y, &m_node_vol_z };
+    std::vector< VectorXs >* node_vel_fluid[] = { &m_node_vel_fluid_x, &m_node_vel_fluid_y, &m_node_vel_fluid_z };
+    std::vector< VectorXs >* node_mass_fluid[] = { &m_node_mass_fluid_x, &m_node_mass_fluid_y, &m_node_mass_fluid_z };
+    std::vector< VectorXs >* node_vol_fluid[] = { &m_node_vol_fluid_x, &m_node_vol_fluid_y, &m_node_vol_fluid_z };
+    std::vector< VectorXs >* node_psi[] = { &m_node_psi_x, &m_node_psi_y, &m_node_psi_z };
+    std::vector< VectorXs >* node_sat[] = { &m_node_sat_x, &m_node_sat_y, &m_node_sat_z };
+    std::vector< VectorXs >* node_raw_weight[] = { &m_node_raw_weight_x, &m_node_raw_weight_y, &m_node_raw_weight_z };
+    std::vector< VectorXs >* node_orientation[] = { &m_node_orientation_x, &m_node_orientation_y, &m_node_orientation_z };
+    std::vector< VectorXs >* node_shape_factor[] = { &m_node_shape_factor_x, &m_node_shape_factor_y, &m_node_shape_factor_z };
+    const std::vector< Matrix27x2i >* particle_nodes[] = { &m_particle_nodes_x, &m_particle_nodes_y, &m_particle_nodes_z };
+    Vector3s (TwoDScene::*node_pos[])(int, int) const = { &TwoDScene::getNodePosX, &TwoDScene::getNodePosY, &TwoDScene::getNodePosZ };
+
+    // the node arrays are used as accumulators during the scatter: psi, sat
+    // and raw weight temporarily hold the solid volume, the liquid volume on
+    // the soft vertices and the weight sum of the shape factor.
+    m_particle_buckets.for_each_active_bucket([&] (int bucket_idx) {
+        for (int r = 0; r < 3; ++r)
+        {
+            (*node_vel[r])[bucket_idx].setZero();
+            (*node_mass[r])[bucket_idx].setZero();
+            (*node_vel_fluid[r])[bucket_idx].setZero();
+            (*node_mass_fluid[r])[bucket_idx].setZero();
+            (*node_vol_fluid[r])[bucket_idx].setZero();
+            (*node_psi[r])[bucket_idx].setZero();
+            (*node_sat[r])[bucket_idx].setZero();
+            (*node_raw_weight[r])[bucket_idx].setZero();
+            (*node_orientation[r])[bucket_idx].setZero();
+            (*node_shape_factor[r])[bucket_idx].setZero();
+        }
+    });
 
-        m_node_psi_z[bucket_idx].setZero();
-        m_node_sat_z[bucket_idx].setZero();
+    // scatter from particles to their stencils. Buckets of the same color are
+    // three buckets apart, so no two concurrently processed particles can
+    // touch the same node.
+    m_particle_buckets.for_each_bucket_particles_colored([&] (int pidx, int bucket_idx) {
+        if (!m_bucket_activated[bucket_idx]) return;
 
-        const auto& bucket_node_particles_x = m_node_particles_x[bucket_idx];
-        const auto& bucket_node_particles_y = m_node_particles_y[bucket_idx];
-        const auto& bucket_node_particles_z = m_node_particles_z[bucket_idx];
+        const auto& weights = m_particle_weights[pidx];
+        const scalar& vol = m_rest_vol(pidx);
+        const Vector3s& m = m_m.segment<3>(pidx * 4);
+        const scalar& fvol = m_fluid_vol(pidx);
+        const Vector3s& fm = m_fluid_m.segment<3>(pidx * 4);
+        const Vector3s& v = m_v.segment<3>(pidx * 4);
+        const Vector3s& fluidv = m_fluid_v.segment<3>(pidx * 4);
+        const Vector3s& pos = m_x.segment<3>(pidx * 4);
+        const Matrix3s& B = m_B.block<3, 3>(pidx * 3, 0);
+        const Matrix3s& fB = m_fB.block<3, 3>(pidx * 3, 0);
 
-        const int num_nodes = getNumNodes(bucket_idx);
+        const bool is_fluid = pidx >= num_elasto;
+        const bool is_soft = m_particle_to_surfel[pidx] < 0;
+        const scalar vol_solid = vol * m_rest_volume_fraction(pidx);
+        const Vector3s& orientation = m_orientation.segment<3>(pidx * 3);
 
-        for (int i = 0; i < num_nodes; ++i)
+        for (int r = 0; r < 3; ++r)
         {
-            const auto& node_particles_x = bucket_node_particles_x[i];
-            const Vector3s& np = getNodePosX(bucket_idx, i);
+            const Matrix27x2i& indices = (*particle_nodes[r])[pidx];
 
-            scalar p = 0.0;
-            scalar mass = 0.0;
-            scalar vol_solid = 0.0;
+            for (int i = 0; i < indices.rows(); ++i)
+            {
+                const int node_bucket_idx = indices(i, 0);
+                const scalar w = weights(i, r);
 
-            scalar p_fluid = 0.0;
-            scalar mass_fluid = 0.0;
-            scalar vol_fluid = 0.0;
+                if (!m_bucket_activated[node_bucket_idx] || w <= 0.0) continue;
 
-            scalar vol_fluid_elasto = 0.0;
-            scalar shape_factor = 0.0;
-            scalar shape_factor_rw = 0.0;
-            Vector3s orientation = Vector3s::Zero();
+                const int node_idx = indices(i, 1);
+                const Vector3s& np = (this->*node_pos[r])(node_bucket_idx, node_idx);
 
-            for (auto& pair : node_particles_x) {
-                const int pidx = pair.first;
+                if (!is_fluid) {
+                    const scalar vel = v(r) + B.row(r).dot(np - pos);
+                    (*node_vel[r])[node_bucket_idx](node_idx) += vel * (m(r) + fm(r)) * w;
+                    (*node_mass[r])[node_bucket_idx](node_idx) += (m(r) + fm(r)) * w;
 
-                auto& weights = m_particle_weights[pidx];
-                const scalar& vol = m_rest_vol(pidx);
-                const Vector3s& m = m_m.segment<3>(pidx * 4);
-                const scalar& fvol = m_fluid_vol(pidx);
-                const Vector3s& fm = m_fluid_m.segment<3>(pidx * 4);
-                const Vector3s& v = m_v.segment<3>(pidx * 4);
-                const Vector3s& fluidv = m_fluid_v.segment<3>(pidx * 4);
-                const Vector3s& pos = m_x.segment<3>(pidx * 4);
-                const Matrix3s& B = m_B.block<3, 3>(pidx * 3, 0);
-                const Matrix3s& fB = m_fB.block<3, 3>(pidx * 3, 0);
-
-                if (!isFluid(pidx)) {
-                    const scalar vel = v(0) + B.row(0).dot(np - pos);
-                    p += vel * (m(0) + fm(0)) * weights(pair.second, 0);
-                    mass += (m(0) + fm(0)) * weights(pair.second, 0);
-
-                    if (m_particle_to_surfel[pidx] < 0) {
-                        vol_solid += vol * m_rest_volume_fraction(pidx) * weights(pair.second, 0);
-                        vol_fluid_elasto += fvol * weights(pair.second, 0);
-                        shape_factor += m_shape_factor(pidx) * weights(pair.second, 0);
-                        shape_factor_rw += weights(pair.second, 0);
-                        orientation += m_orientation.segment<3>(pidx * 3) * weights(pair.second, 0);
+                    if (is_soft) {
+                        (*node_psi[r])[node_bucket_idx](node_idx) += vol_solid * w;
+                        (*node_sat[r])[node_bucket_idx](node_idx) += fvol * w;
+                        (*node_shape_factor[r])[node_bucket_idx](node_idx) += m_shape_factor(pidx) * w;
+                        (*node_raw_weight[r])[node_bucket_idx](node_idx) += w;
+                        (*node_orientation[r])[node_bucket_idx].segment<3>(node_idx * 3) += orientation * w;
                     }
                 } else {
-                    const scalar vel = fluidv(0) + fB.row(0).dot(np - pos);
-                    p_fluid += vel * fm(0) * weights(pair.second, 0);
-                    mass_fluid += fm(0) * weights(pair.second, 0);
-                    vol_fluid += fvol * weights(pair.second, 0);
+                    const scalar vel = fluidv(r) + fB.row(r).dot(np - pos);
+                    (*node_vel_fluid[r])[node_bucket_idx](node_idx) += vel * fm(r) * w;
+                    (*node_mass_fluid[r])[node_bucket_idx](node_idx) += fm(r) * w;
+                    (*node_vol_fluid[r])[node_bucket_idx](node_idx) += fvol * w;
                 }
             }
-
-            if (mass > 1e-20) {
-                m_node_vel_x[bucket_idx](i) = p / mass;
-            }
-
-            if (mass_fluid > 1e-20) {
-                m_node_vel_fluid_x[bucket_idx](i) = p_fluid / mass_fluid;
-            }
-
-            if (shape_factor_rw > 1e-20) {
-                shape_factor /= shape_factor_rw;
-            }
-
-            m_node_mass_x[bucket_idx](i) = mass;
-            m_node_vol_x[bucket_idx](i) = vol_solid + vol_fluid_elasto;
-
-            m_node_mass_fluid_x[bucket_idx](i) = mass_fluid;
-            m_node_vol_fluid_x[bucket_idx](i) = vol_fluid;
-
-            m_node_psi_x[bucket_idx](i) = mathutils::clamp(vol_solid / dV, 0.0, 1.0);
-            m_node_sat_x[bucket_idx](i) = mathutils::clamp((vol_fluid + vol_fluid_elasto) / std::max(1e-20, dV - vol_solid), 0.0, 1.0);
-
-            const scalar lo = orientation.norm();
-            if (lo > 1e-20) {
-                orientation /= lo;
-            }
-            m_node_orientation_x[bucket_idx].segment<3>(i * 3) = orientation;
-            m_node_shape_factor_x[bucket_idx](i) = shape_factor;
         }
+    }, 3);
 
-        assert(!std::isnan(m_node_vel_x[bucket_idx].sum()));
-        assert(!std::isnan(m_node_mass_fluid_x[bucket_idx].sum()));
-        assert(!std::isnan(m_node_vol_fluid_x[bucket_idx].sum()));
+    // turn the accumulated sums into node quantities
+    m_particle_buckets.for_each_active_bucket([&] (int bucket_idx) {
+        const int num_nodes = getNumNodes(bucket_idx);
 
-        for (int i = 0; i < num_nodes; ++i)
+        for (int r = 0; r < 3; ++r)
         {
-            const auto& node_particles_y = bucket_node_particles_y[i];
-            const Vector3s& np = getNodePosY(bucket_idx, i);
-
-            scalar p = 0.0;
-            scalar mass = 0.0;
-            scalar vol_solid = 0.0;
-
-            scalar p_fluid = 0.0;
-            scalar mass_fluid = 0.0;
-            scalar vol_fluid = 0.0;
-
-            scalar vol_fluid_elasto = 0.0;
-            scalar shape_factor = 0.0;
-            scalar shape_factor_rw = 0.0;
-            Vector3s orientation = Vector3s::Zero();
-
-            for (auto& pair : node_particles_y) {
-                const int pidx = pair.first;
-
-                auto& weights = m_particle_weights[pidx];
-                const scalar& vol = m_rest_vol(pidx);
-                const Vector3s& m = m_m.segment<3>(pidx * 4);
-                const scalar& fvol = m_fluid_vol(pidx);
-                const Vector3s& fm = m_fluid_m.segment<3>(pidx * 4);
-                const Vector3s& v = m_v.segment<3>(pidx * 4);
-                const Vector3s& fluidv = m_fluid_v.segment<3>(pidx * 4);
-                const Vector3s& pos = m_x.segment<3>(pidx * 4);
-                const Matrix3s& B = m_B.block<3, 3>(pidx * 3, 0);
-                const Matrix3s& fB = m_fB.block<3, 3>(pidx * 3, 0);
-
-                if (!isFluid(pidx)) {
-                    const scalar vel = v(1) + B.row(1).dot(np - pos);
-                    p += vel * (m(1) + fm(1)) * weights(pair.second, 1);
-                    mass += (m(1) + fm(1)) * weights(pair.second, 1);
-
-                    if (m_particle_to_surfel[pidx] < 0) {
-                        vol_solid += vol * m_rest_volume_fraction(pidx) * weights(pair.second, 1);
-                        vol_fluid_elasto += fvol * weights(pair.second, 1);
-                        shape_factor += m_shape_factor(pidx) * weights(pair.second, 1);
-                        shape_factor_rw += weights(pair.second, 1);
-                        orientation += m_orientation.segment<3>(pidx * 3) * weights(pair.second, 1);
-                    }
+            VectorXs& bucket_vel = (*node_vel[r])[bucket_idx];
+            VectorXs& bucket_mass = (*node_mass[r])[bucket_idx];
+            VectorXs& bucket_vol = (*node_vol[r])[bucket_idx];
+            VectorXs& bucket_vel_fluid = (*node_vel_fluid[r])[bucket_idx];
+            VectorXs& bucket_mass_fluid = (*node_mass_fluid[r])[bucket_idx];
+            VectorXs& bucket_vol_fluid = (*node_vol_fluid[r])[bucket_idx];
+            VectorXs& bucket_psi = (*node_psi[r])[bucket_idx];
+            VectorXs& bucket_sat = (*node_sat[r])[bucket_idx];
+            VectorXs& bucket_raw_weight = (*node_raw_weight[r])[bucket_idx];
+            VectorXs& bucket_orientation = (*node_orientation[r])[bucket_idx];
+            VectorXs& bucket_shape_factor = (*node_shape_factor[r])[bucket_idx];
+
+            for (int i = 0; i < num_nodes; ++i)
+            {
+                if (bucket_mass(i) > 1e-20) {
+                    bucket_vel(i) /= bucket_mass(i);
                 } else {
-                    const scalar vel = fluidv(1) + fB.row(1).dot(np - pos);
-                    p_fluid += vel * fm(1) * weights(pair.second, 1);
-                    mass_fluid += fm(1) * weights(pair.second, 1);
-                    vol_fluid += fvol * weights(pair.second, 1);
+                    bucket_vel(i) = 0.0;
                 }
-            }
-
-            if (mass > 1e-20) {
-                m_node_vel_y[bucket_idx](i) = p / mass;
-            }
-
-            if (mass_fluid > 1e-20) {
-                m_node_vel_fluid_y[bucket_idx](i) = p_fluid / mass_fluid;
-            }
-
-            if (shape_factor_rw > 1e-20) {
-                shape_factor /= shape_factor_rw;
-            }
-
-            m_node_mass_y[bucket_idx](i) = mass;
-            m_node_vol_y[bucket_idx](i) = vol_solid + vol_fluid_elasto;
-
-            m_node_mass_fluid_y[bucket_idx](i) = mass_fluid;
-            m_node_vol_fluid_y[bucket_idx](i) = vol_fluid;
-
-            m_node_psi_y[bucket_idx](i) = mathutils::clamp(vol_solid / dV, 0.0, 1.0);
-            m_node_sat_y[bucket_idx](i) = mathutils::clamp((vol_fluid + vol_fluid_elasto) / std::max(1e-20, dV - vol_solid), 0.0, 1.0);
 
-            const scalar lo = orientation.norm();
-            if (lo > 1e-20) {
-                orientation /= lo;
-            }
-            m_node_orientation_y[bucket_idx].segment<3>(i * 3) = orientation;
-            m_node_shape_factor_y[bucket_idx](i) = shape_factor;
-        }
-
-        assert(!std::isnan(m_node_vel_y[bucket_idx].sum()));
-        assert(!std::isnan(m_node_mass_fluid_y[bucket_idx].sum()));
-        assert(!std::isnan(m_node_vol_fluid_y[bucket_idx].sum()));
-
-        for (int i = 0; i < num_nodes; ++i)
-        {
-            const auto& node_particles_z = bucket_node_particles_z[i];
-            const Vector3s& np = getNodePosZ(bucket_idx, i);
-
-            scalar p = 0.0;
-            scalar mass = 0.0;
-            scalar vol_solid = 0.0;
-
-            scalar p_fluid = 0.0;
-            scalar mass_fluid = 0.0;
-            scalar vol_fluid = 0.0;
-
-            scalar vol_fluid_elasto = 0.0;
-            scalar shape_factor = 0.0;
-            scalar shape_factor_rw = 0.0;
-            Vector3s orientation = Vector3s::Zero();
-
-            for (auto& pair : node_particles_z) {
-                const int pidx = pair.first;
-
-                auto& weights = m_particle_weights[pidx];
-                const scalar& vol = m_rest_vol(pidx);
-                const Vector3s& m = m_m.segment<3>(pidx * 4);
-                const scalar& fvol = m_fluid_vol(pidx);
-                const Vector3s& fm = m_fluid_m.segment<3>(pidx * 4);
-                const Vector3s& v = m_v.segment<3>(pidx * 4);
-                const Vector3s& fluidv = m_fluid_v.segment<3>(pidx * 4);
-                const Vector3s& pos = m_x.segment<3>(pidx * 4);
-                const Matrix3s& B = m_B.block<3, 3>(pidx * 3, 0);
-                const Matrix3s& fB = m_fB.block<3, 3>(pidx * 3, 0);
-
-                if (!isFluid(pidx)) {
-                    const scalar vel = v(2) + B.row(2).dot(np - pos);
-                    p += vel * (m(2) + fm(2)) * weights(pair.second, 2);
-                    mass += (m(2) + fm(2)) * weights(pair.second, 2);
-
-                    if (m_particle_to_surfel[pidx] < 0) {
-                        vol_solid += vol * m_rest_volume_fraction(pidx) * weights(pair.second, 2);
-                        vol_fluid_elasto += fvol * weights(pair.second, 2);
-                        shape_factor += m_shape_factor(pidx) * weights(pair.second, 2);
-                        shape_factor_rw += weights(pair.second, 2);
-                        orientation += m_orientation.segment<3>(pidx * 3) * weights(pair.second, 2);
-                    }
+                if (bucket_mass_fluid(i) > 1e-20) {
+                    bucket_vel_fluid(i) /= bucket_mass_fluid(i);
                 } else {
-                    const scalar vel = fluidv(2) + fB.row(2).dot(np - pos);
-                    p_fluid += vel * fm(2) * weights(pair.second, 2);
-                    mass_fluid += fm(2) * weights(pair.second, 2);
-                    vol_fluid += fvol * weights(pair.second, 2);
+                    bucket_vel_fluid(i) = 0.0;
                 }
-            }
-
-            if (mass > 1e-20) {
-                m_node_vel_z[bucket_idx](i) = p / mass;
-            }
 
-            if (mass_fluid > 1e-20) {
-                m_node_vel_fluid_z[bucket_idx](i) = p_fluid / mass_fluid;
-            }
-
-            if (shape_factor_rw > 1e-20) {
-                shape_factor /= shape_factor_rw;
-            }
-
-            m_node_mass_z[bucket_idx](i) = mass;
-            m_node_vol_z[bucket_idx](i) = vol_solid + vol_fluid_elasto;
+                if (bucket_raw_weight(i) > 1e-20) {
+                    bucket_shape_factor(i) /= bucket_raw_weight(i);
+                }
 
-            m_node_mass_fluid_z[bucket_idx](i) = mass_fluid;
-            m_node_vol_fluid_z[bucket_idx](i) = vol_fluid;
+                const scalar vol_solid = bucket_psi(i);
+                const scalar vol_fluid_elasto = bucket_sat(i);
 
-            m_node_psi_z[bucket_idx](i) = mathutils::clamp(vol_solid / dV, 0.0, 1.0);
-            m_node_sat_z[bucket_idx](i) = mathutils::clamp((vol_fluid + vol_fluid_elasto) / std::max(1e-20, dV - vol_solid), 0.0, 1.0);
+                bucket_vol(i) = vol_solid + vol_fluid_elasto;
+                bucket_psi(i) = mathutils::clamp(vol_solid / dV, 0.0, 1.0);
+                bucket_sat(i) = mathutils::clamp((bucket_vol_fluid(i) + vol_fluid_elasto) / std::max(1e-20, dV - vol_solid), 0.0, 1.0);
 
-            const scalar lo = orientation.norm();
-            if (lo > 1e-20) {
-                orientation /= lo;
+                const scalar lo = bucket_orientation.segment<3>(i * 3).norm();
+                if (lo > 1e-20) {
+                    bucket_orientation.segment<3>(i * 3) /= lo;
+                }
             }
-            m_node_orientation_z[bucket_idx].segment<3>(i * 3) = orientation;
-            m_node_shape_factor_z[bucket_idx](i) = shape_factor;
-        }
 
-        assert(!std::isnan(m_node_vel_z[bucket_idx].sum()));
-        assert(!std::isnan(m_node_mass_fluid_z[bucket_idx].sum()));
-        assert(!std::isnan(m_node_vol_fluid_z[bucket_idx].sum()));
+            assert(!std::isnan(bucket_vel.sum()));
+            assert(!std::isnan(bucket_mass_fluid.sum()));
+            assert(!std::isnan(bucket_vol_fluid.sum()));
+        }
     });
 }
 
@@ -7190,7 +7268,7 @@ VectorXs TwoDScene::getPosition( int particle )
 {
     assert( particle >= 0 );
     // assert( particle < getNumParticles() );
-    assert( getDof(particle) < m_x.size() );
+    assert( getDof(particle) < getNumParticles() * 4 );
 
     return m_x.segment<3>( getDof(particle) );
 }
@@ -7235,14 +7313,14 @@ void TwoDScene::updateRestPos()
     m_rest_x = m_x;
 }
 
-const VectorXs& TwoDScene::getRestPos() const
+ConstVectorXsRef TwoDScene::getRestPos() const
 {
-    return m_rest_x;
+    return m_rest_x.head(getNumParticles() * 4);
 }
 
-VectorXs& TwoDScene::getRestPos()
+VectorXsRef TwoDScene::getRestPos()
 {
-    return m_rest_x;
+    return m_rest_x.head(getNumParticles() * 4);
 }
 
 
@@ -7347,7 +7425,7 @@ scalar TwoDScene::computeKineticEnergy() const
 scalar TwoDScene::computePotentialEnergy() const
 {
     scalar U = 0.0;
-    for ( std::vector<Force*>::size_type i = 0; i < m_forces.size(); ++i ) m_forces[i]->addEnergyToTotal( m_x, m_v, m_m, m_volume_fraction, m_liquid_info.lambda, U );
+    for ( std::vector<Force*>::size_type i = 0; i < m_forces.size(); ++i ) m_forces[i]->addEnergyToTotal( getX(), getV(), getM(), getVolumeFraction(), m_liquid_info.lambda, U );
     return U;
 }
 
@@ -7377,14 +7455,14 @@ scalar TwoDScene::computeTotalEnergy() const
     return computeKineticEnergy() + computePotentialEnergy();
 }
 
-const VectorXs& TwoDScene::getVolumeFraction() const
+ConstVectorXsRef TwoDScene::getVolumeFraction() const
 {
-    return m_volume_fraction;
+    return m_volume_fraction.head(getNumParticles());
 }
 
-VectorXs& TwoDScene::getVolumeFraction()
+VectorXsRef TwoDScene::getVolumeFraction()
 {
-    return m_volume_fraction;
+    return m_volume_fraction.head(getNumParticles());
 }
 
 /*!
@@ -7516,7 +7594,7 @@ void TwoDScene::accumulateManifoldFluidGradU( VectorXs& F )
     F_full.setZero();
 
     for ( std::vector<Force*>::size_type i = 0; i < m_forces.size(); ++i ) {
-        if (m_forces[i]->flag() & 2) m_forces[i]->addGradEToTotal( m_x, m_fluid_v, m_fluid_m, m_volume_fraction, m_liquid_info.lambda, F_full );
+        if (m_forces[i]->flag() & 2) m_forces[i]->addGradEToTotal( getX(), getFluidV(), getFluidM(), getVolumeFraction(), m_liquid_info.lambda, F_full );
     }
 
     F_full *= -1.0;
@@ -7617,18 +7695,18 @@ void TwoDScene::accumulateGradU( VectorXs& F, const VectorXs& dx, const VectorXs
 
     if (F.size() == 0) return;
 
-    VectorXs combined_mass = m_m + m_fluid_m;
+    VectorXs combined_mass = getM() + getFluidM();
 
     // Accumulate all energy gradients
     if ( dx.size() == 0 ) for ( std::vector<Force*>::size_type i = 0; i < m_forces.size(); ++i ) {
-            if (m_forces[i]->flag() & 1) m_forces[i]->addGradEToTotal( m_x, m_v, combined_mass, m_volume_fraction, m_liquid_info.lambda, F );
+            if (m_forces[i]->flag() & 1) m_forces[i]->addGradEToTotal( getX(), getV(), combined_mass, getVolumeFraction(), m_liquid_info.lambda, F );
         }
     else                 {
-        VectorXs ddx = m_x + dx;
-        VectorXs ddv = m_v + dv;
+        VectorXs ddx = getX() + dx;
+        VectorXs ddv = getV() + dv;
 
         for ( std::vector<Force*>::size_type i = 0; i < m_forces.size(); ++i ) {
-            if (m_forces[i]->flag() & 1) m_forces[i]->addGradEToTotal( ddx, ddv, m_m, m_volume_fraction, m_liquid_info.lambda, F );
+            if (m_forces[i]->flag() & 1) m_forces[i]->addGradEToTotal( ddx, ddv, getM(), getVolumeFraction(), m_liquid_info.lambda, F );
         }
     }
 }
@@ -7636,14 +7714,14 @@ void TwoDScene::accumulateGradU( VectorXs& F, const VectorXs& dx, const VectorXs
 void TwoDScene::accumulateFluidGradU( VectorXs& F, const VectorXs& dx, const VectorXs& dv)
 {
     if ( dx.size() == 0 ) for ( std::vector<Force*>::size_type i = 0; i < m_forces.size(); ++i ) {
-            if (m_forces[i]->flag() & 2) m_forces[i]->addGradEToTotal( m_x, m_fluid_v, m_fluid_m, m_volume_fraction, m_liquid_info.lambda, F );
+            if (m_forces[i]->flag() & 2) m_forces[i]->addGradEToTotal( getX(), getFluidV(), getFluidM(), getVolumeFraction(), m_liquid_info.lambda, F );
         }
     else                 {
-        VectorXs ddx = m_x + dx;
-        VectorXs ddv = m_fluid_v + dv;
+        VectorXs ddx = getX() + dx;
+        VectorXs ddv = getFluidV() + dv;
 
         for ( std::vector<Force*>::size_type i = 0; i < m_forces.size(); ++i ) {
-            if (m_forces[i]->flag() & 2) m_forces[i]->addGradEToTotal( ddx, ddv, m_fluid_m, m_volume_fraction, m_liquid_info.lambda, F );
+            if (m_forces[i]->flag() & 2) m_forces[i]->addGradEToTotal( ddx, ddv, getFluidM(), getVolumeFraction(), m_liquid_info.lambda, F );
         }
     }
 }
@@ -7749,22 +7827,22 @@ void TwoDScene::accumulateddUdxdx( TripletXs& A, const scalar& dt, int base_idx,
 
     if ( dx.size() == 0 ) {
         threadutils::for_each(0, num_force, [&] (int i) {
-            if (!m_forces[i]->parallelized()) m_forces[i]->addHessXToTotal( m_x, m_v, m_m, m_volume_fraction, m_liquid_info.lambda, A, offsets[i], dt );
+            if (!m_forces[i]->parallelized()) m_forces[i]->addHessXToTotal( getX(), getV(), getM(), getVolumeFraction(), m_liquid_info.lambda, A, offsets[i], dt );
         });
 
         for ( int i = 0; i < num_force; ++i ) {
-            if (m_forces[i]->parallelized()) m_forces[i]->addHessXToTotal( m_x, m_v, m_m, m_volume_fraction, m_liquid_info.lambda, A, offsets[i], dt );
+            if (m_forces[i]->parallelized()) m_forces[i]->addHessXToTotal( getX(), getV(), getM(), getVolumeFraction(), m_liquid_info.lambda, A, offsets[i], dt );
         }
     } else {
-        VectorXs idx = m_x + dx;
-        VectorXs idv = m_v + dv;
+        VectorXs idx = getX() + dx;
+        VectorXs idv = getV() + dv;
 
         threadutils::for_each(0, num_force, [&] (int i) {
-            if (!m_forces[i]->parallelized()) m_forces[i]->addHessXToTotal( idx, idv, m_m, m_volume_fraction, m_liquid_info.lambda, A, offsets[i], dt );
+            if (!m_forces[i]->parallelized()) m_forces[i]->addHessXToTotal( idx, idv, getM(), getVolumeFraction(), m_liquid_info.lambda, A, offsets[i], dt );
         });
 
         for ( int i = 0; i < num_force; ++i ) {
-            if (m_forces[i]->parallelized()) m_forces[i]->addHessXToTotal( idx, idv, m_m, m_volume_fraction, m_liquid_info.lambda, A, offsets[i], dt );
+            if (m_forces[i]->parallelized()) m_forces[i]->addHessXToTotal( idx, idv, getM(), getVolumeFraction(), m_liquid_info.lambda, A, offsets[i], dt );
         }
     }
 }
@@ -7773,7 +7851,7 @@ void TwoDScene::updateMultipliers(const scalar& dt)
 {
     const int num_force = m_forces.size();
     for ( int i = 0; i < num_force; ++i ) {
-        m_forces[i]->updateMultipliers( m_x, m_v, m_m, m_volume_fraction, m_liquid_info.lambda, dt );
+        m_forces[i]->updateMultipliers( getX(), getV(), getM(), getVolumeFraction(), m_liquid_info.lambda, dt );
     }
 }
 
@@ -7799,14 +7877,14 @@ void TwoDScene::accumulateAngularddUdxdx( TripletXs& A, const scalar& dt, int ba
 
     if ( dx.size() == 0 )
         for ( int i = 0; i < num_force; ++i ) {
-            m_forces[i]->addAngularHessXToTotal( m_x, m_v, m_m, m_volume_fraction, m_liquid_info.lambda, A, offsets[i], dt );
+            m_forces[i]->addAngularHessXToTotal( getX(), getV(), getM(), getVolumeFraction(), m_liquid_info.lambda, A, offsets[i], dt );
         }
     else {
-        VectorXs idx = m_x + dx;
-        VectorXs idv = m_v + dv;
+        VectorXs idx = getX() + dx;
+        VectorXs idv = getV() + dv;
 
         for ( int i = 0; i < num_force; ++i ) {
-            m_forces[i]->addAngularHessXToTotal( idx, idv, m_m, m_volume_fraction, m_liquid_info.lambda, A, offsets[i], dt );
+            m_forces[i]->addAngularHessXToTotal( idx, idv, getM(), getVolumeFraction(), m_liquid_info.lambda, A, offsets[i], dt );
         }
     }
 }
@@ -7835,15 +7913,21 @@ void TwoDScene::stepScript(const scalar& dt, const scalar& current_time)
  */
 void TwoDScene::updateSolidPhi()
 {
-    auto solid_sel = [] (const std::shared_ptr<DistanceField>& dfptr) -> bool {
-        return dfptr->usage == DFU_SOLID;
-    };
+    const scalar solid_cutoff = 3.0 * m_bucket_size;
 
-    m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
-        if (!m_bucket_activated[bucket_idx]) return;
+    // the solids that may reach into a bucket, all the nodes of the bucket
+    // are queried against this list
+    auto gather_solids = [&] (int bucket_idx, std::vector<int>& candidates) {
+        const Vector3s bucket_low = m_grid_mincorner + m_particle_buckets.bucket_handle(bucket_idx).cast<scalar>() * m_bucket_size;
+        m_distance_field_query.gather(DFU_SOLID, bucket_low, bucket_low + Vector3s::Constant(m_bucket_size), solid_cutoff, candidates);
+    };
 
+    m_particle_buckets.for_each_active_bucket([&] (int bucket_idx) {
         const int num_nodes = getNumNodes(bucket_idx);
 
+        std::vector<int> candidates;
+        gather_solids(bucket_idx, candidates);
+
         VectorXs& node_phi = m_node_solid_phi[bucket_idx];
 
         VectorXs& node_solid_vel_x = m_node_solid_vel_x[bucket_idx];
@@ -7853,37 +7937,36 @@ void TwoDScene::updateSolidPhi()
         for (int i = 0; i < num_nodes; ++i)
         {
             Vector3s vel;
-            node_phi(i) = computePhiVel(getNodePosSolidPhi(bucket_idx, i), vel, solid_sel);
+            node_phi(i) = m_distance_field_query.computePhiVel(candidates, getNodePosSolidPhi(bucket_idx, i), vel, solid_cutoff);
 
-            computePhiVel(getNodePosX(bucket_idx, i), vel, solid_sel);
+            m_distance_field_query.computePhiVel(candidates, getNodePosX(bucket_idx, i), vel, solid_cutoff);
             node_solid_vel_x(i) = vel(0);
 
-            computePhiVel(getNodePosY(bucket_idx, i), vel, solid_sel);
+            m_distance_field_query.computePhiVel(candidates, getNodePosY(bucket_idx, i), vel, solid_cutoff);
             node_solid_vel_y(i) = vel(1);
 
-            computePhiVel(getNodePosZ(bucket_idx, i), vel, solid_sel);
+            m_distance_field_query.computePhiVel(candidates, getNodePosZ(bucket_idx, i), vel, solid_cutoff);
             node_solid_vel_z(i) = vel(2);
         }
     });
 
     if (m_liquid_info.compute_viscosity)
     {
-        m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
-            if (!m_bucket_activated[bucket_idx]) return;
-
+        m_particle_buckets.for_each_active_bucket([&] (int bucket_idx) {
             VectorXs& node_cell_solid_phi = m_node_cell_solid_phi[bucket_idx];
 
             const int num_node_p = getNumNodes(bucket_idx);
 
+            std::vector<int> candidates;
+            gather_solids(bucket_idx, candidates);
+
             for (int i = 0; i < num_node_p; ++i)
             {
-                node_cell_solid_phi(i) = computePhi(getNodePosP(bucket_idx, i), solid_sel);
+                node_cell_solid_phi(i) = m_distance_field_query.computePhi(candidates, getNodePosP(bucket_idx, i), solid_cutoff);
             }
         });
 
-        m_particle_buckets.for_each_bucket([&] (int bucket_idx) {
-            if (!m_bucket_activated[bucket_idx]) return;
-
+        m_particle_buckets.for_each_active_bucket([&] (int bucket_idx) {
             const int num_node = getNumNodes(bucket_idx);
 
             VectorXuc& node_state_u = m_node_state_u[bucket_idx];
@@ -8020,6 +8103,8 @@ void TwoDScene::applyScript(const scalar& dt)
     threadutils::for_each(0, num_gdf, [&] (int i) {
         m_group_distance_field[i]->advance(dt);
     });
+
+    updateDistanceFieldQuery();
 }
 
 void TwoDScene::checkConsistency()
@@ -19,6 +19,9 @@
 #include "sorter.h"
 #include "Script.h"
 #include "DistanceFields.h"
+#include "DistanceFieldQuery.h"
+#include "ParticleStore.h"
+#include "NodeParticlePairs.h"
 
 class StrandForce;
 class AttachForce;
@@ -99,6 +102,7 @@ struct LiquidInfo
 	bool use_group_precondition;
 	bool use_lagrangian_mpm;
 	bool use_cosolve_angular;
+	bool sort_particles;
 
 	friend std::ostream& operator<<(std::ostream&, const LiquidInfo&);
 };
@@ -145,33 +149,34 @@ public:
 
 	const std::vector<unsigned char>& getFixed() const;
 
-	const VectorXs& getX() const;
+	// views of the live particles of the columns (see ParticleStore), valid until the particles change
+	ConstVectorXsRef getX() const;
 
-	VectorXs& getX();
+	VectorXsRef getX();
 
-	const VectorXs& getV() const;
+	ConstVectorXsRef getV() const;
 
-	VectorXs& getV();
+	VectorXsRef getV();
 
-	const VectorXs& getFluidV() const;
+	ConstVectorXsRef getFluidV() const;
 
-	VectorXs& getFluidV();
+	VectorXsRef getFluidV();
 
-	const VectorXs& getM() const;
+	ConstVectorXsRef getM() const;
 
-	VectorXs& getM();
+	VectorXsRef getM();
 
-	const VectorXs& getFluidM() const;
+	ConstVectorXsRef getFluidM() const;
 
-	VectorXs& getFluidM();
+	VectorXsRef getFluidM();
 
-	const VectorXs& getVol() const;
+	ConstVectorXsRef getVol() const;
 
-	VectorXs& getVol();
+	VectorXsRef getVol();
 
-	const VectorXs& getFluidVol() const;
+	ConstVectorXsRef getFluidVol() const;
 
-	VectorXs& getFluidVol();
+	VectorXsRef getFluidVol();
 
 	LiquidInfo& getLiquidInfo();
 
@@ -183,13 +188,13 @@ public:
 
 	const std::vector< std::pair<int, scalar> >& getParticleFaces(int pidx) const;
 
-	const VectorXs& getVolumeFraction() const;
+	ConstVectorXsRef getVolumeFraction() const;
 
-	VectorXs& getVolumeFraction();
+	VectorXsRef getVolumeFraction();
 
-	const VectorXs& getRadius() const;
+	ConstVectorXsRef getRadius() const;
 
-	VectorXs& getRadius();
+	VectorXsRef getRadius();
 
 	const VectorXs& getGaussX() const;
 
@@ -499,6 +504,8 @@ public:
 
 	void swapParticles(int i, int j);
 
+	void permuteParticles(const std::vector<int>& order);
+
 	void mapParticleNodesAPIC(); // particles to nodes mapping
 
 	void mapParticleSaturationPsiNodes();
@@ -571,6 +578,22 @@ public:
 
 	scalar getCellSize() const;
 
+	// substeps taken so far, keys the random streams of the deterministic mode
+	uint64_t getStepCount() const;
+
+	void setStepCount( uint64_t count );
+
+	void advanceStepCount();
+
+	// state of the simulation on top of what the scene file sets up
+	void saveCheckpoint( CheckpointWriter& out ) const;
+
+	// replaces the particles by those of a checkpoint, at rest
+	bool loadRestConfiguration( const CheckpointReader& in );
+
+	// false if the checkpoint does not belong to this scene
+	bool loadCheckpoint( const CheckpointReader& in );
+
 	scalar getInverseDCoeff() const;
 
 	scalar getGaussDensity(int pidx) const;
@@ -718,6 +741,7 @@ public:
 
 	void updateParticleBoundingBox();
 	void rebucketizeParticles();
+	void sortLiquidParticles();
 	void resampleNodes();
 	void updateParticleWeights(scalar dt, int start, int end);
 	void updateGaussWeights(scalar dt);
@@ -741,9 +765,9 @@ public:
 
 	void correctLiquidParticles(const scalar& dt);
 
-	const VectorXs& getRestPos() const;
+	ConstVectorXsRef getRestPos() const;
 
-	VectorXs& getRestPos() ;
+	VectorXsRef getRestPos() ;
 
 	void initGroupPos();
 
@@ -760,15 +784,15 @@ public:
 
 	const std::vector< std::shared_ptr<AttachForce> >& getAttachForces() const;
 
-	const std::vector< std::pair<int, int> >& getNodeParticlePairsX(int bucket_idx, int pidx) const;
+	NodeParticlePairs::Range getNodeParticlePairsX(int bucket_idx, int pidx) const;
 
 	const std::vector< std::pair<int, int> >& getNodeGaussPairsX(int bucket_idx, int pidx) const;
 
-	const std::vector< std::pair<int, int> >& getNodeParticlePairsY(int bucket_idx, int pidx) const;
+	NodeParticlePairs::Range getNodeParticlePairsY(int bucket_idx, int pidx) const;
 
 	const std::vector< std::pair<int, int> >& getNodeGaussPairsY(int bucket_idx, int pidx) const;
 
-	const std::vector< std::pair<int, int> >& getNodeParticlePairsZ(int bucket_idx, int pidx) const;
+	NodeParticlePairs::Range getNodeParticlePairsZ(int bucket_idx, int pidx) const;
 
 	const std::vector< std::pair<int, int> >& getNodeGaussPairsZ(int bucket_idx, int pidx) const;
 
@@ -791,15 +815,22 @@ public:
 
 	const std::vector< std::shared_ptr<DistanceField> >& getDistanceFields() const;
 
-	const VectorXuc& getOutsideInfo() const;
+	Eigen::Ref<const VectorXuc> getOutsideInfo() const;
 
 	void sampleSolidDistanceFields();
 
 	void sampleLiquidDistanceFields( scalar cur_time );
 
-	scalar computePhiVel(const Vector3s& pos, Vector3s& vel, const std::function< bool(const std::shared_ptr<DistanceField>&) > selector = nullptr) const;
+	// positions (4 per particle) of the liquid particles within [low, high], found through the particle buckets
+	void gatherFluidParticles( const Vector3s& low, const Vector3s& high, VectorXs& pos ) const;
+
+	// queries restricted to the group fields of one usage, through the spatial index
+	scalar computePhiVel(const Vector3s& pos, Vector3s& vel, DISTANCE_FIELD_USAGE usage) const;
+
+	scalar computePhi(const Vector3s& pos, DISTANCE_FIELD_USAGE usage) const;
 
-	scalar computePhi(const Vector3s& pos, const std::function< bool(const std::shared_ptr<DistanceField>&) > selector = nullptr) const;
+	// rebuild the spatial index of the group fields after they moved
+	void updateDistanceFieldQuery();
 
 	void dump_geometry(std::string filename);
 
@@ -818,7 +849,9 @@ public:
 	void preAllocateNodes();
 
 	template<typename Callable>
-	void findNodes( const Sorter& buckets, const VectorXs& x, std::vector< Matrix27x2i >& particle_nodes, const Vector3s& offset, Callable func );
+	void findNodes( const Sorter& buckets, const ConstVectorXsRef& x, std::vector< Matrix27x2i >& particle_nodes, const Vector3s& offset, Callable func );
+
+	void markChangedBuckets();
 
 	void generateNodes();
 
@@ -907,7 +940,9 @@ public:
 	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
 private:
-	int step_count;
+	// registry of all per-particle arrays below
+	ParticleStore m_particles;
+
 	VectorXs m_x; //particle pos
 	VectorXs m_rest_x; //particle rest pos
 
@@ -934,8 +969,8 @@ private:
 	VectorXs m_edge_rest_length;
 	VectorXs m_particle_rest_area;
 	VectorXs m_face_rest_area;
-	MatrixXs m_B; // particle B matrix
-	MatrixXs m_fB;
+	MatrixRXs m_B; // particle B matrix, 3 contiguous rows per particle
+	MatrixRXs m_fB;
 
 	VectorXs m_x_gauss;
 	VectorXs m_v_gauss;
@@ -962,6 +997,7 @@ private:
 	MatrixXs m_norm_gauss; // normalized material axis with rigid transformation
 
 	std::vector<unsigned char> m_fixed;
+	uint64_t step_count;
 	std::vector<bool> m_twist;
 	MatrixXi m_edges;
 	MatrixXi m_faces; //store the face id
@@ -1001,10 +1037,10 @@ private:
 	std::vector< Matrix27x3s > m_gauss_weights;
 
 	// bucket id -> nodes -> pairs of (particle id, id in particle neighborhoods)
-	std::vector< std::vector< std::vector< std::pair< int, int > > > > m_node_particles_x;
-	std::vector< std::vector< std::vector< std::pair< int, int > > > > m_node_particles_y;
-	std::vector< std::vector< std::vector< std::pair< int, int > > > > m_node_particles_z;
-	std::vector< std::vector< std::vector< std::pair< int, int > > > > m_node_particles_p;
+	NodeParticlePairs m_node_particles_x;
+	NodeParticlePairs m_node_particles_y;
+	NodeParticlePairs m_node_particles_z;
+	NodeParticlePairs m_node_particles_p;
 
 	std::vector< int > m_particle_group;
 
@@ -1017,12 +1053,17 @@ private:
 	int m_num_bucket_colors;
 	Vector3s m_bucket_mincorner;
 	Vector3s m_grid_mincorner;
+	Vector3i m_bucket_origin; // lattice coordinates of bucket (0, 0, 0)
+	bool m_bucket_layout_changed;
 
 	Sorter m_particle_buckets;
 	Sorter m_gauss_buckets;
 	Sorter m_particle_cells;
 
 	std::vector< unsigned char > m_bucket_activated;
+	std::vector< unsigned char > m_bucket_activated_prev;
+	std::vector< unsigned char > m_bucket_dirty; // node tables to rebuild
+	std::vector< unsigned char > m_bucket_reconnect; // pressure tables to reconnect
 
 	std::vector< VectorXs > m_node_pos;
 
@@ -1161,6 +1202,8 @@ private:
 
 	std::vector< std::shared_ptr< DistanceField > > m_group_distance_field;
 
+	DistanceFieldQuery m_distance_field_query;
+
 	std::vector< std::shared_ptr< DistanceField > > m_distance_fields;
 };
 
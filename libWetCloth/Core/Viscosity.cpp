@@ -104,36 +104,18 @@ bool get_node_index(
 	return true;
 };
 
-void applyNodeViscosityImplicit( const TwoDScene& scene,
-                                 const std::vector< VectorXi >& node_global_indices_x,
-                                 const std::vector< VectorXi >& node_global_indices_y,
-                                 const std::vector< VectorXi >& node_global_indices_z,
-                                 int offset_nodes_x,
-                                 int offset_nodes_y,
-                                 int offset_nodes_z,
-                                 const SparseMatrix< scalar >& matrix,
-                                 const std::vector< scalar >& rhs,
-                                 std::vector< scalar >& soln,
-                                 std::vector< VectorXs >& node_vel_x,
-                                 std::vector< VectorXs >& node_vel_y,
-                                 std::vector< VectorXs >& node_vel_z,
-                                 scalar& residual,
-                                 int& iter_out,
-                                 const scalar& criterion,
-                                 int maxiters)
+static void extractNodeViscositySolution( const TwoDScene& scene,
+        const std::vector< VectorXi >& node_global_indices_x,
+        const std::vector< VectorXi >& node_global_indices_y,
+        const std::vector< VectorXi >& node_global_indices_z,
+        int offset_nodes_x,
+        int offset_nodes_y,
+        int offset_nodes_z,
+        const std::vector< scalar >& soln,
+        std::vector< VectorXs >& node_vel_x,
+        std::vector< VectorXs >& node_vel_y,
+        std::vector< VectorXs >& node_vel_z)
 {
-	soln.assign(rhs.size(), 0.0);
-
-	PCGSolver<double> solver;
-	solver.set_solver_parameters(criterion, maxiters, 0.97, 0.1);
-	bool success = false;
-
-	success = solver.solve(matrix, rhs, soln, residual, iter_out);
-	if (!success) {
-		std::cerr << "\n\n\n**********VISCOSITY FAILED**************\n\n\n" << std::endl;
-		exit(0);
-	}
-
 	const std::vector< VectorXuc >& node_state_u = scene.getNodeStateX();
 	const std::vector< VectorXuc >& node_state_v = scene.getNodeStateY();
 	const std::vector< VectorXuc >& node_state_w = scene.getNodeStateZ();
@@ -183,6 +165,99 @@ void applyNodeViscosityImplicit( const TwoDScene& scene,
 	});
 }
 
+void applyNodeViscosityImplicit( const TwoDScene& scene,
+                                 const std::vector< VectorXi >& node_global_indices_x,
+                                 const std::vector< VectorXi >& node_global_indices_y,
+                                 const std::vector< VectorXi >& node_global_indices_z,
+                                 int offset_nodes_x,
+                                 int offset_nodes_y,
+                                 int offset_nodes_z,
+                                 const SparseMatrix< scalar >& matrix,
+                                 const std::vector< scalar >& rhs,
+                                 std::vector< scalar >& soln,
+                                 std::vector< VectorXs >& node_vel_x,
+                                 std::vector< VectorXs >& node_vel_y,
+                                 std::vector< VectorXs >& node_vel_z,
+                                 scalar& residual,
+                                 int& iter_out,
+                                 const scalar& criterion,
+                                 int maxiters)
+{
+	soln.assign(rhs.size(), 0.0);
+
+	PCGSolver<double> solver;
+	solver.set_solver_parameters(criterion, maxiters, 0.97, 0.1);
+	bool success = false;
+
+	success = solver.solve(matrix, rhs, soln, residual, iter_out);
+	if (!success) {
+		std::cerr << "\n\n\n**********VISCOSITY FAILED**************\n\n\n" << std::endl;
+		exit(0);
+	}
+
+	extractNodeViscositySolution(scene, node_global_indices_x, node_global_indices_y, node_global_indices_z,
+	                             offset_nodes_x, offset_nodes_y, offset_nodes_z, soln, node_vel_x, node_vel_y, node_vel_z);
+}
+
+void formViscosityBlockPreconditioner( const TwoDScene& scene,
+                                       const std::vector< Vector2i >& effective_node_indices_x,
+                                       const std::vector< Vector2i >& effective_node_indices_y,
+                                       const std::vector< Vector2i >& effective_node_indices_z,
+                                       int offset_nodes_x,
+                                       int offset_nodes_y,
+                                       int offset_nodes_z,
+                                       const SparseMatrix< scalar >& matrix,
+                                       BlockPCGSolver< scalar >& solver,
+                                       const scalar& criterion,
+                                       int maxiters)
+{
+	// the three velocity components of a bucket go into the same block
+	std::vector<int> block_of_row(matrix.n);
+
+	threadutils::for_each(0, (int) effective_node_indices_x.size(), [&] (int dof_idx) {
+		block_of_row[dof_idx + offset_nodes_x] = effective_node_indices_x[dof_idx](0);
+	});
+
+	threadutils::for_each(0, (int) effective_node_indices_y.size(), [&] (int dof_idx) {
+		block_of_row[dof_idx + offset_nodes_y] = effective_node_indices_y[dof_idx](0);
+	});
+
+	threadutils::for_each(0, (int) effective_node_indices_z.size(), [&] (int dof_idx) {
+		block_of_row[dof_idx + offset_nodes_z] = effective_node_indices_z[dof_idx](0);
+	});
+
+	solver.set_solver_parameters(criterion, maxiters, 0.97, 0.1);
+	solver.form_preconditioner(matrix, block_of_row, scene.getParticleBuckets().size());
+}
+
+void applyNodeViscosityImplicit( const TwoDScene& scene,
+                                 const std::vector< VectorXi >& node_global_indices_x,
+                                 const std::vector< VectorXi >& node_global_indices_y,
+                                 const std::vector< VectorXi >& node_global_indices_z,
+                                 int offset_nodes_x,
+                                 int offset_nodes_y,
+                                 int offset_nodes_z,
+                                 BlockPCGSolver< scalar >& solver,
+                                 const std::vector< scalar >& rhs,
+                                 std::vector< scalar >& soln,
+                                 std::vector< VectorXs >& node_vel_x,
+                                 std::vector< VectorXs >& node_vel_y,
+                                 std::vector< VectorXs >& node_vel_z,
+                                 scalar& residual,
+                                 int& iter_out)
+{
+	soln.assign(rhs.size(), 0.0);
+
+	bool success = solver.solve(rhs, soln, residual, iter_out);
+	if (!success) {
+		std::cerr << "\n\n\n**********VISCOSITY FAILED**************\n\n\n" << std::endl;
+		exit(0);
+	}
+
+	extractNodeViscositySolution(scene, node_global_indices_x, node_global_indices_y, node_global_indices_z,
+	                             offset_nodes_x, offset_nodes_y, offset_nodes_z, soln, node_vel_x, node_vel_y, node_vel_z);
+}
+
 void updateViscosityRHS( const TwoDScene& scene,
                          const std::vector< VectorXi >& node_global_indices_x,
                          const std::vector< VectorXi >& node_global_indices_y,
@@ -1476,11 +1551,9 @@ void applyNodeViscosityExplicit( const TwoDScene& scene,
 	const scalar dx = scene.getCellSize();
 	const scalar coeff = dt / (dx * dx) * scene.getLiquidInfo().viscosity / scene.getLiquidInfo().liquid_density;
 
-	buckets.for_each_bucket([&] (int bucket_idx) {
+	buckets.for_each_active_bucket([&] (int bucket_idx) {
 		const int num_node = scene.getNumNodes(bucket_idx);
 
-		if (!scene.isBucketActivated(bucket_idx)) return;
-
 		const Vector3i bucket_handle = buckets.bucket_handle(bucket_idx);
 
 		for (int i = 0; i < num_node; ++i) {
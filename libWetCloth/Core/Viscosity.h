@@ -18,10 +18,22 @@
 
 class TwoDScene;
 
+namespace robertbridson {
+template <class T> struct BlockPCGSolver;
+}
+
 using namespace robertbridson;
 
 namespace viscosity {
 
+enum VISCOSITY_SOLVER
+{
+	VS_MIC_PCG, // serial modified incomplete Cholesky
+	VS_BLOCK_PCG, // block-Jacobi incomplete Cholesky, one block per bucket
+
+	VS_COUNT
+};
+
 void constructViscosityMatrixRHS( const TwoDScene& scene,
                                   std::vector< VectorXi >& node_global_indices_x,
                                   std::vector< VectorXi >& node_global_indices_y,
@@ -73,6 +85,36 @@ void applyNodeViscosityImplicit( const TwoDScene& scene,
                                  const scalar& criterion,
                                  int maxiters);
 
+// partition the viscosity unknowns by bucket and factor the blocks of matrix
+void formViscosityBlockPreconditioner( const TwoDScene& scene,
+                                       const std::vector< Vector2i >& effective_node_indices_x,
+                                       const std::vector< Vector2i >& effective_node_indices_y,
+                                       const std::vector< Vector2i >& effective_node_indices_z,
+                                       int offset_nodes_x,
+                                       int offset_nodes_y,
+                                       int offset_nodes_z,
+                                       const SparseMatrix< scalar >& matrix,
+                                       BlockPCGSolver< scalar >& solver,
+                                       const scalar& criterion,
+                                       int maxiters);
+
+// solve with a solver prepared by formViscosityBlockPreconditioner
+void applyNodeViscosityImplicit( const TwoDScene& scene,
+                                 const std::vector< VectorXi >& node_global_indices_x,
+                                 const std::vector< VectorXi >& node_global_indices_y,
+                                 const std::vector< VectorXi >& node_global_indices_z,
+                                 int offset_nodes_x,
+                                 int offset_nodes_y,
+                                 int offset_nodes_z,
+                                 BlockPCGSolver< scalar >& solver,
+                                 const std::vector< scalar >& rhs,
+                                 std::vector< scalar >& soln,
+                                 std::vector< VectorXs >& node_vel_x,
+                                 std::vector< VectorXs >& node_vel_y,
+                                 std::vector< VectorXs >& node_vel_z,
+                                 scalar& residual,
+                                 int& iter_out);
+
 void applyNodeViscosityExplicit( const TwoDScene& scene,
                                  const std::vector< VectorXs >& node_vel_src_x,
                                  const std::vector< VectorXs >& node_vel_src_y,
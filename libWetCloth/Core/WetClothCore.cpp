@@ -49,6 +49,24 @@ const std::vector<scalar>& WetClothCore::getTimingStatistics() const
     return timing_buffer;
 }
 
+void WetClothCore::saveCheckpoint( CheckpointWriter& out ) const
+{
+    out.addValue("core/current_step", m_current_step);
+    out.addValue("core/info", m_info);
+
+    m_scene->saveCheckpoint(out);
+}
+
+bool WetClothCore::loadCheckpoint( const CheckpointReader& in )
+{
+    if (!in.readValue("core/current_step", m_current_step) || !in.readValue("core/info", m_info)) {
+        std::cerr << "[checkpoint: missing frame counter]" << std::endl;
+        return false;
+    }
+
+    return m_scene->loadCheckpoint(in);
+}
+
 /*
  * This is the main function where time stepping happens
  */
@@ -116,6 +134,9 @@ void WetClothCore::stepSystem(const scalar &dt) {
         // Create Grid around Particles
         m_scene->updateParticleBoundingBox();
         m_scene->rebucketizeParticles();
+        if (m_scene->getLiquidInfo().sort_particles) {
+            m_scene->sortLiquidParticles();
+        }
         m_scene->resampleNodes();
         t1 = timingutils::seconds();
         timing_buffer[1] += t1 - t0; // build Grid
@@ -289,6 +310,9 @@ void WetClothCore::stepSystem(const scalar &dt) {
         t1 = timingutils::seconds();
         timing_buffer[14] += t1 - t0; // update Deformation Gradient
         t0 = t1;
+
+        // Key the Random Streams of the Next Substep
+        m_scene->advanceStepCount();
     }
 
     // Summarize Divergence if Necessary
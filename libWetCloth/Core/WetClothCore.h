@@ -43,6 +43,10 @@ public:
 
     virtual int getCurrentTime() const;
 
+    // the scene and the frame counter; the stepper has no state across frames
+    virtual void saveCheckpoint( CheckpointWriter& out ) const;
+    virtual bool loadCheckpoint( const CheckpointReader& in );
+
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 private:
     std::shared_ptr<TwoDScene> m_scene;
@@ -1,5 +1,10 @@
 #include "makelevelset3.h"
 #include "MathUtilities.h"
+#include "ThreadUtils.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
 
 //
 // This file is part of the libWetCloth open source project
@@ -69,7 +74,8 @@ static void check_neighbour(const std::vector<Vector3i> &tri, const std::vector<
                             Array3d &phi, Array3i &closest_tri,
                             const Vector3s &gx, int i0, int j0, int k0, int i1, int j1, int k1)
 {
-    if (closest_tri(i1, j1, k1) >= 0) {
+    // a neighbour with the same closest triangle can not lower the distance
+    if (closest_tri(i1, j1, k1) >= 0 && closest_tri(i1, j1, k1) != closest_tri(i0, j0, k0)) {
         const Vector3i& pqr = tri[closest_tri(i1, j1, k1)];
         scalar d = point_triangle_distance(gx, x[pqr(0)], x[pqr(1)], x[pqr(2)]);
         if (d < phi(i0, j0, k0)) {
@@ -79,9 +85,10 @@ static void check_neighbour(const std::vector<Vector3i> &tri, const std::vector<
     }
 }
 
+// samples with a distance up to exact are final and skipped
 static void sweep(const std::vector<Vector3i> &tri, const std::vector<Vector3s> &x,
                   Array3d &phi, Array3i &closest_tri, const Vector3s &origin, scalar dx,
-                  int di, int dj, int dk)
+                  int di, int dj, int dk, scalar exact = 0.0)
 {
     int i0, i1;
     if (di > 0) {
@@ -108,6 +115,39 @@ static void sweep(const std::vector<Vector3i> &tri, const std::vector<Vector3s>
         k1 = -1;
     }
     for (int k = k0; k != k1; k += dk) for (int j = j0; j != j1; j += dj) for (int i = i0; i != i1; i += di) {
+                if (phi(i, j, k) <= exact) continue;
+                Vector3s gx(i * dx + origin[0], j * dx + origin[1], k * dx + origin[2]);
+                check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i - di, j, k);
+                check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i, j - dj, k);
+                check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i - di, j - dj, k);
+                check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i, j, k - dk);
+                check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i - di, j, k - dk);
+                check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i, j - dj, k - dk);
+                check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i - di, j - dj, k - dk);
+            }
+}
+
+// same as sweep, but the nodes of a plane di*i + dj*j + dk*k = const only read
+// nodes of the planes before, so the planes are visited in order and the nodes
+// on each plane in parallel, with the same result as the serial sweep
+static void sweep_parallel(const std::vector<Vector3i> &tri, const std::vector<Vector3s> &x,
+                           Array3d &phi, Array3i &closest_tri, const Vector3s &origin, scalar dx,
+                           int di, int dj, int dk)
+{
+    const int ni = phi.ni, nj = phi.nj, nk = phi.nk;
+    // a, b, c count the nodes from the corner the sweep starts at
+    for (int s = 3; s <= ni + nj + nk - 3; ++s) {
+        const int c0 = std::max(1, s - (ni - 1) - (nj - 1));
+        const int c1 = std::min(nk - 1, s - 2);
+        if (c0 > c1) continue;
+        threadutils::for_each(c0, c1 + 1, [&] (int c) {
+            const int b0 = std::max(1, s - c - (ni - 1));
+            const int b1 = std::min(nj - 1, s - c - 1);
+            for (int b = b0; b <= b1; ++b) {
+                const int a = s - b - c;
+                const int i = di > 0 ? a : ni - 1 - a;
+                const int j = dj > 0 ? b : nj - 1 - b;
+                const int k = dk > 0 ? c : nk - 1 - c;
                 Vector3s gx(i * dx + origin[0], j * dx + origin[1], k * dx + origin[2]);
                 check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i - di, j, k);
                 check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i, j - dj, k);
@@ -117,6 +157,8 @@ static void sweep(const std::vector<Vector3i> &tri, const std::vector<Vector3s>
                 check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i, j - dj, k - dk);
                 check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i - di, j - dj, k - dk);
             }
+        });
+    }
 }
 
 // calculate twice signed area of triangle (0,0)-(x1,y1)-(x2,y2)
@@ -225,4 +267,358 @@ void make_level_set3(const std::vector<Vector3i> &tri, const std::vector<Vector3
         }
 }
 
+void SparseLevelSet3::init(int ni_, int nj_, int nk_)
+{
+    ni = ni_;
+    nj = nj_;
+    nk = nk_;
+    ti = std::max(1, (ni - 1 + tile_size - 1) / tile_size);
+    tj = std::max(1, (nj - 1 + tile_size - 1) / tile_size);
+    tk = std::max(1, (nk - 1 + tile_size - 1) / tile_size);
+    coarse.resize(ti + 1, tj + 1, tk + 1);
+    tile_index.assign(ti * tj * tk, -1);
+    values.resize(0);
+}
+
+scalar SparseLevelSet3::interpolate(const Vector3s &coord) const
+{
+    int i, j, k;
+    scalar fi, fj, fk;
+    mathutils::get_barycentric(coord[0], i, fi, 0, ni);
+    mathutils::get_barycentric(coord[1], j, fj, 0, nj);
+    mathutils::get_barycentric(coord[2], k, fk, 0, nk);
+
+    const int ci = std::min(i / tile_size, ti - 1);
+    const int cj = std::min(j / tile_size, tj - 1);
+    const int ck = std::min(k / tile_size, tk - 1);
+    const int li = i - ci * tile_size;
+    const int lj = j - cj * tile_size;
+    const int lk = k - ck * tile_size;
+
+    const int slot = tile(ci, cj, ck);
+    if (slot < 0) {
+        const scalar inv_size = 1.0 / (scalar) tile_size;
+        return mathutils::trilerp(
+                   coarse(ci, cj, ck), coarse(ci + 1, cj, ck), coarse(ci, cj + 1, ck), coarse(ci + 1, cj + 1, ck),
+                   coarse(ci, cj, ck + 1), coarse(ci + 1, cj, ck + 1), coarse(ci, cj + 1, ck + 1), coarse(ci + 1, cj + 1, ck + 1),
+                   (li + fi) * inv_size, (lj + fj) * inv_size, (lk + fk) * inv_size);
+    }
+
+    const int n = tile_size + 1;
+    const double *v = &values[slot * tile_nodes + li + n * (lj + n * lk)];
+    return mathutils::trilerp(
+               v[0], v[1], v[n], v[n + 1],
+               v[n * n], v[n * n + 1], v[n * n + n], v[n * n + n + 1],
+               fi, fj, fk);
+}
+
+scalar SparseLevelSet3::operator()(int i, int j, int k) const
+{
+    const int ci = std::min(i / tile_size, ti - 1);
+    const int cj = std::min(j / tile_size, tj - 1);
+    const int ck = std::min(k / tile_size, tk - 1);
+    const int li = i - ci * tile_size;
+    const int lj = j - cj * tile_size;
+    const int lk = k - ck * tile_size;
+
+    const int slot = tile(ci, cj, ck);
+    if (slot < 0) {
+        return interpolate(Vector3s(i, j, k));
+    }
+
+    const int n = tile_size + 1;
+    return values[slot * tile_nodes + li + n * (lj + n * lk)];
+}
+
+namespace {
+const int sparse_level_set_magic = 0x33534c53; // "SLS3"
+};
+
+void SparseLevelSet3::write(std::ostream &output) const
+{
+    const int header[] = { sparse_level_set_magic, tile_size, ni, nj, nk };
+    output.write((const char *) header, sizeof(header));
+
+    output.write((const char *) & (coarse.a[0]), coarse.ni * coarse.nj * coarse.nk * sizeof(double));
+    output.write((const char *) & (tile_index[0]), tile_index.size() * sizeof(int));
+
+    const int num_fine = num_fine_tiles();
+    output.write((const char *) &num_fine, sizeof(int));
+    if (num_fine > 0) output.write((const char *) & (values[0]), values.size() * sizeof(double));
+}
+
+bool SparseLevelSet3::read(std::istream &input)
+{
+    int header[5];
+    input.read((char *) header, sizeof(header));
+    if (!input.good() || header[0] != sparse_level_set_magic || header[1] != tile_size) return false;
+
+    // bound the grid before allocating it, the tile count has to fit an int
+    int64_t num_tiles = 1;
+    for (int r = 2; r < 5; ++r) {
+        if (header[r] < 1) return false;
+        num_tiles *= std::max<int64_t>(1, ((int64_t) header[r] - 1 + tile_size - 1) / tile_size);
+        if (num_tiles > std::numeric_limits<int>::max()) return false;
+    }
+
+    init(header[2], header[3], header[4]);
+
+    input.read((char *) & (coarse.a[0]), coarse.ni * coarse.nj * coarse.nk * sizeof(double));
+    input.read((char *) & (tile_index[0]), tile_index.size() * sizeof(int));
+
+    int num_fine = 0;
+    input.read((char *) &num_fine, sizeof(int));
+    if (!input.good() || num_fine < 0 || num_fine > num_tiles) return false;
+
+    for (int idx : tile_index) {
+        if (idx < -1 || idx >= num_fine) return false;
+    }
+
+    values.resize((size_t) num_fine * tile_nodes);
+    if (num_fine > 0) input.read((char *) & (values[0]), values.size() * sizeof(double));
+
+    return !input.fail();
+}
+
+void make_level_set3(const std::vector<Vector3i> &tri, const std::vector<Vector3s> &x,
+                     const Vector3s &origin, scalar dx, int ni, int nj, int nk,
+                     SparseLevelSet3 &phi, const int exact_band)
+{
+    const int ts = SparseLevelSet3::tile_size;
+    const int tn = ts + 1;
+
+    phi.init(ni, nj, nk);
+    const int ti = phi.ti, tj = phi.tj, tk = phi.tk;
+    const int num_tiles = ti * tj * tk;
+
+    // the tiles may cover a few nodes past the far side of the grid
+    const int pi = ti * ts + 1, pj = tj * ts + 1, pk = tk * ts + 1;
+    const scalar upper_bound = (pi + pj + pk) * dx;
 
+    const int num_tri = (int) tri.size();
+
+    // vertices in grid coordinates
+    std::vector<Vector3s> fx(x.size());
+    threadutils::for_each(0, (int) x.size(), [&] (int v) {
+        fx[v] = (x[v] - origin) / dx;
+    });
+
+    auto tri_box = [&] (int t, Vector3s & low, Vector3s & high) {
+        const Vector3i &pqr = tri[t];
+        low = fx[pqr(0)].cwiseMin(fx[pqr(1)]).cwiseMin(fx[pqr(2)]);
+        high = fx[pqr(0)].cwiseMax(fx[pqr(1)]).cwiseMax(fx[pqr(2)]);
+    };
+
+    // tiles sharing a node with the box of a triangle grown by exact_band
+    auto tile_range = [&] (int t, Vector3i & low, Vector3i & high) {
+        Vector3s fl, fh;
+        tri_box(t, fl, fh);
+        const Vector3i tmax(ti - 1, tj - 1, tk - 1);
+        for (int r = 0; r < 3; ++r) {
+            const scalar nl = std::floor(fl(r)) - exact_band;
+            const scalar nh = std::floor(fh(r)) + exact_band + 1;
+            low(r) = mathutils::clamp((int) std::floor((nl - 1.0) / ts), 0, tmax(r));
+            high(r) = mathutils::clamp((int) std::floor(nh / ts), 0, tmax(r));
+        }
+    };
+
+    // bin the triangles to the tiles with a counting sort
+    std::vector<int> bin_offsets(num_tiles + 1, 0);
+    for (int t = 0; t < num_tri; ++t) {
+        Vector3i low, high;
+        tile_range(t, low, high);
+        for (int k = low(2); k <= high(2); ++k) for (int j = low(1); j <= high(1); ++j) for (int i = low(0); i <= high(0); ++i) {
+                    ++bin_offsets[i + ti * (j + tj * k) + 1];
+                }
+    }
+    std::partial_sum(bin_offsets.begin(), bin_offsets.end(), bin_offsets.begin());
+
+    std::vector<int> bin_tris(bin_offsets.back());
+    std::vector<int> bin_cursors(bin_offsets.begin(), bin_offsets.end() - 1);
+    for (int t = 0; t < num_tri; ++t) {
+        Vector3i low, high;
+        tile_range(t, low, high);
+        for (int k = low(2); k <= high(2); ++k) for (int j = low(1); j <= high(1); ++j) for (int i = low(0); i <= high(0); ++i) {
+                    bin_tris[bin_cursors[i + ti * (j + tj * k)]++] = t;
+                }
+    }
+
+    // tiles with triangles nearby keep their samples
+    std::vector<int> active_tiles;
+    for (int idx = 0; idx < num_tiles; ++idx) {
+        if (bin_offsets[idx + 1] == bin_offsets[idx]) continue;
+        phi.tile_index[idx] = (int) active_tiles.size();
+        active_tiles.push_back(idx);
+    }
+
+    const int num_active = (int) active_tiles.size();
+    phi.values.resize(num_active * SparseLevelSet3::tile_nodes);
+    std::vector<int> corner_tri(num_active * 8, -1);
+
+    // exact band and fast sweeping inside each tile
+    threadutils::for_each(0, num_active, [&] (int a) {
+        const int idx = active_tiles[a];
+        const int ci = idx % ti, cj = (idx / ti) % tj, ck = idx / (ti * tj);
+        const Vector3i base(ci * ts, cj * ts, ck * ts);
+
+        Array3d local(tn, tn, tn, upper_bound);
+        Array3i closest_tri(tn, tn, tn, -1);
+
+        for (int b = bin_offsets[idx]; b < bin_offsets[idx + 1]; ++b) {
+            const int t = bin_tris[b];
+            const Vector3i &pqr = tri[t];
+            Vector3s fl, fh;
+            tri_box(t, fl, fh);
+
+            const int i0 = std::max(0, (int) std::floor(fl(0)) - exact_band - base(0));
+            const int i1 = std::min(ts, (int) std::floor(fh(0)) + exact_band + 1 - base(0));
+            const int j0 = std::max(0, (int) std::floor(fl(1)) - exact_band - base(1));
+            const int j1 = std::min(ts, (int) std::floor(fh(1)) + exact_band + 1 - base(1));
+            const int k0 = std::max(0, (int) std::floor(fl(2)) - exact_band - base(2));
+            const int k1 = std::min(ts, (int) std::floor(fh(2)) + exact_band + 1 - base(2));
+
+            for (int k = k0; k <= k1; ++k) for (int j = j0; j <= j1; ++j) for (int i = i0; i <= i1; ++i) {
+                        Vector3s gx((base(0) + i) * dx + origin[0], (base(1) + j) * dx + origin[1], (base(2) + k) * dx + origin[2]);
+                        scalar d = point_triangle_distance(gx, x[pqr(0)], x[pqr(1)], x[pqr(2)]);
+                        if (d < local(i, j, k)) {
+                            local(i, j, k) = d;
+                            closest_tri(i, j, k) = t;
+                        }
+                    }
+
+            // the corners seed the coarse grid
+            for (int c = 0; c < 8; ++c) {
+                const int i = (c & 1) * ts, j = ((c >> 1) & 1) * ts, k = (c >> 2) * ts;
+                Vector3s gx((base(0) + i) * dx + origin[0], (base(1) + j) * dx + origin[1], (base(2) + k) * dx + origin[2]);
+                scalar d = point_triangle_distance(gx, x[pqr(0)], x[pqr(1)], x[pqr(2)]);
+                if (d < local(i, j, k)) {
+                    local(i, j, k) = d;
+                    closest_tri(i, j, k) = t;
+                }
+            }
+        }
+
+        // samples within the band are exact already, one round of sweeps reaches the rest of the tile
+        const Vector3s tile_origin(base(0) * dx + origin[0], base(1) * dx + origin[1], base(2) * dx + origin[2]);
+        const scalar exact = exact_band * dx;
+        sweep(tri, x, local, closest_tri, tile_origin, dx, +1, +1, +1, exact);
+        sweep(tri, x, local, closest_tri, tile_origin, dx, -1, -1, -1, exact);
+        sweep(tri, x, local, closest_tri, tile_origin, dx, +1, +1, -1, exact);
+        sweep(tri, x, local, closest_tri, tile_origin, dx, -1, -1, +1, exact);
+        sweep(tri, x, local, closest_tri, tile_origin, dx, +1, -1, +1, exact);
+        sweep(tri, x, local, closest_tri, tile_origin, dx, -1, +1, -1, exact);
+        sweep(tri, x, local, closest_tri, tile_origin, dx, +1, -1, -1, exact);
+        sweep(tri, x, local, closest_tri, tile_origin, dx, -1, +1, +1, exact);
+
+        std::copy(local.a.begin(), local.a.end(), phi.values.begin() + a * SparseLevelSet3::tile_nodes);
+        for (int c = 0; c < 8; ++c) {
+            corner_tri[a * 8 + c] = closest_tri((c & 1) * ts, ((c >> 1) & 1) * ts, (c >> 2) * ts);
+        }
+    });
+
+    // far field: seed the coarse grid from the tile corners and sweep it
+    Array3d &coarse = phi.coarse;
+    coarse.assign(upper_bound);
+    Array3i coarse_tri(ti + 1, tj + 1, tk + 1, -1);
+    for (int a = 0; a < num_active; ++a) {
+        const int idx = active_tiles[a];
+        const int ci = idx % ti, cj = (idx / ti) % tj, ck = idx / (ti * tj);
+        const double *v = &phi.values[a * SparseLevelSet3::tile_nodes];
+        for (int c = 0; c < 8; ++c) {
+            const int i = c & 1, j = (c >> 1) & 1, k = c >> 2;
+            const double d = v[i * ts + tn * (j * ts + tn * k * ts)];
+            if (corner_tri[a * 8 + c] >= 0 && d < coarse(ci + i, cj + j, ck + k)) {
+                coarse(ci + i, cj + j, ck + k) = d;
+                coarse_tri(ci + i, cj + j, ck + k) = corner_tri[a * 8 + c];
+            }
+        }
+    }
+
+    const scalar coarse_dx = dx * ts;
+    for (unsigned int pass = 0; pass < 2; ++pass) {
+        sweep_parallel(tri, x, coarse, coarse_tri, origin, coarse_dx, +1, +1, +1);
+        sweep_parallel(tri, x, coarse, coarse_tri, origin, coarse_dx, -1, -1, -1);
+        sweep_parallel(tri, x, coarse, coarse_tri, origin, coarse_dx, +1, +1, -1);
+        sweep_parallel(tri, x, coarse, coarse_tri, origin, coarse_dx, -1, -1, +1);
+        sweep_parallel(tri, x, coarse, coarse_tri, origin, coarse_dx, +1, -1, +1);
+        sweep_parallel(tri, x, coarse, coarse_tri, origin, coarse_dx, -1, +1, -1);
+        sweep_parallel(tri, x, coarse, coarse_tri, origin, coarse_dx, +1, -1, -1);
+        sweep_parallel(tri, x, coarse, coarse_tri, origin, coarse_dx, -1, +1, +1);
+    }
+
+    // intersection counts along the rows of nodes in x, the triangles are binned per k
+    std::vector<int> row_offsets(pk + 1, 0);
+    auto row_range = [&] (int t, int & k0, int & k1) {
+        Vector3s fl, fh;
+        tri_box(t, fl, fh);
+        k0 = mathutils::clamp((int) std::ceil(fl(2)), 0, pk - 1);
+        k1 = mathutils::clamp((int) std::floor(fh(2)), 0, pk - 1);
+    };
+    for (int t = 0; t < num_tri; ++t) {
+        int k0, k1;
+        row_range(t, k0, k1);
+        for (int k = k0; k <= k1; ++k) ++row_offsets[k + 1];
+    }
+    std::partial_sum(row_offsets.begin(), row_offsets.end(), row_offsets.begin());
+
+    std::vector<int> row_tris(row_offsets.back());
+    std::vector<int> row_cursors(row_offsets.begin(), row_offsets.end() - 1);
+    for (int t = 0; t < num_tri; ++t) {
+        int k0, k1;
+        row_range(t, k0, k1);
+        for (int k = k0; k <= k1; ++k) row_tris[row_cursors[k]++] = t;
+    }
+
+    // (j, i) of the intersections in each slice k, sorted; an intersection (j, i) is in (i-1,i]x{j}x{k}
+    std::vector< std::vector< std::pair<int, int> > > intersections(pk);
+    threadutils::for_each(0, pk, [&] (int k) {
+        std::vector< std::pair<int, int> > &slice = intersections[k];
+        for (int r = row_offsets[k]; r < row_offsets[k + 1]; ++r) {
+            const Vector3i &pqr = tri[row_tris[r]];
+            const Vector3s &fp = fx[pqr(0)], &fq = fx[pqr(1)], &fr = fx[pqr(2)];
+            const int j0 = mathutils::clamp((int) std::ceil(std::min(std::min(fp(1), fq(1)), fr(1))), 0, pj - 1);
+            const int j1 = mathutils::clamp((int) std::floor(std::max(std::max(fp(1), fq(1)), fr(1))), 0, pj - 1);
+            for (int j = j0; j <= j1; ++j) {
+                scalar a, b, c;
+                if (point_in_triangle_2d(j, k, fp(1), fp(2), fq(1), fq(2), fr(1), fr(2), a, b, c)) {
+                    scalar fi = a * fp(0) + b * fq(0) + c * fr(0); // intersection i coordinate
+                    int i_interval = int(std::ceil(fi)); // intersection is in (i_interval-1,i_interval]
+                    if (i_interval < 0) slice.push_back(std::make_pair(j, 0)); // we enlarge the first interval to include everything to the -x direction
+                    else if (i_interval < pi) slice.push_back(std::make_pair(j, i_interval));
+                    // we ignore intersections that are beyond the +x side of the grid
+                }
+            }
+        }
+        std::sort(slice.begin(), slice.end());
+    });
+
+    // flip the sign of the samples with an odd number of intersections before them in the row
+    auto flip_row = [&] (int j, int k, double * row, int stride, int i_begin, int n) {
+        const std::vector< std::pair<int, int> > &slice = intersections[k];
+        auto it = std::lower_bound(slice.begin(), slice.end(), std::make_pair(j, 0));
+        int total_count = 0;
+        for (int s = 0; s < n; ++s) {
+            const int i = i_begin + s * stride;
+            while (it != slice.end() && it->first == j && it->second <= i) {
+                ++total_count;
+                ++it;
+            }
+            if (total_count % 2 == 1) row[s] = -row[s];
+        }
+    };
+
+    threadutils::for_each(0, num_active, [&] (int a) {
+        const int idx = active_tiles[a];
+        const int ci = idx % ti, cj = (idx / ti) % tj, ck = idx / (ti * tj);
+        double *v = &phi.values[a * SparseLevelSet3::tile_nodes];
+        for (int k = 0; k < tn; ++k) for (int j = 0; j < tn; ++j) {
+                flip_row(cj * ts + j, ck * ts + k, v + tn * (j + tn * k), 1, ci * ts, tn);
+            }
+    });
+
+    threadutils::for_each(0, tk + 1, [&] (int k) {
+        for (int j = 0; j <= tj; ++j) {
+            flip_row(j * ts, k * ts, &coarse(0, j, k), ts, 0, ti + 1);
+        }
+    });
+}
@@ -25,6 +25,9 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#include <iostream>
+#include <vector>
+
 #include "array3.h"
 #include "MathDefs.h"
 
@@ -37,4 +40,54 @@ void make_level_set3(const std::vector<Vector3i> &tri, const std::vector<Vector3
                      const Vector3s &origin, scalar dx, int nx, int ny, int nz,
                      Array3d &phi, const int exact_band = 1);
 
+// Level set sampled on the nodes of an ni x nj x nk grid and stored in tiles of
+// tile_size^3 cells. Tiles near the mesh keep all of their samples (a tile has
+// its own copy of the nodes on its faces, so lookups never leave the tile);
+// the other tiles are interpolated from a coarse grid on the tile corners.
+class SparseLevelSet3
+{
+public:
+    static const int tile_size = 8;
+    static const int tile_nodes = (tile_size + 1) * (tile_size + 1) * (tile_size + 1);
+
+    SparseLevelSet3() : ni(0), nj(0), nk(0), ti(0), tj(0), tk(0) {}
+
+    void init(int ni_, int nj_, int nk_);
+
+    // trilinear interpolation at a point in grid coordinates, clamped to the grid like interpolate_value
+    scalar interpolate(const Vector3s &coord) const;
+
+    // sample at node (i, j, k)
+    scalar operator()(int i, int j, int k) const;
+
+    inline int tile(int ti_, int tj_, int tk_) const
+    {
+        return tile_index[ti_ + ti * (tj_ + tj * tk_)];
+    }
+
+    inline int num_fine_tiles() const
+    {
+        return (int) (values.size() / tile_nodes);
+    }
+
+    void write(std::ostream &output) const;
+
+    // false if the stream does not hold a sparse level set (e.g. an older dense cache)
+    bool read(std::istream &input);
+
+    int ni, nj, nk; // nodes
+    int ti, tj, tk; // tiles
+    Array3d coarse; // samples on the tile corners, (ti + 1) x (tj + 1) x (tk + 1)
+    std::vector<int> tile_index; // slot of the fine samples of each tile, -1 if coarse
+    std::vector<double> values; // tile_nodes samples per fine tile
+};
+
+// Narrow-band version of make_level_set3 for large meshes: the triangles are
+// binned to the tiles within exact_band cells of them, the samples of these
+// tiles are computed in parallel (exact distances in the band, fast sweeping in
+// the rest of the tile), and the far field is swept on the coarse grid.
+void make_level_set3(const std::vector<Vector3i> &tri, const std::vector<Vector3s> &x,
+                     const Vector3s &origin, scalar dx, int nx, int ny, int nz,
+                     SparseLevelSet3 &phi, const int exact_band = 3);
+
 #endif
@@ -14,31 +14,52 @@
 // Simple placeholder code for BLAS calls - replace with calls to a real BLAS library
 
 #include <vector>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <tbb/tbb.h>
 #include <Eigen/Core>
 
+#include "../ThreadUtils.h"
+
 namespace robertbridson {
 
 namespace BLAS {
+// Vectors are processed in fixed blocks, in parallel. Reductions go through
+// threadutils::reduction, which combines the partial results of the blocks
+// in order, so they do not depend on the number of threads or on the
+// scheduling.
+
+const size_t block_size = threadutils::reduction_block_size;
+
+inline size_t num_blocks(size_t n)
+{ return (n + block_size - 1) / block_size; }
+
 // dot products ==============================================================
 
 inline double dot(const std::vector<double> &x, const std::vector<double> &y)
 {
-	double sum = 0;
 	size_t n = x.size() < y.size() ? x.size() : y.size();
-	return Eigen::Map<Eigen::VectorXd>((double*) &y[0], n).dot(Eigen::Map<Eigen::VectorXd>((double*) &x[0], n));
+	return threadutils::reduction(n, 0.0, [&] (size_t start, size_t end) -> double {
+		const size_t len = end - start;
+		return Eigen::Map<Eigen::VectorXd>((double*) &y[start], len).dot(Eigen::Map<Eigen::VectorXd>((double*) &x[start], len));
+	}, std::plus<double>());
 }
 
 // inf-norm (maximum absolute value: index of max returned) ==================
 
 inline int index_abs_max(const std::vector<double> &x)
 {
-	int maxind = 0;
-	int col = 0;
-
 	size_t n = x.size();
-	Eigen::Map<Eigen::VectorXd>((double*) &x[0], n).cwiseAbs().maxCoeff(&maxind, &col);
-
-	return maxind;
+	return threadutils::reduction(n, 0, [&] (size_t start, size_t end) -> int {
+		int ind = 0;
+		int col = 0;
+		Eigen::Map<Eigen::VectorXd>((double*) &x[start], end - start).cwiseAbs().maxCoeff(&ind, &col);
+		return (int) start + ind;
+	}, [&] (int maxind, int ind) -> int {
+		// the first maximum wins, as in the serial search
+		return std::fabs(x[ind]) > std::fabs(x[maxind]) ? ind : maxind;
+	});
 }
 
 // inf-norm (maximum absolute value) =========================================
@@ -52,7 +73,11 @@ inline double abs_max(const std::vector<double> &x)
 inline void add_scaled(double alpha, const std::vector<double> &x, std::vector<double> &y)
 {
 	size_t n = x.size() < y.size() ? x.size() : y.size();
-	Eigen::Map<Eigen::VectorXd>((double*) &y[0], n) += Eigen::Map<const Eigen::VectorXd>((const double*) &x[0], n) * alpha;
+	tbb::parallel_for((size_t) 0, num_blocks(n), (size_t) 1, [&] (size_t b) {
+		const size_t start = b * block_size;
+		const size_t len = std::min(block_size, n - start);
+		Eigen::Map<Eigen::VectorXd>((double*) &y[start], len) += Eigen::Map<const Eigen::VectorXd>((const double*) &x[start], len) * alpha;
+	});
 }
 }
 }
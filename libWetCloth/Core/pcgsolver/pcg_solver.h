@@ -320,6 +320,149 @@ protected:
 		solve_lower_transpose_in_place(ic_factor, result);
 	}
 };
+
+//============================================================================
+// Encapsulates the Conjugate Gradient algorithm with a block-Jacobi
+// preconditioner: the unknowns are partitioned into blocks (e.g. the buckets
+// of a grid), couplings between blocks are dropped, and every block gets its
+// own modified incomplete Cholesky factor. Blocks are factored and solved
+// independently, so both run in parallel. The preconditioner is kept between
+// solves with the same matrix.
+
+template <class T>
+struct BlockPCGSolver
+{
+	BlockPCGSolver(void)
+	{
+		set_solver_parameters(1e-8, 500, 0.97, 0.25);
+	}
+
+	void set_solver_parameters(T tolerance_factor_, int max_iterations_, T modified_incomplete_cholesky_parameter_ = 0.97, T min_diagonal_ratio_ = 0.25)
+	{
+		tolerance_factor = tolerance_factor_;
+		if (tolerance_factor < 1e-30) tolerance_factor = 1e-30;
+		max_iterations = max_iterations_;
+		modified_incomplete_cholesky_parameter = modified_incomplete_cholesky_parameter_;
+		min_diagonal_ratio = min_diagonal_ratio_;
+	}
+
+	// block_of_row[i] in [0, num_blocks) is the block of unknown i
+	void form_preconditioner(const SparseMatrix<T> &matrix, const std::vector<int> &block_of_row, int num_blocks)
+	{
+		const unsigned int n = matrix.n;
+		assert(block_of_row.size() == n);
+
+		block_rows.assign(num_blocks, std::vector<unsigned int>());
+		local_index.resize(n);
+		for (unsigned int i = 0; i < n; ++i) {
+			std::vector<unsigned int>& rows = block_rows[block_of_row[i]];
+			local_index[i] = (unsigned int) rows.size();
+			rows.push_back(i);
+		}
+
+		ic_factors.resize(num_blocks);
+		local_x.resize(num_blocks);
+		local_result.resize(num_blocks);
+
+		tbb::parallel_for(0, num_blocks, 1, [&](int b) {
+			const std::vector<unsigned int>& rows = block_rows[b];
+			const unsigned int nb = (unsigned int) rows.size();
+
+			// local indices follow the global order, so the rows stay sorted
+			SparseMatrix<T> block(nb);
+			for (unsigned int li = 0; li < nb; ++li) {
+				const unsigned int i = rows[li];
+				for (unsigned int j = 0; j < matrix.index[i].size(); ++j) {
+					const unsigned int col = matrix.index[i][j];
+					if (block_of_row[col] != b) continue;
+					block.index[li].push_back(local_index[col]);
+					block.value[li].push_back(matrix.value[i][j]);
+				}
+			}
+
+			factor_modified_incomplete_cholesky0(block, ic_factors[b], modified_incomplete_cholesky_parameter, min_diagonal_ratio);
+			local_x[b].resize(nb);
+			local_result[b].resize(nb);
+		});
+
+		fixed_matrix.construct_from_matrix(matrix);
+	}
+
+	bool solve(const std::vector<T> &rhs, std::vector<T> &result, T &residual_out, int &iterations_out)
+	{
+		unsigned int n = fixed_matrix.n;
+		if (s.size() != n) { s.resize(n); z.resize(n); r.resize(n); }
+		result.resize(n);
+		zero(result);
+		r = rhs;
+		residual_out = BLAS::abs_max(r);
+		if (residual_out < 1e-30) {
+			iterations_out = 0;
+			return true;
+		}
+		double tol = tolerance_factor * residual_out;
+
+		apply_preconditioner(r, z);
+		double rho = BLAS::dot(z, r);
+		if (rho == 0 || rho != rho) {
+			iterations_out = 0;
+			return false;
+		}
+
+		s = z;
+		int iteration;
+		for (iteration = 0; iteration < max_iterations; ++iteration) {
+			multiply(fixed_matrix, s, z);
+			double alpha = rho / BLAS::dot(s, z);
+			BLAS::add_scaled(alpha, s, result);
+			BLAS::add_scaled(-alpha, z, r);
+			residual_out = BLAS::abs_max(r);
+			if (residual_out <= tol) {
+				iterations_out = iteration + 1;
+				return true;
+			}
+			apply_preconditioner(r, z);
+			double rho_new = BLAS::dot(z, r);
+			double beta = rho_new / rho;
+			BLAS::add_scaled(beta, s, z); s.swap(z); // s=beta*s+z
+			rho = rho_new;
+		}
+		iterations_out = iteration;
+		return false;
+	}
+
+protected:
+
+// internal structures
+	std::vector< SparseColumnLowerFactor<T> > ic_factors; // one factor per block
+	std::vector< std::vector<unsigned int> > block_rows; // global unknowns of each block
+	std::vector<unsigned int> local_index; // index of each unknown inside its block
+	std::vector< std::vector<T> > local_x, local_result; // per-block temporaries
+	std::vector<T> z, s, r; // temporary vectors for PCG
+	FixedSparseMatrix<T> fixed_matrix; // used within loop
+
+// parameters
+	T tolerance_factor;
+	int max_iterations;
+	T modified_incomplete_cholesky_parameter;
+	T min_diagonal_ratio;
+
+	void apply_preconditioner(const std::vector<T> &x, std::vector<T> &result)
+	{
+		tbb::parallel_for(0, (int) block_rows.size(), 1, [&](int b) {
+			const std::vector<unsigned int>& rows = block_rows[b];
+			const unsigned int nb = (unsigned int) rows.size();
+			if (nb == 0) return;
+
+			std::vector<T>& lx = local_x[b];
+			std::vector<T>& lr = local_result[b];
+			for (unsigned int li = 0; li < nb; ++li) lx[li] = x[rows[li]];
+			solve_lower(ic_factors[b], lx, lr);
+			solve_lower_transpose_in_place(ic_factors[b], lr);
+			for (unsigned int li = 0; li < nb; ++li) result[rows[li]] = lr[li];
+		});
+	}
+};
 }
 
 #endif
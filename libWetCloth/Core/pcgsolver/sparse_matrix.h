@@ -13,6 +13,7 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <tbb/tbb.h>
 #include "../MathUtilities.h"
 
@@ -183,11 +184,13 @@ void multiply(const SparseMatrix<T> &matrix, const std::vector<T> &x, std::vecto
     //   }
     //}
     int num = matrix.n;
-    tbb::parallel_for(0, num, 1, [&](int i)
+    tbb::parallel_for(tbb::blocked_range<int>(0, num), [&](const tbb::blocked_range<int>& range)
     {
-        result[i] = 0;
-        for (unsigned int j = 0; j < matrix.index[i].size(); ++j) {
-            result[i] += matrix.value[i][j] * x[matrix.index[i][j]];
+        for (int i = range.begin(); i != range.end(); ++i) {
+            result[i] = 0;
+            for (unsigned int j = 0; j < matrix.index[i].size(); ++j) {
+                result[i] += matrix.value[i][j] * x[matrix.index[i][j]];
+            }
         }
     });
 }
@@ -205,11 +208,12 @@ void multiply_and_subtract(const SparseMatrix<T> &matrix, const std::vector<T> &
     // }
     //}
     int num = matrix.n;
-    tbb::parallel_for(0, num, 1, [&](int i)
+    tbb::parallel_for(tbb::blocked_range<int>(0, num), [&](const tbb::blocked_range<int>& range)
     {
-//                              result[i] = 0;
-        for (unsigned int j = 0; j < matrix.index[i].size(); ++j) {
-            result[i] -= matrix.value[i][j] * x[matrix.index[i][j]];
+        for (int i = range.begin(); i != range.end(); ++i) {
+            for (unsigned int j = 0; j < matrix.index[i].size(); ++j) {
+                result[i] -= matrix.value[i][j] * x[matrix.index[i][j]];
+            }
         }
     });
 }
@@ -309,13 +313,14 @@ void multiply(const FixedSparseMatrix<T> &matrix, const std::vector<T> &x, std::
     //}
 
     int num = matrix.n;
-    tbb::parallel_for(0, num, 1, [&](int i)
+    tbb::parallel_for(tbb::blocked_range<int>(0, num), [&](const tbb::blocked_range<int>& range)
     {
-        result[i] = 0;
-        for (unsigned int j = matrix.rowstart[i]; j < matrix.rowstart[i + 1]; ++j) {
-            result[i] += matrix.value[j] * x[matrix.colindex[j]];
+        for (int i = range.begin(); i != range.end(); ++i) {
+            result[i] = 0;
+            for (unsigned int j = matrix.rowstart[i]; j < matrix.rowstart[i + 1]; ++j) {
+                result[i] += matrix.value[j] * x[matrix.colindex[j]];
+            }
         }
-
     });
 
 
@@ -347,6 +352,29 @@ void multiplyMat(const FixedSparseMatrix<T> &A, const FixedSparseMatrix<T> &B, F
     c.clear();
 }
 
+// perform C=scale*A*B, where C already has the nonzero pattern of A*B
+template<class T>
+void multiplyMatNumeric(const FixedSparseMatrix<T> &A, const FixedSparseMatrix<T> &B, FixedSparseMatrix<T> &C, T scale)
+{
+    tbb::parallel_for((unsigned int)0, (unsigned int)C.n, (unsigned int)1, [&](unsigned int i) {
+        const auto row_begin = C.colindex.begin() + C.rowstart[i];
+        const auto row_end = C.colindex.begin() + C.rowstart[i + 1];
+
+        for (unsigned int j = C.rowstart[i]; j < C.rowstart[i + 1]; ++j) C.value[j] = 0;
+
+        for (unsigned int j = A.rowstart[i]; j < A.rowstart[i + 1]; ++j)
+        {
+            unsigned int k = A.colindex[j];
+            T A_ik = A.value[j];
+            for (unsigned int kkk = B.rowstart[k]; kkk < B.rowstart[k + 1]; ++kkk)
+            {
+                const auto it = std::lower_bound(row_begin, row_end, B.colindex[kkk]);
+                C.value[it - C.colindex.begin()] += scale * A_ik * B.value[kkk];
+            }
+        }
+    });
+}
+
 
 // perform A = coef*B'
 template<class T>
@@ -412,13 +440,13 @@ void multiply_and_subtract(const FixedSparseMatrix<T> &matrix, const std::vector
     //   }
     //}
     int num = matrix.n;
-    tbb::parallel_for(0, num, 1, [&](int i)
+    tbb::parallel_for(tbb::blocked_range<int>(0, num), [&](const tbb::blocked_range<int>& range)
     {
-        //result[i]=0;
-        for (unsigned int j = matrix.rowstart[i]; j < matrix.rowstart[i + 1]; ++j) {
-            result[i] -= matrix.value[j] * x[matrix.colindex[j]];
+        for (int i = range.begin(); i != range.end(); ++i) {
+            for (unsigned int j = matrix.rowstart[i]; j < matrix.rowstart[i + 1]; ++j) {
+                result[i] -= matrix.value[j] * x[matrix.colindex[j]];
+            }
         }
-
     });
 }
 }
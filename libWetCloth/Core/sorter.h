@@ -9,6 +9,8 @@
 
 #include "MathDefs.h"
 #include <vector>
+#include <algorithm>
+#include <numeric>
 #include "ThreadUtils.h"
 #include "MathUtilities.h"
 
@@ -278,12 +280,102 @@ public:
 				func(bucket_idx);
 			}
 		} else {
-			threadutils::for_each(0, nsystem, [&] (int bucket_idx) {
+			// buckets stay on the threads that first touched their node arrays
+			threadutils::for_each(0, nsystem, m_bucket_affinity, [&] (int bucket_idx) {
 				func(bucket_idx);
 			});
 		}
 	}
 
+	/*!
+	 * Build the compact list of the active buckets (activated[bucket_idx] != 0),
+	 * sorted by decreasing cost(bucket_idx), and the schedule of its colored
+	 * traversal: with two colors per axis, two adjacent buckets are in
+	 * different color passes, and the one of the earlier pass goes first.
+	 */
+	template<typename Cost>
+	void update_active_buckets( const std::vector<unsigned char>& activated, Cost cost )
+	{
+		const int nsystem = ni * nj * nk;
+
+		m_active.resize(0);
+		for (int bucket_idx = 0; bucket_idx < nsystem; ++bucket_idx) {
+			if (activated[bucket_idx]) m_active.push_back(bucket_idx);
+		}
+
+		const int num_active = (int) m_active.size();
+
+		std::vector<int64_t> costs(nsystem);
+		threadutils::for_each(0, num_active, [&] (int slot) {
+			costs[m_active[slot]] = (int64_t) cost(m_active[slot]);
+		});
+
+		std::sort(m_active.begin(), m_active.end(), [&] (int a, int b) {
+			return costs[a] > costs[b] || (costs[a] == costs[b] && a < b);
+		});
+
+		m_active_slot.assign(nsystem, -1);
+		for (int slot = 0; slot < num_active; ++slot) {
+			m_active_slot[m_active[slot]] = slot;
+		}
+
+		// adjacent active buckets of the later passes
+		m_active_num_preds.resize(num_active);
+		m_active_succ_offsets.resize(num_active + 1);
+		m_active_succ_offsets[0] = 0;
+
+		threadutils::for_each(0, num_active, [&] (int slot) {
+			int num_preds = 0;
+			int num_succ = 0;
+			loop_adjacent_active(slot, [&] (int, bool later) {
+				if (later) ++num_succ;
+				else ++num_preds;
+			});
+			m_active_num_preds[slot] = num_preds;
+			m_active_succ_offsets[slot + 1] = num_succ;
+		});
+
+		std::partial_sum(m_active_succ_offsets.begin(), m_active_succ_offsets.end(), m_active_succ_offsets.begin());
+		m_active_succ.resize(m_active_succ_offsets[num_active]);
+
+		threadutils::for_each(0, num_active, [&] (int slot) {
+			int cursor = m_active_succ_offsets[slot];
+			loop_adjacent_active(slot, [&] (int nslot, bool later) {
+				if (later) m_active_succ[cursor++] = nslot;
+			});
+		});
+
+		m_active_ready.resize(0);
+		for (int slot = 0; slot < num_active; ++slot) {
+			if (!m_active_num_preds[slot]) m_active_ready.push_back(slot);
+		}
+	}
+
+	inline const std::vector<int>& get_active_buckets() const
+	{
+		return m_active;
+	}
+
+	// parallel over the active buckets, the most expensive ones are scheduled first
+	template<typename Callable>
+	void for_each_active_bucket( Callable func ) const
+	{
+		threadutils::for_each(0, (int) m_active.size(), m_active_affinity, [&] (int slot) {
+			func(m_active[slot]);
+		});
+	}
+
+	// the active buckets in two colors per axis, like for_each_bucket_colored,
+	// without the barrier after each color: a bucket only waits for its
+	// adjacent buckets of the earlier colors
+	template<typename Callable>
+	void for_each_active_bucket_colored( Callable func ) const
+	{
+		threadutils::for_each_dependent(m_active_ready, m_active_num_preds, m_active_succ_offsets, m_active_succ, [&] (int slot) {
+			func(m_active[slot]);
+		});
+	}
+
 	template<typename Callable>
 	void for_each_bucket_x( Callable func, bool forced_serial = false ) const
 	{
@@ -413,7 +505,9 @@ public:
 	void for_each_bucket_particles( Callable func ) const
 	{
 		int nsystem = ni * nj * nk;
-		threadutils::for_each(0, nsystem, [&] (int bucket_idx) {
+		threadutils::for_each_weighted(0, nsystem, [&] (int bucket_idx) {
+			return get_bucket_size(bucket_idx);
+		}, [&] (int bucket_idx) {
 			const std::pair<int, int>& G_START_END = array_sup[bucket_idx];
 			for (int N_ID = G_START_END.first; N_ID < G_START_END.second; ++N_ID)
 			{
@@ -433,21 +527,13 @@ public:
 
 		for (int t = 0; t < numcolors; ++t) for (int s = 0; s < numcolors; ++s) for (int r = 0; r < numcolors; ++r)
 				{
-					threadutils::for_each(0, nsystem, [&] (int scaled_bucket_idx) {
-						const int sk = scaled_bucket_idx / (sni * snj);
-						const int sj = (scaled_bucket_idx - sk * sni * snj) / sni;
-						const int si = scaled_bucket_idx - sk * sni * snj - sj * sni;
-
-						const int k = sk * numcolors + t;
-						if (k >= nk) return;
+					threadutils::for_each_weighted(0, nsystem, [&] (int scaled_bucket_idx) {
+						const int bucket_idx = colored_bucket_index(scaled_bucket_idx, t, s, r, numcolors, sni, snj);
+						return bucket_idx < 0 ? 0 : get_bucket_size(bucket_idx);
+					}, [&] (int scaled_bucket_idx) {
+						const int bucket_idx = colored_bucket_index(scaled_bucket_idx, t, s, r, numcolors, sni, snj);
+						if (bucket_idx < 0) return;
 
-						const int j = sj * numcolors + s;
-						if (j >= nj) return;
-
-						const int i = si * numcolors + r;
-						if (i >= ni) return;
-
-						const int bucket_idx = k * ni * nj + j * ni + i;
 						const std::pair<int, int>& G_START_END = array_sup[bucket_idx];
 						for (int N_ID = G_START_END.first; N_ID < G_START_END.second; ++N_ID)
 						{
@@ -457,8 +543,9 @@ public:
 				}
 	}
 
+	// the color order is shuffled; in the deterministic mode it is a function of the key
 	template<typename Callable>
-	void for_each_bucket_particles_colored_randomized( Callable func, int numcolors = 2 ) const
+	void for_each_bucket_particles_colored_randomized( Callable func, int numcolors = 2, uint64_t key = 0 ) const
 	{
 		const int sni = (ni + numcolors - 1) / numcolors;
 		const int snj = (nj + numcolors - 1) / numcolors;
@@ -470,27 +557,19 @@ public:
 		std::vector<int> rand_vec_s;
 		std::vector<int> rand_vec_r;
 
-		mathutils::fisherYates(numcolors, rand_vec_t);
-		mathutils::fisherYates(numcolors, rand_vec_s);
-		mathutils::fisherYates(numcolors, rand_vec_r);
+		mathutils::fisherYates(numcolors, rand_vec_t, mathutils::hash64(key + 0));
+		mathutils::fisherYates(numcolors, rand_vec_s, mathutils::hash64(key + 1));
+		mathutils::fisherYates(numcolors, rand_vec_r, mathutils::hash64(key + 2));
 
 		for (int t : rand_vec_t) for (int s : rand_vec_s) for (int r : rand_vec_r)
 				{
-					threadutils::for_each(0, nsystem, [&] (int scaled_bucket_idx) {
-						const int sk = scaled_bucket_idx / (sni * snj);
-						const int sj = (scaled_bucket_idx - sk * sni * snj) / sni;
-						const int si = scaled_bucket_idx - sk * sni * snj - sj * sni;
+					threadutils::for_each_weighted(0, nsystem, [&] (int scaled_bucket_idx) {
+						const int bucket_idx = colored_bucket_index(scaled_bucket_idx, t, s, r, numcolors, sni, snj);
+						return bucket_idx < 0 ? 0 : get_bucket_size(bucket_idx);
+					}, [&] (int scaled_bucket_idx) {
+						const int bucket_idx = colored_bucket_index(scaled_bucket_idx, t, s, r, numcolors, sni, snj);
+						if (bucket_idx < 0) return;
 
-						const int k = sk * numcolors + t;
-						if (k >= nk) return;
-
-						const int j = sj * numcolors + s;
-						if (j >= nj) return;
-
-						const int i = si * numcolors + r;
-						if (i >= ni) return;
-
-						const int bucket_idx = k * ni * nj + j * ni + i;
 						const std::pair<int, int>& G_START_END = array_sup[bucket_idx];
 						for (int N_ID = G_START_END.first; N_ID < G_START_END.second; ++N_ID)
 						{
@@ -506,6 +585,59 @@ public:
 	int ni;
 	int nj;
 	int nk;
+
+private:
+	// bucket of a scaled index in the (t, s, r) color pass, -1 if outside
+	inline int colored_bucket_index( int scaled_bucket_idx, int t, int s, int r, int numcolors, int sni, int snj ) const
+	{
+		const int sk = scaled_bucket_idx / (sni * snj);
+		const int sj = (scaled_bucket_idx - sk * sni * snj) / sni;
+		const int si = scaled_bucket_idx - sk * sni * snj - sj * sni;
+
+		const int k = sk * numcolors + t;
+		if (k >= nk) return -1;
+
+		const int j = sj * numcolors + s;
+		if (j >= nj) return -1;
+
+		const int i = si * numcolors + r;
+		if (i >= ni) return -1;
+
+		return k * ni * nj + j * ni + i;
+	}
+
+	inline int color_pass( const Vector3i& handle ) const
+	{
+		return (handle(2) & 1) * 4 + (handle(1) & 1) * 2 + (handle(0) & 1);
+	}
+
+	// active buckets adjacent to the one in slot, and whether they come in a later color pass
+	template<typename Callable>
+	void loop_adjacent_active( int slot, Callable func ) const
+	{
+		const Vector3i handle = bucket_handle(m_active[slot]);
+		const int pass = color_pass(handle);
+
+		for (int k = handle(2) - 1; k <= handle(2) + 1; ++k) for (int j = handle(1) - 1; j <= handle(1) + 1; ++j) for (int i = handle(0) - 1; i <= handle(0) + 1; ++i)
+				{
+					if (!has_bucket(i, j, k) || (i == handle(0) && j == handle(1) && k == handle(2))) continue;
+
+					const int nslot = m_active_slot[bucket_index(i, j, k)];
+					if (nslot < 0) continue;
+
+					func(nslot, color_pass(Vector3i(i, j, k)) > pass);
+				}
+	}
+
+	mutable threadutils::AffinityPartitioner m_bucket_affinity;
+	mutable threadutils::AffinityPartitioner m_active_affinity;
+
+	std::vector<int> m_active; // active buckets by decreasing cost
+	std::vector<int> m_active_slot; // bucket -> position in m_active, -1 if inactive
+	std::vector<int> m_active_num_preds;
+	std::vector<int> m_active_succ_offsets;
+	std::vector<int> m_active_succ;
+	std::vector<int> m_active_ready;
 };
 
 #endif